@@ -6,9 +6,11 @@
 # include "aw_config.h"
 # include "aw_server.h"
 # include "aw_depth.h"
+# include "ut_skiplist.h"
 
 static nw_timer timer;
 static dict_t *dict_depth;
+static dict_t *dict_book;
 static rpc_clt *matchengine;
 static nw_state *state_context;
 
@@ -22,12 +24,31 @@ struct depth_key {
 
 struct depth_val {
     dict_t *sessions;
+    mpd_t  *interval;
     json_t *last;
     time_t  last_clean;
+    uint64_t version;
+};
+
+/*
+ * local copy of a market's price levels, loaded from the matchengine
+ * snapshot and kept up to date by the sequenced level updates it pushes.
+ */
+struct depth_book {
+    bool        ready;
+    uint64_t    seq;
+    uint64_t    version;
+    skiplist_t  *asks;
+    skiplist_t  *bids;
+};
+
+struct depth_level {
+    mpd_t *price;
+    mpd_t *amount;
 };
 
 struct state_data {
-    struct depth_key key;
+    char market[MARKET_NAME_MAX_LEN];
 };
 
 static uint32_t dict_ses_hash_func(const void *key)
@@ -73,11 +94,161 @@ static void dict_depth_val_free(void *val)
 {
     struct depth_val *obj = val;
     dict_release(obj->sessions);
+    if (obj->interval)
+        mpd_del(obj->interval);
     if (obj->last)
         json_decref(obj->last);
     free(obj);
 }
 
+static uint32_t dict_book_hash_func(const void *key)
+{
+    return dict_generic_hash_function(key, strlen(key));
+}
+
+static int dict_book_key_compare(const void *key1, const void *key2)
+{
+    return strcmp(key1, key2);
+}
+
+static void *dict_book_key_dup(const void *key)
+{
+    return strdup(key);
+}
+
+static void dict_book_key_free(void *key)
+{
+    free(key);
+}
+
+static void *dict_book_val_dup(const void *val)
+{
+    struct depth_book *obj = malloc(sizeof(struct depth_book));
+    memcpy(obj, val, sizeof(struct depth_book));
+    return obj;
+}
+
+static void dict_book_val_free(void *val)
+{
+    struct depth_book *obj = val;
+    skiplist_release(obj->asks);
+    skiplist_release(obj->bids);
+    free(obj);
+}
+
+static int level_ask_compare(const void *value1, const void *value2)
+{
+    const struct depth_level *level1 = value1;
+    const struct depth_level *level2 = value2;
+    return mpd_cmp(level1->price, level2->price, &mpd_ctx);
+}
+
+static int level_bid_compare(const void *value1, const void *value2)
+{
+    const struct depth_level *level1 = value1;
+    const struct depth_level *level2 = value2;
+    return mpd_cmp(level2->price, level1->price, &mpd_ctx);
+}
+
+static void level_free(void *value)
+{
+    struct depth_level *level = value;
+    mpd_del(level->price);
+    mpd_del(level->amount);
+    free(level);
+}
+
+static int book_reset(struct depth_book *book)
+{
+    if (book->asks)
+        skiplist_release(book->asks);
+    if (book->bids)
+        skiplist_release(book->bids);
+
+    skiplist_type st;
+    memset(&st, 0, sizeof(st));
+    st.free = level_free;
+    st.compare = level_ask_compare;
+    book->asks = skiplist_create(&st);
+    st.compare = level_bid_compare;
+    book->bids = skiplist_create(&st);
+    if (book->asks == NULL || book->bids == NULL)
+        return -__LINE__;
+
+    return 0;
+}
+
+static int book_apply(skiplist_t *list, json_t *levels)
+{
+    if (!json_is_array(levels))
+        return -__LINE__;
+
+    for (size_t i = 0; i < json_array_size(levels); ++i) {
+        json_t *unit = json_array_get(levels, i);
+        const char *price_str  = json_string_value(json_array_get(unit, 0));
+        const char *amount_str = json_string_value(json_array_get(unit, 1));
+        if (price_str == NULL || amount_str == NULL)
+            return -__LINE__;
+        mpd_t *price = decimal(price_str, 0);
+        if (price == NULL)
+            return -__LINE__;
+        mpd_t *amount = decimal(amount_str, 0);
+        if (amount == NULL) {
+            mpd_del(price);
+            return -__LINE__;
+        }
+
+        struct depth_level key = { .price = price };
+        skiplist_node *node = skiplist_find(list, &key);
+        if (mpd_cmp(amount, mpd_zero, &mpd_ctx) == 0) {
+            if (node) {
+                skiplist_delete(list, node);
+            }
+            mpd_del(price);
+            mpd_del(amount);
+        } else if (node) {
+            struct depth_level *level = node->value;
+            mpd_del(level->amount);
+            level->amount = amount;
+            mpd_del(price);
+        } else {
+            struct depth_level *level = malloc(sizeof(struct depth_level));
+            level->price = price;
+            level->amount = amount;
+            if (skiplist_insert(list, level) == NULL) {
+                level_free(level);
+                return -__LINE__;
+            }
+        }
+    }
+
+    return 0;
+}
+
+static void send_subscribe(const char *market)
+{
+    nw_state_entry *state_entry = nw_state_add(state_context, settings.backend_timeout, 0);
+    struct state_data *state = state_entry->data;
+    strncpy(state->market, market, MARKET_NAME_MAX_LEN - 1);
+
+    json_t *params = json_array();
+    json_array_append_new(params, json_string(market));
+
+    rpc_pkg pkg;
+    memset(&pkg, 0, sizeof(pkg));
+    pkg.pkg_type  = RPC_PKG_TYPE_REQUEST;
+    pkg.command   = CMD_ORDER_DEPTH_SUBSCRIBE;
+    pkg.sequence  = state_entry->id;
+    pkg.body      = json_dumps(params, 0);
+    pkg.body_size = strlen(pkg.body);
+
+    rpc_clt_send(matchengine, &pkg);
+    log_trace("send request to %s, cmd: %u, sequence: %u, params: %s",
+            nw_sock_human_addr(rpc_clt_peer_addr(matchengine)), pkg.command, pkg.sequence, (char *)pkg.body);
+    free(pkg.body);
+    json_decref(params);
+}
+
 static void on_backend_connect(nw_ses *ses, bool result)
 {
     rpc_clt *clt = ses->privdata;
@@ -85,7 +256,18 @@ static void on_backend_connect(nw_ses *ses, bool result)
         log_info("connect %s:%s success", clt->name, nw_sock_human_addr(&ses->peer_addr));
     } else {
         log_info("connect %s:%s fail", clt->name, nw_sock_human_addr(&ses->peer_addr));
+        return;
+    }
+
+    // updates of the old connection are lost, load the books again
+    dict_iterator *iter = dict_get_iterator(dict_book);
+    dict_entry *entry;
+    while ((entry = dict_next(iter)) != NULL) {
+        struct depth_book *book = entry->val;
+        book->ready = false;
+        send_subscribe(entry->key);
     }
+    dict_release_iterator(iter);
 }
 
 static json_t *get_list_diff(json_t *list1, json_t *list2, uint32_t limit, int side)
@@ -224,18 +406,73 @@ static int broadcast_update(const char *market, dict_t *sessions, bool clean, js
     return 0;
 }
 
-static int on_market_depth_reply(struct state_data *state, json_t *result)
+static json_t *get_depth_list(skiplist_t *list, uint32_t limit, mpd_t *interval, int side)
+{
+    json_t *result = json_array();
+    skiplist_iter *iter = skiplist_get_iterator(list);
+    skiplist_node *node = skiplist_next(iter);
+
+    if (mpd_cmp(interval, mpd_zero, &mpd_ctx) == 0) {
+        for (; node && json_array_size(result) < limit; node = skiplist_next(iter)) {
+            struct depth_level *level = node->value;
+            json_t *unit = json_array();
+            json_array_append_new_mpd(unit, level->price);
+            json_array_append_new_mpd(unit, level->amount);
+            json_array_append_new(result, unit);
+        }
+        skiplist_release_iterator(iter);
+        return result;
+    }
+
+    mpd_t *price = mpd_new(&mpd_ctx);
+    mpd_t *amount = mpd_new(&mpd_ctx);
+    while (node && json_array_size(result) < limit) {
+        // asks are merged up and bids down to a multiple of interval, in the level precision
+        struct depth_level *level = node->value;
+        mpd_divint(price, level->price, interval, &mpd_ctx);
+        mpd_mul(price, price, interval, &mpd_ctx);
+        if (side > 0 && mpd_cmp(price, level->price, &mpd_ctx) < 0) {
+            mpd_add(price, price, interval, &mpd_ctx);
+        }
+        mpd_rescale(price, price, level->price->exp, &mpd_ctx);
+        mpd_copy(amount, level->amount, &mpd_ctx);
+
+        while ((node = skiplist_next(iter)) != NULL) {
+            level = node->value;
+            if (mpd_cmp(price, level->price, &mpd_ctx) * side >= 0) {
+                mpd_add(amount, amount, level->amount, &mpd_ctx);
+            } else {
+                break;
+            }
+        }
+
+        json_t *unit = json_array();
+        json_array_append_new_mpd(unit, price);
+        json_array_append_new_mpd(unit, amount);
+        json_array_append_new(result, unit);
+    }
+    skiplist_release_iterator(iter);
+    mpd_del(price);
+    mpd_del(amount);
+
+    return result;
+}
+
+static json_t *get_depth(struct depth_book *book, uint32_t limit, mpd_t *interval)
+{
+    json_t *result = json_object();
+    json_object_set_new(result, "asks", get_depth_list(book->asks, limit, interval,  1));
+    json_object_set_new(result, "bids", get_depth_list(book->bids, limit, interval, -1));
+    return result;
+}
+
+static int on_depth_result(struct depth_key *key, struct depth_val *val, json_t *result)
 {
-    dict_entry *entry = dict_find(dict_depth, &state->key);
-    if (entry == NULL)
-        return -__LINE__;
-    struct depth_key *key = entry->key;
-    struct depth_val *val = entry->val;
     if (val->last == NULL) {
         val->last = result;
         val->last_clean = time(NULL);
         json_incref(result);
-        return broadcast_update(state->key.market, val->sessions, true, result);
+        return broadcast_update(key->market, val->sessions, true, result);
     }
 
     json_t *diff = get_depth_diff(val->last, result, key->limit);
@@ -250,20 +487,106 @@ static int on_market_depth_reply(struct state_data *state, json_t *result)
     time_t now = time(NULL);
     if (now - val->last_clean >= CLEAN_INTERVAL) {
         val->last_clean = now;
-        broadcast_update(state->key.market, val->sessions, true, result);
+        broadcast_update(key->market, val->sessions, true, result);
     } else {
-        broadcast_update(state->key.market, val->sessions, false, diff);
+        broadcast_update(key->market, val->sessions, false, diff);
     }
     json_decref(diff);
 
     return 0;
 }
 
+static int on_depth_snapshot(const char *market, json_t *result)
+{
+    dict_entry *entry = dict_find(dict_book, market);
+    if (entry == NULL)
+        return -__LINE__;
+    struct depth_book *book = entry->val;
+
+    if (!json_is_integer(json_object_get(result, "seq")))
+        return -__LINE__;
+    book->ready = false;
+    if (book_reset(book) < 0)
+        return -__LINE__;
+    if (book_apply(book->asks, json_object_get(result, "asks")) < 0)
+        return -__LINE__;
+    if (book_apply(book->bids, json_object_get(result, "bids")) < 0)
+        return -__LINE__;
+    book->seq = json_integer_value(json_object_get(result, "seq"));
+    book->version += 1;
+    book->ready = true;
+
+    return 0;
+}
+
+static int on_depth_update(json_t *update)
+{
+    const char *market = json_string_value(json_object_get(update, "market"));
+    if (market == NULL || !json_is_integer(json_object_get(update, "seq")))
+        return -__LINE__;
+    dict_entry *entry = dict_find(dict_book, market);
+    if (entry == NULL)
+        return 0;
+    struct depth_book *book = entry->val;
+    if (!book->ready)
+        return 0;
+
+    uint64_t seq = json_integer_value(json_object_get(update, "seq"));
+    if (seq != book->seq + 1) {
+        log_error("market: %s depth update out of sequence: %"PRIu64", expect: %"PRIu64, market, seq, book->seq + 1);
+        book->ready = false;
+        send_subscribe(market);
+        return 0;
+    }
+
+    book->version += 1;
+    if (book_apply(book->asks, json_object_get(update, "asks")) < 0 ||
+            book_apply(book->bids, json_object_get(update, "bids")) < 0) {
+        book->ready = false;
+        send_subscribe(market);
+        return -__LINE__;
+    }
+    book->seq = seq;
+
+    return 0;
+}
+
+static void delete_market(const char *market)
+{
+    dict_iterator *iter = dict_get_iterator(dict_depth);
+    dict_entry *entry;
+    while ((entry = dict_next(iter)) != NULL) {
+        struct depth_key *key = entry->key;
+        if (strcmp(key->market, market) == 0) {
+            dict_delete(dict_depth, key);
+        }
+    }
+    dict_release_iterator(iter);
+    dict_delete(dict_book, market);
+}
+
 static void on_backend_recv_pkg(nw_ses *ses, rpc_pkg *pkg)
 {
     sds reply_str = sdsnewlen(pkg->body, pkg->body_size);
     log_trace("recv pkg from: %s, cmd: %u, sequence: %u, reply: %s",
             nw_sock_human_addr(&ses->peer_addr), pkg->command, pkg->sequence, reply_str);
+
+    if (pkg->command == CMD_ORDER_DEPTH_UPDATE) {
+        json_t *update = json_loadb(pkg->body, pkg->body_size, 0, NULL);
+        if (update == NULL) {
+            log_error("invalid depth update from: %s, update: %s", nw_sock_human_addr(&ses->peer_addr), reply_str);
+            sdsfree(reply_str);
+            return;
+        }
+        int ret = on_depth_update(update);
+        if (ret < 0) {
+            log_error("on_depth_update: %d, update: %s", ret, reply_str);
+        }
+        sdsfree(reply_str);
+        json_decref(update);
+        return;
+    }
+
     nw_state_entry *entry = nw_state_get(state_context, pkg->sequence);
     if (entry == NULL) {
         sdsfree(reply_str);
@@ -283,7 +606,7 @@ static void on_backend_recv_pkg(nw_ses *ses, rpc_pkg *pkg)
 
     json_t *error = json_object_get(reply, "error");
     if (error && !json_is_null(error)) {
-        dict_delete(dict_depth, &state->key);
+        delete_market(state->market);
     }
     json_t *result = json_object_get(reply, "result");
     if (error == NULL || !json_is_null(error) || result == NULL) {
@@ -296,10 +619,10 @@ static void on_backend_recv_pkg(nw_ses *ses, rpc_pkg *pkg)
 
     int ret;
     switch (pkg->command) {
-    case CMD_ORDER_DEPTH:
-        ret = on_market_depth_reply(state, result);
+    case CMD_ORDER_DEPTH_SUBSCRIBE:
+        ret = on_depth_snapshot(state->market, result);
         if (ret < 0) {
-            log_error("on_market_depth_reply: %d, reply: %s", ret, reply_str);
+            log_error("on_depth_snapshot: %d, reply: %s", ret, reply_str);
         }
         break;
     default:
@@ -314,7 +637,11 @@ static void on_backend_recv_pkg(nw_ses *ses, rpc_pkg *pkg)
 
 static void on_timeout(nw_state_entry *entry)
 {
-    log_fatal("query depth timeout, state id: %u", entry->id);
+    struct state_data *state = entry->data;
+    log_fatal("subscribe depth timeout, state id: %u, market: %s", entry->id, state->market);
+    if (rpc_clt_connected(matchengine) && dict_find(dict_book, state->market)) {
+        send_subscribe(state->market);
+    }
 }
 
 static void on_timer(nw_timer *timer, void *privdata)
@@ -322,35 +649,27 @@ static void on_timer(nw_timer *timer, void *privdata)
     dict_iterator *iter = dict_get_iterator(dict_depth);
     dict_entry *entry;
     while ((entry = dict_next(iter)) != NULL) {
-        const struct depth_val *obj = entry->val;
+        struct depth_val *obj = entry->val;
         if (dict_size(obj->sessions) == 0) {
             dict_delete(dict_depth, entry->key);
             continue;
         }
 
         struct depth_key *key = entry->key;
-        json_t *params = json_array();
-        json_array_append_new(params, json_string(key->market));
-        json_array_append_new(params, json_integer(key->limit));
-        json_array_append_new(params, json_string(key->interval));
-
-        nw_state_entry *state_entry = nw_state_add(state_context, settings.backend_timeout, 0);
-        struct state_data *state = state_entry->data;
-        memcpy(&state->key, key, sizeof(struct depth_key));
-
-        rpc_pkg pkg;
-        memset(&pkg, 0, sizeof(pkg));
-        pkg.pkg_type  = RPC_PKG_TYPE_REQUEST;
-        pkg.command   = CMD_ORDER_DEPTH;
-        pkg.sequence  = state_entry->id;
-        pkg.body      = json_dumps(params, 0);
-        pkg.body_size = strlen(pkg.body);
-
-        rpc_clt_send(matchengine, &pkg);
-        log_trace("send request to %s, cmd: %u, sequence: %u, params: %s",
-                nw_sock_human_addr(rpc_clt_peer_addr(matchengine)), pkg.command, pkg.sequence, (char *)pkg.body);
-        free(pkg.body);
-        json_decref(params);
+        dict_entry *book_entry = dict_find(dict_book, key->market);
+        if (book_entry == NULL)
+            continue;
+        struct depth_book *book = book_entry->val;
+        if (!book->ready || book->version == obj->version)
+            continue;
+
+        json_t *result = get_depth(book, key->limit, obj->interval);
+        obj->version = book->version;
+        int ret = on_depth_result(key, obj, result);
+        if (ret < 0) {
+            log_error("on_depth_result: %d, market: %s", ret, key->market);
+        }
+        json_decref(result);
     }
     dict_release_iterator(iter);
 }
@@ -370,6 +689,18 @@ int init_depth(void)
     if (dict_depth == NULL)
         return -__LINE__;
 
+    memset(&dt, 0, sizeof(dt));
+    dt.hash_function = dict_book_hash_func;
+    dt.key_compare = dict_book_key_compare;
+    dt.key_dup = dict_book_key_dup;
+    dt.key_destructor = dict_book_key_free;
+    dt.val_dup = dict_book_val_dup;
+    dt.val_destructor = dict_book_val_free;
+
+    dict_book = dict_create(&dt, 64);
+    if (dict_book == NULL)
+        return -__LINE__;
+
     rpc_clt_type ct;
     memset(&ct, 0, sizeof(ct));
     ct.on_connect = on_backend_connect;
@@ -448,12 +779,27 @@ int depth_subscribe(nw_ses *ses, const char *market, uint32_t limit, const char
         val.sessions = dict_create(&dt, 1024);
         if (val.sessions == NULL)
             return -__LINE__;
+        val.interval = decimal(interval, 0);
+        if (val.interval == NULL) {
+            dict_release(val.sessions);
+            return -__LINE__;
+        }
 
         entry = dict_add(dict_depth, &key, &val);
         if (entry == NULL)
             return -__LINE__;
     }
 
+    if (dict_find(dict_book, key.market) == NULL) {
+        struct depth_book book;
+        memset(&book, 0, sizeof(book));
+        if (book_reset(&book) < 0)
+            return -__LINE__;
+        if (dict_add(dict_book, key.market, &book) == NULL)
+            return -__LINE__;
+        send_subscribe(key.market);
+    }
+
     struct depth_val *obj = entry->val;
     dict_add(obj->sessions, ses, NULL);
 
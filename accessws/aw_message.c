@@ -7,6 +7,7 @@
 # include "aw_message.h"
 # include "aw_asset.h"
 # include "aw_order.h"
+# include "ut_event.h"
 
 static kafka_consumer_t *kafka_orders;
 static kafka_consumer_t *kafka_balances;
@@ -32,10 +33,59 @@ static int process_orders_message(json_t *msg)
     return 0;
 }
 
+/* the same fields as the json orders message */
+static json_t *get_event_order_info(event_order *event)
+{
+    json_t *info = json_object();
+    json_object_set_new(info, "id", json_integer(event->id));
+    json_object_set_new(info, "market", json_string(event->market));
+    json_object_set_new(info, "source", json_string(event->source));
+    json_object_set_new(info, "type", json_integer(event->type));
+    json_object_set_new(info, "side", json_integer(event->side));
+    json_object_set_new(info, "user", json_integer(event->user_id));
+    json_object_set_new(info, "ctime", json_real(event->create_time));
+    json_object_set_new(info, "mtime", json_real(event->update_time));
+    json_object_set_new_fixed(info, "price", event->price.value, event->price.prec);
+    json_object_set_new_fixed(info, "amount", event->amount.value, event->amount.prec);
+    json_object_set_new_fixed(info, "taker_fee", event->taker_fee.value, event->taker_fee.prec);
+    json_object_set_new_fixed(info, "maker_fee", event->maker_fee.value, event->maker_fee.prec);
+    json_object_set_new_fixed(info, "left", event->left.value, event->left.prec);
+    json_object_set_new_fixed(info, "deal_stock", event->deal_stock.value, event->deal_stock.prec);
+    json_object_set_new_fixed(info, "deal_money", event->deal_money.value, event->deal_money.prec);
+    json_object_set_new_fixed(info, "deal_fee", event->deal_fee.value, event->deal_fee.prec);
+    return info;
+}
+
+static int process_orders_event(sds message)
+{
+    event_order event;
+    int ret = unpack_event_order(message, sdslen(message), &event);
+    if (ret < 0)
+        return ret;
+    if (event.event == 0 || event.user_id == 0)
+        return -__LINE__;
+
+    asset_on_update(event.user_id, event.stock);
+    asset_on_update(event.user_id, event.money);
+    json_t *order = get_event_order_info(&event);
+    order_on_update(event.user_id, event.event, order);
+    json_decref(order);
+
+    return 0;
+}
+
 static void on_orders_message(sds message, int64_t offset)
 {
-    log_trace("order message: %s", message);
     monitor_inc("message_order", 1);
+    if (is_event_message(message, sdslen(message))) {
+        int ret = process_orders_event(message);
+        if (ret < 0) {
+            log_error("process_orders_event size: %zu, offset: %"PRIi64" fail: %d", sdslen(message), offset, ret);
+        }
+        return;
+    }
+
+    log_trace("order message: %s", message);
     json_t *msg = json_loads(message, 0, NULL);
     if (!msg) {
         log_error("invalid balance message: %s", message);
@@ -65,8 +115,19 @@ static int process_balances_message(json_t *msg)
 
 static void on_balances_message(sds message, int64_t offset)
 {
-    log_trace("balance message: %s", message);
     monitor_inc("message_balance", 1);
+    if (is_event_message(message, sdslen(message))) {
+        event_balance event;
+        int ret = unpack_event_balance(message, sdslen(message), &event);
+        if (ret < 0 || event.user_id == 0) {
+            log_error("invalid balance event, size: %zu, offset: %"PRIi64", ret: %d", sdslen(message), offset, ret);
+            return;
+        }
+        asset_on_update(event.user_id, event.asset);
+        return;
+    }
+
+    log_trace("balance message: %s", message);
     json_t *msg = json_loads(message, 0, NULL);
     if (!msg) {
         log_error("invalid balance message: %s", message);
@@ -8,6 +8,7 @@
 # include "mp_config.h"
 # include "mp_message.h"
 # include "mp_kline.h"
+# include "ut_event.h"
 
 struct market_info {
     char   *name;
@@ -510,8 +511,41 @@ static int market_update(double timestamp, uint64_t id, const char *market, int
     return 0;
 }
 
+static void on_deals_event(sds message, int64_t offset)
+{
+    event_deal deal;
+    int ret = unpack_event_deal(message, sdslen(message), &deal);
+    if (ret < 0) {
+        log_error("invalid deals event, size: %zu, offset: %"PRIi64", ret: %d", sdslen(message), offset, ret);
+        return;
+    }
+    log_trace("deals event: %"PRIu64", market: %s, offset: %"PRIi64, deal.id, deal.market, offset);
+    if (deal.timestamp == 0 || deal.id == 0 || deal.ask_user_id == 0 || deal.bid_user_id == 0 ||
+            (deal.side != MARKET_TRADE_SIDE_SELL && deal.side != MARKET_TRADE_SIDE_BUY)) {
+        log_error("invalid deals event: %"PRIu64", offset: %"PRIi64, deal.id, offset);
+        return;
+    }
+
+    mpd_t *price = fixed_to_mpd(deal.price.value, deal.price.prec);
+    mpd_t *amount = fixed_to_mpd(deal.amount.value, deal.amount.prec);
+    ret = market_update(deal.timestamp, deal.id, deal.market, deal.side, deal.ask_user_id, deal.bid_user_id, price, amount);
+    if (ret < 0) {
+        log_error("market_update fail %d, deal: %"PRIu64, ret, deal.id);
+    } else {
+        last_offset = offset;
+        monitor_inc("new_message", 1);
+    }
+    mpd_del(price);
+    mpd_del(amount);
+}
+
 static void on_deals_message(sds message, int64_t offset)
 {
+    if (is_event_message(message, sdslen(message))) {
+        on_deals_event(message, offset);
+        return;
+    }
+
     log_trace("deals message: %s, offset: %"PRIi64, message, offset);
     json_t *obj = json_loadb(message, sdslen(message), 0, NULL);
     if (obj == NULL) {
@@ -0,0 +1,363 @@
+/*
+ * Description: admission of the requests that change state, by the pending
+ *              operlog, history and message queues
+ */
+
+# include "me_admission.h"
+# include "me_operlog.h"
+# include "me_history.h"
+# include "me_message.h"
+
+# define BUCKET_BURST_TIME      1.0
+# define BUCKET_EXPIRE_TIME     60
+
+static dict_t *dict_user;
+static dict_t *dict_source;
+static nw_timer timer;
+static int level_last;
+
+static uint64_t admit_count[3];
+static uint64_t reject_count[3];
+
+struct dict_user_key {
+    uint32_t    user_id;
+};
+
+/* a token bucket, rate tokens a second up to BUCKET_BURST_TIME of them */
+struct token_bucket {
+    double      tokens;
+    double      update_time;
+};
+
+static uint32_t dict_user_hash_function(const void *key)
+{
+    const struct dict_user_key *obj = key;
+    return obj->user_id;
+}
+
+static int dict_user_key_compare(const void *key1, const void *key2)
+{
+    const struct dict_user_key *obj1 = key1;
+    const struct dict_user_key *obj2 = key2;
+    if (obj1->user_id == obj2->user_id) {
+        return 0;
+    }
+    return 1;
+}
+
+static void *dict_user_key_dup(const void *key)
+{
+    struct dict_user_key *obj = malloc(sizeof(struct dict_user_key));
+    memcpy(obj, key, sizeof(struct dict_user_key));
+    return obj;
+}
+
+static uint32_t dict_source_hash_function(const void *key)
+{
+    return dict_generic_hash_function(key, strlen(key));
+}
+
+static int dict_source_key_compare(const void *key1, const void *key2)
+{
+    return strcmp(key1, key2);
+}
+
+static void *dict_source_key_dup(const void *key)
+{
+    return strdup(key);
+}
+
+static void dict_key_free(void *key)
+{
+    free(key);
+}
+
+static void dict_bucket_free(void *val)
+{
+    free(val);
+}
+
+static double get_pressure(void)
+{
+    double pressure = operlog_pressure();
+    double history = history_pressure();
+    double message = message_pressure();
+    if (history > pressure)
+        pressure = history;
+    if (message > pressure)
+        pressure = message;
+    return pressure;
+}
+
+static int get_level(double pressure)
+{
+    if (pressure >= 1)
+        return ADMIT_LEVEL_HALT;
+    if (pressure >= settings.admission.shed)
+        return ADMIT_LEVEL_SHED;
+    if (pressure >= settings.admission.slow)
+        return ADMIT_LEVEL_SLOW;
+    return ADMIT_LEVEL_NORMAL;
+}
+
+// the bucket of key refilled up to now, NULL if it is not limited
+static struct token_bucket *get_bucket(dict_t *dict, const void *key, double rate, double now)
+{
+    if (rate <= 0)
+        return NULL;
+
+    struct token_bucket *bucket;
+    dict_entry *entry = dict_find(dict, key);
+    if (entry == NULL) {
+        bucket = malloc(sizeof(struct token_bucket));
+        if (bucket == NULL)
+            return NULL;
+        bucket->tokens = rate * BUCKET_BURST_TIME;
+        bucket->update_time = now;
+        if (dict_add(dict, (void *)key, bucket) == NULL) {
+            free(bucket);
+            return NULL;
+        }
+    } else {
+        bucket = entry->val;
+        bucket->tokens += (now - bucket->update_time) * rate;
+        if (bucket->tokens > rate * BUCKET_BURST_TIME)
+            bucket->tokens = rate * BUCKET_BURST_TIME;
+        bucket->update_time = now;
+    }
+
+    return bucket;
+}
+
+static bool has_tokens(dict_t *dict, const void *key, double rate, double now, size_t need)
+{
+    struct token_bucket *bucket = get_bucket(dict, key, rate, now);
+    return bucket == NULL || bucket->tokens >= need;
+}
+
+static void take_tokens(dict_t *dict, const void *key, double rate, double now, size_t need)
+{
+    struct token_bucket *bucket = get_bucket(dict, key, rate, now);
+    if (bucket) {
+        bucket->tokens -= need;
+    }
+}
+
+// the orders of a batch before index with the same user, and the number with it
+static bool count_user(size_t count, const uint32_t *user_ids, size_t index, size_t *need)
+{
+    *need = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (user_ids[i] == user_ids[index]) {
+            if (i < index)
+                return false;
+            *need += 1;
+        }
+    }
+    return true;
+}
+
+static bool count_source(size_t count, const char **sources, size_t index, size_t *need)
+{
+    *need = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (sources[i] && strcmp(sources[i], sources[index]) == 0) {
+            if (i < index)
+                return false;
+            *need += 1;
+        }
+    }
+    return true;
+}
+
+static bool is_low_source(const char *source)
+{
+    for (size_t i = 0; i < settings.admission.low_source_num; ++i) {
+        if (strcmp(settings.admission.low_sources[i], source) == 0)
+            return true;
+    }
+    return false;
+}
+
+/*
+ * every order takes a token of its user and one of its source. the orders
+ * of a batch are admitted together or not at all, the tokens are only
+ * taken when every bucket has enough for all of them.
+ */
+static bool admit_orders(int level, size_t count, const uint32_t *user_ids, const char **sources)
+{
+    if (level == ADMIT_LEVEL_NORMAL)
+        return true;
+    if (level == ADMIT_LEVEL_HALT) {
+        monitor_inc("admission_reject_halt", 1);
+        return false;
+    }
+    if (level == ADMIT_LEVEL_SHED) {
+        for (size_t i = 0; i < count; ++i) {
+            if (sources[i] && is_low_source(sources[i])) {
+                monitor_inc("admission_reject_shed", 1);
+                return false;
+            }
+        }
+    }
+
+    double now = current_timestamp();
+    size_t need;
+    for (size_t i = 0; i < count; ++i) {
+        struct dict_user_key key = { .user_id = user_ids[i] };
+        if (user_ids[i] && count_user(count, user_ids, i, &need) &&
+                !has_tokens(dict_user, &key, settings.admission.user_rate, now, need)) {
+            monitor_inc("admission_reject_user", 1);
+            return false;
+        }
+        if (sources[i] && count_source(count, sources, i, &need) &&
+                !has_tokens(dict_source, sources[i], settings.admission.source_rate, now, need)) {
+            monitor_inc("admission_reject_source", 1);
+            return false;
+        }
+    }
+    for (size_t i = 0; i < count; ++i) {
+        struct dict_user_key key = { .user_id = user_ids[i] };
+        if (user_ids[i] && count_user(count, user_ids, i, &need)) {
+            take_tokens(dict_user, &key, settings.admission.user_rate, now, need);
+        }
+        if (sources[i] && count_source(count, sources, i, &need)) {
+            take_tokens(dict_source, sources[i], settings.admission.source_rate, now, need);
+        }
+    }
+
+    return true;
+}
+
+static int update_level(double pressure)
+{
+    int level = get_level(pressure);
+    if (level == level_last)
+        return level;
+
+    if (level == ADMIT_LEVEL_HALT) {
+        log_fatal("admission level: %d -> %d, operlog: %f, history: %f, message: %f", level_last, level,
+                operlog_pressure(), history_pressure(), message_pressure());
+    } else {
+        log_error("admission level: %d -> %d, operlog: %f, history: %f, message: %f", level_last, level,
+                operlog_pressure(), history_pressure(), message_pressure());
+    }
+    level_last = level;
+
+    return level;
+}
+
+static bool admit_class(int class, size_t count, const uint32_t *user_ids, const char **sources)
+{
+    double pressure = get_pressure();
+    int level = update_level(pressure);
+
+    bool admit;
+    switch (class) {
+    case ADMIT_CLASS_CANCEL:
+        admit = pressure < settings.admission.cancel_limit;
+        break;
+    case ADMIT_CLASS_BALANCE:
+        /* balance updates come from the backend, they are not rate limited */
+        admit = level != ADMIT_LEVEL_HALT;
+        break;
+    default:
+        class = ADMIT_CLASS_ORDER;
+        admit = admit_orders(level, count, user_ids, sources);
+        break;
+    }
+
+    if (admit) {
+        admit_count[class]++;
+    } else {
+        reject_count[class]++;
+        monitor_inc("admission_reject", 1);
+    }
+    return admit;
+}
+
+bool admit_request(int class, uint32_t user_id, const char *source)
+{
+    return admit_class(class, 1, &user_id, &source);
+}
+
+bool admit_order_batch(size_t count, const uint32_t *user_ids, const char **sources)
+{
+    return admit_class(ADMIT_CLASS_ORDER, count, user_ids, sources);
+}
+
+static void expire_buckets(dict_t *dict, double now)
+{
+    dict_iterator *iter = dict_get_iterator(dict);
+    dict_entry *entry;
+    while ((entry = dict_next(iter)) != NULL) {
+        struct token_bucket *bucket = entry->val;
+        if (now - bucket->update_time >= BUCKET_EXPIRE_TIME) {
+            dict_delete(dict, entry->key);
+        }
+    }
+    dict_release_iterator(iter);
+}
+
+static void on_timer(nw_timer *t, void *privdata)
+{
+    update_level(get_pressure());
+    monitor_set("admission_level", level_last);
+    monitor_set("pending_operlog", operlog_pressure() * MAX_PENDING_OPERLOG);
+    monitor_set("pending_history", history_pressure() * MAX_PENDING_HISTORY);
+    monitor_set("pending_message", message_pressure() * MAX_PENDING_MESSAGE);
+
+    static double expire_last;
+    double now = current_timestamp();
+    if (now - expire_last >= BUCKET_EXPIRE_TIME) {
+        expire_buckets(dict_user, now);
+        expire_buckets(dict_source, now);
+        expire_last = now;
+    }
+}
+
+int init_admission(void)
+{
+    dict_types dt;
+    memset(&dt, 0, sizeof(dt));
+    dt.hash_function  = dict_user_hash_function;
+    dt.key_compare    = dict_user_key_compare;
+    dt.key_dup        = dict_user_key_dup;
+    dt.key_destructor = dict_key_free;
+    dt.val_destructor = dict_bucket_free;
+
+    dict_user = dict_create(&dt, 1024);
+    if (dict_user == NULL)
+        return -__LINE__;
+
+    memset(&dt, 0, sizeof(dt));
+    dt.hash_function  = dict_source_hash_function;
+    dt.key_compare    = dict_source_key_compare;
+    dt.key_dup        = dict_source_key_dup;
+    dt.key_destructor = dict_key_free;
+    dt.val_destructor = dict_bucket_free;
+
+    dict_source = dict_create(&dt, 64);
+    if (dict_source == NULL)
+        return -__LINE__;
+
+    nw_timer_set(&timer, 1.0, true, on_timer, NULL);
+    nw_timer_start(&timer);
+
+    return 0;
+}
+
+sds admission_status(sds reply)
+{
+    static const char *class_names[] = { "cancel", "order", "balance" };
+    reply = sdscatprintf(reply, "admission level: %d\n", level_last);
+    reply = sdscatprintf(reply, "admission pressure operlog: %f, history: %f, message: %f\n",
+            operlog_pressure(), history_pressure(), message_pressure());
+    for (int i = 0; i < 3; ++i) {
+        reply = sdscatprintf(reply, "admission %s admit: %"PRIu64", reject: %"PRIu64"\n",
+                class_names[i], admit_count[i], reject_count[i]);
+    }
+    reply = sdscatprintf(reply, "admission buckets user: %u, source: %u\n", dict_size(dict_user), dict_size(dict_source));
+    return reply;
+}
+
@@ -0,0 +1,41 @@
+/*
+ * Description: admission of the requests that change state, by the pending
+ *              operlog, history and message queues
+ */
+
+# ifndef _ME_ADMISSION_H_
+# define _ME_ADMISSION_H_
+
+# include "me_config.h"
+
+/* cancels shrink the book, they are admitted the longest */
+enum {
+    ADMIT_CLASS_CANCEL,
+    ADMIT_CLASS_ORDER,
+    ADMIT_CLASS_BALANCE,
+};
+
+/*
+ * the level is set by the fullest queue, relative to its MAX_PENDING_*
+ * NORMAL: below admission.slow, everything is admitted
+ * SLOW:   new orders are rate limited per user and per source
+ * SHED:   from admission.shed, the orders of low_sources are rejected too
+ * HALT:   a queue is full, only cancels are admitted until cancel_limit
+ */
+enum {
+    ADMIT_LEVEL_NORMAL,
+    ADMIT_LEVEL_SLOW,
+    ADMIT_LEVEL_SHED,
+    ADMIT_LEVEL_HALT,
+};
+
+int init_admission(void);
+
+/* user_id 0 and source NULL if the request does not have them */
+bool admit_request(int class, uint32_t user_id, const char *source);
+/* the orders of a batch, each needs its tokens, admitted all together or not at all */
+bool admit_order_batch(size_t count, const uint32_t *user_ids, const char **sources);
+sds admission_status(sds reply);
+
+# endif
+
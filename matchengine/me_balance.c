@@ -5,11 +5,17 @@
 
 # include "me_config.h"
 # include "me_balance.h"
+# include "me_persist.h"
+# include "me_match.h"
+
+# include <assert.h>
 
 dict_t *dict_balance;
 static dict_t *dict_asset;
+static fixed_t balance_zero;
 
 struct asset_type {
+    int id;
     int prec_save;
     int prec_show;
 };
@@ -50,36 +56,20 @@ static void asset_dict_val_free(void *val)
 
 static uint32_t balance_dict_hash_function(const void *key)
 {
-    return dict_generic_hash_function(key, sizeof(struct balance_key));
-}
-
-static void *balance_dict_key_dup(const void *key)
-{
-    struct balance_key *obj = malloc(sizeof(struct balance_key));
-    if (obj == NULL)
-        return NULL;
-    memcpy(obj, key, sizeof(struct balance_key));
-    return obj;
-}
-
-static void *balance_dict_val_dup(const void *val)
-{
-    return mpd_qncopy(val);
+    return *(const uint32_t *)key;
 }
 
 static int balance_dict_key_compare(const void *key1, const void *key2)
 {
-    return memcmp(key1, key2, sizeof(struct balance_key));
-}
-
-static void balance_dict_key_free(void *key)
-{
-    free(key);
+    if (*(const uint32_t *)key1 == *(const uint32_t *)key2) {
+        return 0;
+    }
+    return 1;
 }
 
 static void balance_dict_val_free(void *val)
 {
-    mpd_del(val);
+    free(val);
 }
 
 static int init_dict(void)
@@ -97,12 +87,10 @@ static int init_dict(void)
     if (dict_asset == NULL)
         return -__LINE__;
 
+    // the key is user_id of the value, freed with it
     memset(&type, 0, sizeof(type));
     type.hash_function  = balance_dict_hash_function;
     type.key_compare    = balance_dict_key_compare;
-    type.key_dup        = balance_dict_key_dup;
-    type.key_destructor = balance_dict_key_free;
-    type.val_dup        = balance_dict_val_dup;
     type.val_destructor = balance_dict_val_free;
 
     dict_balance = dict_create(&type, 64);
@@ -118,6 +106,7 @@ int init_balance()
 
     for (size_t i = 0; i < settings.asset_num; ++i) {
         struct asset_type type;
+        type.id = i;
         type.prec_save = settings.assets[i].prec_save;
         type.prec_show = settings.assets[i].prec_show;
         if (dict_add(dict_asset, settings.assets[i].name, &type) == NULL)
@@ -154,211 +143,261 @@ int asset_prec_show(const char *asset)
     return at ? at->prec_show: -1;
 }
 
-mpd_t *balance_get(uint32_t user_id, uint32_t type, const char *asset)
+int get_asset_id(const char *asset)
 {
-    struct balance_key key;
-    key.user_id = user_id;
-    key.type = type;
-    strncpy(key.asset, asset, sizeof(key.asset));
-
-    dict_entry *entry = dict_find(dict_balance, &key);
-    if (entry) {
-        return entry->val;
-    }
-
-    return NULL;
+    struct asset_type *at = get_asset_type(asset);
+    return at ? at->id : -1;
 }
 
-void balance_del(uint32_t user_id, uint32_t type, const char *asset)
+static bool balance_valid(uint32_t type, int asset_id)
 {
-    struct balance_key key;
-    key.user_id = user_id;
-    key.type = type;
-    strncpy(key.asset, asset, sizeof(key.asset));
-    dict_delete(dict_balance, &key);
+    if (type != BALANCE_TYPE_AVAILABLE && type != BALANCE_TYPE_FROZEN)
+        return false;
+    if (asset_id < 0 || (size_t)asset_id >= settings.asset_num)
+        return false;
+    return true;
 }
 
-mpd_t *balance_set(uint32_t user_id, uint32_t type, const char *asset, mpd_t *amount)
+static struct balance_user *user_find(uint32_t user_id)
 {
-    struct asset_type *at = get_asset_type(asset);
-    if (at == NULL)
+    dict_entry *entry = dict_find(dict_balance, &user_id);
+    if (entry == NULL)
         return NULL;
 
-    int ret = mpd_cmp(amount, mpd_zero, &mpd_ctx);
-    if (ret < 0) {
-        return NULL;
-    } else if (ret == 0) {
-        balance_del(user_id, type, asset);
-        return mpd_zero;
-    }
+    return entry->val;
+}
 
-    struct balance_key key;
-    key.user_id = user_id;
-    key.type = type;
-    strncpy(key.asset, asset, sizeof(key.asset));
+static struct balance_user *user_get(uint32_t user_id)
+{
+    struct balance_user *user = user_find(user_id);
+    if (user)
+        return user;
 
-    mpd_t *result;
-    dict_entry *entry;
-    entry = dict_find(dict_balance, &key);
-    if (entry) {
-        result = entry->val;
-        mpd_rescale(result, amount, -at->prec_save, &mpd_ctx);
-        return result;
+    // aligned to the cache line, so a slot is never split by it
+    size_t size = sizeof(struct balance_user) + sizeof(struct balance_slot) * settings.asset_num;
+    if (posix_memalign((void **)&user, 64, size) != 0)
+        return NULL;
+    memset(user, 0, size);
+    assert(!match_running());
+    user->user_id = user_id;
+    // new users are not part of a running slice
+    user->slice_epoch = slice_epoch;
+    if (dict_add(dict_balance, &user->user_id, user) == NULL) {
+        free(user);
+        return NULL;
     }
 
-    entry = dict_add(dict_balance, &key, amount);
-    if (entry == NULL)
-        return NULL;
-    result = entry->val;
-    mpd_rescale(result, amount, -at->prec_save, &mpd_ctx);
+    return user;
+}
 
-    return result;
+static fixed_t *user_value(struct balance_user *user, uint32_t type, int asset_id)
+{
+    struct balance_slot *slot = &user->slots[asset_id];
+    return type == BALANCE_TYPE_AVAILABLE ? &slot->available : &slot->frozen;
 }
 
-mpd_t *balance_add(uint32_t user_id, uint32_t type, const char *asset, mpd_t *amount)
+// called before the balances of a user are changed
+static void balance_save(struct balance_user *user)
 {
-    struct asset_type *at = get_asset_type(asset);
-    if (at == NULL)
-        return NULL;
+    // the matching threads read the balances while a batch runs, changes wait for the journal
+    assert(!match_running());
+    slice_save_balance(user);
+}
 
-    if (mpd_cmp(amount, mpd_zero, &mpd_ctx) < 0)
+fixed_t *balance_get(uint32_t user_id, uint32_t type, int asset_id)
+{
+    if (!balance_valid(type, asset_id))
+        return NULL;
+    struct balance_user *user = user_find(user_id);
+    if (user == NULL)
         return NULL;
 
-    struct balance_key key;
-    key.user_id = user_id;
-    key.type = type;
-    strncpy(key.asset, asset, sizeof(key.asset));
-
-    mpd_t *result;
-    dict_entry *entry = dict_find(dict_balance, &key);
-    if (entry) {
-        result = entry->val;
-        mpd_add(result, result, amount, &mpd_ctx);
-        mpd_rescale(result, result, -at->prec_save, &mpd_ctx);
-        return result;
+    fixed_t *value = user_value(user, type, asset_id);
+    return *value ? value : NULL;
+}
+
+void balance_del(uint32_t user_id, uint32_t type, int asset_id)
+{
+    fixed_t *value = balance_get(user_id, type, asset_id);
+    if (value) {
+        balance_save(user_find(user_id));
+        *value = 0;
     }
+}
 
-    return balance_set(user_id, type, asset, amount);
+/*
+ * subtract amount from a stored balance, round the result down to the
+ * balance precision. the result is set to zero if the exact result is.
+ */
+static void balance_sub_value(fixed_t *result, int result_prec, fixed_t amount, int prec)
+{
+    if (prec <= result_prec) {
+        *result -= fixed_rescale(amount, prec, result_prec);
+        return;
+    }
+
+    fixed_t q = amount / fixed_pow10[prec - result_prec];
+    fixed_t r = amount % fixed_pow10[prec - result_prec];
+    if (*result == q && r == 0) {
+        *result = 0;
+        return;
+    }
+    *result -= r ? q + 1 : q;
 }
 
-mpd_t *balance_sub(uint32_t user_id, uint32_t type, const char *asset, mpd_t *amount)
+fixed_t *balance_set(uint32_t user_id, uint32_t type, int asset_id, fixed_t amount, int prec)
 {
-    struct asset_type *at = get_asset_type(asset);
-    if (at == NULL)
+    if (!balance_valid(type, asset_id))
         return NULL;
 
-    if (mpd_cmp(amount, mpd_zero, &mpd_ctx) < 0)
+    if (amount < 0) {
         return NULL;
+    } else if (amount == 0) {
+        balance_del(user_id, type, asset_id);
+        return &balance_zero;
+    }
 
-    mpd_t *result = balance_get(user_id, type, asset);
-    if (result == NULL)
+    struct balance_user *user = user_get(user_id);
+    if (user == NULL)
         return NULL;
-    if (mpd_cmp(result, amount, &mpd_ctx) < 0)
+    balance_save(user);
+    fixed_t *value = user_value(user, type, asset_id);
+    *value = fixed_rescale(amount, prec, settings.assets[asset_id].prec_save);
+
+    return value;
+}
+
+fixed_t *balance_add(uint32_t user_id, uint32_t type, int asset_id, fixed_t amount, int prec)
+{
+    if (!balance_valid(type, asset_id))
         return NULL;
 
-    mpd_sub(result, result, amount, &mpd_ctx);
-    if (mpd_cmp(result, mpd_zero, &mpd_ctx) == 0) {
-        balance_del(user_id, type, asset);
-        return mpd_zero;
+    if (amount < 0)
+        return NULL;
+    if (amount == 0) {
+        fixed_t *value = balance_get(user_id, type, asset_id);
+        return value ? value : &balance_zero;
     }
-    mpd_rescale(result, result, -at->prec_save, &mpd_ctx);
 
-    return result;
+    struct balance_user *user = user_get(user_id);
+    if (user == NULL)
+        return NULL;
+    balance_save(user);
+    fixed_t *value = user_value(user, type, asset_id);
+    *value += fixed_rescale(amount, prec, settings.assets[asset_id].prec_save);
+
+    return value;
 }
 
-mpd_t *balance_freeze(uint32_t user_id, const char *asset, mpd_t *amount)
+fixed_t *balance_sub(uint32_t user_id, uint32_t type, int asset_id, fixed_t amount, int prec)
 {
-    struct asset_type *at = get_asset_type(asset);
-    if (at == NULL)
+    if (amount < 0)
         return NULL;
 
-    if (mpd_cmp(amount, mpd_zero, &mpd_ctx) < 0)
-        return NULL;
-    mpd_t *available = balance_get(user_id, BALANCE_TYPE_AVAILABLE, asset);
-    if (available == NULL)
+    fixed_t *value = balance_get(user_id, type, asset_id);
+    if (value == NULL)
         return NULL;
-    if (mpd_cmp(available, amount, &mpd_ctx) < 0)
+    int value_prec = settings.assets[asset_id].prec_save;
+    if (fixed_cmp(*value, value_prec, amount, prec) < 0)
         return NULL;
 
-    if (balance_add(user_id, BALANCE_TYPE_FROZEN, asset, amount) == 0)
-        return NULL;
-    mpd_sub(available, available, amount, &mpd_ctx);
-    if (mpd_cmp(available, mpd_zero, &mpd_ctx) == 0) {
-        balance_del(user_id, BALANCE_TYPE_AVAILABLE, asset);
-        return mpd_zero;
-    }
-    mpd_rescale(available, available, -at->prec_save, &mpd_ctx);
+    balance_save(user_find(user_id));
+    balance_sub_value(value, value_prec, amount, prec);
 
-    return available;
+    return value;
 }
 
-mpd_t *balance_unfreeze(uint32_t user_id, const char *asset, mpd_t *amount)
+// move amount between available and frozen of the same slot
+static fixed_t *balance_move(uint32_t user_id, uint32_t from, int asset_id, fixed_t amount, int prec)
 {
-    struct asset_type *at = get_asset_type(asset);
-    if (at == NULL)
+    if (amount < 0)
         return NULL;
 
-    if (mpd_cmp(amount, mpd_zero, &mpd_ctx) < 0)
-        return NULL;
-    mpd_t *frozen = balance_get(user_id, BALANCE_TYPE_FROZEN, asset);
-    if (frozen == NULL)
+    fixed_t *value = balance_get(user_id, from, asset_id);
+    if (value == NULL)
         return NULL;
-    if (mpd_cmp(frozen, amount, &mpd_ctx) < 0)
+    int value_prec = settings.assets[asset_id].prec_save;
+    if (fixed_cmp(*value, value_prec, amount, prec) < 0)
         return NULL;
 
-    if (balance_add(user_id, BALANCE_TYPE_AVAILABLE, asset, amount) == 0)
-        return NULL;
-    mpd_sub(frozen, frozen, amount, &mpd_ctx);
-    if (mpd_cmp(frozen, mpd_zero, &mpd_ctx) == 0) {
-        balance_del(user_id, BALANCE_TYPE_FROZEN, asset);
-        return mpd_zero;
-    }
-    mpd_rescale(frozen, frozen, -at->prec_save, &mpd_ctx);
+    struct balance_user *user = user_find(user_id);
+    balance_save(user);
+    uint32_t to = from == BALANCE_TYPE_AVAILABLE ? BALANCE_TYPE_FROZEN : BALANCE_TYPE_AVAILABLE;
+    *user_value(user, to, asset_id) += fixed_rescale(amount, prec, value_prec);
+    balance_sub_value(value, value_prec, amount, prec);
 
-    return frozen;
+    return value;
 }
 
-mpd_t *balance_total(uint32_t user_id, const char *asset)
+fixed_t *balance_freeze(uint32_t user_id, int asset_id, fixed_t amount, int prec)
 {
-    mpd_t *balance = mpd_new(&mpd_ctx);
-    mpd_copy(balance, mpd_zero, &mpd_ctx);
-    mpd_t *available = balance_get(user_id, BALANCE_TYPE_AVAILABLE, asset);
-    if (available) {
-        mpd_add(balance, balance, available, &mpd_ctx);
-    }
-    mpd_t *frozen = balance_get(user_id, BALANCE_TYPE_FROZEN, asset);
-    if (frozen) {
-        mpd_add(balance, balance, frozen, &mpd_ctx);
-    }
+    return balance_move(user_id, BALANCE_TYPE_AVAILABLE, asset_id, amount, prec);
+}
+
+fixed_t *balance_unfreeze(uint32_t user_id, int asset_id, fixed_t amount, int prec)
+{
+    return balance_move(user_id, BALANCE_TYPE_FROZEN, asset_id, amount, prec);
+}
 
-    return balance;
+fixed_t balance_total(uint32_t user_id, int asset_id)
+{
+    if (!balance_valid(BALANCE_TYPE_AVAILABLE, asset_id))
+        return 0;
+    struct balance_user *user = user_find(user_id);
+    if (user == NULL)
+        return 0;
+
+    struct balance_slot *slot = &user->slots[asset_id];
+    return slot->available + slot->frozen;
 }
 
-int balance_status(const char *asset, mpd_t *total, size_t *available_count, mpd_t *available, size_t *frozen_count, mpd_t *frozen)
+int balance_status(int asset_id, fixed_t *total, size_t *available_count, fixed_t *available, size_t *frozen_count, fixed_t *frozen)
 {
     *frozen_count = 0;
     *available_count = 0;
-    mpd_copy(total, mpd_zero, &mpd_ctx);
-    mpd_copy(frozen, mpd_zero, &mpd_ctx);
-    mpd_copy(available, mpd_zero, &mpd_ctx);
+    *total = 0;
+    *frozen = 0;
+    *available = 0;
+    if (!balance_valid(BALANCE_TYPE_AVAILABLE, asset_id))
+        return -__LINE__;
 
     dict_entry *entry;
     dict_iterator *iter = dict_get_iterator(dict_balance);
     while ((entry = dict_next(iter)) != NULL) {
-        struct balance_key *key = entry->key;
-        if (strcmp(key->asset, asset) != 0)
-            continue;
-        mpd_add(total, total, entry->val, &mpd_ctx);
-        if (key->type == BALANCE_TYPE_AVAILABLE) {
+        struct balance_user *user = entry->val;
+        struct balance_slot *slot = &user->slots[asset_id];
+        if (slot->available) {
             *available_count += 1;
-            mpd_add(available, available, entry->val, &mpd_ctx);
-        } else {
+            *available += slot->available;
+        }
+        if (slot->frozen) {
             *frozen_count += 1;
-            mpd_add(frozen, frozen, entry->val, &mpd_ctx);
+            *frozen += slot->frozen;
         }
     }
     dict_release_iterator(iter);
+    *total = *available + *frozen;
 
     return 0;
 }
 
+size_t balance_user_rows(const struct balance_user *user, struct balance_key *keys, fixed_t *values)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < settings.asset_num; ++i) {
+        const struct balance_slot *slot = &user->slots[i];
+        for (uint32_t type = BALANCE_TYPE_AVAILABLE; type <= BALANCE_TYPE_FROZEN; ++type) {
+            fixed_t value = type == BALANCE_TYPE_AVAILABLE ? slot->available : slot->frozen;
+            if (value == 0)
+                continue;
+            keys[count].user_id = user->user_id;
+            keys[count].type = type;
+            keys[count].asset_id = i;
+            values[count] = value;
+            count++;
+        }
+    }
+
+    return count;
+}
+
@@ -11,12 +11,33 @@
 # define BALANCE_TYPE_AVAILABLE 1
 # define BALANCE_TYPE_FROZEN    2
 
+/* the balances of a user by user id, the key points to user_id of the value */
 extern dict_t *dict_balance;
 
+/* a stored balance, the rows of the slice, dump and snapshot */
 struct balance_key {
     uint32_t    user_id;
     uint32_t    type;
-    char        asset[ASSET_NAME_MAX_LEN + 1];
+    uint32_t    asset_id;
+};
+
+/*
+ * available and frozen of an asset are changed together by every order,
+ * keep them in the same cache line. the slots are 32 bytes aligned.
+ */
+struct balance_slot {
+    fixed_t     available;
+    fixed_t     frozen;
+};
+
+/*
+ * the balances of a user indexed by asset id, a zero balance is not stored.
+ * slice_epoch is the last slice the balances are saved to.
+ */
+struct balance_user {
+    uint32_t    user_id;
+    uint32_t    slice_epoch;
+    struct balance_slot slots[] __attribute__((aligned(32)));
 };
 
 int init_balance(void);
@@ -25,16 +46,26 @@ bool asset_exist(const char *asset);
 int asset_prec(const char *asset);
 int asset_prec_show(const char *asset);
 
-mpd_t *balance_get(uint32_t user_id, uint32_t type, const char *asset);
-void   balance_del(uint32_t user_id, uint32_t type, const char *asset);
-mpd_t *balance_set(uint32_t user_id, uint32_t type, const char *asset, mpd_t *amount);
-mpd_t *balance_add(uint32_t user_id, uint32_t type, const char *asset, mpd_t *amount);
-mpd_t *balance_sub(uint32_t user_id, uint32_t type, const char *asset, mpd_t *amount);
-mpd_t *balance_freeze(uint32_t user_id, const char *asset, mpd_t *amount);
-mpd_t *balance_unfreeze(uint32_t user_id, const char *asset, mpd_t *amount);
+/* the id of an asset is its index in settings.assets, resolve it once by name, -1 if not exist */
+int get_asset_id(const char *asset);
+
+/*
+ * balances are stored as fixed_t scaled by the asset prec_save, amount
+ * arguments carry their own prec and the result is rounded down.
+ */
+fixed_t *balance_get(uint32_t user_id, uint32_t type, int asset_id);
+void     balance_del(uint32_t user_id, uint32_t type, int asset_id);
+fixed_t *balance_set(uint32_t user_id, uint32_t type, int asset_id, fixed_t amount, int prec);
+fixed_t *balance_add(uint32_t user_id, uint32_t type, int asset_id, fixed_t amount, int prec);
+fixed_t *balance_sub(uint32_t user_id, uint32_t type, int asset_id, fixed_t amount, int prec);
+fixed_t *balance_freeze(uint32_t user_id, int asset_id, fixed_t amount, int prec);
+fixed_t *balance_unfreeze(uint32_t user_id, int asset_id, fixed_t amount, int prec);
+
+fixed_t balance_total(uint32_t user_id, int asset_id);
+int balance_status(int asset_id, fixed_t *total, size_t *available_count, fixed_t *available, size_t *frozen_count, fixed_t *frozen);
 
-mpd_t *balance_total(uint32_t user_id, const char *asset);
-int balance_status(const char *asset, mpd_t *total, size_t *available_count, mpd_t *available, size_t *frozen_count, mpd_t *frozen);
+/* the stored balances of the user as rows, keys and values have room for 2 * asset_num, return the count */
+size_t balance_user_rows(const struct balance_user *user, struct balance_key *keys, fixed_t *values);
 
 # endif
 
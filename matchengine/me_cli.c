@@ -12,6 +12,9 @@
 # include "me_operlog.h"
 # include "me_history.h"
 # include "me_message.h"
+# include "me_admission.h"
+# include "me_match.h"
+# include "me_io.h"
 
 static cli_svr *svr;
 
@@ -19,9 +22,12 @@ static sds on_cmd_status(const char *cmd, int argc, sds *argv)
 {
     sds reply = sdsempty();
     reply = market_status(reply);
+    reply = match_status(reply);
+    reply = io_status(reply);
     reply = operlog_status(reply);
     reply = history_status(reply);
     reply = message_status(reply);
+    reply = admission_status(reply);
     return reply;
 }
 
@@ -38,17 +44,21 @@ static sds on_cmd_balance_list(const char *cmd, int argc, sds *argv)
     dict_iterator *iter = dict_get_iterator(dict_balance);
     dict_entry *entry;
     while ((entry = dict_next(iter)) != NULL) {
-        struct balance_key *key = entry->key;
-        if (asset && strcmp(key->asset, asset) != 0)
-            continue;
-        mpd_t *val = entry->val;
-        char *str = mpd_to_sci(val, 0);
-        if (key->type == BALANCE_TYPE_AVAILABLE) {
-            reply = sdscatprintf(reply, "%-10u %-16s %-10s %s\n", key->user_id, key->asset, "available", str);
-        } else {
-            reply = sdscatprintf(reply, "%-10u %-16s %-10s %s\n", key->user_id, key->asset, "frozen", str);
+        struct balance_user *user = entry->val;
+        for (size_t i = 0; i < settings.asset_num; ++i) {
+            if (asset && strcmp(settings.assets[i].name, asset) != 0)
+                continue;
+            struct balance_slot *slot = &user->slots[i];
+            char str[FIXED_STR_MAX_LEN];
+            if (slot->available) {
+                fixed_to_sci(str, slot->available, settings.assets[i].prec_save);
+                reply = sdscatprintf(reply, "%-10u %-16s %-10s %s\n", user->user_id, settings.assets[i].name, "available", str);
+            }
+            if (slot->frozen) {
+                fixed_to_sci(str, slot->frozen, settings.assets[i].prec_save);
+                reply = sdscatprintf(reply, "%-10u %-16s %-10s %s\n", user->user_id, settings.assets[i].name, "frozen", str);
+            }
         }
-        free(str);
     }
     dict_release_iterator(iter);
 
@@ -66,17 +76,16 @@ static sds on_cmd_balance_get(const char *cmd, int argc, sds *argv)
     uint32_t user_id = strtoul(argv[1], NULL, 0);
     for (uint32_t i = 0; i < settings.asset_num; ++i) {
         const char *asset = settings.assets[i].name;
-        mpd_t *result = balance_get(user_id, BALANCE_TYPE_AVAILABLE, asset);
+        char str[FIXED_STR_MAX_LEN];
+        fixed_t *result = balance_get(user_id, BALANCE_TYPE_AVAILABLE, i);
         if (result) {
-            char *str = mpd_to_sci(result, 0);
+            fixed_to_sci(str, *result, settings.assets[i].prec_save);
             reply = sdscatprintf(reply, "%-10u %-16s %-10s %s\n", user_id, asset, "available", str);
-            free(str);
         }
-        result = balance_get(user_id, BALANCE_TYPE_FROZEN, asset);
+        result = balance_get(user_id, BALANCE_TYPE_FROZEN, i);
         if (result) {
-            char *str = mpd_to_sci(result, 0);
+            fixed_to_sci(str, *result, settings.assets[i].prec_save);
             reply = sdscatprintf(reply, "%-10u %-16s %-10s %s\n", user_id, asset, "frozen", str);
-            free(str);
         }
     }
 
@@ -93,23 +102,19 @@ static sds on_cmd_balance_summary(const char *cmd, int argc, sds *argv)
 
     size_t available_count;
     size_t frozen_count;
-    mpd_t *total = mpd_new(&mpd_ctx);
-    mpd_t *available = mpd_new(&mpd_ctx);
-    mpd_t *frozen = mpd_new(&mpd_ctx);
+    fixed_t total, available, frozen;
+    char total_str[FIXED_STR_MAX_LEN];
+    char available_str[FIXED_STR_MAX_LEN];
+    char frozen_str[FIXED_STR_MAX_LEN];
     for (size_t i = 0; i < settings.asset_num; ++i) {
-        balance_status(settings.assets[i].name, total, &available_count, available, &frozen_count, frozen);
-        char *total_str = mpd_to_sci(total, 0);
-        char *available_str = mpd_to_sci(available, 0);
-        char *frozen_str = mpd_to_sci(frozen, 0);
+        int prec = settings.assets[i].prec_save;
+        balance_status(i, &total, &available_count, &available, &frozen_count, &frozen);
+        fixed_to_sci(total_str, total, available_count + frozen_count ? prec : 0);
+        fixed_to_sci(available_str, available, available_count ? prec : 0);
+        fixed_to_sci(frozen_str, frozen, frozen_count ? prec : 0);
         reply = sdscatprintf(reply, "%-16s %-30s %-10zu %-30s %-10zu %-30s\n", settings.assets[i].name,
                 total_str, available_count, available_str, frozen_count, frozen_str);
-        free(total_str);
-        free(available_str);
-        free(frozen_str);
     }
-    mpd_del(total);
-    mpd_del(available);
-    mpd_del(frozen);
 
     return reply;
 }
@@ -139,19 +144,17 @@ static sds on_cmd_market_summary(const char *cmd, int argc, sds *argv)
 
     size_t ask_count;
     size_t bid_count;
-    mpd_t *ask_amount = mpd_new(&mpd_ctx);
-    mpd_t *bid_amount = mpd_new(&mpd_ctx);
+    fixed_t ask_amount;
+    fixed_t bid_amount;
+    char ask_amount_str[FIXED_STR_MAX_LEN];
+    char bid_amount_str[FIXED_STR_MAX_LEN];
     for (size_t i = 0; i < settings.market_num; ++i) {
-        market_t *market = get_market(settings.markets[i].name);
-        market_get_status(market, &ask_count, ask_amount, &bid_count, bid_amount);
-        char *ask_amount_str = mpd_to_sci(ask_amount, 0);
-        char *bid_amount_str = mpd_to_sci(bid_amount, 0);
+        market_t *market = get_market_by_id(i);
+        market_get_status(market, &ask_count, &ask_amount, &bid_count, &bid_amount);
+        fixed_to_sci(ask_amount_str, ask_amount, ask_count ? market->stock_prec : 0);
+        fixed_to_sci(bid_amount_str, bid_amount, bid_count ? market->stock_prec : 0);
         reply = sdscatprintf(reply, "%-10s %-10zu %-20s %-10zu %-20s\n", market->name, ask_count, ask_amount_str, bid_count, bid_amount_str);
-        free(ask_amount_str);
-        free(bid_amount_str);
     }
-    mpd_del(ask_amount);
-    mpd_del(bid_amount);
 
     return reply;
 }
@@ -63,6 +63,92 @@ static int load_markets(json_t *root, const char *key)
     return 0;
 }
 
+static int load_depth_merge(json_t *root, const char *key)
+{
+    json_t *node = json_object_get(root, key);
+    if (!node) {
+        settings.depth_merge_num = 0;
+        return 0;
+    }
+    if (!json_is_array(node))
+        return -__LINE__;
+
+    settings.depth_merge_num = json_array_size(node);
+    settings.depth_merge = malloc(sizeof(mpd_t *) * settings.depth_merge_num);
+    for (size_t i = 0; i < settings.depth_merge_num; ++i) {
+        json_t *row = json_array_get(node, i);
+        if (!json_is_string(row))
+            return -__LINE__;
+        settings.depth_merge[i] = decimal(json_string_value(row), 0);
+        if (settings.depth_merge[i] == NULL)
+            return -__LINE__;
+    }
+
+    return 0;
+}
+
+static int read_message_format(json_t *node, const char *key, bool *binary)
+{
+    char *format = NULL;
+    ERR_RET_LN(read_cfg_str(node, key, &format, "json"));
+    if (strcmp(format, "binary") == 0) {
+        *binary = true;
+    } else if (strcmp(format, "json") == 0) {
+        *binary = false;
+    } else {
+        free(format);
+        return -__LINE__;
+    }
+    free(format);
+    return 0;
+}
+
+static int load_message_format(json_t *root, const char *key)
+{
+    json_t *node = json_object_get(root, key);
+    if (node && !json_is_object(node))
+        return -__LINE__;
+
+    ERR_RET_LN(read_message_format(node, "deals", &settings.message_format.deals));
+    ERR_RET_LN(read_message_format(node, "orders", &settings.message_format.orders));
+    ERR_RET_LN(read_message_format(node, "balances", &settings.message_format.balances));
+
+    return 0;
+}
+
+static int load_admission(json_t *root, const char *key)
+{
+    /* all optional, the defaults are used if the node is missing */
+    json_t *node = json_object_get(root, key);
+    if (node && !json_is_object(node))
+        return -__LINE__;
+
+    struct admission *cfg = &settings.admission;
+    ERR_RET_LN(read_cfg_real(node, "slow", &cfg->slow, false, 0.5));
+    ERR_RET_LN(read_cfg_real(node, "shed", &cfg->shed, false, 0.8));
+    ERR_RET_LN(read_cfg_real(node, "cancel_limit", &cfg->cancel_limit, false, 2.0));
+    ERR_RET_LN(read_cfg_real(node, "user_rate", &cfg->user_rate, false, 20));
+    ERR_RET_LN(read_cfg_real(node, "source_rate", &cfg->source_rate, false, 1000));
+    if (cfg->slow > cfg->shed || cfg->shed > 1 || cfg->cancel_limit < 1)
+        return -__LINE__;
+
+    json_t *sources = json_object_get(node, "low_sources");
+    if (sources == NULL)
+        return 0;
+    if (!json_is_array(sources))
+        return -__LINE__;
+    cfg->low_source_num = json_array_size(sources);
+    cfg->low_sources = malloc(sizeof(char *) * cfg->low_source_num);
+    for (size_t i = 0; i < cfg->low_source_num; ++i) {
+        json_t *row = json_array_get(sources, i);
+        if (!json_is_string(row))
+            return -__LINE__;
+        cfg->low_sources[i] = strdup(json_string_value(row));
+    }
+
+    return 0;
+}
+
 static int read_config_from_json(json_t *root)
 {
     int ret;
@@ -126,6 +212,11 @@ static int read_config_from_json(json_t *root)
         printf("load brokers fail: %d\n", ret);
         return -__LINE__;
     }
+    ret = load_message_format(root, "message_format");
+    if (ret < 0) {
+        printf("load message_format fail: %d\n", ret);
+        return -__LINE__;
+    }
     ret = read_cfg_int(root, "slice_interval", &settings.slice_interval, false, 86400);
     if (ret < 0) {
         printf("load slice_interval fail: %d", ret);
@@ -136,13 +227,61 @@ static int read_config_from_json(json_t *root)
         printf("load slice_keeptime fail: %d", ret);
         return -__LINE__;
     }
+    ret = read_cfg_str(root, "slice_path", &settings.slice_path, "");
+    if (ret < 0) {
+        printf("load slice_path fail: %d", ret);
+        return -__LINE__;
+    }
+    ret = read_cfg_str(root, "operlog_path", &settings.operlog_path, "");
+    if (ret < 0) {
+        printf("load operlog_path fail: %d", ret);
+        return -__LINE__;
+    }
+    ret = read_cfg_real(root, "operlog_commit_interval", &settings.operlog_commit_interval, false, 0.01);
+    if (ret < 0) {
+        printf("load operlog_commit_interval fail: %d", ret);
+        return -__LINE__;
+    }
+    ret = read_cfg_int(root, "operlog_commit_size", &settings.operlog_commit_size, false, 1024 * 1024);
+    if (ret < 0) {
+        printf("load operlog_commit_size fail: %d", ret);
+        return -__LINE__;
+    }
+    ret = read_cfg_uint64(root, "operlog_segment_size", &settings.operlog_segment_size, false, 64 * 1024 * 1024);
+    if (ret < 0) {
+        printf("load operlog_segment_size fail: %d", ret);
+        return -__LINE__;
+    }
+    ret = read_cfg_int(root, "match_thread", &settings.match_thread, false, 1);
+    if (ret < 0 || settings.match_thread < 1 || settings.match_thread > MATCH_THREAD_MAX) {
+        printf("load match_thread fail: %d", ret);
+        return -__LINE__;
+    }
+    ret = read_cfg_bool(root, "io_thread", &settings.io_thread, false, false);
+    if (ret < 0) {
+        printf("load io_thread fail: %d", ret);
+        return -__LINE__;
+    }
     ret = read_cfg_int(root, "history_thread", &settings.history_thread, false, 10);
     if (ret < 0) {
         printf("load history_thread fail: %d", ret);
         return -__LINE__;
     }
-
-    ERR_RET_LN(read_cfg_real(root, "cache_timeout", &settings.cache_timeout, false, 0.45));
+    ret = read_cfg_bool(root, "history_load_data", &settings.history_load_data, false, false);
+    if (ret < 0) {
+        printf("load history_load_data fail: %d", ret);
+        return -__LINE__;
+    }
+    ret = load_admission(root, "admission");
+    if (ret < 0) {
+        printf("load admission fail: %d", ret);
+        return -__LINE__;
+    }
+    ret = load_depth_merge(root, "depth_merge");
+    if (ret < 0) {
+        printf("load depth_merge fail: %d", ret);
+        return -__LINE__;
+    }
 
     return 0;
 }
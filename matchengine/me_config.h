@@ -27,6 +27,7 @@
 # include "ut_cli.h"
 # include "ut_misc.h"
 # include "ut_list.h"
+# include "ut_pack.h"
 # include "ut_mysql.h"
 # include "ut_signal.h"
 # include "ut_define.h"
@@ -44,11 +45,15 @@
 
 # define ORDER_BOOK_MAX_LEN     101
 # define ORDER_LIST_MAX_LEN     101
+# define ORDER_BATCH_MAX_LEN    100
 
 # define MAX_PENDING_OPERLOG    100
 # define MAX_PENDING_HISTORY    1000
 # define MAX_PENDING_MESSAGE    1000
 
+# define MATCH_THREAD_MAX       64
+# define MATCH_BATCH_MAX_LEN    1000
+
 struct asset {
     char                *name;
     int                 prec_save;
@@ -65,6 +70,23 @@ struct market {
     mpd_t               *min_amount;
 };
 
+struct admission {
+    double              slow;
+    double              shed;
+    double              cancel_limit;
+    double              user_rate;
+    double              source_rate;
+    size_t              low_source_num;
+    char                **low_sources;
+};
+
+/* the topics produced in the binary encoding of ut_event, json if false */
+struct message_format {
+    bool                deals;
+    bool                orders;
+    bool                balances;
+};
+
 struct settings {
     bool                debug;
     process_cfg         process;
@@ -83,10 +105,22 @@ struct settings {
     struct market       *markets;
 
     char                *brokers;
+    struct message_format message_format;
     int                 slice_interval;
     int                 slice_keeptime;
+    char                *slice_path;
+    char                *operlog_path;
+    double              operlog_commit_interval;
+    int                 operlog_commit_size;
+    uint64_t            operlog_segment_size;
+    int                 match_thread;
+    bool                io_thread;
     int                 history_thread;
-    double              cache_timeout;
+    bool                history_load_data;
+    struct admission    admission;
+
+    size_t              depth_merge_num;
+    mpd_t               **depth_merge;
 };
 
 extern struct settings settings;
@@ -0,0 +1,156 @@
+/*
+ * Description: push depth updates of the markets to subscribed connections
+ */
+
+# include "me_config.h"
+# include "me_depth.h"
+# include "me_trade.h"
+# include "me_io.h"
+
+static dict_t *dict_sub;
+
+static uint32_t dict_market_hash_function(const void *key)
+{
+    return dict_generic_hash_function(key, strlen(key));
+}
+
+static int dict_market_key_compare(const void *key1, const void *key2)
+{
+    return strcmp(key1, key2);
+}
+
+static void *dict_market_key_dup(const void *key)
+{
+    return strdup(key);
+}
+
+static void dict_market_key_free(void *key)
+{
+    free(key);
+}
+
+static void dict_market_val_free(void *val)
+{
+    dict_release(val);
+}
+
+// the pointer itself, with io_thread the session is the io thread's and may be closed or reused
+static uint32_t dict_ses_hash_function(const void *key)
+{
+    uintptr_t ses = (uintptr_t)key;
+    return dict_generic_hash_function(&ses, sizeof(ses));
+}
+
+static int dict_ses_key_compare(const void *key1, const void *key2)
+{
+    return key1 == key2 ? 0 : 1;
+}
+
+int init_depth(void)
+{
+    dict_types dt;
+    memset(&dt, 0, sizeof(dt));
+    dt.hash_function  = dict_market_hash_function;
+    dt.key_compare    = dict_market_key_compare;
+    dt.key_dup        = dict_market_key_dup;
+    dt.key_destructor = dict_market_key_free;
+    dt.val_destructor = dict_market_val_free;
+
+    dict_sub = dict_create(&dt, 64);
+    if (dict_sub == NULL)
+        return -__LINE__;
+
+    return 0;
+}
+
+static void push_update(market_t *m, dict_t *sessions, json_t *update)
+{
+    json_object_set_new(update, "market", json_string(m->name));
+    char *message_data = json_dumps(update, 0);
+    if (message_data == NULL)
+        return;
+
+    rpc_pkg pkg;
+    memset(&pkg, 0, sizeof(pkg));
+    pkg.pkg_type  = RPC_PKG_TYPE_PUSH;
+    pkg.command   = CMD_ORDER_DEPTH_UPDATE;
+    pkg.body      = message_data;
+    pkg.body_size = strlen(message_data);
+
+    dict_entry *entry;
+    dict_iterator *iter = dict_get_iterator(sessions);
+    while ((entry = dict_next(iter)) != NULL) {
+        nw_ses *ses = entry->key;
+        if (io_enabled()) {
+            io_push(ses, (uintptr_t)entry->val, &pkg);
+            continue;
+        }
+        log_trace("connection: %s push: %s", nw_sock_human_addr(&ses->peer_addr), message_data);
+        rpc_send(ses, &pkg);
+    }
+    dict_release_iterator(iter);
+    monitor_inc("depth_update", dict_size(sessions));
+
+    free(message_data);
+}
+
+static void flush_market(market_t *m)
+{
+    json_t *update = market_get_depth_update(m);
+    if (update == NULL)
+        return;
+
+    dict_entry *entry = dict_find(dict_sub, m->name);
+    if (entry) {
+        push_update(m, entry->val, update);
+    }
+    json_decref(update);
+}
+
+json_t *depth_subscribe(nw_ses *ses, uint64_t ses_id, market_t *m)
+{
+    dict_entry *entry = dict_find(dict_sub, m->name);
+    if (entry == NULL) {
+        dict_types dt;
+        memset(&dt, 0, sizeof(dt));
+        dt.hash_function = dict_ses_hash_function;
+        dt.key_compare   = dict_ses_key_compare;
+
+        dict_t *sessions = dict_create(&dt, 16);
+        if (sessions == NULL)
+            return NULL;
+        entry = dict_add(dict_sub, m->name, sessions);
+        if (entry == NULL) {
+            dict_release(sessions);
+            return NULL;
+        }
+    }
+
+    // changes made before the snapshot go to the current subscribers only
+    flush_market(m);
+    m->depth_track = true;
+    dict_replace(entry->val, ses, (void *)(uintptr_t)ses_id);
+
+    return market_get_depth_snapshot(m);
+}
+
+void depth_unsubscribe(nw_ses *ses)
+{
+    dict_entry *entry;
+    dict_iterator *iter = dict_get_iterator(dict_sub);
+    while ((entry = dict_next(iter)) != NULL) {
+        dict_delete(entry->val, ses);
+    }
+    dict_release_iterator(iter);
+}
+
+void depth_flush(void)
+{
+    for (size_t i = 0; i < settings.market_num; ++i) {
+        market_t *m = get_market_by_id(i);
+        if (m && m->depth_change_num) {
+            flush_market(m);
+        }
+    }
+}
+
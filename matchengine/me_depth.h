@@ -0,0 +1,21 @@
+/*
+ * Description: push depth updates of the markets to subscribed connections
+ */
+
+# ifndef _ME_DEPTH_H_
+# define _ME_DEPTH_H_
+
+# include "me_config.h"
+# include "me_market.h"
+
+int init_depth(void);
+
+/* return the depth snapshot of the market, updates after it are pushed to ses */
+json_t *depth_subscribe(nw_ses *ses, uint64_t ses_id, market_t *m);
+void depth_unsubscribe(nw_ses *ses);
+
+/* push the levels changed by the last command */
+void depth_flush(void);
+
+# endif
+
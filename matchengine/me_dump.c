@@ -8,18 +8,43 @@
 # include "me_market.h"
 # include "me_balance.h"
 
-static sds sql_append_mpd(sds sql, mpd_t *val, bool comma)
+static sds sql_append_fixed(sds sql, fixed_t val, int prec, bool comma)
 {
-    char *str = mpd_to_sci(val, 0);
-    sql = sdscatprintf(sql, "'%s'", str);
+    char buf[FIXED_STR_MAX_LEN];
+    sql = sdscatprintf(sql, "'%s'", fixed_to_sci(buf, val, prec));
     if (comma) {
         sql = sdscatprintf(sql, ", ");
     }
-    free(str);
     return sql;
 }
 
-static int dump_orders_list(MYSQL *conn, const char *table, skiplist_t *list)
+static sds sql_append_order(sds sql, market_t *m, order_t *order)
+{
+    sql = sdscatprintf(sql, "(%"PRIu64", %u, %u, %f, %f, %u, '%s', '%s', ",
+            order->id, order->type, order->side, order->create_time, order->update_time, order->user_id, m->name, order->source);
+    sql = sql_append_fixed(sql, order->price, order_price_prec(m, order), true);
+    sql = sql_append_fixed(sql, order->amount, m->stock_prec, true);
+    sql = sql_append_fixed(sql, order->taker_fee, m->fee_prec, true);
+    sql = sql_append_fixed(sql, order->maker_fee, order_maker_fee_prec(m, order), true);
+    sql = sql_append_fixed(sql, order->left, order_left_prec(m, order), true);
+    sql = sql_append_fixed(sql, order->frozen, order_frozen_prec(m, order), true);
+    sql = sql_append_fixed(sql, order->deal_stock, order_deal_stock_prec(m, order), true);
+    sql = sql_append_fixed(sql, order->deal_money, order_deal_money_prec(m, order), true);
+    sql = sql_append_fixed(sql, order->deal_fee, order_deal_fee_prec(m, order), false);
+    sql = sdscatprintf(sql, ")");
+    return sql;
+}
+
+static sds sql_append_balance(sds sql, const struct balance_key *key, fixed_t balance)
+{
+    struct asset *asset = &settings.assets[key->asset_id];
+    sql = sdscatprintf(sql, "(NULL, %u, '%s', %u, ", key->user_id, asset->name, key->type);
+    sql = sql_append_fixed(sql, balance, asset->prec_save, false);
+    sql = sdscatprintf(sql, ")");
+    return sql;
+}
+
+static int dump_orders_list(MYSQL *conn, const char *table, market_t *m, skiplist_t *list)
 {
     sds sql = sdsempty();
 
@@ -28,39 +53,30 @@ static int dump_orders_list(MYSQL *conn, const char *table, skiplist_t *list)
     skiplist_iter *iter = skiplist_get_iterator(list);
     skiplist_node *node;
     while ((node = skiplist_next(iter)) != NULL) {
-        order_t *order = node->value;
-        if (index == 0) {
-            sql = sdscatprintf(sql, "INSERT INTO `%s` (`id`, `t`, `side`, `create_time`, `update_time`, `user_id`, `market`, `source`, "
-                    "`price`, `amount`, `taker_fee`, `maker_fee`, `left`, `frozen`, `deal_stock`, `deal_money`, `deal_fee`) VALUES ", table);
-        } else {
-            sql = sdscatprintf(sql, ", ");
-        }
+        order_level_t *level = node->value;
+        for (order_t *order = level->head; order; order = order->next) {
+            if (index == 0) {
+                sql = sdscatprintf(sql, "INSERT INTO `%s` (`id`, `t`, `side`, `create_time`, `update_time`, `user_id`, `market`, `source`, "
+                        "`price`, `amount`, `taker_fee`, `maker_fee`, `left`, `frozen`, `deal_stock`, `deal_money`, `deal_fee`) VALUES ", table);
+            } else {
+                sql = sdscatprintf(sql, ", ");
+            }
+
+            sql = sql_append_order(sql, m, order);
 
-        sql = sdscatprintf(sql, "(%"PRIu64", %u, %u, %f, %f, %u, '%s', '%s', ",
-                order->id, order->type, order->side, order->create_time, order->update_time, order->user_id, order->market, order->source);
-        sql = sql_append_mpd(sql, order->price, true);
-        sql = sql_append_mpd(sql, order->amount, true);
-        sql = sql_append_mpd(sql, order->taker_fee, true);
-        sql = sql_append_mpd(sql, order->maker_fee, true);
-        sql = sql_append_mpd(sql, order->left, true);
-        sql = sql_append_mpd(sql, order->frozen, true);
-        sql = sql_append_mpd(sql, order->deal_stock, true);
-        sql = sql_append_mpd(sql, order->deal_money, true);
-        sql = sql_append_mpd(sql, order->deal_fee, false);
-        sql = sdscatprintf(sql, ")");
-
-        index += 1;
-        if (index == insert_limit) {
-            log_trace("exec sql: %s", sql);
-            int ret = mysql_real_query(conn, sql, sdslen(sql));
-            if (ret < 0) {
-                log_error("exec sql: %s fail: %d %s", sql, mysql_errno(conn), mysql_error(conn));
-                skiplist_release_iterator(iter);
-                sdsfree(sql);
-                return -__LINE__;
+            index += 1;
+            if (index == insert_limit) {
+                log_trace("exec sql: %s", sql);
+                int ret = mysql_real_query(conn, sql, sdslen(sql));
+                if (ret < 0) {
+                    log_error("exec sql: %s fail: %d %s", sql, mysql_errno(conn), mysql_error(conn));
+                    skiplist_release_iterator(iter);
+                    sdsfree(sql);
+                    return -__LINE__;
+                }
+                sdsclear(sql);
+                index = 0;
             }
-            sdsclear(sql);
-            index = 0;
         }
     }
     skiplist_release_iterator(iter);
@@ -79,7 +95,7 @@ static int dump_orders_list(MYSQL *conn, const char *table, skiplist_t *list)
     return 0;
 }
 
-int dump_orders(MYSQL *conn, const char *table)
+int dump_create_table(MYSQL *conn, const char *table, const char *example)
 {
     sds sql = sdsempty();
     sql = sdscatprintf(sql, "DROP TABLE IF EXISTS `%s`", table);
@@ -92,7 +108,7 @@ int dump_orders(MYSQL *conn, const char *table)
     }
     sdsclear(sql);
 
-    sql = sdscatprintf(sql, "CREATE TABLE IF NOT EXISTS `%s` LIKE `slice_order_example`", table);
+    sql = sdscatprintf(sql, "CREATE TABLE IF NOT EXISTS `%s` LIKE `%s`", table, example);
     log_trace("exec sql: %s", sql);
     ret = mysql_real_query(conn, sql, sdslen(sql));
     if (ret != 0) {
@@ -102,18 +118,27 @@ int dump_orders(MYSQL *conn, const char *table)
     }
     sdsfree(sql);
 
+    return 0;
+}
+
+int dump_orders(MYSQL *conn, const char *table)
+{
+    int ret = dump_create_table(conn, table, "slice_order_example");
+    if (ret < 0)
+        return ret;
+
     for (int i = 0; i < settings.market_num; ++i) {
-        market_t *market = get_market(settings.markets[i].name);
+        market_t *market = get_market_by_id(i);
         if (market == NULL) {
             return -__LINE__;
         }
         int ret;
-        ret = dump_orders_list(conn, table, market->asks);
+        ret = dump_orders_list(conn, table, market, market->asks);
         if (ret < 0) {
             log_error("dump market: %s asks orders list fail: %d", market->name, ret);
             return -__LINE__;
         }
-        ret = dump_orders_list(conn, table, market->bids);
+        ret = dump_orders_list(conn, table, market, market->bids);
         if (ret < 0) {
             log_error("dump market: %s bids orders list fail: %d", market->name, ret);
             return -__LINE__;
@@ -129,36 +154,48 @@ static int dump_balance_dict(MYSQL *conn, const char *table, dict_t *dict)
 
     size_t insert_limit = 1000;
     size_t index = 0;
+    struct balance_key *keys = malloc(sizeof(struct balance_key) * settings.asset_num * 2);
+    fixed_t *balances = malloc(sizeof(fixed_t) * settings.asset_num * 2);
+    if (keys == NULL || balances == NULL) {
+        free(keys);
+        free(balances);
+        sdsfree(sql);
+        return -__LINE__;
+    }
+
     dict_iterator *iter = dict_get_iterator(dict);
     dict_entry *entry;
     while ((entry = dict_next(iter)) != NULL) {
-        struct balance_key *key = entry->key;
-        mpd_t *balance = entry->val;
-        if (index == 0) {
-            sql = sdscatprintf(sql, "INSERT INTO `%s` (`id`, `user_id`, `asset`, `t`, `balance`) VALUES ", table);
-        } else {
-            sql = sdscatprintf(sql, ", ");
-        }
+        size_t count = balance_user_rows(entry->val, keys, balances);
+        for (size_t i = 0; i < count; ++i) {
+            if (index == 0) {
+                sql = sdscatprintf(sql, "INSERT INTO `%s` (`id`, `user_id`, `asset`, `t`, `balance`) VALUES ", table);
+            } else {
+                sql = sdscatprintf(sql, ", ");
+            }
 
-        sql = sdscatprintf(sql, "(NULL, %u, '%s', %u, ", key->user_id, key->asset, key->type);
-        sql = sql_append_mpd(sql, balance, false);
-        sql = sdscatprintf(sql, ")");
-
-        index += 1;
-        if (index == insert_limit) {
-            log_trace("exec sql: %s", sql);
-            int ret = mysql_real_query(conn, sql, sdslen(sql));
-            if (ret < 0) {
-                log_error("exec sql: %s fail: %d %s", sql, mysql_errno(conn), mysql_error(conn));
-                dict_release_iterator(iter);
-                sdsfree(sql);
-                return -__LINE__;
+            sql = sql_append_balance(sql, &keys[i], balances[i]);
+
+            index += 1;
+            if (index == insert_limit) {
+                log_trace("exec sql: %s", sql);
+                int ret = mysql_real_query(conn, sql, sdslen(sql));
+                if (ret < 0) {
+                    log_error("exec sql: %s fail: %d %s", sql, mysql_errno(conn), mysql_error(conn));
+                    dict_release_iterator(iter);
+                    free(keys);
+                    free(balances);
+                    sdsfree(sql);
+                    return -__LINE__;
+                }
+                sdsclear(sql);
+                index = 0;
             }
-            sdsclear(sql);
-            index = 0;
         }
     }
     dict_release_iterator(iter);
+    free(keys);
+    free(balances);
 
     if (index > 0) {
         log_trace("exec sql: %s", sql);
@@ -176,33 +213,71 @@ static int dump_balance_dict(MYSQL *conn, const char *table, dict_t *dict)
 
 int dump_balance(MYSQL *conn, const char *table)
 {
-    sds sql = sdsempty();
-    sql = sdscatprintf(sql, "DROP TABLE IF EXISTS `%s`", table);
-    log_trace("exec sql: %s", sql);
-    int ret = mysql_real_query(conn, sql, sdslen(sql));
-    if (ret != 0) {
-        log_error("exec sql: %s fail: %d %s", sql, mysql_errno(conn), mysql_error(conn));
-        sdsfree(sql);
+    int ret = dump_create_table(conn, table, "slice_balance_example");
+    if (ret < 0)
+        return ret;
+
+    ret = dump_balance_dict(conn, table, dict_balance);
+    if (ret < 0) {
+        log_error("dump_balance_dict fail: %d", ret);
         return -__LINE__;
     }
-    sdsclear(sql);
 
-    sql = sdscatprintf(sql, "CREATE TABLE IF NOT EXISTS `%s` LIKE `slice_balance_example`", table);
+    return 0;
+}
+
+
+static int exec_sql(MYSQL *conn, sds sql)
+{
     log_trace("exec sql: %s", sql);
-    ret = mysql_real_query(conn, sql, sdslen(sql));
+    int ret = mysql_real_query(conn, sql, sdslen(sql));
     if (ret != 0) {
         log_error("exec sql: %s fail: %d %s", sql, mysql_errno(conn), mysql_error(conn));
-        sdsfree(sql);
         return -__LINE__;
     }
-    sdsfree(sql);
+    return 0;
+}
 
-    ret = dump_balance_dict(conn, table, dict_balance);
-    if (ret < 0) {
-        log_error("dump_balance_dict fail: %d", ret);
-        return -__LINE__;
+int dump_order_rows(MYSQL *conn, const char *table, order_t *orders, size_t count)
+{
+    if (count == 0)
+        return 0;
+
+    sds sql = sdsempty();
+    sql = sdscatprintf(sql, "INSERT INTO `%s` (`id`, `t`, `side`, `create_time`, `update_time`, `user_id`, `market`, `source`, "
+            "`price`, `amount`, `taker_fee`, `maker_fee`, `left`, `frozen`, `deal_stock`, `deal_money`, `deal_fee`) VALUES ", table);
+    for (size_t i = 0; i < count; ++i) {
+        market_t *m = get_market_by_id(orders[i].market_id);
+        if (m == NULL) {
+            sdsfree(sql);
+            return -__LINE__;
+        }
+        if (i > 0) {
+            sql = sdscatprintf(sql, ", ");
+        }
+        sql = sql_append_order(sql, m, &orders[i]);
     }
 
-    return 0;
+    int ret = exec_sql(conn, sql);
+    sdsfree(sql);
+    return ret;
 }
 
+int dump_balance_rows(MYSQL *conn, const char *table, struct balance_key *keys, fixed_t *balances, size_t count)
+{
+    if (count == 0)
+        return 0;
+
+    sds sql = sdsempty();
+    sql = sdscatprintf(sql, "INSERT INTO `%s` (`id`, `user_id`, `asset`, `t`, `balance`) VALUES ", table);
+    for (size_t i = 0; i < count; ++i) {
+        if (i > 0) {
+            sql = sdscatprintf(sql, ", ");
+        }
+        sql = sql_append_balance(sql, &keys[i], balances[i]);
+    }
+
+    int ret = exec_sql(conn, sql);
+    sdsfree(sql);
+    return ret;
+}
@@ -8,9 +8,18 @@
 
 # include "ut_mysql.h"
 
+# include "me_market.h"
+# include "me_balance.h"
+
 int dump_orders(MYSQL *conn, const char *table);
 int dump_markets(MYSQL *conn, const char *table);
 int dump_balance(MYSQL *conn, const char *table);
 
+/* drop table and create it again like example */
+int dump_create_table(MYSQL *conn, const char *table, const char *example);
+/* insert copies of orders and balances saved by a slice, in one statement */
+int dump_order_rows(MYSQL *conn, const char *table, order_t *orders, size_t count);
+int dump_balance_rows(MYSQL *conn, const char *table, struct balance_key *keys, fixed_t *balances, size_t count);
+
 # endif
 
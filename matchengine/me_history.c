@@ -7,11 +7,28 @@
 # include "me_history.h"
 # include "me_balance.h"
 
-static MYSQL *mysql_conn;
-static nw_job *job;
+# define HISTORY_FLUSH_MIN   100
+# define HISTORY_FLUSH_MAX   10000
+# define HISTORY_FLUSH_DELAY 1.0
+# define HISTORY_VALUE_MAX   7
+
 static dict_t *dict_sql;
 static nw_timer timer;
 
+/*
+ * a writer thread with its own connection for each shard of the table
+ * hash, so the tables of a hash are written in order and the shards are
+ * written in parallel.
+ */
+struct history_shard {
+    nw_job      *job;
+    /* rows of a table that are sent to the writer in one statement */
+    size_t      flush_rows;
+};
+
+static struct history_shard *shards;
+static int shard_num;
+
 enum {
     HISTORY_USER_BALANCE,
     HISTORY_USER_ORDER,
@@ -25,6 +42,50 @@ struct dict_sql_key {
     uint32_t hash;
 };
 
+/* the fields of a history row, they are rendered to sql by the writer threads */
+struct history_row {
+    double      time;
+    double      finish_time;
+    uint64_t    id;
+    uint64_t    order_id;
+    uint64_t    deal_order_id;
+    uint32_t    user_id;
+    uint32_t    type;
+    uint32_t    side;
+    int         role;
+    const char  *market;
+    const char  *asset;
+    char        source[SOURCE_MAX_LEN + 1];
+    char        business[BUSINESS_NAME_MAX_LEN + 1];
+    fixed_t     value[HISTORY_VALUE_MAX];
+    int         prec[HISTORY_VALUE_MAX];
+    char        *detail;
+};
+
+struct history_batch {
+    uint32_t    type;
+    uint32_t    hash;
+    double      create_time;
+    size_t      count;
+    size_t      size;
+    struct history_row *rows;
+};
+
+struct history_writer {
+    MYSQL       *conn;
+    bool        load_data;
+    int         field;
+    sds         buf;
+    char        *escape;
+    size_t      escape_size;
+};
+
+struct history_infile {
+    const char  *data;
+    size_t      size;
+    size_t      offset;
+};
+
 static uint32_t dict_sql_hash_function(const void *key)
 {
     return dict_generic_hash_function(key, sizeof(struct dict_sql_key));
@@ -47,45 +108,313 @@ static void dict_sql_key_free(void *key)
     free(key);
 }
 
+static void out_field(struct history_writer *w)
+{
+    if (w->field++ > 0) {
+        w->buf = sdscatlen(w->buf, w->load_data ? "\t" : ", ", w->load_data ? 1 : 2);
+    }
+}
+
+static void out_row_begin(struct history_writer *w, size_t index)
+{
+    w->field = 0;
+    if (!w->load_data) {
+        w->buf = sdscat(w->buf, index == 0 ? "(" : ", (");
+    }
+}
+
+static void out_row_end(struct history_writer *w)
+{
+    w->buf = sdscatlen(w->buf, w->load_data ? "\n" : ")", 1);
+}
+
+static void out_null(struct history_writer *w)
+{
+    out_field(w);
+    w->buf = sdscat(w->buf, w->load_data ? "\\N" : "NULL");
+}
+
+static void out_uint(struct history_writer *w, uint64_t val)
+{
+    out_field(w);
+    w->buf = sdscatprintf(w->buf, "%"PRIu64, val);
+}
+
+static void out_int(struct history_writer *w, int val)
+{
+    out_field(w);
+    w->buf = sdscatprintf(w->buf, "%d", val);
+}
+
+static void out_double(struct history_writer *w, double val)
+{
+    out_field(w);
+    w->buf = sdscatprintf(w->buf, "%f", val);
+}
+
+static void out_str(struct history_writer *w, const char *str)
+{
+    out_field(w);
+    size_t len = strlen(str);
+    if (!w->load_data) {
+        if (w->escape_size < len * 2 + 1) {
+            w->escape_size = len * 2 + 1;
+            w->escape = realloc(w->escape, w->escape_size);
+        }
+        mysql_real_escape_string(w->conn, w->escape, str, len);
+        w->buf = sdscatprintf(w->buf, "'%s'", w->escape);
+        return;
+    }
+
+    /* the escapes of LOAD DATA with the default FIELDS ESCAPED BY '\\' */
+    size_t start = 0;
+    for (size_t i = 0; i < len; ++i) {
+        const char *esc = NULL;
+        switch (str[i]) {
+        case '\\': esc = "\\\\"; break;
+        case '\t': esc = "\\t"; break;
+        case '\n': esc = "\\n"; break;
+        case '\r': esc = "\\r"; break;
+        }
+        if (esc) {
+            w->buf = sdscatlen(w->buf, str + start, i - start);
+            w->buf = sdscat(w->buf, esc);
+            start = i + 1;
+        }
+    }
+    w->buf = sdscatlen(w->buf, str + start, len - start);
+}
+
+static void out_fixed(struct history_writer *w, fixed_t val, int prec)
+{
+    char buf[FIXED_STR_MAX_LEN];
+    out_field(w);
+    fixed_to_sci(buf, val, prec);
+    if (w->load_data) {
+        w->buf = sdscat(w->buf, buf);
+    } else {
+        w->buf = sdscatprintf(w->buf, "'%s'", buf);
+    }
+}
+
+static void render_order(struct history_writer *w, struct history_row *row)
+{
+    out_uint(w, row->id);
+    out_double(w, row->time);
+    out_double(w, row->finish_time);
+    out_uint(w, row->user_id);
+    out_str(w, row->market);
+    out_str(w, row->source);
+    out_uint(w, row->type);
+    out_uint(w, row->side);
+    for (int i = 0; i < 7; ++i) {
+        out_fixed(w, row->value[i], row->prec[i]);
+    }
+}
+
+static void render_order_deal(struct history_writer *w, struct history_row *row)
+{
+    out_null(w);
+    out_double(w, row->time);
+    out_uint(w, row->user_id);
+    out_uint(w, row->id);
+    out_uint(w, row->order_id);
+    out_uint(w, row->deal_order_id);
+    out_int(w, row->role);
+    for (int i = 0; i < 5; ++i) {
+        out_fixed(w, row->value[i], row->prec[i]);
+    }
+}
+
+static void render_user_deal(struct history_writer *w, struct history_row *row)
+{
+    out_null(w);
+    out_double(w, row->time);
+    out_uint(w, row->user_id);
+    out_str(w, row->market);
+    out_uint(w, row->id);
+    out_uint(w, row->order_id);
+    out_uint(w, row->deal_order_id);
+    out_int(w, row->side);
+    out_int(w, row->role);
+    for (int i = 0; i < 5; ++i) {
+        out_fixed(w, row->value[i], row->prec[i]);
+    }
+}
+
+static void render_user_balance(struct history_writer *w, struct history_row *row)
+{
+    out_null(w);
+    out_double(w, row->time);
+    out_uint(w, row->user_id);
+    out_str(w, row->asset);
+    out_str(w, row->business);
+    out_fixed(w, row->value[0], row->prec[0]);
+    out_fixed(w, row->value[1], row->prec[1]);
+    out_str(w, row->detail ? row->detail : "");
+}
+
+static const struct history_table {
+    const char *name;
+    const char *columns;
+    void (*render)(struct history_writer *w, struct history_row *row);
+} history_tables[] = {
+    [HISTORY_USER_BALANCE] = { "balance_history",
+        "`id`, `time`, `user_id`, `asset`, `business`, `change`, `balance`, `detail`", render_user_balance },
+    [HISTORY_USER_ORDER] = { "order_history",
+        "`id`, `create_time`, `finish_time`, `user_id`, `market`, `source`, `t`, `side`, "
+        "`price`, `amount`, `taker_fee`, `maker_fee`, `deal_stock`, `deal_money`, `deal_fee`", render_order },
+    [HISTORY_USER_DEAL] = { "user_deal_history",
+        "`id`, `time`, `user_id`, `market`, `deal_id`, `order_id`, `deal_order_id`, `side`, `role`, "
+        "`price`, `amount`, `deal`, `fee`, `deal_fee`", render_user_deal },
+    [HISTORY_ORDER_DETAIL] = { "order_detail",
+        "`id`, `create_time`, `finish_time`, `user_id`, `market`, `source`, `t`, `side`, "
+        "`price`, `amount`, `taker_fee`, `maker_fee`, `deal_stock`, `deal_money`, `deal_fee`", render_order },
+    [HISTORY_ORDER_DEAL] = { "order_deal_history",
+        "`id`, `time`, `user_id`, `deal_id`, `order_id`, `deal_order_id`, `role`, "
+        "`price`, `amount`, `deal`, `fee`, `deal_fee`", render_order_deal },
+};
+
+static int infile_init(void **ptr, const char *filename, void *userdata)
+{
+    struct history_infile *infile = userdata;
+    infile->offset = 0;
+    *ptr = infile;
+    return 0;
+}
+
+static int infile_read(void *ptr, char *buf, unsigned int len)
+{
+    struct history_infile *infile = ptr;
+    size_t size = infile->size - infile->offset;
+    if (size > len)
+        size = len;
+    memcpy(buf, infile->data + infile->offset, size);
+    infile->offset += size;
+    return size;
+}
+
+static void infile_end(void *ptr)
+{
+}
+
+static int infile_error(void *ptr, char *msg, unsigned int len)
+{
+    snprintf(msg, len, "read history buffer fail");
+    return CR_UNKNOWN_ERROR;
+}
+
 static void *on_job_init(void)
 {
-    return mysql_connect(&settings.db_history);
+    struct history_writer *w = malloc(sizeof(struct history_writer));
+    memset(w, 0, sizeof(struct history_writer));
+    w->load_data = settings.history_load_data;
+    w->conn = mysql_connect_opt(&settings.db_history, w->load_data);
+    w->buf = sdsempty();
+    return w;
+}
+
+static sds render_batch(struct history_writer *w, struct history_batch *batch)
+{
+    const struct history_table *table = &history_tables[batch->type];
+    sdsclear(w->buf);
+    for (size_t i = 0; i < batch->count; ++i) {
+        out_row_begin(w, i);
+        table->render(w, &batch->rows[i]);
+        out_row_end(w);
+    }
+
+    sds sql = sdsempty();
+    if (w->load_data) {
+        return sdscatprintf(sql, "LOAD DATA LOCAL INFILE 'history' IGNORE INTO TABLE `%s_%u` CHARACTER SET %s (%s)",
+                table->name, batch->hash, settings.db_history.charset, table->columns);
+    }
+    sql = sdscatprintf(sql, "INSERT INTO `%s_%u` (%s) VALUES ", table->name, batch->hash, table->columns);
+    return sdscatsds(sql, w->buf);
 }
 
 static void on_job(nw_job_entry *entry, void *privdata)
 {
-    MYSQL *conn = privdata;
-    sds sql = entry->request;
+    struct history_writer *w = privdata;
+    struct history_batch *batch = entry->request;
+    sds sql = render_batch(w, batch);
     log_trace("exec sql: %s", sql);
+
+    struct history_infile infile = { w->buf, sdslen(w->buf), 0 };
     while (true) {
-        int ret = mysql_real_query(conn, sql, sdslen(sql));
-        if (ret != 0 && mysql_errno(conn) != 1062) {
-            log_fatal("exec sql: %s fail: %d %s", sql, mysql_errno(conn), mysql_error(conn));
+        if (w->load_data) {
+            mysql_set_local_infile_handler(w->conn, infile_init, infile_read, infile_end, infile_error, &infile);
+        }
+        int ret = mysql_real_query(w->conn, sql, sdslen(sql));
+        if (ret != 0 && mysql_errno(w->conn) != 1062) {
+            log_fatal("exec sql: %s fail: %d %s", sql, mysql_errno(w->conn), mysql_error(w->conn));
             usleep(1000 * 1000);
             continue;
         }
         break;
     }
+    sdsfree(sql);
 }
 
 static void on_job_cleanup(nw_job_entry *entry)
 {
-    sdsfree(entry->request);
+    struct history_batch *batch = entry->request;
+    for (size_t i = 0; i < batch->count; ++i) {
+        free(batch->rows[i].detail);
+    }
+    free(batch->rows);
+    free(batch);
 }
 
 static void on_job_release(void *privdata)
 {
-    mysql_close(privdata);
+    struct history_writer *w = privdata;
+    mysql_close(w->conn);
+    sdsfree(w->buf);
+    free(w->escape);
+    free(w);
 }
 
-static void on_timer(nw_timer *t, void *privdata)
+static struct history_shard *get_shard(uint32_t hash)
+{
+    return &shards[hash % shard_num];
+}
+
+static void flush_batch(dict_entry *entry)
+{
+    struct history_batch *batch = entry->val;
+    nw_job_add(get_shard(batch->hash)->job, 0, batch);
+    dict_delete(dict_sql, entry->key);
+}
+
+/*
+ * when a writer falls behind the batches of its shard grow, so a statement
+ * carries more rows and the queue is drained faster, they shrink again when
+ * it is empty. with a backlog, only the batches that are waited too long
+ * are sent.
+ */
+static void flush_history(bool all)
 {
+    for (int i = 0; i < shard_num; ++i) {
+        struct history_shard *shard = &shards[i];
+        if (shard->job->request_count > 1) {
+            if (shard->flush_rows < HISTORY_FLUSH_MAX)
+                shard->flush_rows *= 2;
+        } else if (shard->job->request_count == 0) {
+            if (shard->flush_rows > HISTORY_FLUSH_MIN)
+                shard->flush_rows /= 2;
+        }
+    }
+
     size_t count = 0;
+    double now = current_timestamp();
     dict_iterator *iter = dict_get_iterator(dict_sql);
     dict_entry *entry;
     while ((entry = dict_next(iter)) != NULL) {
-        nw_job_add(job, 0, entry->val);
-        dict_delete(dict_sql, entry->key);
+        struct history_batch *batch = entry->val;
+        if (!all && get_shard(batch->hash)->job->request_count > 0 && now - batch->create_time < HISTORY_FLUSH_DELAY)
+            continue;
+        flush_batch(entry);
         count++;
     }
     dict_release_iterator(iter);
@@ -96,14 +425,13 @@ static void on_timer(nw_timer *t, void *privdata)
     }
 }
 
-int init_history(void)
+static void on_timer(nw_timer *t, void *privdata)
 {
-    mysql_conn = mysql_init(NULL);
-    if (mysql_conn == NULL)
-        return -__LINE__;
-    if (mysql_options(mysql_conn, MYSQL_SET_CHARSET_NAME, settings.db_history.charset) != 0)
-        return -__LINE__;
+    flush_history(false);
+}
 
+int init_history(void)
+{
     dict_types dt;
     memset(&dt, 0, sizeof(dt));
     dt.hash_function  = dict_sql_hash_function;
@@ -123,9 +451,18 @@ int init_history(void)
     jt.on_cleanup = on_job_cleanup;
     jt.on_release = on_job_release;
 
-    job = nw_job_create(&jt, settings.history_thread);
-    if (job == NULL)
+    shard_num = settings.history_thread;
+    if (shard_num <= 0 || shard_num > HISTORY_HASH_NUM)
+        return -__LINE__;
+    shards = malloc(sizeof(struct history_shard) * shard_num);
+    if (shards == NULL)
         return -__LINE__;
+    for (int i = 0; i < shard_num; ++i) {
+        shards[i].job = nw_job_create(&jt, 1);
+        if (shards[i].job == NULL)
+            return -__LINE__;
+        shards[i].flush_rows = HISTORY_FLUSH_MIN;
+    }
 
     nw_timer_set(&timer, 0.1, true, on_timer, NULL);
     nw_timer_start(&timer);
@@ -135,232 +472,228 @@ int init_history(void)
 
 int fini_history(void)
 {
-    on_timer(NULL, NULL);
+    flush_history(true);
 
     usleep(100 * 1000);
-    nw_job_release(job);
+    for (int i = 0; i < shard_num; ++i) {
+        nw_job_release(shards[i].job);
+    }
 
     return 0;
 }
 
-static sds sql_append_mpd(sds sql, mpd_t *val, bool comma)
+static struct history_row *append_row(uint32_t type, uint32_t hash)
 {
-    char *str = mpd_to_sci(val, 0);
-    sql = sdscatprintf(sql, "'%s'", str);
-    if (comma) {
-        sql = sdscatprintf(sql, ", ");
+    struct dict_sql_key key;
+    key.type = type;
+    key.hash = hash;
+
+    /* a batch is sent when the next row comes, the rows are filled by the caller */
+    dict_entry *entry = dict_find(dict_sql, &key);
+    if (entry && ((struct history_batch *)entry->val)->count >= get_shard(hash)->flush_rows) {
+        flush_batch(entry);
+        entry = NULL;
     }
-    free(str);
-    return sql;
-}
-
-static sds get_sql(struct dict_sql_key *key)
-{
-    dict_entry *entry = dict_find(dict_sql, key);
     if (!entry) {
-        sds val = sdsempty();
-        entry = dict_add(dict_sql, key, val);
+        struct history_batch *batch = malloc(sizeof(struct history_batch));
+        if (batch == NULL)
+            return NULL;
+        memset(batch, 0, sizeof(struct history_batch));
+        batch->type = type;
+        batch->hash = hash;
+        batch->create_time = current_timestamp();
+        entry = dict_add(dict_sql, &key, batch);
         if (entry == NULL) {
-            sdsfree(val);
+            free(batch);
             return NULL;
         }
     }
-    return entry->val;
+
+    struct history_batch *batch = entry->val;
+    if (batch->count == batch->size) {
+        size_t size = batch->size ? batch->size * 2 : 16;
+        struct history_row *rows = realloc(batch->rows, sizeof(struct history_row) * size);
+        if (rows == NULL)
+            return NULL;
+        batch->rows = rows;
+        batch->size = size;
+    }
+
+    struct history_row *row = &batch->rows[batch->count++];
+    memset(row, 0, sizeof(struct history_row));
+
+    return row;
 }
 
-static void set_sql(struct dict_sql_key *key, sds sql)
+static void set_order_row(struct history_row *row, market_t *m, order_t *order)
 {
-    dict_entry *entry = dict_find(dict_sql, key);
-    if (entry) {
-        entry->val = sql;
-    }
+    row->id = order->id;
+    row->time = order->create_time;
+    row->finish_time = order->update_time;
+    row->user_id = order->user_id;
+    row->market = m->name;
+    sstrncpy(row->source, order->source, sizeof(row->source));
+    row->type = order->type;
+    row->side = order->side;
+    row->value[0] = order->price;
+    row->prec[0]  = order_price_prec(m, order);
+    row->value[1] = order->amount;
+    row->prec[1]  = m->stock_prec;
+    row->value[2] = order->taker_fee;
+    row->prec[2]  = m->fee_prec;
+    row->value[3] = order->maker_fee;
+    row->prec[3]  = order_maker_fee_prec(m, order);
+    row->value[4] = order->deal_stock;
+    row->prec[4]  = order_deal_stock_prec(m, order);
+    row->value[5] = order->deal_money;
+    row->prec[5]  = order_deal_money_prec(m, order);
+    row->value[6] = order->deal_fee;
+    row->prec[6]  = order_deal_fee_prec(m, order);
 }
 
-static int append_user_order(order_t *order)
+static int append_user_order(market_t *m, order_t *order)
 {
-    struct dict_sql_key key;
-    key.hash = order->user_id % HISTORY_HASH_NUM;
-    key.type = HISTORY_USER_ORDER;
-    sds sql = get_sql(&key);
-    if (sql == NULL)
+    struct history_row *row = append_row(HISTORY_USER_ORDER, order->user_id % HISTORY_HASH_NUM);
+    if (row == NULL)
         return -__LINE__;
-
-    if (sdslen(sql) == 0) {
-        sql = sdscatprintf(sql, "INSERT INTO `order_history_%u` (`id`, `create_time`, `finish_time`, `user_id`, "
-                "`market`, `source`, `t`, `side`, `price`, `amount`, `taker_fee`, `maker_fee`, `deal_stock`, `deal_money`, `deal_fee`) VALUES ", key.hash);
-    } else {
-        sql = sdscatprintf(sql, ", ");
-    }
-
-    sql = sdscatprintf(sql, "(%"PRIu64", %f, %f, %u, '%s', '%s', %u, %u, ", order->id,
-        order->create_time, order->update_time, order->user_id, order->market, order->source, order->type, order->side);
-    sql = sql_append_mpd(sql, order->price, true);
-    sql = sql_append_mpd(sql, order->amount, true);
-    sql = sql_append_mpd(sql, order->taker_fee, true);
-    sql = sql_append_mpd(sql, order->maker_fee, true);
-    sql = sql_append_mpd(sql, order->deal_stock, true);
-    sql = sql_append_mpd(sql, order->deal_money, true);
-    sql = sql_append_mpd(sql, order->deal_fee, false);
-    sql = sdscatprintf(sql, ")");
-
-    set_sql(&key, sql);
+    set_order_row(row, m, order);
 
     return 0;
 }
 
-static int append_order_detail(order_t *order)
+static int append_order_detail(market_t *m, order_t *order)
 {
-    struct dict_sql_key key;
-    key.hash = order->id % HISTORY_HASH_NUM;
-    key.type = HISTORY_ORDER_DETAIL;
-    sds sql = get_sql(&key);
-    if (sql == NULL)
+    struct history_row *row = append_row(HISTORY_ORDER_DETAIL, order->id % HISTORY_HASH_NUM);
+    if (row == NULL)
         return -__LINE__;
-
-    if (sdslen(sql) == 0) {
-        sql = sdscatprintf(sql, "INSERT INTO `order_detail_%u` (`id`, `create_time`, `finish_time`, `user_id`, "
-                "`market`, `source`, `t`, `side`, `price`, `amount`, `taker_fee`, `maker_fee`, `deal_stock`, `deal_money`, `deal_fee`) VALUES ", key.hash);
-    } else {
-        sql = sdscatprintf(sql, ", ");
-    }
-
-    sql = sdscatprintf(sql, "(%"PRIu64", %f, %f, %u, '%s', '%s', %u, %u, ", order->id,
-        order->create_time, order->update_time, order->user_id, order->market, order->source, order->type, order->side);
-    sql = sql_append_mpd(sql, order->price, true);
-    sql = sql_append_mpd(sql, order->amount, true);
-    sql = sql_append_mpd(sql, order->taker_fee, true);
-    sql = sql_append_mpd(sql, order->maker_fee, true);
-    sql = sql_append_mpd(sql, order->deal_stock, true);
-    sql = sql_append_mpd(sql, order->deal_money, true);
-    sql = sql_append_mpd(sql, order->deal_fee, false);
-    sql = sdscatprintf(sql, ")");
-
-    set_sql(&key, sql);
+    set_order_row(row, m, order);
 
     return 0;
 }
 
-static int append_order_deal(double t, uint32_t user_id, uint64_t deal_id, uint64_t order_id, uint64_t deal_order_id, int role, mpd_t *price, mpd_t *amount, mpd_t *deal, mpd_t *fee, mpd_t *deal_fee)
+static void set_deal_row(struct history_row *row, market_t *m, fixed_t price, fixed_t amount, fixed_t deal,
+        fixed_t fee, int fee_prec, fixed_t deal_fee, int deal_fee_prec)
 {
-    struct dict_sql_key key;
-    key.hash = order_id % HISTORY_HASH_NUM;
-    key.type = HISTORY_ORDER_DEAL;
-    sds sql = get_sql(&key);
-    if (sql == NULL)
-        return -__LINE__;
-
-    if (sdslen(sql) == 0) {
-        sql = sdscatprintf(sql, "INSERT INTO `order_deal_history_%u` (`id`, `time`, `user_id`, `deal_id`, `order_id`, `deal_order_id`, `role`, `price`, `amount`, `deal`, `fee`, `deal_fee`) VALUES ", key.hash);
-    } else {
-        sql = sdscatprintf(sql, ", ");
-    }
+    row->value[0] = price;
+    row->prec[0]  = m->money_prec;
+    row->value[1] = amount;
+    row->prec[1]  = m->stock_prec;
+    row->value[2] = deal;
+    row->prec[2]  = m->stock_prec + m->money_prec;
+    row->value[3] = fee;
+    row->prec[3]  = fee_prec;
+    row->value[4] = deal_fee;
+    row->prec[4]  = deal_fee_prec;
+}
 
-    sql = sdscatprintf(sql, "(NULL, %f, %u, %"PRIu64", %"PRIu64", %"PRIu64", %d, ", t, user_id, deal_id, order_id, deal_order_id, role);
-    sql = sql_append_mpd(sql, price, true);
-    sql = sql_append_mpd(sql, amount, true);
-    sql = sql_append_mpd(sql, deal, true);
-    sql = sql_append_mpd(sql, fee, true);
-    sql = sql_append_mpd(sql, deal_fee, false);
-    sql = sdscatprintf(sql, ")");
+static int append_order_deal(double t, market_t *m, uint32_t user_id, uint64_t deal_id, uint64_t order_id, uint64_t deal_order_id, int role,
+        fixed_t price, fixed_t amount, fixed_t deal, fixed_t fee, int fee_prec, fixed_t deal_fee, int deal_fee_prec)
+{
+    struct history_row *row = append_row(HISTORY_ORDER_DEAL, order_id % HISTORY_HASH_NUM);
+    if (row == NULL)
+        return -__LINE__;
 
-    set_sql(&key, sql);
+    row->time = t;
+    row->user_id = user_id;
+    row->id = deal_id;
+    row->order_id = order_id;
+    row->deal_order_id = deal_order_id;
+    row->role = role;
+    set_deal_row(row, m, price, amount, deal, fee, fee_prec, deal_fee, deal_fee_prec);
 
     return 0;
 }
 
-static int append_user_deal(double t, uint32_t user_id, const char *market, uint64_t deal_id, uint64_t order_id, uint64_t deal_order_id, int side, int role, mpd_t *price, mpd_t *amount, mpd_t *deal, mpd_t *fee, mpd_t *deal_fee)
+static int append_user_deal(double t, market_t *m, uint32_t user_id, uint64_t deal_id, uint64_t order_id, uint64_t deal_order_id, int side, int role,
+        fixed_t price, fixed_t amount, fixed_t deal, fixed_t fee, int fee_prec, fixed_t deal_fee, int deal_fee_prec)
 {
-    struct dict_sql_key key;
-    key.hash = user_id % HISTORY_HASH_NUM;
-    key.type = HISTORY_USER_DEAL;
-    sds sql = get_sql(&key);
-    if (sql == NULL)
+    struct history_row *row = append_row(HISTORY_USER_DEAL, user_id % HISTORY_HASH_NUM);
+    if (row == NULL)
         return -__LINE__;
 
-    if (sdslen(sql) == 0) {
-        sql = sdscatprintf(sql, "INSERT INTO `user_deal_history_%u` (`id`, `time`, `user_id`, `market`, `deal_id`, `order_id`, `deal_order_id`, `side`, `role`, `price`, `amount`, `deal`, `fee`, `deal_fee`) VALUES ", key.hash);
-    } else {
-        sql = sdscatprintf(sql, ", ");
-    }
-
-    sql = sdscatprintf(sql, "(NULL, %f, %u, '%s', %"PRIu64", %"PRIu64", %"PRIu64", %d, %d, ", t, user_id, market, deal_id, order_id, deal_order_id, side, role);
-    sql = sql_append_mpd(sql, price, true);
-    sql = sql_append_mpd(sql, amount, true);
-    sql = sql_append_mpd(sql, deal, true);
-    sql = sql_append_mpd(sql, fee, true);
-    sql = sql_append_mpd(sql, deal_fee, false);
-    sql = sdscatprintf(sql, ")");
-
-    set_sql(&key, sql);
+    row->time = t;
+    row->user_id = user_id;
+    row->market = m->name;
+    row->id = deal_id;
+    row->order_id = order_id;
+    row->deal_order_id = deal_order_id;
+    row->side = side;
+    row->role = role;
+    set_deal_row(row, m, price, amount, deal, fee, fee_prec, deal_fee, deal_fee_prec);
 
     return 0;
 }
 
-static int append_user_balance(double t, uint32_t user_id, const char *asset, const char *business, mpd_t *change, mpd_t *balance, const char *detail)
+static int append_user_balance(double t, uint32_t user_id, int asset_id, const char *business, fixed_t change, int change_prec, fixed_t balance, int balance_prec, const char *detail)
 {
-    struct dict_sql_key key;
-    key.hash = user_id % HISTORY_HASH_NUM;
-    key.type = HISTORY_USER_BALANCE;
-    sds sql = get_sql(&key);
-    if (sql == NULL)
+    struct history_row *row = append_row(HISTORY_USER_BALANCE, user_id % HISTORY_HASH_NUM);
+    if (row == NULL)
         return -__LINE__;
 
-    if (sdslen(sql) == 0) {
-        sql = sdscatprintf(sql, "INSERT INTO `balance_history_%u` (`id`, `time`, `user_id`, `asset`, `business`, `change`, `balance`, `detail`) VALUES ", key.hash);
-    } else {
-        sql = sdscatprintf(sql, ", ");
-    }
-
-    char buf[10 * 1024];
-    sql = sdscatprintf(sql, "(NULL, %f, %u, '%s', '%s', ", t, user_id, asset, business);
-    sql = sql_append_mpd(sql, change, true);
-    sql = sql_append_mpd(sql, balance, true);
-    mysql_real_escape_string(mysql_conn, buf, detail, strlen(detail));
-    sql = sdscatprintf(sql, "'%s')", buf);
-
-    set_sql(&key, sql);
+    row->time = t;
+    row->user_id = user_id;
+    row->asset = settings.assets[asset_id].name;
+    sstrncpy(row->business, business, sizeof(row->business));
+    row->value[0] = change;
+    row->prec[0]  = change_prec;
+    row->value[1] = balance;
+    row->prec[1]  = balance_prec;
+    row->detail = strdup(detail);
+    if (row->detail == NULL)
+        return -__LINE__;
 
     return 0;
 }
 
-int append_order_history(order_t *order)
+int append_order_history(market_t *m, order_t *order)
 {
-    append_user_order(order);
-    append_order_detail(order);
+    append_user_order(m, order);
+    append_order_detail(m, order);
 
     return 0;
 }
 
-int append_order_deal_history(double t, uint64_t deal_id, order_t *ask, int ask_role, order_t *bid, int bid_role, mpd_t *price, mpd_t *amount, mpd_t *deal, mpd_t *ask_fee, mpd_t *bid_fee)
+int append_order_deal_history(double t, uint64_t deal_id, market_t *m, order_t *ask, int ask_role, order_t *bid, int bid_role,
+        fixed_t price, fixed_t amount, fixed_t deal, fixed_t ask_fee, fixed_t bid_fee)
 {
-    append_order_deal(t, ask->user_id, deal_id, ask->id, bid->id, ask_role, price, amount, deal, ask_fee, bid_fee);
-    append_order_deal(t, bid->user_id, deal_id, bid->id, ask->id, bid_role, price, amount, deal, bid_fee, ask_fee);
+    int ask_fee_prec = m->stock_prec + m->money_prec + m->fee_prec;
+    int bid_fee_prec = m->stock_prec + m->fee_prec;
 
-    append_user_deal(t, ask->user_id, ask->market, deal_id, ask->id, bid->id, ask->side, ask_role, price, amount, deal, ask_fee, bid_fee);
-    append_user_deal(t, bid->user_id, ask->market, deal_id, bid->id, ask->id, bid->side, bid_role, price, amount, deal, bid_fee, ask_fee);
+    append_order_deal(t, m, ask->user_id, deal_id, ask->id, bid->id, ask_role, price, amount, deal, ask_fee, ask_fee_prec, bid_fee, bid_fee_prec);
+    append_order_deal(t, m, bid->user_id, deal_id, bid->id, ask->id, bid_role, price, amount, deal, bid_fee, bid_fee_prec, ask_fee, ask_fee_prec);
+
+    append_user_deal(t, m, ask->user_id, deal_id, ask->id, bid->id, ask->side, ask_role, price, amount, deal, ask_fee, ask_fee_prec, bid_fee, bid_fee_prec);
+    append_user_deal(t, m, bid->user_id, deal_id, bid->id, ask->id, bid->side, bid_role, price, amount, deal, bid_fee, bid_fee_prec, ask_fee, ask_fee_prec);
 
     return 0;
 }
 
-int append_user_balance_history(double t, uint32_t user_id, const char *asset, const char *business, mpd_t *change, const char *detail)
+int append_user_balance_history(double t, uint32_t user_id, int asset_id, const char *business, fixed_t change, int change_prec, const char *detail)
 {
-    mpd_t *balance = balance_total(user_id, asset);
-    append_user_balance(t, user_id, asset, business, change, balance, detail);
-    mpd_del(balance);
+    fixed_t balance = balance_total(user_id, asset_id);
+    append_user_balance(t, user_id, asset_id, business, change, change_prec, balance, balance ? settings.assets[asset_id].prec_save : 0, detail);
 
     return 0;
 }
 
-bool is_history_block(void)
+double history_pressure(void)
 {
-    if (job->request_count >= MAX_PENDING_HISTORY) {
-        return true;
+    int pending = 0;
+    for (int i = 0; i < shard_num; ++i) {
+        pending += shards[i].job->request_count;
     }
-    return false;
+    return (double)pending / MAX_PENDING_HISTORY;
 }
 
 sds history_status(sds reply)
 {
-    return sdscatprintf(reply, "history pending %d\n", job->request_count);
+    int pending = 0;
+    for (int i = 0; i < shard_num; ++i) {
+        pending += shards[i].job->request_count;
+        reply = sdscatprintf(reply, "history shard %d pending: %d, flush rows: %zu\n",
+                i, shards[i].job->request_count, shards[i].flush_rows);
+    }
+    reply = sdscatprintf(reply, "history pending %d\n", pending);
+    return reply;
 }
 
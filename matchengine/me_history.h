@@ -11,11 +11,13 @@
 int init_history(void);
 int fini_history(void);
 
-int append_order_history(order_t *order);
-int append_order_deal_history(double t, uint64_t deal_id, order_t *ask, int ask_role, order_t *bid, int bid_role, mpd_t *price, mpd_t *amount, mpd_t *deal, mpd_t *ask_fee, mpd_t *bid_fee);
-int append_user_balance_history(double t, uint32_t user_id, const char *asset, const char *business, mpd_t *change, const char *detail);
+int append_order_history(market_t *m, order_t *order);
+int append_order_deal_history(double t, uint64_t deal_id, market_t *m, order_t *ask, int ask_role, order_t *bid, int bid_role,
+        fixed_t price, fixed_t amount, fixed_t deal, fixed_t ask_fee, fixed_t bid_fee);
+int append_user_balance_history(double t, uint32_t user_id, int asset_id, const char *business, fixed_t change, int change_prec, const char *detail);
 
-bool is_history_block(void);
+/* pending requests relative to MAX_PENDING_HISTORY, see me_admission */
+double history_pressure(void);
 sds history_status(sds reply);
 
 # endif
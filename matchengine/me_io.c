@@ -0,0 +1,441 @@
+/*
+ * Description: network io thread of the server
+ */
+
+# include "me_io.h"
+# include "ut_ring.h"
+
+# include <pthread.h>
+
+# ifndef IO_RING_SIZE
+# define IO_RING_SIZE       65536
+# endif
+
+enum {
+    IO_MSG_REQUEST = 1,
+    IO_MSG_CLOSE,
+    IO_MSG_REPLY,
+    IO_MSG_PUSH,
+};
+
+/* the body and ext of pkg are owned by the message */
+struct io_msg {
+    int             type;
+    nw_ses          *ses;
+    uint64_t        ses_id;
+    /* of a request, the main thread does not read the session */
+    nw_addr_t       peer_addr;
+    rpc_pkg         pkg;
+    /* the params of a request, or the reply to encode */
+    json_t          *json;
+    struct io_msg   *next;
+};
+
+static io_handler handler;
+static rpc_svr *svr;
+static struct ev_loop *io_loop;
+static pthread_t io_thread;
+static bool io_stop;
+
+/* requests to the main thread, replies to the io thread */
+static ring_t *request_ring;
+static ring_t *reply_ring;
+static ev_async request_notify;
+static ev_async reply_notify;
+
+/*
+ * neither thread waits for the other: what does not fit in a ring is kept
+ * in order, requests in the inbox of the io thread and replies in the
+ * outbox of the main thread, and the blocked flag of the ring is set. the
+ * side that pops the ring wakes the other when the flag is set, and what
+ * was kept is pushed then.
+ */
+static struct io_msg *inbox_head;
+static struct io_msg *inbox_tail;
+static bool request_blocked;
+
+static struct io_msg *outbox_head;
+static struct io_msg *outbox_tail;
+static bool reply_blocked;
+
+static uint64_t request_total;
+static uint64_t reply_total;
+static uint64_t request_full_total;
+static uint64_t reply_full_total;
+
+static int send_binary(nw_ses *ses, rpc_pkg *pkg, const json_t *json)
+{
+    static void *reply_buf;
+    static size_t reply_buf_size;
+
+    void *p = reply_buf;
+    size_t left = reply_buf_size;
+    while (reply_buf == NULL || pack_json(&p, &left, json) < 0) {
+        size_t new_size = reply_buf_size ? reply_buf_size * 2 : 64 * 1024;
+        if (new_size > settings.svr.max_pkg_size)
+            return -__LINE__;
+        void *new_buf = realloc(reply_buf, new_size);
+        if (new_buf == NULL)
+            return -__LINE__;
+        reply_buf = new_buf;
+        reply_buf_size = new_size;
+        p = reply_buf;
+        left = reply_buf_size;
+    }
+
+    rpc_pkg reply;
+    memcpy(&reply, pkg, sizeof(reply));
+    reply.pkg_type = RPC_PKG_TYPE_REPLY | RPC_PKG_FLAG_BINARY;
+    reply.body = reply_buf;
+    reply.body_size = reply_buf_size - left;
+    rpc_send(ses, &reply);
+
+    return 0;
+}
+
+int send_json(nw_ses *ses, rpc_pkg *pkg, const json_t *json)
+{
+    if (pkg->pkg_type & RPC_PKG_FLAG_BINARY)
+        return send_binary(ses, pkg, json);
+
+    char *message_data;
+    if (settings.debug) {
+        message_data = json_dumps(json, JSON_INDENT(4));
+    } else {
+        message_data = json_dumps(json, 0);
+    }
+    if (message_data == NULL)
+        return -__LINE__;
+    log_trace("connection: %s send: %s", nw_sock_human_addr(&ses->peer_addr), message_data);
+
+    rpc_pkg reply;
+    memcpy(&reply, pkg, sizeof(reply));
+    reply.pkg_type = RPC_PKG_TYPE_REPLY;
+    reply.body = message_data;
+    reply.body_size = strlen(message_data);
+    rpc_send(ses, &reply);
+    free(message_data);
+
+    return 0;
+}
+
+json_t *decode_pkg_params(rpc_svr *svr, nw_ses *ses, rpc_pkg *pkg)
+{
+    json_t *params = NULL;
+    if (pkg->pkg_type & RPC_PKG_FLAG_BINARY) {
+        void *p = pkg->body;
+        size_t left = pkg->body_size;
+        if (unpack_json(&p, &left, &params) < 0 || left != 0 || !json_is_array(params)) {
+            goto decode_error;
+        }
+    } else {
+        params = json_loadb(pkg->body, pkg->body_size, 0, NULL);
+        if (params == NULL || !json_is_array(params)) {
+            goto decode_error;
+        }
+    }
+
+    return params;
+
+decode_error:
+    if (params) {
+        json_decref(params);
+    }
+    sds hex = hexdump(pkg->body, pkg->body_size);
+    log_error("connection: %s, cmd: %u decode params fail, params data: \n%s", \
+            nw_sock_human_addr(&ses->peer_addr), pkg->command, hex);
+    sdsfree(hex);
+    rpc_svr_close_clt(svr, ses);
+
+    return NULL;
+}
+
+static void *copy_data(const void *data, size_t size)
+{
+    if (size == 0)
+        return NULL;
+    void *copy = malloc(size);
+    if (copy == NULL)
+        return NULL;
+    memcpy(copy, data, size);
+    return copy;
+}
+
+static struct io_msg *create_msg(int type, nw_ses *ses, uint64_t ses_id, rpc_pkg *pkg, bool with_body)
+{
+    struct io_msg *msg = malloc(sizeof(struct io_msg));
+    if (msg == NULL)
+        return NULL;
+    memset(msg, 0, sizeof(struct io_msg));
+    msg->type = type;
+    msg->ses = ses;
+    msg->ses_id = ses_id;
+    if (pkg == NULL)
+        return msg;
+
+    memcpy(&msg->pkg, pkg, sizeof(rpc_pkg));
+    msg->pkg.ext = copy_data(pkg->ext, pkg->ext_size);
+    msg->pkg.body = with_body ? copy_data(pkg->body, pkg->body_size) : NULL;
+    if ((pkg->ext_size && msg->pkg.ext == NULL) || (with_body && pkg->body_size && msg->pkg.body == NULL)) {
+        free(msg->pkg.ext);
+        free(msg->pkg.body);
+        free(msg);
+        return NULL;
+    }
+    if (!with_body) {
+        msg->pkg.body_size = 0;
+    }
+
+    return msg;
+}
+
+static void free_msg(struct io_msg *msg)
+{
+    if (msg->json) {
+        json_decref(msg->json);
+    }
+    free(msg->pkg.ext);
+    free(msg->pkg.body);
+    free(msg);
+}
+
+static void add_msg(struct io_msg **head, struct io_msg **tail, struct io_msg *msg)
+{
+    if (*tail) {
+        (*tail)->next = msg;
+    } else {
+        *head = msg;
+    }
+    *tail = msg;
+}
+
+// push the kept messages in order, until the ring is full and the popping side is to wake this one
+static void push_msgs(ring_t *ring, struct io_msg **head, struct io_msg **tail, bool *blocked, uint64_t *full, uint64_t *total)
+{
+    while (*head) {
+        // the message is the other side's once it is pushed, it is taken off the list before
+        struct io_msg *msg = *head;
+        struct io_msg *next = msg->next;
+        msg->next = NULL;
+        if (!ring_push(ring, msg)) {
+            // the flag is seen by the pop that makes room, or this push sees the room
+            __atomic_store_n(blocked, true, __ATOMIC_SEQ_CST);
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            if (!ring_push(ring, msg)) {
+                msg->next = next;
+                __atomic_add_fetch(full, 1, __ATOMIC_RELAXED);
+                return;
+            }
+        }
+        *head = next;
+        if (total) {
+            *total += 1;
+        }
+    }
+    *tail = NULL;
+}
+
+// after popping, wake the pushing side if it has messages kept
+static void wake_blocked(bool *blocked, struct ev_loop *loop, ev_async *notify)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(blocked, __ATOMIC_SEQ_CST) && __atomic_exchange_n(blocked, false, __ATOMIC_SEQ_CST)) {
+        ev_async_send(loop, notify);
+    }
+}
+
+// io thread
+static void send_requests(void)
+{
+    if (inbox_head == NULL)
+        return;
+    push_msgs(request_ring, &inbox_head, &inbox_tail, &request_blocked, &request_full_total, NULL);
+    ev_async_send(nw_default_loop, &request_notify);
+}
+
+static void on_recv_pkg(nw_ses *ses, rpc_pkg *pkg)
+{
+    json_t *params = decode_pkg_params(svr, ses, pkg);
+    if (params == NULL)
+        return;
+
+    struct io_msg *msg = create_msg(IO_MSG_REQUEST, ses, ses->id, pkg, true);
+    if (msg == NULL) {
+        log_fatal("create request of connection: %s fail", nw_sock_human_addr(&ses->peer_addr));
+        json_decref(params);
+        return;
+    }
+    msg->json = params;
+    msg->peer_addr = ses->peer_addr;
+    add_msg(&inbox_head, &inbox_tail, msg);
+    send_requests();
+}
+
+static void on_new_connection(nw_ses *ses)
+{
+    log_trace("new connection: %s", nw_sock_human_addr(&ses->peer_addr));
+}
+
+static void on_connection_close(nw_ses *ses)
+{
+    log_trace("connection: %s close", nw_sock_human_addr(&ses->peer_addr));
+    struct io_msg *msg = create_msg(IO_MSG_CLOSE, ses, ses->id, NULL, false);
+    if (msg == NULL) {
+        log_fatal("create close of connection: %s fail", nw_sock_human_addr(&ses->peer_addr));
+        return;
+    }
+    add_msg(&inbox_head, &inbox_tail, msg);
+    send_requests();
+}
+
+// io thread, write the replies to the connections still open
+static void on_reply_notify(struct ev_loop *loop, ev_async *watcher, int events)
+{
+    struct io_msg *msg;
+    while ((msg = ring_pop(reply_ring)) != NULL) {
+        if (msg->ses->id == msg->ses_id) {
+            if (msg->type == IO_MSG_REPLY) {
+                send_json(msg->ses, &msg->pkg, msg->json);
+            } else {
+                rpc_send(msg->ses, &msg->pkg);
+            }
+        }
+        free_msg(msg);
+    }
+    wake_blocked(&reply_blocked, nw_default_loop, &request_notify);
+    send_requests();
+
+    if (__atomic_load_n(&io_stop, __ATOMIC_ACQUIRE)) {
+        ev_break(loop, EVBREAK_ALL);
+    }
+}
+
+// main thread, a ring at most each time so that the timers are not starved
+static void on_request_notify(struct ev_loop *loop, ev_async *watcher, int events)
+{
+    for (size_t i = 0; i < IO_RING_SIZE; ++i) {
+        struct io_msg *msg = ring_pop(request_ring);
+        if (msg == NULL)
+            break;
+        if (msg->type == IO_MSG_REQUEST) {
+            request_total += 1;
+            handler.on_request(msg->ses, msg->ses_id, &msg->peer_addr, &msg->pkg, msg->json);
+        } else {
+            handler.on_close(msg->ses, msg->ses_id);
+        }
+        free_msg(msg);
+    }
+    if (ring_size(request_ring) > 0) {
+        ev_async_send(loop, watcher);
+    }
+    wake_blocked(&request_blocked, io_loop, &reply_notify);
+
+    io_flush();
+}
+
+static void *io_thread_routine(void *arg)
+{
+    ev_run(io_loop, 0);
+    return NULL;
+}
+
+bool io_enabled(void)
+{
+    return settings.io_thread;
+}
+
+int io_reply(nw_ses *ses, uint64_t ses_id, rpc_pkg *pkg, const json_t *json)
+{
+    struct io_msg *msg = create_msg(IO_MSG_REPLY, ses, ses_id, pkg, false);
+    if (msg == NULL)
+        return -__LINE__;
+    msg->json = json_incref((json_t *)json);
+    add_msg(&outbox_head, &outbox_tail, msg);
+
+    return 0;
+}
+
+int io_push(nw_ses *ses, uint64_t ses_id, rpc_pkg *pkg)
+{
+    struct io_msg *msg = create_msg(IO_MSG_PUSH, ses, ses_id, pkg, true);
+    if (msg == NULL)
+        return -__LINE__;
+    add_msg(&outbox_head, &outbox_tail, msg);
+
+    return 0;
+}
+
+void io_flush(void)
+{
+    if (outbox_head == NULL)
+        return;
+    push_msgs(reply_ring, &outbox_head, &outbox_tail, &reply_blocked, &reply_full_total, &reply_total);
+    ev_async_send(io_loop, &reply_notify);
+}
+
+int init_io(io_handler *h)
+{
+    handler = *h;
+
+    request_ring = ring_create(IO_RING_SIZE);
+    if (request_ring == NULL)
+        return -__LINE__;
+    reply_ring = ring_create(IO_RING_SIZE);
+    if (reply_ring == NULL)
+        return -__LINE__;
+
+    io_loop = ev_loop_new(EVFLAG_AUTO | EVFLAG_NOENV);
+    if (io_loop == NULL)
+        return -__LINE__;
+    ev_async_init(&request_notify, on_request_notify);
+    ev_async_start(nw_default_loop, &request_notify);
+    ev_async_init(&reply_notify, on_reply_notify);
+    ev_async_start(io_loop, &reply_notify);
+
+    rpc_svr_type type;
+    memset(&type, 0, sizeof(type));
+    type.on_recv_pkg = on_recv_pkg;
+    type.on_new_connection = on_new_connection;
+    type.on_connection_close = on_connection_close;
+
+    svr = rpc_svr_create(&settings.svr, &type);
+    if (svr == NULL)
+        return -__LINE__;
+    rpc_svr_set_loop(svr, io_loop);
+    if (rpc_svr_start(svr) < 0)
+        return -__LINE__;
+
+    // the server is only used by the io thread from now on
+    if (pthread_create(&io_thread, NULL, io_thread_routine, NULL) != 0)
+        return -__LINE__;
+
+    return 0;
+}
+
+int fini_io(void)
+{
+    if (!io_enabled())
+        return 0;
+
+    // the io thread drains the replies on its own, the main loop does not run any more
+    io_flush();
+    while (outbox_head) {
+        usleep(1000);
+        io_flush();
+    }
+    __atomic_store_n(&io_stop, true, __ATOMIC_RELEASE);
+    ev_async_send(io_loop, &reply_notify);
+    pthread_join(io_thread, NULL);
+
+    return 0;
+}
+
+sds io_status(sds reply)
+{
+    if (!io_enabled())
+        return reply;
+    reply = sdscatprintf(reply, "io request: %"PRIu64", reply: %"PRIu64"\n", request_total, reply_total);
+    reply = sdscatprintf(reply, "io ring full: request %"PRIu64", reply %"PRIu64"\n",
+            __atomic_load_n(&request_full_total, __ATOMIC_RELAXED), __atomic_load_n(&reply_full_total, __ATOMIC_RELAXED));
+    return reply;
+}
@@ -0,0 +1,46 @@
+/*
+ * Description: network io thread of the server
+ */
+
+# ifndef _ME_IO_H_
+# define _ME_IO_H_
+
+# include "me_config.h"
+
+/*
+ * with io_thread, the connections of the server are on a thread of their
+ * own: it reads, decodes the params and hands the requests to the main
+ * thread over a ring, the replies come back over another ring and are
+ * encoded and written there. the main thread never touches a connection,
+ * ses is only a handle with the ses_id it had, a reply to a connection
+ * that is closed since is dropped.
+ */
+typedef struct io_handler {
+    /* called on the main thread, params is freed after, peer_addr is a copy made by the io thread */
+    void (*on_request)(nw_ses *ses, uint64_t ses_id, nw_addr_t *peer_addr, rpc_pkg *pkg, json_t *params);
+    void (*on_close)(nw_ses *ses, uint64_t ses_id);
+} io_handler;
+
+int init_io(io_handler *handler);
+int fini_io(void);
+bool io_enabled(void);
+
+/* the params of the pkg, NULL and the connection is closed if they are invalid */
+json_t *decode_pkg_params(rpc_svr *svr, nw_ses *ses, rpc_pkg *pkg);
+/* encode json in the format of the request and send it */
+int send_json(nw_ses *ses, rpc_pkg *pkg, const json_t *json);
+
+/* main thread, queue a reply to encode, or a package to send */
+int io_reply(nw_ses *ses, uint64_t ses_id, rpc_pkg *pkg, const json_t *json);
+int io_push(nw_ses *ses, uint64_t ses_id, rpc_pkg *pkg);
+/*
+ * hand the queued messages to the io thread, after the command is done with
+ * them. what does not fit in the ring stays queued, it is handed over when
+ * the io thread has made room.
+ */
+void io_flush(void);
+
+sds io_status(sds reply);
+
+# endif
+
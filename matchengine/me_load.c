@@ -36,28 +36,31 @@ int load_orders(MYSQL *conn, const char *table)
             if (market == NULL)
                 continue;
 
-            order_t *order = malloc(sizeof(order_t));
-            memset(order, 0, sizeof(order_t));
+            order_t *order = market_alloc_order(market);
+            if (order == NULL) {
+                mysql_free_result(result);
+                return -__LINE__;
+            }
             order->id = strtoull(row[0], NULL, 0);
             order->type = strtoul(row[1], NULL, 0);
             order->side = strtoul(row[2], NULL, 0);
             order->create_time = strtod(row[3], NULL);
             order->update_time = strtod(row[4], NULL);
             order->user_id = strtoul(row[5], NULL, 0);
-            order->market = strdup(row[6]);
-            order->source = strdup(row[7]);
-            order->price = decimal(row[8], market->money_prec);
-            order->amount = decimal(row[9], market->stock_prec);
-            order->taker_fee = decimal(row[10], market->fee_prec);
-            order->maker_fee = decimal(row[11], market->fee_prec);
-            order->left = decimal(row[12], market->stock_prec);
-            order->frozen = decimal(row[13], 0);
-            order->deal_stock = decimal(row[14], 0);
-            order->deal_money = decimal(row[15], 0);
-            order->deal_fee = decimal(row[16], 0);
-
-            if (!order->market || !order->source || !order->price || !order->amount || !order->taker_fee || !order->maker_fee ||
-                    !order->left || !order->frozen || !order->deal_stock || !order->deal_money || !order->deal_fee) {
+            snprintf(order->source, sizeof(order->source), "%s", row[7]);
+
+            int error = 0;
+            error |= fixed_parse(row[8], market->money_prec, &order->price);
+            error |= fixed_parse(row[9], market->stock_prec, &order->amount);
+            error |= fixed_parse(row[10], market->fee_prec, &order->taker_fee);
+            error |= fixed_parse(row[11], market->fee_prec, &order->maker_fee);
+            error |= fixed_parse(row[12], market->stock_prec, &order->left);
+            error |= fixed_parse(row[13], order_frozen_prec(market, order), &order->frozen);
+            error |= fixed_parse(row[14], market->stock_prec, &order->deal_stock);
+            error |= fixed_parse(row[15], order_deal_money_prec(market, order), &order->deal_money);
+            error |= fixed_parse(row[16], order_deal_fee_prec(market, order), &order->deal_fee);
+
+            if (error) {
                 log_error("get order detail of order id: %"PRIu64" fail", order->id);
                 mysql_free_result(result);
                 return -__LINE__;
@@ -97,13 +100,19 @@ int load_balance(MYSQL *conn, const char *table)
             MYSQL_ROW row = mysql_fetch_row(result);
             last_id = strtoull(row[0], NULL, 0);
             uint32_t user_id = strtoul(row[1], NULL, 0);
-            const char *asset = row[2];
-            if (!asset_exist(asset)) {
+            int asset_id = get_asset_id(row[2]);
+            if (asset_id < 0) {
                 continue;
             }
             uint32_t type = strtoul(row[3], NULL, 0);
-            mpd_t *balance = decimal(row[4], asset_prec(asset));
-            balance_set(user_id, type, asset, balance);
+            int prec = settings.assets[asset_id].prec_save;
+            fixed_t balance;
+            if (fixed_parse(row[4], prec, &balance) < 0) {
+                log_error("get balance of id: %"PRIu64" fail", last_id);
+                mysql_free_result(result);
+                return -__LINE__;
+            }
+            balance_set(user_id, type, asset_id, balance, prec);
         }
         mysql_free_result(result);
 
@@ -127,10 +136,10 @@ static int load_update_balance(json_t *params)
     // asset
     if (!json_is_string(json_array_get(params, 1)))
         return -__LINE__;
-    const char *asset = json_string_value(json_array_get(params, 1));
-    int prec = asset_prec(asset);
-    if (prec < 0)
+    int asset_id = get_asset_id(json_string_value(json_array_get(params, 1)));
+    if (asset_id < 0)
         return 0;
+    int prec = settings.assets[asset_id].prec_save;
 
     // business
     if (!json_is_string(json_array_get(params, 2)))
@@ -145,19 +154,17 @@ static int load_update_balance(json_t *params)
     // change
     if (!json_is_string(json_array_get(params, 4)))
         return -__LINE__;
-    mpd_t *change = decimal(json_string_value(json_array_get(params, 4)), prec);
-    if (change == NULL)
+    fixed_t change;
+    if (fixed_parse(json_string_value(json_array_get(params, 4)), prec, &change) < 0)
         return -__LINE__;
 
     // detail
     json_t *detail = json_array_get(params, 5);
     if (!json_is_object(detail)) {
-        mpd_del(change);
         return -__LINE__;
     }
 
-    int ret = update_user_balance(false, user_id, asset, business, business_id, change, detail);
-    mpd_del(change);
+    int ret = update_user_balance(false, user_id, asset_id, business, business_id, change, prec, detail);
 
     if (ret < 0) {
         return -__LINE__;
@@ -191,74 +198,48 @@ static int load_limit_order(json_t *params)
     if (side != MARKET_ORDER_SIDE_ASK && side != MARKET_ORDER_SIDE_BID)
         return -__LINE__;
 
-    mpd_t *amount = NULL;
-    mpd_t *price  = NULL;
-    mpd_t *taker_fee = NULL;
-    mpd_t *maker_fee = NULL;
+    fixed_t amount, price, taker_fee, maker_fee;
 
     // amount
     if (!json_is_string(json_array_get(params, 3)))
-        goto error;
-    amount = decimal(json_string_value(json_array_get(params, 3)), market->stock_prec);
-    if (amount == NULL)
-        goto error;
-    if (mpd_cmp(amount, mpd_zero, &mpd_ctx) <= 0)
-        goto error;
+        return -__LINE__;
+    if (fixed_parse(json_string_value(json_array_get(params, 3)), market->stock_prec, &amount) < 0)
+        return -__LINE__;
+    if (amount <= 0)
+        return -__LINE__;
 
     // price 
     if (!json_is_string(json_array_get(params, 4)))
-        goto error;
-    price = decimal(json_string_value(json_array_get(params, 4)), market->money_prec);
-    if (price == NULL) 
-        goto error;
-    if (mpd_cmp(price, mpd_zero, &mpd_ctx) <= 0)
-        goto error;
+        return -__LINE__;
+    if (fixed_parse(json_string_value(json_array_get(params, 4)), market->money_prec, &price) < 0)
+        return -__LINE__;
+    if (price <= 0)
+        return -__LINE__;
 
     // taker fee
     if (!json_is_string(json_array_get(params, 5)))
-        goto error;
-    taker_fee = decimal(json_string_value(json_array_get(params, 5)), market->fee_prec);
-    if (taker_fee == NULL)
-        goto error;
-    if (mpd_cmp(taker_fee, mpd_zero, &mpd_ctx) < 0 || mpd_cmp(taker_fee, mpd_one, &mpd_ctx) >= 0)
-        goto error;
+        return -__LINE__;
+    if (fixed_parse(json_string_value(json_array_get(params, 5)), market->fee_prec, &taker_fee) < 0)
+        return -__LINE__;
+    if (taker_fee < 0 || taker_fee >= fixed_pow10[market->fee_prec])
+        return -__LINE__;
 
     // maker fee
     if (!json_is_string(json_array_get(params, 6)))
-        goto error;
-    maker_fee = decimal(json_string_value(json_array_get(params, 6)), market->fee_prec);
-    if (maker_fee == NULL)
-        goto error;
-    if (mpd_cmp(maker_fee, mpd_zero, &mpd_ctx) < 0 || mpd_cmp(maker_fee, mpd_one, &mpd_ctx) >= 0)
-        goto error;
+        return -__LINE__;
+    if (fixed_parse(json_string_value(json_array_get(params, 6)), market->fee_prec, &maker_fee) < 0)
+        return -__LINE__;
+    if (maker_fee < 0 || maker_fee >= fixed_pow10[market->fee_prec])
+        return -__LINE__;
 
     // source
     if (!json_is_string(json_array_get(params, 7)))
-        goto error;
+        return -__LINE__;
     const char *source = json_string_value(json_array_get(params, 7));
     if (strlen(source) > SOURCE_MAX_LEN)
-        goto error;
-
-    int ret = market_put_limit_order(false, NULL, market, user_id, side, amount, price, taker_fee, maker_fee, source);
-
-    mpd_del(amount);
-    mpd_del(price);
-    mpd_del(taker_fee);
-    mpd_del(maker_fee);
-
-    return ret;
-
-error:
-    if (amount)
-        mpd_del(amount);
-    if (price)
-        mpd_del(price);
-    if (taker_fee)
-        mpd_del(taker_fee);
-    if (maker_fee)
-        mpd_del(maker_fee);
+        return -__LINE__;
 
-    return -__LINE__;
+    return market_put_limit_order(false, NULL, market, user_id, side, amount, price, taker_fee, maker_fee, source);
 }
 
 static int load_market_order(json_t *params)
@@ -286,51 +267,86 @@ static int load_market_order(json_t *params)
     if (side != MARKET_ORDER_SIDE_ASK && side != MARKET_ORDER_SIDE_BID)
         return -__LINE__;
 
-    mpd_t *amount = NULL;
-    mpd_t *taker_fee = NULL;
+    fixed_t amount, taker_fee;
 
     // amount
     if (!json_is_string(json_array_get(params, 3)))
-        goto error;
-    amount = decimal(json_string_value(json_array_get(params, 3)), market->stock_prec);
-    if (amount == NULL)
-        goto error;
-    if (mpd_cmp(amount, mpd_zero, &mpd_ctx) <= 0)
-        goto error;
+        return -__LINE__;
+    if (fixed_parse(json_string_value(json_array_get(params, 3)), market->stock_prec, &amount) < 0)
+        return -__LINE__;
+    if (amount <= 0)
+        return -__LINE__;
 
     // taker fee
     if (!json_is_string(json_array_get(params, 4)))
-        goto error;
-    taker_fee = decimal(json_string_value(json_array_get(params, 4)), market->fee_prec);
-    if (taker_fee == NULL)
-        goto error;
-    if (mpd_cmp(taker_fee, mpd_zero, &mpd_ctx) < 0 || mpd_cmp(taker_fee, mpd_one, &mpd_ctx) >= 0)
-        goto error;
+        return -__LINE__;
+    if (fixed_parse(json_string_value(json_array_get(params, 4)), market->fee_prec, &taker_fee) < 0)
+        return -__LINE__;
+    if (taker_fee < 0 || taker_fee >= fixed_pow10[market->fee_prec])
+        return -__LINE__;
 
     // source
     if (!json_is_string(json_array_get(params, 5)))
-        goto error;
+        return -__LINE__;
     const char *source = json_string_value(json_array_get(params, 5));
     if (strlen(source) > SOURCE_MAX_LEN)
-        goto error;
+        return -__LINE__;
 
-    int ret = market_put_market_order(false, NULL, market, user_id, side, amount, taker_fee, source);
+    return market_put_market_order(false, NULL, market, user_id, side, amount, taker_fee, source);
+}
 
-    mpd_del(amount);
-    mpd_del(taker_fee);
+static int load_cancel_order(json_t *params)
+{
+    if (json_array_size(params) != 3)
+        return -__LINE__;
 
-    return ret;
+    // user_id
+    if (!json_is_integer(json_array_get(params, 0)))
+        return -__LINE__;
+    uint32_t user_id = json_integer_value(json_array_get(params, 0));
 
-error:
-    if (amount)
-        mpd_del(amount);
-    if (taker_fee)
-        mpd_del(taker_fee);
+    // market
+    if (!json_is_string(json_array_get(params, 1)))
+        return -__LINE__;
+    const char *market_name = json_string_value(json_array_get(params, 1));
+    market_t *market = get_market(market_name);
+    if (market == NULL)
+        return 0;
 
-    return -__LINE__;
+    // order_id
+    if (!json_is_integer(json_array_get(params, 2)))
+        return -__LINE__;
+    uint64_t order_id = json_integer_value(json_array_get(params, 2));
+
+    order_t *order = market_get_order(market, order_id);
+    if (order == NULL) {
+        return -__LINE__;
+    }
+
+    int ret = market_cancel_order(false, NULL, market, order);
+    if (ret < 0) {
+        log_error("market_cancel_order id: %"PRIu64", user id: %u, market: %s", order_id, user_id, market_name);
+        return -__LINE__;
+    }
+
+    return 0;
 }
 
-static int load_cancel_order(json_t *params)
+static int load_limit_order_batch(json_t *params)
+{
+    for (size_t i = 0; i < json_array_size(params); ++i) {
+        json_t *order_params = json_array_get(params, i);
+        if (!json_is_array(order_params))
+            return -__LINE__;
+        int ret = load_limit_order(order_params);
+        if (ret < 0)
+            return ret;
+    }
+
+    return 0;
+}
+
+static int load_cancel_order_batch(json_t *params)
 {
     if (json_array_size(params) != 3)
         return -__LINE__;
@@ -340,6 +356,83 @@ static int load_cancel_order(json_t *params)
         return -__LINE__;
     uint32_t user_id = json_integer_value(json_array_get(params, 0));
 
+    // market
+    if (!json_is_string(json_array_get(params, 1)))
+        return -__LINE__;
+    const char *market_name = json_string_value(json_array_get(params, 1));
+    market_t *market = get_market(market_name);
+    if (market == NULL)
+        return 0;
+
+    // order_ids
+    json_t *order_ids = json_array_get(params, 2);
+    if (!json_is_array(order_ids))
+        return -__LINE__;
+
+    for (size_t i = 0; i < json_array_size(order_ids); ++i) {
+        if (!json_is_integer(json_array_get(order_ids, i)))
+            return -__LINE__;
+        uint64_t order_id = json_integer_value(json_array_get(order_ids, i));
+        order_t *order = market_get_order(market, order_id);
+        if (order == NULL) {
+            return -__LINE__;
+        }
+
+        int ret = market_cancel_order(false, NULL, market, order);
+        if (ret < 0) {
+            log_error("market_cancel_order id: %"PRIu64", user id: %u, market: %s", order_id, user_id, market_name);
+            return -__LINE__;
+        }
+    }
+
+    return 0;
+}
+
+static int load_cancel_all_order(json_t *params)
+{
+    if (json_array_size(params) != 1 && json_array_size(params) != 2)
+        return -__LINE__;
+
+    // user_id
+    if (!json_is_integer(json_array_get(params, 0)))
+        return -__LINE__;
+    uint32_t user_id = json_integer_value(json_array_get(params, 0));
+
+    // market
+    market_t *market = NULL;
+    if (json_array_size(params) == 2) {
+        if (!json_is_string(json_array_get(params, 1)))
+            return -__LINE__;
+        market = get_market(json_string_value(json_array_get(params, 1)));
+        if (market == NULL)
+            return 0;
+    }
+
+    for (size_t i = 0; i < settings.market_num; ++i) {
+        market_t *m = get_market_by_id(i);
+        if (market && m != market)
+            continue;
+
+        int ret = market_cancel_all_order(false, NULL, m, user_id);
+        if (ret < 0) {
+            log_error("market_cancel_all_order user id: %u, market: %s", user_id, m->name);
+            return -__LINE__;
+        }
+    }
+
+    return 0;
+}
+
+static int load_cancel_replace_order(json_t *params)
+{
+    if (json_array_size(params) != 9)
+        return -__LINE__;
+
+    // user_id
+    if (!json_is_integer(json_array_get(params, 0)))
+        return -__LINE__;
+    uint32_t user_id = json_integer_value(json_array_get(params, 0));
+
     // market
     if (!json_is_string(json_array_get(params, 1)))
         return -__LINE__;
@@ -353,21 +446,95 @@ static int load_cancel_order(json_t *params)
         return -__LINE__;
     uint64_t order_id = json_integer_value(json_array_get(params, 2));
 
+    // side
+    if (!json_is_integer(json_array_get(params, 3)))
+        return -__LINE__;
+    uint32_t side = json_integer_value(json_array_get(params, 3));
+    if (side != MARKET_ORDER_SIDE_ASK && side != MARKET_ORDER_SIDE_BID)
+        return -__LINE__;
+
+    fixed_t amount, price, taker_fee, maker_fee;
+
+    // amount
+    if (!json_is_string(json_array_get(params, 4)))
+        return -__LINE__;
+    if (fixed_parse(json_string_value(json_array_get(params, 4)), market->stock_prec, &amount) < 0)
+        return -__LINE__;
+    if (amount <= 0)
+        return -__LINE__;
+
+    // price
+    if (!json_is_string(json_array_get(params, 5)))
+        return -__LINE__;
+    if (fixed_parse(json_string_value(json_array_get(params, 5)), market->money_prec, &price) < 0)
+        return -__LINE__;
+    if (price <= 0)
+        return -__LINE__;
+
+    // taker fee
+    if (!json_is_string(json_array_get(params, 6)))
+        return -__LINE__;
+    if (fixed_parse(json_string_value(json_array_get(params, 6)), market->fee_prec, &taker_fee) < 0)
+        return -__LINE__;
+    if (taker_fee < 0 || taker_fee >= fixed_pow10[market->fee_prec])
+        return -__LINE__;
+
+    // maker fee
+    if (!json_is_string(json_array_get(params, 7)))
+        return -__LINE__;
+    if (fixed_parse(json_string_value(json_array_get(params, 7)), market->fee_prec, &maker_fee) < 0)
+        return -__LINE__;
+    if (maker_fee < 0 || maker_fee >= fixed_pow10[market->fee_prec])
+        return -__LINE__;
+
+    // source
+    if (!json_is_string(json_array_get(params, 8)))
+        return -__LINE__;
+    const char *source = json_string_value(json_array_get(params, 8));
+    if (strlen(source) > SOURCE_MAX_LEN)
+        return -__LINE__;
+
     order_t *order = market_get_order(market, order_id);
     if (order == NULL) {
         return -__LINE__;
     }
 
-    int ret = market_cancel_order(false, NULL, market, order);
+    int ret = market_replace_order(false, NULL, market, order, side, amount, price, taker_fee, maker_fee, source);
     if (ret < 0) {
-        log_error("market_cancel_order id: %"PRIu64", user id: %u, market: %s", order_id, user_id, market_name);
+        log_error("market_replace_order id: %"PRIu64", user id: %u, market: %s", order_id, user_id, market_name);
         return -__LINE__;
     }
 
     return 0;
 }
 
-static int load_oper(json_t *detail)
+typedef int (*load_oper_fn)(json_t *params);
+
+static struct {
+    const char      *method;
+    load_oper_fn    load;
+} oper_methods[] = {
+    { "update_balance",         load_update_balance },
+    { "limit_order",            load_limit_order },
+    { "market_order",           load_market_order },
+    { "cancel_order",           load_cancel_order },
+    { "limit_order_batch",      load_limit_order_batch },
+    { "cancel_order_batch",     load_cancel_order_batch },
+    { "cancel_replace_order",   load_cancel_replace_order },
+    { "cancel_all_order",       load_cancel_all_order },
+};
+
+/* an operlog parsed by the reader thread, detail holds the reference of params */
+struct oper_record {
+    uint64_t        id;
+    /* the order id taken by the command, ids of failed commands are skipped */
+    uint64_t        order_id;
+    load_oper_fn    load;
+    json_t          *detail;
+    json_t          *params;
+};
+
+static int parse_oper(json_t *detail, struct oper_record *record)
 {
     const char *method = json_string_value(json_object_get(detail, "method"));
     if (method == NULL)
@@ -376,70 +543,260 @@ static int load_oper(json_t *detail)
     if (params == NULL || !json_is_array(params))
         return -__LINE__;
 
-    int ret = 0;
-    if (strcmp(method, "update_balance") == 0) {
-        ret = load_update_balance(params);
-    } else if (strcmp(method, "limit_order") == 0) {
-        ret = load_limit_order(params);
-    } else if (strcmp(method, "market_order") == 0) {
-        ret = load_market_order(params);
-    } else if (strcmp(method, "cancel_order") == 0) {
-        ret = load_cancel_order(params);
-    } else {
+    for (size_t i = 0; i < sizeof(oper_methods) / sizeof(oper_methods[0]); ++i) {
+        if (strcmp(method, oper_methods[i].method) == 0) {
+            record->load = oper_methods[i].load;
+            record->order_id = json_integer_value(json_object_get(detail, "order_id"));
+            record->detail = detail;
+            record->params = params;
+            return 0;
+        }
+    }
+
+    return -__LINE__;
+}
+
+static int apply_oper(struct oper_record *record)
+{
+    if (record->order_id > order_id_start + 1) {
+        order_id_start = record->order_id - 1;
+    }
+    return record->load(record->params);
+}
+
+static int load_oper(json_t *detail)
+{
+    struct oper_record record;
+    int ret = parse_oper(detail, &record);
+    if (ret < 0)
+        return ret;
+    return apply_oper(&record);
+}
+
+int load_operlog_detail(const char *detail, size_t size)
+{
+    json_t *obj = json_loadb(detail, size, 0, NULL);
+    if (obj == NULL) {
+        log_error("invalid detail data: %.*s", (int)size, detail);
         return -__LINE__;
     }
+    int ret = load_oper(obj);
+    json_decref(obj);
 
     return ret;
 }
 
-int load_operlog(MYSQL *conn, const char *table, uint64_t *start_id)
+/*
+ * operlog replay is pipelined: a reader thread pages rows from mysql and
+ * parses them into oper_record, the main thread applies them in id order.
+ */
+# define OPER_BATCH_SIZE    1000
+# define OPER_QUEUE_SIZE    8
+
+struct oper_batch {
+    size_t              count;
+    struct oper_record  records[OPER_BATCH_SIZE];
+};
+
+struct oper_reader {
+    MYSQL               *conn;
+    const char          *table;
+    uint64_t            last_id;
+    int                 error;
+
+    pthread_mutex_t     lock;
+    pthread_cond_t      notify;
+    struct oper_batch   *queue[OPER_QUEUE_SIZE];
+    size_t              head;
+    size_t              count;
+    bool                done;
+    bool                stop;
+};
+
+static void free_oper_batch(struct oper_batch *batch)
 {
-    size_t query_limit = 1000;
-    uint64_t last_id = *start_id;
-    while (true) {
-        sds sql = sdsempty();
-        sql = sdscatprintf(sql, "SELECT `id`, `detail` from `%s` WHERE `id` > %"PRIu64" ORDER BY `id` LIMIT %zu", table, last_id, query_limit);
-        log_trace("exec sql: %s", sql);
-        int ret = mysql_real_query(conn, sql, sdslen(sql));
-        if (ret != 0) {
-            log_error("exec sql: %s fail: %d %s", sql, mysql_errno(conn), mysql_error(conn));
-            sdsfree(sql);
+    for (size_t i = 0; i < batch->count; ++i) {
+        json_decref(batch->records[i].detail);
+    }
+    free(batch);
+}
+
+static bool push_oper_batch(struct oper_reader *reader, struct oper_batch *batch)
+{
+    pthread_mutex_lock(&reader->lock);
+    while (reader->count == OPER_QUEUE_SIZE && !reader->stop) {
+        pthread_cond_wait(&reader->notify, &reader->lock);
+    }
+    if (reader->stop) {
+        pthread_mutex_unlock(&reader->lock);
+        free_oper_batch(batch);
+        return false;
+    }
+    reader->queue[(reader->head + reader->count) % OPER_QUEUE_SIZE] = batch;
+    reader->count += 1;
+    pthread_cond_broadcast(&reader->notify);
+    pthread_mutex_unlock(&reader->lock);
+
+    return true;
+}
+
+static struct oper_batch *pop_oper_batch(struct oper_reader *reader)
+{
+    pthread_mutex_lock(&reader->lock);
+    while (reader->count == 0 && !reader->done) {
+        pthread_cond_wait(&reader->notify, &reader->lock);
+    }
+    struct oper_batch *batch = NULL;
+    if (reader->count > 0) {
+        batch = reader->queue[reader->head];
+        reader->head = (reader->head + 1) % OPER_QUEUE_SIZE;
+        reader->count -= 1;
+        pthread_cond_broadcast(&reader->notify);
+    }
+    pthread_mutex_unlock(&reader->lock);
+
+    return batch;
+}
+
+static int read_oper_page(struct oper_reader *reader, struct oper_batch *batch)
+{
+    MYSQL *conn = reader->conn;
+    sds sql = sdsempty();
+    sql = sdscatprintf(sql, "SELECT `id`, `detail` from `%s` WHERE `id` > %"PRIu64" ORDER BY `id` LIMIT %d", reader->table, reader->last_id, OPER_BATCH_SIZE);
+    log_trace("exec sql: %s", sql);
+    int ret = mysql_real_query(conn, sql, sdslen(sql));
+    if (ret != 0) {
+        log_error("exec sql: %s fail: %d %s", sql, mysql_errno(conn), mysql_error(conn));
+        sdsfree(sql);
+        return -__LINE__;
+    }
+    sdsfree(sql);
+
+    MYSQL_RES *result = mysql_store_result(conn);
+    size_t num_rows = mysql_num_rows(result);
+    for (size_t i = 0; i < num_rows; ++i) {
+        MYSQL_ROW row = mysql_fetch_row(result);
+        uint64_t id = strtoull(row[0], NULL, 0);
+        if (id != reader->last_id + 1) {
+            log_error("invalid id: %"PRIu64", last id: %"PRIu64"", id, reader->last_id);
+            mysql_free_result(result);
             return -__LINE__;
         }
-        sdsfree(sql);
+        json_t *detail = json_loadb(row[1], strlen(row[1]), 0, NULL);
+        if (detail == NULL) {
+            log_error("invalid detail data: %s", row[1]);
+            mysql_free_result(result);
+            return -__LINE__;
+        }
+        struct oper_record *record = &batch->records[batch->count];
+        if (parse_oper(detail, record) < 0) {
+            log_error("invalid oper: %"PRIu64":%s", id, row[1]);
+            json_decref(detail);
+            mysql_free_result(result);
+            return -__LINE__;
+        }
+        record->id = id;
+        batch->count += 1;
+        reader->last_id = id;
+    }
+    mysql_free_result(result);
 
-        MYSQL_RES *result = mysql_store_result(conn);
-        size_t num_rows = mysql_num_rows(result);
-        for (size_t i = 0; i < num_rows; ++i) {
-            MYSQL_ROW row = mysql_fetch_row(result);
-            uint64_t id = strtoull(row[0], NULL, 0);
-            if (id != last_id + 1) {
-                log_error("invalid id: %"PRIu64", last id: %"PRIu64"", id, last_id);
-                return -__LINE__;
-            }
-            last_id = id;
-            json_t *detail = json_loadb(row[1], strlen(row[1]), 0, NULL);
-            if (detail == NULL) {
-                log_error("invalid detail data: %s", row[1]);
-                mysql_free_result(result);
-                return -__LINE__;
-            }
-            ret = load_oper(detail);
+    return num_rows;
+}
+
+static void *oper_reader_thread(void *arg)
+{
+    struct oper_reader *reader = arg;
+    while (true) {
+        struct oper_batch *batch = malloc(sizeof(struct oper_batch));
+        if (batch == NULL) {
+            reader->error = -__LINE__;
+            break;
+        }
+        batch->count = 0;
+
+        int ret = read_oper_page(reader, batch);
+        if (ret < 0) {
+            reader->error = ret;
+            free_oper_batch(batch);
+            break;
+        }
+        if (batch->count == 0) {
+            free(batch);
+            break;
+        }
+        if (!push_oper_batch(reader, batch))
+            break;
+        if (ret < OPER_BATCH_SIZE)
+            break;
+    }
+
+    pthread_mutex_lock(&reader->lock);
+    reader->done = true;
+    pthread_cond_broadcast(&reader->notify);
+    pthread_mutex_unlock(&reader->lock);
+
+    return NULL;
+}
+
+int load_operlog(MYSQL *conn, const char *table, uint64_t *start_id)
+{
+    struct oper_reader reader;
+    memset(&reader, 0, sizeof(reader));
+    reader.conn = conn;
+    reader.table = table;
+    reader.last_id = *start_id;
+    pthread_mutex_init(&reader.lock, NULL);
+    pthread_cond_init(&reader.notify, NULL);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, oper_reader_thread, &reader) != 0) {
+        pthread_mutex_destroy(&reader.lock);
+        pthread_cond_destroy(&reader.notify);
+        return -__LINE__;
+    }
+
+    int ret = 0;
+    uint64_t last_id = *start_id;
+    struct oper_batch *batch;
+    while ((batch = pop_oper_batch(&reader)) != NULL) {
+        for (size_t i = 0; i < batch->count && ret == 0; ++i) {
+            struct oper_record *record = &batch->records[i];
+            ret = apply_oper(record);
             if (ret < 0) {
-                json_decref(detail);
-                log_error("load_oper: %"PRIu64":%s fail: %d", id, row[1], ret);
-                mysql_free_result(result);
-                return -__LINE__;
+                char *detail = json_dumps(record->detail, 0);
+                log_error("load_oper: %"PRIu64":%s fail: %d", record->id, detail, ret);
+                free(detail);
+                ret = -__LINE__;
+                break;
             }
-            json_decref(detail);
+            last_id = record->id;
         }
-        mysql_free_result(result);
-
-        if (num_rows < query_limit)
+        free_oper_batch(batch);
+        if (ret < 0)
             break;
     }
 
+    if (ret < 0) {
+        pthread_mutex_lock(&reader.lock);
+        reader.stop = true;
+        pthread_cond_broadcast(&reader.notify);
+        pthread_mutex_unlock(&reader.lock);
+    }
+    pthread_join(thread, NULL);
+    while (reader.count > 0) {
+        free_oper_batch(reader.queue[reader.head]);
+        reader.head = (reader.head + 1) % OPER_QUEUE_SIZE;
+        reader.count -= 1;
+    }
+    pthread_mutex_destroy(&reader.lock);
+    pthread_cond_destroy(&reader.notify);
+
+    if (ret < 0)
+        return ret;
+    if (reader.error < 0)
+        return -__LINE__;
+
     *start_id = last_id;
     return 0;
 }
-
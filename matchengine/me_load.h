@@ -14,6 +14,7 @@ int load_markets(MYSQL *conn, const char *table);
 int load_balance(MYSQL *conn, const char *table);
 
 int load_operlog(MYSQL *conn, const char *table, uint64_t *start_id);
+int load_operlog_detail(const char *detail, size_t size);
 
 # endif
 
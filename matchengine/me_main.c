@@ -12,8 +12,11 @@
 # include "me_persist.h"
 # include "me_history.h"
 # include "me_message.h"
+# include "me_depth.h"
 # include "me_cli.h"
 # include "me_server.h"
+# include "me_admission.h"
+# include "me_match.h"
 
 const char *__process__ = "matchengine";
 const char *__version__ = "0.1.0";
@@ -125,10 +128,22 @@ int main(int argc, char *argv[])
     if (ret < 0) {
         error(EXIT_FAILURE, errno, "init persist fail: %d", ret);
     }
+    ret = init_admission();
+    if (ret < 0) {
+        error(EXIT_FAILURE, errno, "init admission fail: %d", ret);
+    }
     ret = init_cli();
     if (ret < 0) {
         error(EXIT_FAILURE, errno, "init cli fail: %d", ret);
     }
+    ret = init_depth();
+    if (ret < 0) {
+        error(EXIT_FAILURE, errno, "init depth fail: %d", ret);
+    }
+    ret = init_match();
+    if (ret < 0) {
+        error(EXIT_FAILURE, errno, "init match fail: %d", ret);
+    }
     ret = init_server();
     if (ret < 0) {
         error(EXIT_FAILURE, errno, "init server fail: %d", ret);
@@ -142,6 +157,8 @@ int main(int argc, char *argv[])
     nw_loop_run();
     log_vip("server stop");
 
+    fini_server();
+    fini_match();
     fini_message();
     fini_history();
     fini_operlog();
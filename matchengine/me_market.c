@@ -8,10 +8,21 @@
 # include "me_balance.h"
 # include "me_history.h"
 # include "me_message.h"
+# include "me_trade.h"
+# include "me_persist.h"
+# include "me_match.h"
+
+# define ORDER_POOL_SLAB_SIZE   1024
+# define ORDER_POOL_KEEP_SLABS  2
+# define ORDER_LIST_INDEX_MAX   64
+# define ORDER_LIST_INDEX_MIN   32
 
 uint64_t order_id_start;
 uint64_t deals_id_start;
 
+/* the markets whose book changed, linked by next_changed */
+static market_t *changed_markets;
+
 struct dict_user_key {
     uint32_t    user_id;
 };
@@ -36,21 +47,13 @@ static int dict_user_key_compare(const void *key1, const void *key2)
     return 1;
 }
 
-static void *dict_user_key_dup(const void *key)
+static void dict_user_val_free(void *val)
 {
-    struct dict_user_key *obj = malloc(sizeof(struct dict_user_key));
-    memcpy(obj, key, sizeof(struct dict_user_key));
-    return obj;
-}
-
-static void dict_user_key_free(void *key)
-{
-    free(key);
-}
-
-static void dict_user_val_free(void *key)
-{
-    skiplist_release(key);
+    order_list_t *list = val;
+    if (list->index) {
+        skiplist_release(list->index);
+    }
+    free(list);
 }
 
 static uint32_t dict_order_hash_function(const void *key)
@@ -80,29 +83,31 @@ static void dict_order_key_free(void *key)
     free(key);
 }
 
-static int order_match_compare(const void *value1, const void *value2)
+static int level_ask_compare(const void *value1, const void *value2)
 {
-    const order_t *order1 = value1;
-    const order_t *order2 = value2;
+    const order_level_t *level1 = value1;
+    const order_level_t *level2 = value2;
 
-    if (order1->id == order2->id) {
+    if (level1->price == level2->price) {
         return 0;
     }
-    if (order1->type != order2->type) {
-        return 1;
-    }
+    return level1->price > level2->price ? 1 : -1;
+}
 
-    int cmp;
-    if (order1->side == MARKET_ORDER_SIDE_ASK) {
-        cmp = mpd_cmp(order1->price, order2->price, &mpd_ctx);
-    } else {
-        cmp = mpd_cmp(order2->price, order1->price, &mpd_ctx);
-    }
-    if (cmp != 0) {
-        return cmp;
+static int level_bid_compare(const void *value1, const void *value2)
+{
+    const order_level_t *level1 = value1;
+    const order_level_t *level2 = value2;
+
+    if (level1->price == level2->price) {
+        return 0;
     }
+    return level1->price < level2->price ? 1 : -1;
+}
 
-    return order1->id > order2->id ? 1 : -1;
+static void level_free(void *value)
+{
+    free(value);
 }
 
 static int order_id_compare(const void *value1, const void *value2)
@@ -116,27 +121,229 @@ static int order_id_compare(const void *value1, const void *value2)
     return order1->id > order2->id ? -1 : 1;
 }
 
-static void order_free(order_t *order)
+static int order_pool_init(order_pool_t *pool)
+{
+    memset(pool, 0, sizeof(order_pool_t));
+    pool->free_total = ORDER_POOL_SLAB_SIZE;
+    pool->free_arr = malloc(pool->free_total * sizeof(order_t *));
+    if (pool->free_arr == NULL)
+        return -__LINE__;
+    return 0;
+}
+
+// the index of the slab order is carved from
+static uint32_t order_pool_find(order_pool_t *pool, order_t *order)
+{
+    uint32_t low = 0;
+    uint32_t high = pool->slab_num;
+    while (high - low > 1) {
+        uint32_t mid = (low + high) / 2;
+        if ((uintptr_t)pool->slabs[mid].records <= (uintptr_t)order) {
+            low = mid;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+static int order_pool_grow(order_pool_t *pool)
+{
+    // the free array can hold every order of every slab, so order_free never fails
+    uint32_t need = (pool->slab_num + 1) * ORDER_POOL_SLAB_SIZE;
+    if (need > pool->free_total) {
+        uint32_t new_free_total = pool->free_total;
+        while (new_free_total < need) {
+            new_free_total *= 2;
+        }
+        void *new_arr = realloc(pool->free_arr, new_free_total * sizeof(order_t *));
+        if (new_arr == NULL)
+            return -__LINE__;
+        pool->free_total = new_free_total;
+        pool->free_arr = new_arr;
+    }
+    if (pool->slab_num == pool->slab_max) {
+        uint32_t new_slab_max = pool->slab_max ? pool->slab_max * 2 : 16;
+        void *new_slabs = realloc(pool->slabs, new_slab_max * sizeof(order_slab_t));
+        if (new_slabs == NULL)
+            return -__LINE__;
+        pool->slab_max = new_slab_max;
+        pool->slabs = new_slabs;
+    }
+
+    order_t *slab = malloc(ORDER_POOL_SLAB_SIZE * sizeof(order_t));
+    if (slab == NULL)
+        return -__LINE__;
+    uint32_t index = pool->slab_num;
+    while (index > 0 && (uintptr_t)pool->slabs[index - 1].records > (uintptr_t)slab) {
+        index -= 1;
+    }
+    memmove(&pool->slabs[index + 1], &pool->slabs[index], (pool->slab_num - index) * sizeof(order_slab_t));
+    pool->slabs[index].records = slab;
+    pool->slabs[index].used = 0;
+    pool->slabs[index].trim = false;
+    pool->slab_num += 1;
+
+    for (int i = ORDER_POOL_SLAB_SIZE - 1; i >= 0; --i) {
+        pool->free_arr[pool->free++] = &slab[i];
+    }
+
+    return 0;
+}
+
+static order_t *order_alloc(market_t *m)
+{
+    order_pool_t *pool = &m->pool;
+    if (pool->free == 0 && order_pool_grow(pool) < 0)
+        return NULL;
+    pool->used += 1;
+    order_t *order = pool->free_arr[--pool->free];
+    pool->slabs[order_pool_find(pool, order)].used += 1;
+    order->slice_epoch = slice_epoch;
+    return order;
+}
+
+static void order_free(market_t *m, order_t *order)
 {
-    mpd_del(order->price);
-    mpd_del(order->amount);
-    mpd_del(order->taker_fee);
-    mpd_del(order->maker_fee);
-    mpd_del(order->left);
-    mpd_del(order->frozen);
-    mpd_del(order->deal_stock);
-    mpd_del(order->deal_money);
-    mpd_del(order->deal_fee);
-    free(order->market);
-    free(order->source);
-    free(order);
+    order_pool_t *pool = &m->pool;
+    pool->used -= 1;
+    pool->slabs[order_pool_find(pool, order)].used -= 1;
+    pool->free_arr[pool->free++] = order;
 }
 
-json_t *get_order_info(order_t *order)
+/*
+ * when at least half of the pool is free, the empty slabs beyond
+ * ORDER_POOL_KEEP_SLABS are freed and the free records are put back so that
+ * the records of the lowest slabs are taken first, the others drain and are
+ * freed by later calls.
+ */
+uint32_t market_trim_pool(market_t *m)
+{
+    order_pool_t *pool = &m->pool;
+    if (pool->slab_num <= ORDER_POOL_KEEP_SLABS || pool->free < pool->used)
+        return 0;
+    uint32_t empty = 0;
+    for (uint32_t i = 0; i < pool->slab_num; ++i) {
+        if (pool->slabs[i].used == 0)
+            empty += 1;
+    }
+    if (empty <= ORDER_POOL_KEEP_SLABS)
+        return 0;
+
+    order_t **free_arr = malloc(pool->free_total * sizeof(order_t *));
+    uint32_t *pos = malloc(pool->slab_num * sizeof(uint32_t));
+    if (free_arr == NULL || pos == NULL) {
+        free(free_arr);
+        free(pos);
+        return 0;
+    }
+
+    // the lowest empty slabs are kept, the records of the lowest slabs are on top of the free array
+    uint32_t keep = 0;
+    for (uint32_t i = 0; i < pool->slab_num; ++i) {
+        order_slab_t *slab = &pool->slabs[i];
+        slab->trim = slab->used == 0 && ++keep > ORDER_POOL_KEEP_SLABS;
+    }
+    uint32_t count = 0;
+    for (uint32_t i = pool->slab_num; i-- > 0;) {
+        if (pool->slabs[i].trim)
+            continue;
+        pos[i] = count;
+        count += ORDER_POOL_SLAB_SIZE - pool->slabs[i].used;
+    }
+    for (uint32_t i = 0; i < pool->free; ++i) {
+        order_t *order = pool->free_arr[i];
+        uint32_t index = order_pool_find(pool, order);
+        if (!pool->slabs[index].trim) {
+            free_arr[pos[index]++] = order;
+        }
+    }
+    free(pos);
+    free(pool->free_arr);
+    pool->free_arr = free_arr;
+    pool->free = count;
+
+    uint32_t trim = 0;
+    uint32_t j = 0;
+    for (uint32_t i = 0; i < pool->slab_num; ++i) {
+        if (pool->slabs[i].trim) {
+            free(pool->slabs[i].records);
+            trim += 1;
+        } else {
+            pool->slabs[j++] = pool->slabs[i];
+        }
+    }
+    pool->slab_num = j;
+    pool->trim_total += trim;
+
+    // the free array only has to hold the slabs left
+    uint32_t need = pool->slab_num * ORDER_POOL_SLAB_SIZE;
+    if (need < ORDER_POOL_SLAB_SIZE)
+        need = ORDER_POOL_SLAB_SIZE;
+    if (pool->free_total > need * 2) {
+        uint32_t new_free_total = pool->free_total;
+        while (new_free_total / 2 >= need) {
+            new_free_total /= 2;
+        }
+        void *new_arr = realloc(pool->free_arr, new_free_total * sizeof(order_t *));
+        if (new_arr) {
+            pool->free_total = new_free_total;
+            pool->free_arr = new_arr;
+        }
+    }
+
+    return trim;
+}
+
+int order_price_prec(market_t *m, order_t *order)
+{
+    return order->type == MARKET_ORDER_TYPE_LIMIT ? m->money_prec : 0;
+}
+
+int order_maker_fee_prec(market_t *m, order_t *order)
+{
+    return order->type == MARKET_ORDER_TYPE_LIMIT ? m->fee_prec : 0;
+}
+
+int order_left_prec(market_t *m, order_t *order)
+{
+    // market bid order left is money, it is scaled as deal money after the first deal
+    if (order->type == MARKET_ORDER_TYPE_MARKET && order->side == MARKET_ORDER_SIDE_BID && order->deal_stock)
+        return m->stock_prec + m->money_prec;
+    return m->stock_prec;
+}
+
+int order_frozen_prec(market_t *m, order_t *order)
+{
+    if (order->side == MARKET_ORDER_SIDE_ASK)
+        return m->stock_prec;
+    return m->stock_prec + m->money_prec;
+}
+
+int order_deal_stock_prec(market_t *m, order_t *order)
+{
+    return order->deal_stock ? m->stock_prec : 0;
+}
+
+int order_deal_money_prec(market_t *m, order_t *order)
+{
+    return order->deal_stock ? m->stock_prec + m->money_prec : 0;
+}
+
+int order_deal_fee_prec(market_t *m, order_t *order)
+{
+    if (order->deal_stock == 0)
+        return 0;
+    if (order->side == MARKET_ORDER_SIDE_ASK)
+        return m->stock_prec + m->money_prec + m->fee_prec;
+    return m->stock_prec + m->fee_prec;
+}
+
+json_t *get_order_info(market_t *m, order_t *order)
 {
     json_t *info = json_object();
     json_object_set_new(info, "id", json_integer(order->id));
-    json_object_set_new(info, "market", json_string(order->market));
+    json_object_set_new(info, "market", json_string(m->name));
     json_object_set_new(info, "source", json_string(order->source));
     json_object_set_new(info, "type", json_integer(order->type));
     json_object_set_new(info, "side", json_integer(order->side));
@@ -144,89 +351,465 @@ json_t *get_order_info(order_t *order)
     json_object_set_new(info, "ctime", json_real(order->create_time));
     json_object_set_new(info, "mtime", json_real(order->update_time));
 
-    json_object_set_new_mpd(info, "price", order->price);
-    json_object_set_new_mpd(info, "amount", order->amount);
-    json_object_set_new_mpd(info, "taker_fee", order->taker_fee);
-    json_object_set_new_mpd(info, "maker_fee", order->maker_fee);
-    json_object_set_new_mpd(info, "left", order->left);
-    json_object_set_new_mpd(info, "deal_stock", order->deal_stock);
-    json_object_set_new_mpd(info, "deal_money", order->deal_money);
-    json_object_set_new_mpd(info, "deal_fee", order->deal_fee);
+    json_object_set_new_fixed(info, "price", order->price, order_price_prec(m, order));
+    json_object_set_new_fixed(info, "amount", order->amount, m->stock_prec);
+    json_object_set_new_fixed(info, "taker_fee", order->taker_fee, m->fee_prec);
+    json_object_set_new_fixed(info, "maker_fee", order->maker_fee, order_maker_fee_prec(m, order));
+    json_object_set_new_fixed(info, "left", order->left, order_left_prec(m, order));
+    json_object_set_new_fixed(info, "deal_stock", order->deal_stock, order_deal_stock_prec(m, order));
+    json_object_set_new_fixed(info, "deal_money", order->deal_money, order_deal_money_prec(m, order));
+    json_object_set_new_fixed(info, "deal_fee", order->deal_fee, order_deal_fee_prec(m, order));
 
     return info;
 }
 
+static void level_change(market_t *m, uint32_t side, order_level_t *level)
+{
+    m->book_version += 1;
+    if (!m->book_changed) {
+        // the markets of a batch change on their matching threads
+        m->book_changed = true;
+        m->next_changed = __atomic_load_n(&changed_markets, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&changed_markets, &m->next_changed, m, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            ;
+    }
+    if (!m->depth_track || level->changed)
+        return;
+
+    if (m->depth_change_num == m->depth_change_max) {
+        size_t new_max = m->depth_change_max ? m->depth_change_max * 2 : 64;
+        depth_change_t *changes = realloc(m->depth_changes, sizeof(depth_change_t) * new_max);
+        if (changes == NULL) {
+            log_fatal("depth change list grow fail, market: %s", m->name);
+            return;
+        }
+        m->depth_changes = changes;
+        m->depth_change_max = new_max;
+    }
+
+    level->changed = true;
+    m->depth_changes[m->depth_change_num].side = side;
+    m->depth_changes[m->depth_change_num].price = level->price;
+    m->depth_change_num += 1;
+}
+
+// apply a change of the level at price to the merged ladders
+static void ladder_update(market_t *m, uint32_t side, fixed_t price, fixed_t left, int count)
+{
+    for (size_t i = 0; i < m->ladder_num; ++i) {
+        depth_ladder_t *ladder = &m->ladders[i];
+        skiplist_t *list;
+        order_level_t key;
+        key.price = price / ladder->interval * ladder->interval;
+        if (side == MARKET_ORDER_SIDE_ASK) {
+            list = ladder->asks;
+            if (price % ladder->interval != 0) {
+                key.price += ladder->interval;
+            }
+        } else {
+            list = ladder->bids;
+        }
+
+        order_level_t *level;
+        skiplist_node *node = skiplist_find(list, &key);
+        if (node) {
+            level = node->value;
+        } else {
+            level = malloc(sizeof(order_level_t));
+            if (level == NULL) {
+                log_fatal("ladder level malloc fail, market: %s", m->name);
+                continue;
+            }
+            memset(level, 0, sizeof(order_level_t));
+            level->price = key.price;
+            if (skiplist_insert(list, level) == NULL) {
+                log_fatal("ladder level insert fail, market: %s", m->name);
+                free(level);
+                continue;
+            }
+        }
+
+        level->left += left;
+        level->count += count;
+        if (level->count == 0) {
+            skiplist_delete(list, node ? node : skiplist_find(list, level));
+        }
+    }
+}
+
+static int book_insert(market_t *m, order_t *order)
+{
+    skiplist_t *list = order->side == MARKET_ORDER_SIDE_ASK ? m->asks : m->bids;
+    order_level_t key = { .price = order->price };
+    order_level_t *level;
+
+    // a new level comes in with weight 1, the order put to it
+    skiplist_node *node = skiplist_find(list, &key);
+    if (node) {
+        level = node->value;
+        skiplist_add_weight(list, level, 1);
+    } else {
+        level = malloc(sizeof(order_level_t));
+        if (level == NULL)
+            return -__LINE__;
+        memset(level, 0, sizeof(order_level_t));
+        level->price = order->price;
+        if (skiplist_insert(list, level) == NULL) {
+            free(level);
+            return -__LINE__;
+        }
+    }
+
+    // new orders go to the tail, orders loaded from dump may come out of id order
+    order_t *prev = level->tail;
+    while (prev && prev->id > order->id) {
+        prev = prev->prev;
+    }
+    order->prev = prev;
+    order->next = prev ? prev->next : level->head;
+    if (order->next) {
+        order->next->prev = order;
+    } else {
+        level->tail = order;
+    }
+    if (prev) {
+        prev->next = order;
+    } else {
+        level->head = order;
+    }
+
+    order->level = level;
+    level->left += order->left;
+    level->count += 1;
+    level_change(m, order->side, level);
+    ladder_update(m, order->side, order->price, order->left, 1);
+    if (order->side == MARKET_ORDER_SIDE_ASK) {
+        m->ask_count += 1;
+    } else {
+        m->bid_count += 1;
+    }
+
+    return 0;
+}
+
+static void book_remove(market_t *m, order_t *order)
+{
+    order_level_t *level = order->level;
+    if (order->prev) {
+        order->prev->next = order->next;
+    } else {
+        level->head = order->next;
+    }
+    if (order->next) {
+        order->next->prev = order->prev;
+    } else {
+        level->tail = order->prev;
+    }
+
+    order->level = NULL;
+    order->prev = NULL;
+    order->next = NULL;
+    level->left -= order->left;
+    level->count -= 1;
+    level_change(m, order->side, level);
+    ladder_update(m, order->side, order->price, -order->left, -1);
+
+    skiplist_t *list;
+    if (order->side == MARKET_ORDER_SIDE_ASK) {
+        list = m->asks;
+        m->ask_count -= 1;
+    } else {
+        list = m->bids;
+        m->bid_count -= 1;
+    }
+    if (level->count == 0) {
+        skiplist_node *node = skiplist_find(list, level);
+        if (node) {
+            skiplist_delete(list, node);
+        }
+    } else {
+        skiplist_add_weight(list, level, -1);
+    }
+}
+
+// the first order in time priority of the best price level
+static order_t *book_first(skiplist_t *list)
+{
+    skiplist_node *node = skiplist_first(list);
+    if (node == NULL)
+        return NULL;
+    order_level_t *level = node->value;
+    return level->head;
+}
+
+/*
+ * the changes out of the market go to the journal of the command when the
+ * market runs on a matching thread, the journal is only set for real commands.
+ */
+static int change_balance(market_t *m, int op, uint32_t user_id, uint32_t type, int asset_id, fixed_t amount, int prec)
+{
+    if (m->journal) {
+        journal_balance(m->journal, op, user_id, type, asset_id, amount, prec);
+        return 0;
+    }
+
+    fixed_t *result = NULL;
+    switch (op) {
+    case JOURNAL_BALANCE_ADD:
+        result = balance_add(user_id, type, asset_id, amount, prec);
+        break;
+    case JOURNAL_BALANCE_SUB:
+        result = balance_sub(user_id, type, asset_id, amount, prec);
+        break;
+    case JOURNAL_BALANCE_FREEZE:
+        result = balance_freeze(user_id, asset_id, amount, prec);
+        break;
+    case JOURNAL_BALANCE_UNFREEZE:
+        result = balance_unfreeze(user_id, asset_id, amount, prec);
+        break;
+    }
+
+    return result ? 0 : -__LINE__;
+}
+
+static void save_order(market_t *m, order_t *order)
+{
+    if (m->journal) {
+        if (slice_mark_order(order)) {
+            journal_slice_order(m->journal, order);
+        }
+    } else {
+        slice_save_order(order);
+    }
+}
+
+static void count_order(market_t *m, const char *key)
+{
+    if (m->journal) {
+        journal_monitor(m->journal, key, 1);
+    } else {
+        monitor_inc(key, 1);
+    }
+}
+
+static void push_order(market_t *m, uint32_t event, order_t *order)
+{
+    if (m->journal) {
+        journal_order_message(m->journal, event, order);
+    } else {
+        push_order_message(event, order, m);
+    }
+}
+
+static void append_order(market_t *m, order_t *order)
+{
+    if (m->journal) {
+        journal_order_history(m->journal, order);
+        return;
+    }
+
+    int ret = append_order_history(m, order);
+    if (ret < 0) {
+        log_fatal("append_order_history fail: %d, order: %"PRIu64"", ret, order->id);
+    }
+}
+
+static void append_deal(bool real, market_t *m, double t, int side, order_t *ask, int ask_role, order_t *bid, int bid_role,
+        fixed_t price, fixed_t amount, fixed_t deal, fixed_t ask_fee, fixed_t bid_fee)
+{
+    if (m->journal) {
+        journal_deal(m->journal, t, side, ask, ask_role, bid, bid_role, price, amount, deal, ask_fee, bid_fee);
+        return;
+    }
+
+    uint64_t deal_id = ++deals_id_start;
+    if (real) {
+        append_order_deal_history(t, deal_id, m, ask, ask_role, bid, bid_role, price, amount, deal, ask_fee, bid_fee);
+        push_deal_message(t, deal_id, m, side, ask, bid, price, amount, deal, ask_fee, bid_fee);
+    }
+}
+
+// detail is freed
+static void append_balance(market_t *m, order_t *order, int asset_id, fixed_t change, int change_prec, char *detail)
+{
+    if (m->journal) {
+        journal_balance_history(m->journal, order->update_time, order->user_id, asset_id, change, change_prec, detail);
+        return;
+    }
+
+    append_user_balance_history(order->update_time, order->user_id, asset_id, "trade", change, change_prec, detail);
+    free(detail);
+}
+
+static uint64_t next_order_id(market_t *m)
+{
+    if (m->journal)
+        return m->journal->order_id;
+    return ++order_id_start;
+}
+
+static void order_list_drop_index(order_list_t *list)
+{
+    skiplist_release(list->index);
+    list->index = NULL;
+}
+
+// index all orders of the list, a list is left without it if this fails
+static void order_list_build_index(order_list_t *list)
+{
+    skiplist_type type;
+    memset(&type, 0, sizeof(type));
+    type.compare = order_id_compare;
+    list->index = skiplist_create(&type);
+    if (list->index == NULL)
+        return;
+    for (order_t *order = list->head; order; order = order->user_next) {
+        if (skiplist_insert(list->index, order) == NULL) {
+            order_list_drop_index(list);
+            return;
+        }
+    }
+}
+
+// new orders go to the head, orders loaded from dump may come out of id order
+static void order_list_insert(order_list_t *list, order_t *order)
+{
+    order_t *prev = NULL;
+    order_t *next = list->head;
+    while (next && next->id > order->id) {
+        prev = next;
+        next = next->user_next;
+    }
+    order->user_prev = prev;
+    order->user_next = next;
+    if (prev) {
+        prev->user_next = order;
+    } else {
+        list->head = order;
+    }
+    if (next) {
+        next->user_prev = order;
+    }
+    list->count += 1;
+    if (order->side == MARKET_ORDER_SIDE_ASK) {
+        list->ask_count += 1;
+    }
+
+    if (list->index) {
+        if (skiplist_insert(list->index, order) == NULL) {
+            order_list_drop_index(list);
+        }
+    } else if (list->count > ORDER_LIST_INDEX_MAX) {
+        order_list_build_index(list);
+    }
+}
+
+static void order_list_remove(order_list_t *list, order_t *order)
+{
+    if (order->user_prev) {
+        order->user_prev->user_next = order->user_next;
+    } else {
+        list->head = order->user_next;
+    }
+    if (order->user_next) {
+        order->user_next->user_prev = order->user_prev;
+    }
+    order->user_prev = NULL;
+    order->user_next = NULL;
+    list->count -= 1;
+    if (order->side == MARKET_ORDER_SIDE_ASK) {
+        list->ask_count -= 1;
+    }
+
+    if (list->index) {
+        if (list->count < ORDER_LIST_INDEX_MIN) {
+            order_list_drop_index(list);
+        } else {
+            skiplist_node *node = skiplist_find(list->index, order);
+            if (node) {
+                skiplist_delete(list->index, node);
+            }
+        }
+    }
+}
+
+order_t *order_list_get(order_list_t *list, size_t offset)
+{
+    if (offset >= list->count)
+        return NULL;
+    if (list->index) {
+        skiplist_node *node = skiplist_find_by_rank(list->index, offset, NULL);
+        return node ? node->value : NULL;
+    }
+
+    order_t *order = list->head;
+    for (; order && offset > 0; offset--) {
+        order = order->user_next;
+    }
+    return order;
+}
+
 static int order_put(market_t *m, order_t *order)
 {
     if (order->type != MARKET_ORDER_TYPE_LIMIT)
         return -__LINE__;
 
+    order->level = NULL;
+    order->prev = NULL;
+    order->next = NULL;
+    order->user_prev = NULL;
+    order->user_next = NULL;
+
     struct dict_order_key order_key = { .order_id = order->id };
     if (dict_add(m->orders, &order_key, order) == NULL)
         return -__LINE__;
 
-    struct dict_user_key user_key = { .user_id = order->user_id };
-    dict_entry *entry = dict_find(m->users, &user_key);
-    if (entry) {
-        skiplist_t *order_list = entry->val;
-        if (skiplist_insert(order_list, order) == NULL)
+    order_list_t *list = market_get_order_list(m, order->user_id);
+    if (list == NULL) {
+        list = malloc(sizeof(order_list_t));
+        if (list == NULL)
             return -__LINE__;
-    } else {
-        skiplist_type type;
-        memset(&type, 0, sizeof(type));
-        type.compare = order_id_compare;
-        skiplist_t *order_list = skiplist_create(&type);
-        if (order_list == NULL)
-            return -__LINE__;
-        if (skiplist_insert(order_list, order) == NULL)
-            return -__LINE__;
-        if (dict_add(m->users, &user_key, order_list) == NULL)
+        memset(list, 0, sizeof(order_list_t));
+        list->user_id = order->user_id;
+        if (dict_add(m->users, list, list) == NULL) {
+            free(list);
             return -__LINE__;
+        }
     }
+    order_list_insert(list, order);
 
+    if (book_insert(m, order) < 0)
+        return -__LINE__;
     if (order->side == MARKET_ORDER_SIDE_ASK) {
-        if (skiplist_insert(m->asks, order) == NULL)
-            return -__LINE__;
-        mpd_copy(order->frozen, order->left, &mpd_ctx);
-        if (balance_freeze(order->user_id, m->stock, order->left) == NULL)
+        order->frozen = order->left;
+        if (change_balance(m, JOURNAL_BALANCE_FREEZE, order->user_id, BALANCE_TYPE_AVAILABLE, m->stock_id, order->frozen, m->stock_prec) < 0)
             return -__LINE__;
     } else {
-        if (skiplist_insert(m->bids, order) == NULL)
-            return -__LINE__;
-        mpd_t *result = mpd_new(&mpd_ctx);
-        mpd_mul(result, order->price, order->left, &mpd_ctx);
-        mpd_copy(order->frozen, result, &mpd_ctx);
-        if (balance_freeze(order->user_id, m->money, result) == NULL) {
-            mpd_del(result);
+        order->frozen = order->price * order->left;
+        if (change_balance(m, JOURNAL_BALANCE_FREEZE, order->user_id, BALANCE_TYPE_AVAILABLE, m->money_id, order->frozen, m->stock_prec + m->money_prec) < 0)
             return -__LINE__;
-        }
-        mpd_del(result);
     }
 
-    monitor_inc("order_put", 1);
+    count_order(m, "order_put");
 
     return 0;
 }
 
 static int order_finish(bool real, market_t *m, order_t *order)
 {
+    save_order(m, order);
+    if (order->level) {
+        book_remove(m, order);
+    }
     if (order->side == MARKET_ORDER_SIDE_ASK) {
-        skiplist_node *node = skiplist_find(m->asks, order);
-        if (node) {
-            skiplist_delete(m->asks, node);
-        }
-        if (mpd_cmp(order->frozen, mpd_zero, &mpd_ctx) > 0) {
-            if (balance_unfreeze(order->user_id, m->stock, order->frozen) == NULL) {
+        if (order->frozen > 0) {
+            if (change_balance(m, JOURNAL_BALANCE_UNFREEZE, order->user_id, BALANCE_TYPE_AVAILABLE, m->stock_id, order->frozen, order_frozen_prec(m, order)) < 0) {
                 return -__LINE__;
             }
         }
     } else {
-        skiplist_node *node = skiplist_find(m->bids, order);
-        if (node) {
-            skiplist_delete(m->bids, node);
-        }
-        if (mpd_cmp(order->frozen, mpd_zero, &mpd_ctx) > 0) {
-            if (balance_unfreeze(order->user_id, m->money, order->frozen) == NULL) {
+        if (order->frozen > 0) {
+            if (change_balance(m, JOURNAL_BALANCE_UNFREEZE, order->user_id, BALANCE_TYPE_AVAILABLE, m->money_id, order->frozen, order_frozen_prec(m, order)) < 0) {
                 return -__LINE__;
             }
         }
@@ -235,32 +818,28 @@ static int order_finish(bool real, market_t *m, order_t *order)
     struct dict_order_key order_key = { .order_id = order->id };
     dict_delete(m->orders, &order_key);
 
-    struct dict_user_key user_key = { .user_id = order->user_id };
-    dict_entry *entry = dict_find(m->users, &user_key);
-    if (entry) {
-        skiplist_t *order_list = entry->val;
-        skiplist_node *node = skiplist_find(order_list, order);
-        if (node) {
-            skiplist_delete(order_list, node);
+    order_list_t *list = market_get_order_list(m, order->user_id);
+    if (list) {
+        order_list_remove(list, order);
+        if (list->count == 0) {
+            struct dict_user_key user_key = { .user_id = order->user_id };
+            dict_delete(m->users, &user_key);
         }
     }
 
     if (real) {
-        if (mpd_cmp(order->deal_stock, mpd_zero, &mpd_ctx) > 0) {
-            int ret = append_order_history(order);
-            if (ret < 0) {
-                log_fatal("append_order_history fail: %d, order: %"PRIu64"", ret, order->id);
-            }
+        if (order->deal_stock > 0) {
+            append_order(m, order);
         }
     }
 
-    order_free(order);
-    monitor_inc("order_finish", 1);
+    order_free(m, order);
+    count_order(m, "order_finish");
 
     return 0;
 }
 
-market_t *market_create(struct market *conf)
+market_t *market_create(struct market *conf, uint32_t id)
 {
     if (!asset_exist(conf->stock) || !asset_exist(conf->money))
         return NULL;
@@ -271,22 +850,35 @@ market_t *market_create(struct market *conf)
     if (conf->money_prec + conf->fee_prec > asset_prec(conf->money))
         return NULL;
 
+    // min_amount is compared with amounts of stock_prec, round it up
+    fixed_t min_amount;
+    if (fixed_from_mpd(conf->min_amount, conf->stock_prec, &min_amount) < 0)
+        return NULL;
+    mpd_t *check = fixed_to_mpd(min_amount, conf->stock_prec);
+    if (mpd_cmp(check, conf->min_amount, &mpd_ctx) < 0)
+        min_amount += 1;
+    mpd_del(check);
+
     market_t *m = malloc(sizeof(market_t));
     memset(m, 0, sizeof(market_t));
+    m->id               = id;
     m->name             = strdup(conf->name);
     m->stock            = strdup(conf->stock);
     m->money            = strdup(conf->money);
+    m->stock_id         = get_asset_id(conf->stock);
+    m->money_id         = get_asset_id(conf->money);
     m->stock_prec       = conf->stock_prec;
     m->money_prec       = conf->money_prec;
     m->fee_prec         = conf->fee_prec;
-    m->min_amount       = mpd_qncopy(conf->min_amount);
+    m->min_amount       = min_amount;
+
+    if (order_pool_init(&m->pool) < 0)
+        return NULL;
 
     dict_types dt;
     memset(&dt, 0, sizeof(dt));
     dt.hash_function    = dict_user_hash_function;
     dt.key_compare      = dict_user_key_compare;
-    dt.key_dup          = dict_user_key_dup;
-    dt.key_destructor   = dict_user_key_free;
     dt.val_destructor   = dict_user_val_free;
 
     m->users = dict_create(&dt, 1024);
@@ -305,328 +897,339 @@ market_t *market_create(struct market *conf)
 
     skiplist_type lt;
     memset(&lt, 0, sizeof(lt));
-    lt.compare          = order_match_compare;
-
+    lt.free             = level_free;
+    lt.compare          = level_ask_compare;
     m->asks = skiplist_create(&lt);
+
+    lt.compare          = level_bid_compare;
     m->bids = skiplist_create(&lt);
     if (m->asks == NULL || m->bids == NULL)
         return NULL;
 
+    // intervals finer than money_prec can not be kept
+    m->ladders = malloc(sizeof(depth_ladder_t) * (settings.depth_merge_num + 1));
+    if (m->ladders == NULL)
+        return NULL;
+    for (size_t i = 0; i < settings.depth_merge_num; ++i) {
+        fixed_t interval;
+        if (fixed_from_mpd(settings.depth_merge[i], m->money_prec, &interval) < 0 || interval <= 0)
+            continue;
+        mpd_t *check = fixed_to_mpd(interval, m->money_prec);
+        int cmp = mpd_cmp(check, settings.depth_merge[i], &mpd_ctx);
+        mpd_del(check);
+        if (cmp != 0 || market_get_depth_ladder(m, MARKET_ORDER_SIDE_ASK, interval))
+            continue;
+
+        depth_ladder_t *ladder = &m->ladders[m->ladder_num];
+        ladder->interval = interval;
+        lt.compare = level_ask_compare;
+        ladder->asks = skiplist_create(&lt);
+        lt.compare = level_bid_compare;
+        ladder->bids = skiplist_create(&lt);
+        if (ladder->asks == NULL || ladder->bids == NULL)
+            return NULL;
+        m->ladder_num += 1;
+    }
+
     return m;
 }
 
-static int append_balance_trade_add(order_t *order, const char *asset, mpd_t *change, mpd_t *price, mpd_t *amount)
+static int append_balance_trade_add(market_t *m, order_t *order, int asset_id, fixed_t change, int change_prec, fixed_t price, fixed_t amount)
 {
     json_t *detail = json_object();
-    json_object_set_new(detail, "m", json_string(order->market));
+    json_object_set_new(detail, "m", json_string(m->name));
     json_object_set_new(detail, "i", json_integer(order->id));
-    json_object_set_new_mpd(detail, "p", price);
-    json_object_set_new_mpd(detail, "a", amount);
+    json_object_set_new_fixed(detail, "p", price, m->money_prec);
+    json_object_set_new_fixed(detail, "a", amount, m->stock_prec);
     char *detail_str = json_dumps(detail, JSON_SORT_KEYS);
-    int ret = append_user_balance_history(order->update_time, order->user_id, asset, "trade", change, detail_str);
-    free(detail_str);
     json_decref(detail);
-    return ret;
+    append_balance(m, order, asset_id, change, change_prec, detail_str);
+    return 0;
 }
 
-static int append_balance_trade_sub(order_t *order, const char *asset, mpd_t *change, mpd_t *price, mpd_t *amount)
+static int append_balance_trade_sub(market_t *m, order_t *order, int asset_id, fixed_t change, int change_prec, fixed_t price, fixed_t amount)
 {
     json_t *detail = json_object();
-    json_object_set_new(detail, "m", json_string(order->market));
+    json_object_set_new(detail, "m", json_string(m->name));
     json_object_set_new(detail, "i", json_integer(order->id));
-    json_object_set_new_mpd(detail, "p", price);
-    json_object_set_new_mpd(detail, "a", amount);
+    json_object_set_new_fixed(detail, "p", price, m->money_prec);
+    json_object_set_new_fixed(detail, "a", amount, m->stock_prec);
     char *detail_str = json_dumps(detail, JSON_SORT_KEYS);
-    mpd_t *real_change = mpd_new(&mpd_ctx);
-    mpd_copy_negate(real_change, change, &mpd_ctx);
-    int ret = append_user_balance_history(order->update_time, order->user_id, asset, "trade", real_change, detail_str);
-    mpd_del(real_change);
-    free(detail_str);
     json_decref(detail);
-    return ret;
+    append_balance(m, order, asset_id, -change, change_prec, detail_str);
+    return 0;
 }
 
 
-static int append_balance_trade_fee(order_t *order, const char *asset, mpd_t *change, mpd_t *price, mpd_t *amount, mpd_t *fee_rate)
+static int append_balance_trade_fee(market_t *m, order_t *order, int asset_id, fixed_t change, int change_prec, fixed_t price, fixed_t amount, fixed_t fee_rate)
 {
     json_t *detail = json_object();
-    json_object_set_new(detail, "m", json_string(order->market));
+    json_object_set_new(detail, "m", json_string(m->name));
     json_object_set_new(detail, "i", json_integer(order->id));
-    json_object_set_new_mpd(detail, "p", price);
-    json_object_set_new_mpd(detail, "a", amount);
-    json_object_set_new_mpd(detail, "f", fee_rate);
+    json_object_set_new_fixed(detail, "p", price, m->money_prec);
+    json_object_set_new_fixed(detail, "a", amount, m->stock_prec);
+    json_object_set_new_fixed(detail, "f", fee_rate, m->fee_prec);
     char *detail_str = json_dumps(detail, JSON_SORT_KEYS);
-    mpd_t *real_change = mpd_new(&mpd_ctx);
-    mpd_copy_negate(real_change, change, &mpd_ctx);
-    int ret = append_user_balance_history(order->update_time, order->user_id, asset, "trade", real_change, detail_str);
-    mpd_del(real_change);
-    free(detail_str);
     json_decref(detail);
-    return ret;
+    append_balance(m, order, asset_id, -change, change_prec, detail_str);
+    return 0;
 }
 
 static int execute_limit_ask_order(bool real, market_t *m, order_t *taker)
 {
-    mpd_t *price    = mpd_new(&mpd_ctx);
-    mpd_t *amount   = mpd_new(&mpd_ctx);
-    mpd_t *deal     = mpd_new(&mpd_ctx);
-    mpd_t *ask_fee  = mpd_new(&mpd_ctx);
-    mpd_t *bid_fee  = mpd_new(&mpd_ctx);
-    mpd_t *result   = mpd_new(&mpd_ctx);
+    // amount: stock_prec, deal: stock_prec + money_prec
+    int amount_prec  = m->stock_prec;
+    int deal_prec    = m->stock_prec + m->money_prec;
+    int ask_fee_prec = deal_prec + m->fee_prec;
+    int bid_fee_prec = amount_prec + m->fee_prec;
 
-    skiplist_node *node;
-    skiplist_iter *iter = skiplist_get_iterator(m->bids);
-    while ((node = skiplist_next(iter)) != NULL) {
-        if (mpd_cmp(taker->left, mpd_zero, &mpd_ctx) == 0) {
+    fixed_t price, amount, deal, ask_fee, bid_fee;
+
+    order_t *maker;
+    while ((maker = book_first(m->bids)) != NULL) {
+        if (taker->left == 0) {
             break;
         }
 
-        order_t *maker = node->value;
-        if (mpd_cmp(taker->price, maker->price, &mpd_ctx) > 0) {
+        if (taker->price > maker->price) {
             break;
         }
 
-        mpd_copy(price, maker->price, &mpd_ctx);
-        if (mpd_cmp(taker->left, maker->left, &mpd_ctx) < 0) {
-            mpd_copy(amount, taker->left, &mpd_ctx);
+        price = maker->price;
+        if (taker->left < maker->left) {
+            amount = taker->left;
         } else {
-            mpd_copy(amount, maker->left, &mpd_ctx);
+            amount = maker->left;
         }
 
-        mpd_mul(deal, price, amount, &mpd_ctx);
-        mpd_mul(ask_fee, deal, taker->taker_fee, &mpd_ctx);
-        mpd_mul(bid_fee, amount, maker->maker_fee, &mpd_ctx);
+        deal    = price * amount;
+        ask_fee = deal * taker->taker_fee;
+        bid_fee = amount * maker->maker_fee;
 
+        save_order(m, maker);
         taker->update_time = maker->update_time = current_timestamp();
-        uint64_t deal_id = ++deals_id_start;
-        if (real) {
-            append_order_deal_history(taker->update_time, deal_id, taker, MARKET_ROLE_TAKER, maker, MARKET_ROLE_MAKER, price, amount, deal, ask_fee, bid_fee);
-            push_deal_message(taker->update_time, deal_id, m, MARKET_TRADE_SIDE_SELL, taker, maker, price, amount, deal, ask_fee, bid_fee);
-        }
+        append_deal(real, m, taker->update_time, MARKET_TRADE_SIDE_SELL, taker, MARKET_ROLE_TAKER, maker, MARKET_ROLE_MAKER, price, amount, deal, ask_fee, bid_fee);
 
-        mpd_sub(taker->left, taker->left, amount, &mpd_ctx);
-        mpd_add(taker->deal_stock, taker->deal_stock, amount, &mpd_ctx);
-        mpd_add(taker->deal_money, taker->deal_money, deal, &mpd_ctx);
-        mpd_add(taker->deal_fee, taker->deal_fee, ask_fee, &mpd_ctx);
+        taker->left       -= amount;
+        taker->deal_stock += amount;
+        taker->deal_money += deal;
+        taker->deal_fee   += ask_fee;
 
-        balance_sub(taker->user_id, BALANCE_TYPE_AVAILABLE, m->stock, amount);
+        change_balance(m, JOURNAL_BALANCE_SUB, taker->user_id, BALANCE_TYPE_AVAILABLE, m->stock_id, amount, amount_prec);
         if (real) {
-            append_balance_trade_sub(taker, m->stock, amount, price, amount);
+            append_balance_trade_sub(m, taker, m->stock_id, amount, amount_prec, price, amount);
         }
-        balance_add(taker->user_id, BALANCE_TYPE_AVAILABLE, m->money, deal);
+        change_balance(m, JOURNAL_BALANCE_ADD, taker->user_id, BALANCE_TYPE_AVAILABLE, m->money_id, deal, deal_prec);
         if (real) {
-            append_balance_trade_add(taker, m->money, deal, price, amount);
+            append_balance_trade_add(m, taker, m->money_id, deal, deal_prec, price, amount);
         }
-        if (mpd_cmp(ask_fee, mpd_zero, &mpd_ctx) > 0) {
-            balance_sub(taker->user_id, BALANCE_TYPE_AVAILABLE, m->money, ask_fee);
+        if (ask_fee > 0) {
+            change_balance(m, JOURNAL_BALANCE_SUB, taker->user_id, BALANCE_TYPE_AVAILABLE, m->money_id, ask_fee, ask_fee_prec);
             if (real) {
-                append_balance_trade_fee(taker, m->money, ask_fee, price, amount, taker->taker_fee);
+                append_balance_trade_fee(m, taker, m->money_id, ask_fee, ask_fee_prec, price, amount, taker->taker_fee);
             }
         }
 
-        mpd_sub(maker->left, maker->left, amount, &mpd_ctx);
-        mpd_sub(maker->frozen, maker->frozen, deal, &mpd_ctx);
-        mpd_add(maker->deal_stock, maker->deal_stock, amount, &mpd_ctx);
-        mpd_add(maker->deal_money, maker->deal_money, deal, &mpd_ctx);
-        mpd_add(maker->deal_fee, maker->deal_fee, bid_fee, &mpd_ctx);
+        maker->left       -= amount;
+        maker->level->left -= amount;
+        level_change(m, maker->side, maker->level);
+        ladder_update(m, maker->side, maker->price, -amount, 0);
+        maker->frozen     -= deal;
+        maker->deal_stock += amount;
+        maker->deal_money += deal;
+        maker->deal_fee   += bid_fee;
 
-        balance_sub(maker->user_id, BALANCE_TYPE_FROZEN, m->money, deal);
+        change_balance(m, JOURNAL_BALANCE_SUB, maker->user_id, BALANCE_TYPE_FROZEN, m->money_id, deal, deal_prec);
         if (real) {
-            append_balance_trade_sub(maker, m->money, deal, price, amount);
+            append_balance_trade_sub(m, maker, m->money_id, deal, deal_prec, price, amount);
         }
-        balance_add(maker->user_id, BALANCE_TYPE_AVAILABLE, m->stock, amount);
+        change_balance(m, JOURNAL_BALANCE_ADD, maker->user_id, BALANCE_TYPE_AVAILABLE, m->stock_id, amount, amount_prec);
         if (real) {
-            append_balance_trade_add(maker, m->stock, amount, price, amount);
+            append_balance_trade_add(m, maker, m->stock_id, amount, amount_prec, price, amount);
         }
-        if (mpd_cmp(bid_fee, mpd_zero, &mpd_ctx) > 0) {
-            balance_sub(maker->user_id, BALANCE_TYPE_AVAILABLE, m->stock, bid_fee);
+        if (bid_fee > 0) {
+            change_balance(m, JOURNAL_BALANCE_SUB, maker->user_id, BALANCE_TYPE_AVAILABLE, m->stock_id, bid_fee, bid_fee_prec);
             if (real) {
-                append_balance_trade_fee(maker, m->stock, bid_fee, price, amount, maker->maker_fee);
+                append_balance_trade_fee(m, maker, m->stock_id, bid_fee, bid_fee_prec, price, amount, maker->maker_fee);
             }
         }
 
-        if (mpd_cmp(maker->left, mpd_zero, &mpd_ctx) == 0) {
+        if (maker->left == 0) {
             if (real) {
-                push_order_message(ORDER_EVENT_FINISH, maker, m);
+                push_order(m, ORDER_EVENT_FINISH, maker);
             }
             order_finish(real, m, maker);
         } else {
             if (real) {
-                push_order_message(ORDER_EVENT_UPDATE, maker, m);
+                push_order(m, ORDER_EVENT_UPDATE, maker);
             }
         }
     }
-    skiplist_release_iterator(iter);
-
-    mpd_del(amount);
-    mpd_del(price);
-    mpd_del(deal);
-    mpd_del(ask_fee);
-    mpd_del(bid_fee);
-    mpd_del(result);
 
     return 0;
 }
 
 static int execute_limit_bid_order(bool real, market_t *m, order_t *taker)
 {
-    mpd_t *price    = mpd_new(&mpd_ctx);
-    mpd_t *amount   = mpd_new(&mpd_ctx);
-    mpd_t *deal     = mpd_new(&mpd_ctx);
-    mpd_t *ask_fee  = mpd_new(&mpd_ctx);
-    mpd_t *bid_fee  = mpd_new(&mpd_ctx);
-    mpd_t *result   = mpd_new(&mpd_ctx);
+    int amount_prec  = m->stock_prec;
+    int deal_prec    = m->stock_prec + m->money_prec;
+    int ask_fee_prec = deal_prec + m->fee_prec;
+    int bid_fee_prec = amount_prec + m->fee_prec;
 
-    skiplist_node *node;
-    skiplist_iter *iter = skiplist_get_iterator(m->asks);
-    while ((node = skiplist_next(iter)) != NULL) {
-        if (mpd_cmp(taker->left, mpd_zero, &mpd_ctx) == 0) {
+    fixed_t price, amount, deal, ask_fee, bid_fee;
+
+    order_t *maker;
+    while ((maker = book_first(m->asks)) != NULL) {
+        if (taker->left == 0) {
             break;
         }
 
-        order_t *maker = node->value;
-        if (mpd_cmp(taker->price, maker->price, &mpd_ctx) < 0) {
+        if (taker->price < maker->price) {
             break;
         }
 
-        mpd_copy(price, maker->price, &mpd_ctx);
-        if (mpd_cmp(taker->left, maker->left, &mpd_ctx) < 0) {
-            mpd_copy(amount, taker->left, &mpd_ctx);
+        price = maker->price;
+        if (taker->left < maker->left) {
+            amount = taker->left;
         } else {
-            mpd_copy(amount, maker->left, &mpd_ctx);
+            amount = maker->left;
         }
 
-        mpd_mul(deal, price, amount, &mpd_ctx);
-        mpd_mul(ask_fee, deal, maker->maker_fee, &mpd_ctx);
-        mpd_mul(bid_fee, amount, taker->taker_fee, &mpd_ctx);
+        deal    = price * amount;
+        ask_fee = deal * maker->maker_fee;
+        bid_fee = amount * taker->taker_fee;
 
+        save_order(m, maker);
         taker->update_time = maker->update_time = current_timestamp();
-        uint64_t deal_id = ++deals_id_start;
-        if (real) {
-            append_order_deal_history(taker->update_time, deal_id, maker, MARKET_ROLE_MAKER, taker, MARKET_ROLE_TAKER, price, amount, deal, ask_fee, bid_fee);
-            push_deal_message(taker->update_time, deal_id, m, MARKET_TRADE_SIDE_BUY, maker, taker, price, amount, deal, ask_fee, bid_fee);
-        }
+        append_deal(real, m, taker->update_time, MARKET_TRADE_SIDE_BUY, maker, MARKET_ROLE_MAKER, taker, MARKET_ROLE_TAKER, price, amount, deal, ask_fee, bid_fee);
 
-        mpd_sub(taker->left, taker->left, amount, &mpd_ctx);
-        mpd_add(taker->deal_stock, taker->deal_stock, amount, &mpd_ctx);
-        mpd_add(taker->deal_money, taker->deal_money, deal, &mpd_ctx);
-        mpd_add(taker->deal_fee, taker->deal_fee, bid_fee, &mpd_ctx);
+        taker->left       -= amount;
+        taker->deal_stock += amount;
+        taker->deal_money += deal;
+        taker->deal_fee   += bid_fee;
 
-        balance_sub(taker->user_id, BALANCE_TYPE_AVAILABLE, m->money, deal);
+        change_balance(m, JOURNAL_BALANCE_SUB, taker->user_id, BALANCE_TYPE_AVAILABLE, m->money_id, deal, deal_prec);
         if (real) {
-            append_balance_trade_sub(taker, m->money, deal, price, amount);
+            append_balance_trade_sub(m, taker, m->money_id, deal, deal_prec, price, amount);
         }
-        balance_add(taker->user_id, BALANCE_TYPE_AVAILABLE, m->stock, amount);
+        change_balance(m, JOURNAL_BALANCE_ADD, taker->user_id, BALANCE_TYPE_AVAILABLE, m->stock_id, amount, amount_prec);
         if (real) {
-            append_balance_trade_add(taker, m->stock, amount, price, amount);
+            append_balance_trade_add(m, taker, m->stock_id, amount, amount_prec, price, amount);
         }
-        if (mpd_cmp(bid_fee, mpd_zero, &mpd_ctx) > 0) {
-            balance_sub(taker->user_id, BALANCE_TYPE_AVAILABLE, m->stock, bid_fee);
+        if (bid_fee > 0) {
+            change_balance(m, JOURNAL_BALANCE_SUB, taker->user_id, BALANCE_TYPE_AVAILABLE, m->stock_id, bid_fee, bid_fee_prec);
             if (real) {
-                append_balance_trade_fee(taker, m->stock, bid_fee, price, amount, taker->taker_fee);
+                append_balance_trade_fee(m, taker, m->stock_id, bid_fee, bid_fee_prec, price, amount, taker->taker_fee);
             }
         }
 
-        mpd_sub(maker->left, maker->left, amount, &mpd_ctx);
-        mpd_sub(maker->frozen, maker->frozen, amount, &mpd_ctx);
-        mpd_add(maker->deal_stock, maker->deal_stock, amount, &mpd_ctx);
-        mpd_add(maker->deal_money, maker->deal_money, deal, &mpd_ctx);
-        mpd_add(maker->deal_fee, maker->deal_fee, ask_fee, &mpd_ctx);
+        maker->left       -= amount;
+        maker->level->left -= amount;
+        level_change(m, maker->side, maker->level);
+        ladder_update(m, maker->side, maker->price, -amount, 0);
+        maker->frozen     -= amount;
+        maker->deal_stock += amount;
+        maker->deal_money += deal;
+        maker->deal_fee   += ask_fee;
 
-        balance_sub(maker->user_id, BALANCE_TYPE_FROZEN, m->stock, amount);
+        change_balance(m, JOURNAL_BALANCE_SUB, maker->user_id, BALANCE_TYPE_FROZEN, m->stock_id, amount, amount_prec);
         if (real) {
-            append_balance_trade_sub(maker, m->stock, amount, price, amount);
+            append_balance_trade_sub(m, maker, m->stock_id, amount, amount_prec, price, amount);
         }
-        balance_add(maker->user_id, BALANCE_TYPE_AVAILABLE, m->money, deal);
+        change_balance(m, JOURNAL_BALANCE_ADD, maker->user_id, BALANCE_TYPE_AVAILABLE, m->money_id, deal, deal_prec);
         if (real) {
-            append_balance_trade_add(maker, m->money, deal, price, amount);
+            append_balance_trade_add(m, maker, m->money_id, deal, deal_prec, price, amount);
         }
-        if (mpd_cmp(ask_fee, mpd_zero, &mpd_ctx) > 0) {
-            balance_sub(maker->user_id, BALANCE_TYPE_AVAILABLE, m->money, ask_fee);
+        if (ask_fee > 0) {
+            change_balance(m, JOURNAL_BALANCE_SUB, maker->user_id, BALANCE_TYPE_AVAILABLE, m->money_id, ask_fee, ask_fee_prec);
             if (real) {
-                append_balance_trade_fee(maker, m->money, ask_fee, price, amount, maker->maker_fee);
+                append_balance_trade_fee(m, maker, m->money_id, ask_fee, ask_fee_prec, price, amount, maker->maker_fee);
             }
         }
 
-        if (mpd_cmp(maker->left, mpd_zero, &mpd_ctx) == 0) {
+        if (maker->left == 0) {
             if (real) {
-                push_order_message(ORDER_EVENT_FINISH, maker, m);
+                push_order(m, ORDER_EVENT_FINISH, maker);
             }
             order_finish(real, m, maker);
         } else {
             if (real) {
-                push_order_message(ORDER_EVENT_UPDATE, maker, m);
+                push_order(m, ORDER_EVENT_UPDATE, maker);
             }
         }
     }
-    skiplist_release_iterator(iter);
-
-    mpd_del(amount);
-    mpd_del(price);
-    mpd_del(deal);
-    mpd_del(ask_fee);
-    mpd_del(bid_fee);
-    mpd_del(result);
 
     return 0;
 }
 
-int market_put_limit_order(bool real, json_t **result, market_t *m, uint32_t user_id, uint32_t side, mpd_t *amount, mpd_t *price, mpd_t *taker_fee, mpd_t *maker_fee, const char *source)
+/*
+ * the frozen balance of replace is counted as available, it is released before the new order is put.
+ * on a matching thread the balances are read without a lock, it is safe as nothing changes
+ * them while match_run runs, the changes of the batch are journaled, see match_running.
+ */
+static int check_limit_order(market_t *m, uint32_t user_id, uint32_t side, fixed_t amount, fixed_t price, order_t *replace)
 {
     if (side == MARKET_ORDER_SIDE_ASK) {
-        mpd_t *balance = balance_get(user_id, BALANCE_TYPE_AVAILABLE, m->stock);
-        if (!balance || mpd_cmp(balance, amount, &mpd_ctx) < 0) {
+        int prec = settings.assets[m->stock_id].prec_save;
+        fixed_t *balance = balance_get(user_id, BALANCE_TYPE_AVAILABLE, m->stock_id);
+        fixed_t available = balance ? *balance : 0;
+        if (replace && replace->side == MARKET_ORDER_SIDE_ASK) {
+            available += fixed_rescale(replace->frozen, order_frozen_prec(m, replace), prec);
+        }
+        if (fixed_cmp(available, prec, amount, m->stock_prec) < 0) {
             return -1;
         }
     } else {
-        mpd_t *balance = balance_get(user_id, BALANCE_TYPE_AVAILABLE, m->money);
-        mpd_t *require = mpd_new(&mpd_ctx);
-        mpd_mul(require, amount, price, &mpd_ctx);
-        if (!balance || mpd_cmp(balance, require, &mpd_ctx) < 0) {
-            mpd_del(require);
+        // the deals of a bid order are bounded by amount * price, keep them and their fee in range
+        fixed_t require, fee_check;
+        if (__builtin_mul_overflow(amount, price, &require) ||
+                __builtin_mul_overflow(require, fixed_pow10[m->fee_prec], &fee_check)) {
+            return -1;
+        }
+        int prec = settings.assets[m->money_id].prec_save;
+        fixed_t *balance = balance_get(user_id, BALANCE_TYPE_AVAILABLE, m->money_id);
+        fixed_t available = balance ? *balance : 0;
+        if (replace && replace->side == MARKET_ORDER_SIDE_BID) {
+            available += fixed_rescale(replace->frozen, order_frozen_prec(m, replace), prec);
+        }
+        if (fixed_cmp(available, prec, require, m->stock_prec + m->money_prec) < 0) {
             return -1;
         }
-        mpd_del(require);
     }
 
-    if (mpd_cmp(amount, m->min_amount, &mpd_ctx) < 0) {
+    if (amount < m->min_amount) {
         return -2;
     }
 
-    order_t *order = malloc(sizeof(order_t));
+    return 0;
+}
+
+static int put_limit_order(bool real, json_t **result, market_t *m, uint32_t user_id, uint32_t side, fixed_t amount, fixed_t price, fixed_t taker_fee, fixed_t maker_fee, const char *source)
+{
+    int ret;
+    order_t *order = order_alloc(m);
     if (order == NULL) {
         return -__LINE__;
     }
 
-    order->id           = ++order_id_start;
+    order->id           = next_order_id(m);
     order->type         = MARKET_ORDER_TYPE_LIMIT;
     order->side         = side;
     order->create_time  = current_timestamp();
     order->update_time  = order->create_time;
-    order->market       = strdup(m->name);
-    order->source       = strdup(source);
+    order->market_id    = m->id;
+    snprintf(order->source, sizeof(order->source), "%s", source);
     order->user_id      = user_id;
-    order->price        = mpd_new(&mpd_ctx);
-    order->amount       = mpd_new(&mpd_ctx);
-    order->taker_fee    = mpd_new(&mpd_ctx);
-    order->maker_fee    = mpd_new(&mpd_ctx);
-    order->left         = mpd_new(&mpd_ctx);
-    order->frozen       = mpd_new(&mpd_ctx);
-    order->deal_stock   = mpd_new(&mpd_ctx);
-    order->deal_money   = mpd_new(&mpd_ctx);
-    order->deal_fee     = mpd_new(&mpd_ctx);
-
-    mpd_copy(order->price, price, &mpd_ctx);
-    mpd_copy(order->amount, amount, &mpd_ctx);
-    mpd_copy(order->taker_fee, taker_fee, &mpd_ctx);
-    mpd_copy(order->maker_fee, maker_fee, &mpd_ctx);
-    mpd_copy(order->left, amount, &mpd_ctx);
-    mpd_copy(order->frozen, mpd_zero, &mpd_ctx);
-    mpd_copy(order->deal_stock, mpd_zero, &mpd_ctx);
-    mpd_copy(order->deal_money, mpd_zero, &mpd_ctx);
-    mpd_copy(order->deal_fee, mpd_zero, &mpd_ctx);
+    order->price        = price;
+    order->amount       = amount;
+    order->taker_fee    = taker_fee;
+    order->maker_fee    = maker_fee;
+    order->left         = amount;
+    order->frozen       = 0;
+    order->deal_stock   = 0;
+    order->deal_money   = 0;
+    order->deal_fee     = 0;
 
-    int ret;
     if (side == MARKET_ORDER_SIDE_ASK) {
         ret = execute_limit_ask_order(real, m, order);
     } else {
@@ -634,24 +1237,21 @@ int market_put_limit_order(bool real, json_t **result, market_t *m, uint32_t use
     }
     if (ret < 0) {
         log_error("execute order: %"PRIu64" fail: %d", order->id, ret);
-        order_free(order);
+        order_free(m, order);
         return -__LINE__;
     }
 
-    if (mpd_cmp(order->left, mpd_zero, &mpd_ctx) == 0) {
+    if (order->left == 0) {
         if (real) {
-            ret = append_order_history(order);
-            if (ret < 0) {
-                log_fatal("append_order_history fail: %d, order: %"PRIu64"", ret, order->id);
-            }
-            push_order_message(ORDER_EVENT_FINISH, order, m);
-            *result = get_order_info(order);
+            append_order(m, order);
+            push_order(m, ORDER_EVENT_FINISH, order);
+            *result = get_order_info(m, order);
         }
-        order_free(order);
+        order_free(m, order);
     } else {
         if (real) {
-            push_order_message(ORDER_EVENT_PUT, order, m);
-            *result = get_order_info(order);
+            push_order(m, ORDER_EVENT_PUT, order);
+            *result = get_order_info(m, order);
         }
         ret = order_put(m, order);
         if (ret < 0) {
@@ -662,294 +1262,255 @@ int market_put_limit_order(bool real, json_t **result, market_t *m, uint32_t use
     return 0;
 }
 
+int market_put_limit_order(bool real, json_t **result, market_t *m, uint32_t user_id, uint32_t side, fixed_t amount, fixed_t price, fixed_t taker_fee, fixed_t maker_fee, const char *source)
+{
+    int ret = check_limit_order(m, user_id, side, amount, price, NULL);
+    if (ret < 0) {
+        return ret;
+    }
+
+    return put_limit_order(real, result, m, user_id, side, amount, price, taker_fee, maker_fee, source);
+}
+
 static int execute_market_ask_order(bool real, market_t *m, order_t *taker)
 {
-    mpd_t *price    = mpd_new(&mpd_ctx);
-    mpd_t *amount   = mpd_new(&mpd_ctx);
-    mpd_t *deal     = mpd_new(&mpd_ctx);
-    mpd_t *ask_fee  = mpd_new(&mpd_ctx);
-    mpd_t *bid_fee  = mpd_new(&mpd_ctx);
-    mpd_t *result   = mpd_new(&mpd_ctx);
+    int amount_prec  = m->stock_prec;
+    int deal_prec    = m->stock_prec + m->money_prec;
+    int ask_fee_prec = deal_prec + m->fee_prec;
+    int bid_fee_prec = amount_prec + m->fee_prec;
 
-    skiplist_node *node;
-    skiplist_iter *iter = skiplist_get_iterator(m->bids);
-    while ((node = skiplist_next(iter)) != NULL) {
-        if (mpd_cmp(taker->left, mpd_zero, &mpd_ctx) == 0) {
+    fixed_t price, amount, deal, ask_fee, bid_fee;
+
+    order_t *maker;
+    while ((maker = book_first(m->bids)) != NULL) {
+        if (taker->left == 0) {
             break;
         }
 
-        order_t *maker = node->value;
-        mpd_copy(price, maker->price, &mpd_ctx);
-        if (mpd_cmp(taker->left, maker->left, &mpd_ctx) < 0) {
-            mpd_copy(amount, taker->left, &mpd_ctx);
+        price = maker->price;
+        if (taker->left < maker->left) {
+            amount = taker->left;
         } else {
-            mpd_copy(amount, maker->left, &mpd_ctx);
+            amount = maker->left;
         }
 
-        mpd_mul(deal, price, amount, &mpd_ctx);
-        mpd_mul(ask_fee, deal, taker->taker_fee, &mpd_ctx);
-        mpd_mul(bid_fee, amount, maker->maker_fee, &mpd_ctx);
+        deal    = price * amount;
+        ask_fee = deal * taker->taker_fee;
+        bid_fee = amount * maker->maker_fee;
 
+        save_order(m, maker);
         taker->update_time = maker->update_time = current_timestamp();
-        uint64_t deal_id = ++deals_id_start;
-        if (real) {
-            append_order_deal_history(taker->update_time, deal_id, taker, MARKET_ROLE_TAKER, maker, MARKET_ROLE_MAKER, price, amount, deal, ask_fee, bid_fee);
-            push_deal_message(taker->update_time, deal_id, m, MARKET_TRADE_SIDE_SELL, taker, maker, price, amount, deal, ask_fee, bid_fee);
-        }
+        append_deal(real, m, taker->update_time, MARKET_TRADE_SIDE_SELL, taker, MARKET_ROLE_TAKER, maker, MARKET_ROLE_MAKER, price, amount, deal, ask_fee, bid_fee);
 
-        mpd_sub(taker->left, taker->left, amount, &mpd_ctx);
-        mpd_add(taker->deal_stock, taker->deal_stock, amount, &mpd_ctx);
-        mpd_add(taker->deal_money, taker->deal_money, deal, &mpd_ctx);
-        mpd_add(taker->deal_fee, taker->deal_fee, ask_fee, &mpd_ctx);
+        taker->left       -= amount;
+        taker->deal_stock += amount;
+        taker->deal_money += deal;
+        taker->deal_fee   += ask_fee;
 
-        balance_sub(taker->user_id, BALANCE_TYPE_AVAILABLE, m->stock, amount);
+        change_balance(m, JOURNAL_BALANCE_SUB, taker->user_id, BALANCE_TYPE_AVAILABLE, m->stock_id, amount, amount_prec);
         if (real) {
-            append_balance_trade_sub(taker, m->stock, amount, price, amount);
+            append_balance_trade_sub(m, taker, m->stock_id, amount, amount_prec, price, amount);
         }
-        balance_add(taker->user_id, BALANCE_TYPE_AVAILABLE, m->money, deal);
+        change_balance(m, JOURNAL_BALANCE_ADD, taker->user_id, BALANCE_TYPE_AVAILABLE, m->money_id, deal, deal_prec);
         if (real) {
-            append_balance_trade_add(taker, m->money, deal, price, amount);
+            append_balance_trade_add(m, taker, m->money_id, deal, deal_prec, price, amount);
         }
-        if (mpd_cmp(ask_fee, mpd_zero, &mpd_ctx) > 0) {
-            balance_sub(taker->user_id, BALANCE_TYPE_AVAILABLE, m->money, ask_fee);
+        if (ask_fee > 0) {
+            change_balance(m, JOURNAL_BALANCE_SUB, taker->user_id, BALANCE_TYPE_AVAILABLE, m->money_id, ask_fee, ask_fee_prec);
             if (real) {
-                append_balance_trade_fee(taker, m->money, ask_fee, price, amount, taker->taker_fee);
+                append_balance_trade_fee(m, taker, m->money_id, ask_fee, ask_fee_prec, price, amount, taker->taker_fee);
             }
         }
 
-        mpd_sub(maker->left, maker->left, amount, &mpd_ctx);
-        mpd_sub(maker->frozen, maker->frozen, deal, &mpd_ctx);
-        mpd_add(maker->deal_stock, maker->deal_stock, amount, &mpd_ctx);
-        mpd_add(maker->deal_money, maker->deal_money, deal, &mpd_ctx);
-        mpd_add(maker->deal_fee, maker->deal_fee, bid_fee, &mpd_ctx);
+        maker->left       -= amount;
+        maker->level->left -= amount;
+        level_change(m, maker->side, maker->level);
+        ladder_update(m, maker->side, maker->price, -amount, 0);
+        maker->frozen     -= deal;
+        maker->deal_stock += amount;
+        maker->deal_money += deal;
+        maker->deal_fee   += bid_fee;
 
-        balance_sub(maker->user_id, BALANCE_TYPE_FROZEN, m->money, deal);
+        change_balance(m, JOURNAL_BALANCE_SUB, maker->user_id, BALANCE_TYPE_FROZEN, m->money_id, deal, deal_prec);
         if (real) {
-            append_balance_trade_sub(maker, m->money, deal, price, amount);
+            append_balance_trade_sub(m, maker, m->money_id, deal, deal_prec, price, amount);
         }
-        balance_add(maker->user_id, BALANCE_TYPE_AVAILABLE, m->stock, amount);
+        change_balance(m, JOURNAL_BALANCE_ADD, maker->user_id, BALANCE_TYPE_AVAILABLE, m->stock_id, amount, amount_prec);
         if (real) {
-            append_balance_trade_add(maker, m->stock, amount, price, amount);
+            append_balance_trade_add(m, maker, m->stock_id, amount, amount_prec, price, amount);
         }
-        if (mpd_cmp(bid_fee, mpd_zero, &mpd_ctx) > 0) {
-            balance_sub(maker->user_id, BALANCE_TYPE_AVAILABLE, m->stock, bid_fee);
+        if (bid_fee > 0) {
+            change_balance(m, JOURNAL_BALANCE_SUB, maker->user_id, BALANCE_TYPE_AVAILABLE, m->stock_id, bid_fee, bid_fee_prec);
             if (real) {
-                append_balance_trade_fee(maker, m->stock, bid_fee, price, amount, maker->maker_fee);
+                append_balance_trade_fee(m, maker, m->stock_id, bid_fee, bid_fee_prec, price, amount, maker->maker_fee);
             }
         }
 
-        if (mpd_cmp(maker->left, mpd_zero, &mpd_ctx) == 0) {
+        if (maker->left == 0) {
             if (real) {
-                push_order_message(ORDER_EVENT_FINISH, maker, m);
+                push_order(m, ORDER_EVENT_FINISH, maker);
             }
             order_finish(real, m, maker);
         } else {
             if (real) {
-                push_order_message(ORDER_EVENT_UPDATE, maker, m);
+                push_order(m, ORDER_EVENT_UPDATE, maker);
             }
         }
     }
-    skiplist_release_iterator(iter);
-
-    mpd_del(amount);
-    mpd_del(price);
-    mpd_del(deal);
-    mpd_del(ask_fee);
-    mpd_del(bid_fee);
-    mpd_del(result);
 
     return 0;
 }
 
 static int execute_market_bid_order(bool real, market_t *m, order_t *taker)
 {
-    mpd_t *price    = mpd_new(&mpd_ctx);
-    mpd_t *amount   = mpd_new(&mpd_ctx);
-    mpd_t *deal     = mpd_new(&mpd_ctx);
-    mpd_t *ask_fee  = mpd_new(&mpd_ctx);
-    mpd_t *bid_fee  = mpd_new(&mpd_ctx);
-    mpd_t *result   = mpd_new(&mpd_ctx);
+    int amount_prec  = m->stock_prec;
+    int deal_prec    = m->stock_prec + m->money_prec;
+    int ask_fee_prec = deal_prec + m->fee_prec;
+    int bid_fee_prec = amount_prec + m->fee_prec;
 
-    skiplist_node *node;
-    skiplist_iter *iter = skiplist_get_iterator(m->asks);
-    while ((node = skiplist_next(iter)) != NULL) {
-        if (mpd_cmp(taker->left, mpd_zero, &mpd_ctx) == 0) {
+    fixed_t price, amount, deal, ask_fee, bid_fee, left;
+
+    order_t *maker;
+    while ((maker = book_first(m->asks)) != NULL) {
+        if (taker->left == 0) {
             break;
         }
 
-        order_t *maker = node->value;
-        mpd_copy(price, maker->price, &mpd_ctx);
+        price = maker->price;
 
-        mpd_div(amount, taker->left, price, &mpd_ctx);
-        mpd_rescale(amount, amount, -m->stock_prec, &mpd_ctx);
-        while (true) {
-            mpd_mul(result, amount, price, &mpd_ctx);
-            if (mpd_cmp(result, taker->left, &mpd_ctx) > 0) {
-                mpd_set_i32(result, -m->stock_prec, &mpd_ctx);
-                mpd_pow(result, mpd_ten, result, &mpd_ctx);
-                mpd_sub(amount, amount, result, &mpd_ctx);
-            } else {
-                break;
-            }
-        }
+        // the largest amount of stock_prec whose deal does not exceed left
+        left   = fixed_rescale(taker->left, order_left_prec(m, taker), deal_prec);
+        amount = left / price;
 
-        if (mpd_cmp(amount, maker->left, &mpd_ctx) > 0) {
-            mpd_copy(amount, maker->left, &mpd_ctx);
+        if (amount > maker->left) {
+            amount = maker->left;
         }
-        if (mpd_cmp(amount, mpd_zero, &mpd_ctx) == 0) {
+        if (amount == 0) {
             break;
         }
 
-        mpd_mul(deal, price, amount, &mpd_ctx);
-        mpd_mul(ask_fee, deal, maker->maker_fee, &mpd_ctx);
-        mpd_mul(bid_fee, amount, taker->taker_fee, &mpd_ctx);
+        deal    = price * amount;
+        ask_fee = deal * maker->maker_fee;
+        bid_fee = amount * taker->taker_fee;
 
+        save_order(m, maker);
         taker->update_time = maker->update_time = current_timestamp();
-        uint64_t deal_id = ++deals_id_start;
-        if (real) {
-            append_order_deal_history(taker->update_time, deal_id, maker, MARKET_ROLE_MAKER, taker, MARKET_ROLE_TAKER, price, amount, deal, ask_fee, bid_fee);
-            push_deal_message(taker->update_time, deal_id, m, MARKET_TRADE_SIDE_BUY, maker, taker, price, amount, deal, ask_fee, bid_fee);
-        }
+        append_deal(real, m, taker->update_time, MARKET_TRADE_SIDE_BUY, maker, MARKET_ROLE_MAKER, taker, MARKET_ROLE_TAKER, price, amount, deal, ask_fee, bid_fee);
 
-        mpd_sub(taker->left, taker->left, deal, &mpd_ctx);
-        mpd_add(taker->deal_stock, taker->deal_stock, amount, &mpd_ctx);
-        mpd_add(taker->deal_money, taker->deal_money, deal, &mpd_ctx);
-        mpd_add(taker->deal_fee, taker->deal_fee, bid_fee, &mpd_ctx);
+        taker->left        = left - deal;
+        taker->deal_stock += amount;
+        taker->deal_money += deal;
+        taker->deal_fee   += bid_fee;
 
-        balance_sub(taker->user_id, BALANCE_TYPE_AVAILABLE, m->money, deal);
+        change_balance(m, JOURNAL_BALANCE_SUB, taker->user_id, BALANCE_TYPE_AVAILABLE, m->money_id, deal, deal_prec);
         if (real) {
-            append_balance_trade_sub(taker, m->money, deal, price, amount);
+            append_balance_trade_sub(m, taker, m->money_id, deal, deal_prec, price, amount);
         }
-        balance_add(taker->user_id, BALANCE_TYPE_AVAILABLE, m->stock, amount);
+        change_balance(m, JOURNAL_BALANCE_ADD, taker->user_id, BALANCE_TYPE_AVAILABLE, m->stock_id, amount, amount_prec);
         if (real) {
-            append_balance_trade_add(taker, m->stock, amount, price, amount);
+            append_balance_trade_add(m, taker, m->stock_id, amount, amount_prec, price, amount);
         }
-        if (mpd_cmp(bid_fee, mpd_zero, &mpd_ctx) > 0) {
-            balance_sub(taker->user_id, BALANCE_TYPE_AVAILABLE, m->stock, bid_fee);
+        if (bid_fee > 0) {
+            change_balance(m, JOURNAL_BALANCE_SUB, taker->user_id, BALANCE_TYPE_AVAILABLE, m->stock_id, bid_fee, bid_fee_prec);
             if (real) {
-                append_balance_trade_fee(taker, m->stock, bid_fee, price, amount, taker->taker_fee);
+                append_balance_trade_fee(m, taker, m->stock_id, bid_fee, bid_fee_prec, price, amount, taker->taker_fee);
             }
         }
 
-        mpd_sub(maker->left, maker->left, amount, &mpd_ctx);
-        mpd_sub(maker->frozen, maker->frozen, amount, &mpd_ctx);
-        mpd_add(maker->deal_stock, maker->deal_stock, amount, &mpd_ctx);
-        mpd_add(maker->deal_money, maker->deal_money, deal, &mpd_ctx);
-        mpd_add(maker->deal_fee, maker->deal_fee, ask_fee, &mpd_ctx);
+        maker->left       -= amount;
+        maker->level->left -= amount;
+        level_change(m, maker->side, maker->level);
+        ladder_update(m, maker->side, maker->price, -amount, 0);
+        maker->frozen     -= amount;
+        maker->deal_stock += amount;
+        maker->deal_money += deal;
+        maker->deal_fee   += ask_fee;
 
-        balance_sub(maker->user_id, BALANCE_TYPE_FROZEN, m->stock, amount);
+        change_balance(m, JOURNAL_BALANCE_SUB, maker->user_id, BALANCE_TYPE_FROZEN, m->stock_id, amount, amount_prec);
         if (real) {
-            append_balance_trade_sub(maker, m->stock, amount, price, amount);
+            append_balance_trade_sub(m, maker, m->stock_id, amount, amount_prec, price, amount);
         }
-        balance_add(maker->user_id, BALANCE_TYPE_AVAILABLE, m->money, deal);
+        change_balance(m, JOURNAL_BALANCE_ADD, maker->user_id, BALANCE_TYPE_AVAILABLE, m->money_id, deal, deal_prec);
         if (real) {
-            append_balance_trade_add(maker, m->money, deal, price, amount);
+            append_balance_trade_add(m, maker, m->money_id, deal, deal_prec, price, amount);
         }
-        if (mpd_cmp(ask_fee, mpd_zero, &mpd_ctx) > 0) {
-            balance_sub(maker->user_id, BALANCE_TYPE_AVAILABLE, m->money, ask_fee);
+        if (ask_fee > 0) {
+            change_balance(m, JOURNAL_BALANCE_SUB, maker->user_id, BALANCE_TYPE_AVAILABLE, m->money_id, ask_fee, ask_fee_prec);
             if (real) {
-                append_balance_trade_fee(maker, m->money, ask_fee, price, amount, maker->maker_fee);
+                append_balance_trade_fee(m, maker, m->money_id, ask_fee, ask_fee_prec, price, amount, maker->maker_fee);
             }
         }
 
-        if (mpd_cmp(maker->left, mpd_zero, &mpd_ctx) == 0) {
+        if (maker->left == 0) {
             if (real) {
-                push_order_message(ORDER_EVENT_FINISH, maker, m);
+                push_order(m, ORDER_EVENT_FINISH, maker);
             }
             order_finish(real, m, maker);
         } else {
             if (real) {
-                push_order_message(ORDER_EVENT_UPDATE, maker, m);
+                push_order(m, ORDER_EVENT_UPDATE, maker);
             }
         }
     }
-    skiplist_release_iterator(iter);
-
-    mpd_del(amount);
-    mpd_del(price);
-    mpd_del(deal);
-    mpd_del(ask_fee);
-    mpd_del(bid_fee);
-    mpd_del(result);
 
     return 0;
 }
 
-int market_put_market_order(bool real, json_t **result, market_t *m, uint32_t user_id, uint32_t side, mpd_t *amount, mpd_t *taker_fee, const char *source)
+int market_put_market_order(bool real, json_t **result, market_t *m, uint32_t user_id, uint32_t side, fixed_t amount, fixed_t taker_fee, const char *source)
 {
+    // read without a lock on a matching thread, see check_limit_order
     if (side == MARKET_ORDER_SIDE_ASK) {
-        mpd_t *balance = balance_get(user_id, BALANCE_TYPE_AVAILABLE, m->stock);
-        if (!balance || mpd_cmp(balance, amount, &mpd_ctx) < 0) {
+        fixed_t *balance = balance_get(user_id, BALANCE_TYPE_AVAILABLE, m->stock_id);
+        if (!balance || fixed_cmp(*balance, settings.assets[m->stock_id].prec_save, amount, m->stock_prec) < 0) {
             return -1;
         }
 
-        skiplist_iter *iter = skiplist_get_iterator(m->bids);
-        skiplist_node *node = skiplist_next(iter);
-        if (node == NULL) {
-            skiplist_release_iterator(iter);
+        if (book_first(m->bids) == NULL) {
             return -3;
         }
-        skiplist_release_iterator(iter);
 
-        if (mpd_cmp(amount, m->min_amount, &mpd_ctx) < 0) {
+        if (amount < m->min_amount) {
             return -2;
         }
     } else {
-        mpd_t *balance = balance_get(user_id, BALANCE_TYPE_AVAILABLE, m->money);
-        if (!balance || mpd_cmp(balance, amount, &mpd_ctx) < 0) {
+        fixed_t *balance = balance_get(user_id, BALANCE_TYPE_AVAILABLE, m->money_id);
+        if (!balance || fixed_cmp(*balance, settings.assets[m->money_id].prec_save, amount, m->stock_prec) < 0) {
             return -1;
         }
 
-        skiplist_iter *iter = skiplist_get_iterator(m->asks);
-        skiplist_node *node = skiplist_next(iter);
-        if (node == NULL) {
-            skiplist_release_iterator(iter);
+        order_t *order = book_first(m->asks);
+        if (order == NULL) {
             return -3;
         }
-        skiplist_release_iterator(iter);
 
-        order_t *order = node->value;
-        mpd_t *require = mpd_new(&mpd_ctx);
-        mpd_mul(require, order->price, m->min_amount, &mpd_ctx);
-        if (mpd_cmp(amount, require, &mpd_ctx) < 0) {
-            mpd_del(require);
+        fixed_t require = order->price * m->min_amount;
+        if (fixed_cmp(amount, m->stock_prec, require, m->stock_prec + m->money_prec) < 0) {
             return -2;
         }
-        mpd_del(require);
     }
 
-    order_t *order = malloc(sizeof(order_t));
+    order_t *order = order_alloc(m);
     if (order == NULL) {
         return -__LINE__;
     }
 
-    order->id           = ++order_id_start;
+    order->id           = next_order_id(m);
     order->type         = MARKET_ORDER_TYPE_MARKET;
     order->side         = side;
     order->create_time  = current_timestamp();
     order->update_time  = order->create_time;
-    order->market       = strdup(m->name);
-    order->source       = strdup(source);
+    order->market_id    = m->id;
+    snprintf(order->source, sizeof(order->source), "%s", source);
     order->user_id      = user_id;
-    order->price        = mpd_new(&mpd_ctx);
-    order->amount       = mpd_new(&mpd_ctx);
-    order->taker_fee    = mpd_new(&mpd_ctx);
-    order->maker_fee    = mpd_new(&mpd_ctx);
-    order->left         = mpd_new(&mpd_ctx);
-    order->frozen       = mpd_new(&mpd_ctx);
-    order->deal_stock   = mpd_new(&mpd_ctx);
-    order->deal_money   = mpd_new(&mpd_ctx);
-    order->deal_fee     = mpd_new(&mpd_ctx);
-
-    mpd_copy(order->price, mpd_zero, &mpd_ctx);
-    mpd_copy(order->amount, amount, &mpd_ctx);
-    mpd_copy(order->taker_fee, taker_fee, &mpd_ctx);
-    mpd_copy(order->maker_fee, mpd_zero, &mpd_ctx);
-    mpd_copy(order->left, amount, &mpd_ctx);
-    mpd_copy(order->frozen, mpd_zero, &mpd_ctx);
-    mpd_copy(order->deal_stock, mpd_zero, &mpd_ctx);
-    mpd_copy(order->deal_money, mpd_zero, &mpd_ctx);
-    mpd_copy(order->deal_fee, mpd_zero, &mpd_ctx);
+    order->price        = 0;
+    order->amount       = amount;
+    order->taker_fee    = taker_fee;
+    order->maker_fee    = 0;
+    order->left         = amount;
+    order->frozen       = 0;
+    order->deal_stock   = 0;
+    order->deal_money   = 0;
+    order->deal_fee     = 0;
 
     int ret;
     if (side == MARKET_ORDER_SIDE_ASK) {
@@ -959,38 +1520,127 @@ int market_put_market_order(bool real, json_t **result, market_t *m, uint32_t us
     }
     if (ret < 0) {
         log_error("execute order: %"PRIu64" fail: %d", order->id, ret);
-        order_free(order);
+        order_free(m, order);
         return -__LINE__;
     }
 
     if (real) {
-        int ret = append_order_history(order);
-        if (ret < 0) {
-            log_fatal("append_order_history fail: %d, order: %"PRIu64"", ret, order->id);
-        }
-        push_order_message(ORDER_EVENT_FINISH, order, m);
-        *result = get_order_info(order);
+        append_order(m, order);
+        push_order(m, ORDER_EVENT_FINISH, order);
+        *result = get_order_info(m, order);
     }
 
-    order_free(order);
+    order_free(m, order);
     return 0;
 }
 
 int market_cancel_order(bool real, json_t **result, market_t *m, order_t *order)
 {
     if (real) {
-        push_order_message(ORDER_EVENT_FINISH, order, m);
-        *result = get_order_info(order);
+        push_order(m, ORDER_EVENT_FINISH, order);
+        *result = get_order_info(m, order);
     }
     order_finish(real, m, order);
     return 0;
 }
 
+int market_cancel_all_order(bool real, json_t **result, market_t *m, uint32_t user_id)
+{
+    if (real) {
+        *result = json_array();
+    }
+
+    order_list_t *list = market_get_order_list(m, user_id);
+    if (list == NULL || list->count == 0)
+        return 0;
+
+    // the list goes away with the last order
+    size_t count = list->count;
+    order_t **orders = malloc(sizeof(order_t *) * count);
+    if (orders == NULL)
+        return -__LINE__;
+
+    size_t i = 0;
+    for (order_t *order = list->head; order; order = order->user_next) {
+        orders[i++] = order;
+    }
+
+    if (real) {
+        if (m->journal) {
+            for (i = 0; i < count; ++i) {
+                push_order(m, ORDER_EVENT_FINISH, orders[i]);
+            }
+        } else {
+            push_order_message_batch(ORDER_EVENT_FINISH, orders, count, m);
+        }
+    }
+    for (i = 0; i < count; ++i) {
+        if (real) {
+            json_array_append_new(*result, json_integer(orders[i]->id));
+        }
+        int ret = order_finish(real, m, orders[i]);
+        if (ret < 0) {
+            log_fatal("order_finish fail: %d, order: %"PRIu64"", ret, orders[i]->id);
+            free(orders);
+            return -__LINE__;
+        }
+    }
+    free(orders);
+
+    return count;
+}
+
+int market_replace_order(bool real, json_t **result, market_t *m, order_t *order, uint32_t side, fixed_t amount, fixed_t price, fixed_t taker_fee, fixed_t maker_fee, const char *source)
+{
+    uint32_t user_id = order->user_id;
+    int ret = check_limit_order(m, user_id, side, amount, price, order);
+    if (ret < 0) {
+        return ret;
+    }
+
+    json_t *cancel = NULL;
+    if (real) {
+        push_order(m, ORDER_EVENT_FINISH, order);
+        cancel = get_order_info(m, order);
+    }
+    order_finish(real, m, order);
+
+    // it is checked with the frozen balance of order, which is released now
+    json_t *put = NULL;
+    ret = put_limit_order(real, &put, m, user_id, side, amount, price, taker_fee, maker_fee, source);
+    if (ret < 0) {
+        log_fatal("market_put_limit_order fail: %d, user: %u", ret, user_id);
+        if (cancel) {
+            json_decref(cancel);
+        }
+        return -__LINE__;
+    }
+
+    if (real) {
+        *result = json_object();
+        json_object_set_new(*result, "cancel", cancel);
+        json_object_set_new(*result, "order", put);
+    }
+
+    return 0;
+}
+
 int market_put_order(market_t *m, order_t *order)
 {
     return order_put(m, order);
 }
 
+order_t *market_alloc_order(market_t *m)
+{
+    order_t *order = order_alloc(m);
+    if (order) {
+        memset(order, 0, sizeof(order_t));
+        order->market_id = m->id;
+        order->slice_epoch = slice_epoch;
+    }
+    return order;
+}
+
 order_t *market_get_order(market_t *m, uint64_t order_id)
 {
     struct dict_order_key key = { .order_id = order_id };
@@ -1001,7 +1651,7 @@ order_t *market_get_order(market_t *m, uint64_t order_id)
     return NULL;
 }
 
-skiplist_t *market_get_order_list(market_t *m, uint32_t user_id)
+order_list_t *market_get_order_list(market_t *m, uint32_t user_id)
 {
     struct dict_user_key key = { .user_id = user_id };
     dict_entry *entry = dict_find(m->users, &key);
@@ -1011,34 +1661,128 @@ skiplist_t *market_get_order_list(market_t *m, uint32_t user_id)
     return NULL;
 }
 
-int market_get_status(market_t *m, size_t *ask_count, mpd_t *ask_amount, size_t *bid_count, mpd_t *bid_amount)
+skiplist_t *market_get_depth_ladder(market_t *m, uint32_t side, fixed_t interval)
 {
-    *ask_count = m->asks->len;
-    *bid_count = m->bids->len;
-    mpd_copy(ask_amount, mpd_zero, &mpd_ctx);
-    mpd_copy(bid_amount, mpd_zero, &mpd_ctx);
+    for (size_t i = 0; i < m->ladder_num; ++i) {
+        if (m->ladders[i].interval == interval) {
+            return side == MARKET_ORDER_SIDE_ASK ? m->ladders[i].asks : m->ladders[i].bids;
+        }
+    }
+    return NULL;
+}
+
+static json_t *get_depth_levels(market_t *m, skiplist_t *list)
+{
+    json_t *levels = json_array();
+    skiplist_node *node;
+    skiplist_iter *iter = skiplist_get_iterator(list);
+    while ((node = skiplist_next(iter)) != NULL) {
+        order_level_t *level = node->value;
+        json_t *info = json_array();
+        json_array_append_new_fixed(info, level->price, m->money_prec);
+        json_array_append_new_fixed(info, level->left, m->stock_prec);
+        json_array_append_new(levels, info);
+    }
+    skiplist_release_iterator(iter);
+
+    return levels;
+}
+
+json_t *market_get_depth_snapshot(market_t *m)
+{
+    json_t *result = json_object();
+    json_object_set_new(result, "seq", json_integer(m->depth_seq));
+    json_object_set_new(result, "asks", get_depth_levels(m, m->asks));
+    json_object_set_new(result, "bids", get_depth_levels(m, m->bids));
+
+    return result;
+}
+
+json_t *market_get_depth_update(market_t *m)
+{
+    if (m->depth_change_num == 0)
+        return NULL;
+
+    json_t *asks = json_array();
+    json_t *bids = json_array();
+    for (size_t i = 0; i < m->depth_change_num; ++i) {
+        depth_change_t *change = &m->depth_changes[i];
+        skiplist_t *list = change->side == MARKET_ORDER_SIDE_ASK ? m->asks : m->bids;
+        order_level_t key = { .price = change->price };
+        fixed_t left = 0;
+        skiplist_node *node = skiplist_find(list, &key);
+        if (node) {
+            order_level_t *level = node->value;
+            // the level was removed and put again, it is reported once
+            if (!level->changed)
+                continue;
+            level->changed = false;
+            left = level->left;
+        }
+
+        json_t *info = json_array();
+        json_array_append_new_fixed(info, change->price, m->money_prec);
+        json_array_append_new_fixed(info, left, m->stock_prec);
+        json_array_append_new(change->side == MARKET_ORDER_SIDE_ASK ? asks : bids, info);
+    }
+    m->depth_change_num = 0;
+    m->depth_seq += 1;
+
+    json_t *result = json_object();
+    json_object_set_new(result, "seq", json_integer(m->depth_seq));
+    json_object_set_new(result, "asks", asks);
+    json_object_set_new(result, "bids", bids);
+
+    return result;
+}
+
+int market_get_status(market_t *m, size_t *ask_count, fixed_t *ask_amount, size_t *bid_count, fixed_t *bid_amount)
+{
+    *ask_count = m->ask_count;
+    *bid_count = m->bid_count;
+    *ask_amount = 0;
+    *bid_amount = 0;
 
     skiplist_node *node;
     skiplist_iter *iter = skiplist_get_iterator(m->asks);
     while ((node = skiplist_next(iter)) != NULL) {
-        order_t *order = node->value;
-        mpd_add(ask_amount, ask_amount, order->left, &mpd_ctx);
+        order_level_t *level = node->value;
+        *ask_amount += level->left;
     }
     skiplist_release_iterator(iter);
 
     iter = skiplist_get_iterator(m->bids);
     while ((node = skiplist_next(iter)) != NULL) {
-        order_t *order = node->value;
-        mpd_add(bid_amount, bid_amount, order->left, &mpd_ctx);
+        order_level_t *level = node->value;
+        *bid_amount += level->left;
     }
+    skiplist_release_iterator(iter);
 
     return 0;
 }
 
+market_t *market_pop_changed(void)
+{
+    market_t *m = __atomic_load_n(&changed_markets, __ATOMIC_ACQUIRE);
+    if (m == NULL)
+        return NULL;
+    __atomic_store_n(&changed_markets, m->next_changed, __ATOMIC_RELAXED);
+    m->next_changed = NULL;
+    m->book_changed = false;
+    return m;
+}
+
 sds market_status(sds reply)
 {
     reply = sdscatprintf(reply, "order last ID: %"PRIu64"\n", order_id_start);
     reply = sdscatprintf(reply, "deals last ID: %"PRIu64"\n", deals_id_start);
+    for (size_t i = 0; i < settings.market_num; ++i) {
+        market_t *m = get_market_by_id(i);
+        if (m == NULL)
+            continue;
+        reply = sdscatprintf(reply, "market: %s order pool slab: %u, used: %"PRIu64", free: %u, trimmed: %"PRIu64"\n",
+                m->name, m->pool.slab_num, m->pool.used, m->pool.free, m->pool.trim_total);
+    }
     return reply;
 }
 
@@ -11,6 +11,9 @@
 extern uint64_t order_id_start;
 extern uint64_t deals_id_start;
 
+struct order_level_t;
+struct match_journal_t;
+
 typedef struct order_t {
     uint64_t        id;
     uint32_t        type;
@@ -18,48 +21,188 @@ typedef struct order_t {
     double          create_time;
     double          update_time;
     uint32_t        user_id;
-    char            *market;
-    char            *source;
-    mpd_t           *price;
-    mpd_t           *amount;
-    mpd_t           *taker_fee;
-    mpd_t           *maker_fee;
-    mpd_t           *left;
-    mpd_t           *frozen;
-    mpd_t           *deal_stock;
-    mpd_t           *deal_money;
-    mpd_t           *deal_fee;
+    uint32_t        market_id;
+    char            source[SOURCE_MAX_LEN + 1];
+
+    /* scaled by the market precisions, see order_*_prec */
+    fixed_t         price;
+    fixed_t         amount;
+    fixed_t         taker_fee;
+    fixed_t         maker_fee;
+    fixed_t         left;
+    fixed_t         frozen;
+    fixed_t         deal_stock;
+    fixed_t         deal_money;
+    fixed_t         deal_fee;
+
+    /* the price level the order rests in and its neighbours in time priority */
+    struct order_level_t *level;
+    struct order_t  *prev;
+    struct order_t  *next;
+    /* the open orders of the user in the market, newest first */
+    struct order_t  *user_prev;
+    struct order_t  *user_next;
+
+    /* the slice the order was last saved to, see slice_save_order */
+    uint32_t        slice_epoch;
 } order_t;
 
+/* all orders of one side at the same price, left is the sum of their left */
+typedef struct order_level_t {
+    fixed_t         price;
+    fixed_t         left;
+    size_t          count;
+    order_t         *head;
+    order_t         *tail;
+    /* already in the depth change list of the market */
+    bool            changed;
+} order_level_t;
+
+/*
+ * the open orders of a user in a market, the key of market_t->users is user_id.
+ * a user with many orders gets a rank index over the chain for paging.
+ */
+typedef struct order_list_t {
+    uint32_t        user_id;
+    uint32_t        count;
+    uint32_t        ask_count;
+    order_t         *head;
+    /* order_t newest first, kept from more than ORDER_LIST_INDEX_MAX orders down to ORDER_LIST_INDEX_MIN */
+    skiplist_t      *index;
+} order_list_t;
+
+/* a price level changed since the last depth update */
+typedef struct depth_change_t {
+    uint32_t        side;
+    fixed_t         price;
+} depth_change_t;
+
+/* levels merged to multiples of interval, asks round up and bids down, count is the number of orders */
+typedef struct depth_ladder_t {
+    fixed_t         interval;
+    skiplist_t      *asks;
+    skiplist_t      *bids;
+} depth_ladder_t;
+
+/* a slab of order records, used is the number of them allocated */
+typedef struct order_slab_t {
+    order_t         *records;
+    uint32_t        used;
+    bool            trim;
+} order_slab_t;
+
+/*
+ * order records are carved from slabs and recycled, similar with nw_cache.
+ * empty slabs are freed by market_trim_pool when the pool is mostly free.
+ */
+typedef struct order_pool_t {
+    uint32_t        slab_num;
+    uint32_t        slab_max;
+    /* sorted by the address of the records */
+    order_slab_t    *slabs;
+    uint64_t        used;
+    uint32_t        free;
+    uint32_t        free_total;
+    order_t         **free_arr;
+    uint64_t        trim_total;
+} order_pool_t;
+
 typedef struct market_t {
+    uint32_t        id;
     char            *name;
     char            *stock;
     char            *money;
+    /* resolved once, for the balances */
+    int             stock_id;
+    int             money_id;
 
     int             stock_prec;
     int             money_prec;
     int             fee_prec;
-    mpd_t           *min_amount;
+    fixed_t         min_amount;
 
     dict_t          *orders;
     dict_t          *users;
 
+    /* order_level_t sorted by price, best first, the weight of a level is its count */
     skiplist_t      *asks;
     skiplist_t      *bids;
+    size_t          ask_count;
+    size_t          bid_count;
+
+    /* bumped by every change of the book */
+    uint64_t        book_version;
+    /* linked in the changed list from the first change after the last market_pop_changed */
+    bool            book_changed;
+    struct market_t *next_changed;
+
+    /* one ladder for each configured depth_merge interval */
+    size_t          ladder_num;
+    depth_ladder_t  *ladders;
+
+    order_pool_t    pool;
+
+    /* levels changed since the last depth update, only kept when depth_track is set */
+    bool            depth_track;
+    uint64_t        depth_seq;
+    size_t          depth_change_num;
+    size_t          depth_change_max;
+    depth_change_t  *depth_changes;
+
+    /* the matching thread of the market, and the journal of the command it runs, see me_match */
+    int             shard;
+    struct match_journal_t *journal;
 } market_t;
 
-market_t *market_create(struct market *conf);
-int market_get_status(market_t *m, size_t *ask_count, mpd_t *ask_amount, size_t *bid_count, mpd_t *bid_amount);
+market_t *market_create(struct market *conf, uint32_t id);
+int market_get_status(market_t *m, size_t *ask_count, fixed_t *ask_amount, size_t *bid_count, fixed_t *bid_amount);
 
-int market_put_limit_order(bool real, json_t **result, market_t *m, uint32_t user_id, uint32_t side, mpd_t *amount, mpd_t *price, mpd_t *taker_fee, mpd_t *maker_fee, const char *source);
-int market_put_market_order(bool real, json_t **result, market_t *m, uint32_t user_id, uint32_t side, mpd_t *amount, mpd_t *taker_fee, const char *source);
+/* amount is scaled by stock_prec, price by money_prec and fees by fee_prec */
+int market_put_limit_order(bool real, json_t **result, market_t *m, uint32_t user_id, uint32_t side, fixed_t amount, fixed_t price, fixed_t taker_fee, fixed_t maker_fee, const char *source);
+int market_put_market_order(bool real, json_t **result, market_t *m, uint32_t user_id, uint32_t side, fixed_t amount, fixed_t taker_fee, const char *source);
 int market_cancel_order(bool real, json_t **result, market_t *m, order_t *order);
+/* cancel all orders of user in the market, result is the array of cancelled order ids, return the count */
+int market_cancel_all_order(bool real, json_t **result, market_t *m, uint32_t user_id);
+/* cancel order and put a limit order for its user, nothing is done if the new order would fail */
+int market_replace_order(bool real, json_t **result, market_t *m, order_t *order, uint32_t side, fixed_t amount, fixed_t price, fixed_t taker_fee, fixed_t maker_fee, const char *source);
 
 int market_put_order(market_t *m, order_t *order);
+order_t *market_alloc_order(market_t *m);
+/* free the empty slabs of the order pool, called from a timer, return the number freed */
+uint32_t market_trim_pool(market_t *m);
+/* take a market whose book changed, NULL when there is none left, on the main thread out of a batch */
+market_t *market_pop_changed(void);
 
-json_t *get_order_info(order_t *order);
+/*
+ * precision of the order fields, it follows the order state the same way
+ * the decimal exponent did: products are scaled by the sum of the
+ * precisions and values that are still zero have precision 0.
+ * amount is always stock_prec and taker_fee fee_prec.
+ */
+int order_price_prec(market_t *m, order_t *order);
+int order_maker_fee_prec(market_t *m, order_t *order);
+int order_left_prec(market_t *m, order_t *order);
+int order_frozen_prec(market_t *m, order_t *order);
+int order_deal_stock_prec(market_t *m, order_t *order);
+int order_deal_money_prec(market_t *m, order_t *order);
+int order_deal_fee_prec(market_t *m, order_t *order);
+
+json_t *get_order_info(market_t *m, order_t *order);
 order_t *market_get_order(market_t *m, uint64_t id);
-skiplist_t *market_get_order_list(market_t *m, uint32_t user_id);
+order_list_t *market_get_order_list(market_t *m, uint32_t user_id);
+/* the order at offset of the list, newest first, NULL if there are not so many */
+order_t *order_list_get(order_list_t *list, size_t offset);
+
+/*
+ * depth updates: the snapshot is every level of the book with the current
+ * sequence, each update carries the levels changed since the previous one
+ * with amount 0 for removed levels and the next sequence.
+ */
+/* merged levels of the side for interval, NULL if the interval is not kept */
+skiplist_t *market_get_depth_ladder(market_t *m, uint32_t side, fixed_t interval);
+
+json_t *market_get_depth_snapshot(market_t *m);
+json_t *market_get_depth_update(market_t *m);
 
 sds market_status(sds reply);
 
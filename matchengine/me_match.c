@@ -0,0 +1,436 @@
+/*
+ * Description: matching threads, the markets are sharded to them
+ */
+
+# include "me_match.h"
+# include "me_balance.h"
+# include "me_history.h"
+# include "me_message.h"
+# include "me_persist.h"
+# include "me_trade.h"
+
+# include <pthread.h>
+
+/* records of the journal are kept 16 bytes aligned for fixed_t */
+# define JOURNAL_ALIGN(size)    (((size) + 15) & ~(size_t)15)
+
+enum {
+    JOURNAL_BALANCE_HISTORY = 16,
+    JOURNAL_ORDER_HISTORY,
+    JOURNAL_ORDER_MESSAGE,
+    JOURNAL_DEAL,
+    JOURNAL_SLICE_ORDER,
+    JOURNAL_MONITOR,
+};
+
+struct journal_head {
+    int         type;
+    uint32_t    size;
+};
+
+struct journal_balance {
+    struct journal_head head;
+    uint32_t    user_id;
+    uint32_t    type;
+    int         asset_id;
+    int         prec;
+    fixed_t     amount;
+};
+
+struct journal_balance_history {
+    struct journal_head head;
+    double      time;
+    uint32_t    user_id;
+    int         asset_id;
+    char        *detail;
+    int         prec;
+    fixed_t     change;
+};
+
+struct journal_order {
+    struct journal_head head;
+    uint32_t    event;
+    order_t     order;
+};
+
+struct journal_deal {
+    struct journal_head head;
+    double      time;
+    int         side;
+    int         ask_role;
+    int         bid_role;
+    fixed_t     price;
+    fixed_t     amount;
+    fixed_t     deal;
+    fixed_t     ask_fee;
+    fixed_t     bid_fee;
+    order_t     ask;
+    order_t     bid;
+};
+
+struct journal_monitor {
+    struct journal_head head;
+    const char  *key;
+    int         val;
+};
+
+static int thread_num;
+static pthread_t *threads;
+static pthread_mutex_t lock;
+static pthread_cond_t start_notify;
+static pthread_cond_t done_notify;
+static uint64_t batch_seq;
+static int batch_busy;
+static bool batch_running;
+static bool stop;
+
+static match_task_t *batch_tasks;
+static size_t batch_count;
+static match_fn batch_fn;
+
+static uint64_t task_total;
+static uint64_t batch_total;
+
+static void *journal_add(match_journal_t *j, int type, size_t size)
+{
+    size = JOURNAL_ALIGN(size);
+    if (j->size + size > j->max) {
+        size_t new_max = j->max ? j->max * 2 : 4096;
+        while (new_max < j->size + size) {
+            new_max *= 2;
+        }
+        char *buf = realloc(j->buf, new_max);
+        if (buf == NULL) {
+            log_fatal("journal grow to: %zu fail", new_max);
+            return NULL;
+        }
+        j->buf = buf;
+        j->max = new_max;
+    }
+
+    struct journal_head *head = (struct journal_head *)(j->buf + j->size);
+    head->type = type;
+    head->size = size;
+    j->size += size;
+
+    return head;
+}
+
+void journal_balance(match_journal_t *j, int op, uint32_t user_id, uint32_t type, int asset_id, fixed_t amount, int prec)
+{
+    struct journal_balance *r = journal_add(j, op, sizeof(struct journal_balance));
+    if (r == NULL)
+        return;
+    r->user_id = user_id;
+    r->type = type;
+    r->asset_id = asset_id;
+    r->amount = amount;
+    r->prec = prec;
+}
+
+void journal_balance_history(match_journal_t *j, double t, uint32_t user_id, int asset_id, fixed_t change, int prec, char *detail)
+{
+    struct journal_balance_history *r = journal_add(j, JOURNAL_BALANCE_HISTORY, sizeof(struct journal_balance_history));
+    if (r == NULL) {
+        free(detail);
+        return;
+    }
+    r->time = t;
+    r->user_id = user_id;
+    r->asset_id = asset_id;
+    r->change = change;
+    r->prec = prec;
+    r->detail = detail;
+}
+
+void journal_order_history(match_journal_t *j, order_t *order)
+{
+    struct journal_order *r = journal_add(j, JOURNAL_ORDER_HISTORY, sizeof(struct journal_order));
+    if (r == NULL)
+        return;
+    r->event = 0;
+    memcpy(&r->order, order, sizeof(order_t));
+}
+
+void journal_order_message(match_journal_t *j, uint32_t event, order_t *order)
+{
+    struct journal_order *r = journal_add(j, JOURNAL_ORDER_MESSAGE, sizeof(struct journal_order));
+    if (r == NULL)
+        return;
+    r->event = event;
+    memcpy(&r->order, order, sizeof(order_t));
+}
+
+void journal_deal(match_journal_t *j, double t, int side, order_t *ask, int ask_role, order_t *bid, int bid_role,
+        fixed_t price, fixed_t amount, fixed_t deal, fixed_t ask_fee, fixed_t bid_fee)
+{
+    struct journal_deal *r = journal_add(j, JOURNAL_DEAL, sizeof(struct journal_deal));
+    if (r == NULL)
+        return;
+    r->time = t;
+    r->side = side;
+    r->ask_role = ask_role;
+    r->bid_role = bid_role;
+    r->price = price;
+    r->amount = amount;
+    r->deal = deal;
+    r->ask_fee = ask_fee;
+    r->bid_fee = bid_fee;
+    memcpy(&r->ask, ask, sizeof(order_t));
+    memcpy(&r->bid, bid, sizeof(order_t));
+}
+
+void journal_slice_order(match_journal_t *j, order_t *order)
+{
+    struct journal_order *r = journal_add(j, JOURNAL_SLICE_ORDER, sizeof(struct journal_order));
+    if (r == NULL)
+        return;
+    r->event = 0;
+    memcpy(&r->order, order, sizeof(order_t));
+}
+
+void journal_monitor(match_journal_t *j, const char *key, int val)
+{
+    struct journal_monitor *r = journal_add(j, JOURNAL_MONITOR, sizeof(struct journal_monitor));
+    if (r == NULL)
+        return;
+    r->key = key;
+    r->val = val;
+}
+
+static int apply_balance(struct journal_balance *r)
+{
+    fixed_t *result = NULL;
+    switch (r->head.type) {
+    case JOURNAL_BALANCE_ADD:
+        result = balance_add(r->user_id, r->type, r->asset_id, r->amount, r->prec);
+        break;
+    case JOURNAL_BALANCE_SUB:
+        result = balance_sub(r->user_id, r->type, r->asset_id, r->amount, r->prec);
+        break;
+    case JOURNAL_BALANCE_FREEZE:
+        result = balance_freeze(r->user_id, r->asset_id, r->amount, r->prec);
+        break;
+    case JOURNAL_BALANCE_UNFREEZE:
+        result = balance_unfreeze(r->user_id, r->asset_id, r->amount, r->prec);
+        break;
+    }
+    if (result == NULL) {
+        log_fatal("apply balance: %d, user: %u, asset: %s fail", r->head.type, r->user_id, settings.assets[r->asset_id].name);
+        return -__LINE__;
+    }
+
+    return 0;
+}
+
+int journal_apply(match_journal_t *j, market_t *m)
+{
+    int ret = 0;
+    size_t offset = 0;
+    while (offset < j->size) {
+        struct journal_head *head = (struct journal_head *)(j->buf + offset);
+        offset += head->size;
+
+        switch (head->type) {
+        case JOURNAL_BALANCE_ADD:
+        case JOURNAL_BALANCE_SUB:
+        case JOURNAL_BALANCE_FREEZE:
+        case JOURNAL_BALANCE_UNFREEZE:
+            if (apply_balance((struct journal_balance *)head) < 0) {
+                ret = -__LINE__;
+            }
+            break;
+        case JOURNAL_BALANCE_HISTORY:
+        {
+            struct journal_balance_history *r = (struct journal_balance_history *)head;
+            append_user_balance_history(r->time, r->user_id, r->asset_id, "trade", r->change, r->prec, r->detail);
+            free(r->detail);
+            break;
+        }
+        case JOURNAL_ORDER_HISTORY:
+        {
+            struct journal_order *r = (struct journal_order *)head;
+            if (append_order_history(m, &r->order) < 0) {
+                log_fatal("append_order_history fail, order: %"PRIu64"", r->order.id);
+            }
+            break;
+        }
+        case JOURNAL_ORDER_MESSAGE:
+        {
+            struct journal_order *r = (struct journal_order *)head;
+            push_order_message(r->event, &r->order, m);
+            break;
+        }
+        case JOURNAL_DEAL:
+        {
+            struct journal_deal *r = (struct journal_deal *)head;
+            uint64_t deal_id = ++deals_id_start;
+            append_order_deal_history(r->time, deal_id, m, &r->ask, r->ask_role, &r->bid, r->bid_role,
+                    r->price, r->amount, r->deal, r->ask_fee, r->bid_fee);
+            push_deal_message(r->time, deal_id, m, r->side, &r->ask, &r->bid,
+                    r->price, r->amount, r->deal, r->ask_fee, r->bid_fee);
+            break;
+        }
+        case JOURNAL_SLICE_ORDER:
+        {
+            struct journal_order *r = (struct journal_order *)head;
+            slice_add_order(&r->order);
+            break;
+        }
+        case JOURNAL_MONITOR:
+        {
+            struct journal_monitor *r = (struct journal_monitor *)head;
+            monitor_inc(r->key, r->val);
+            break;
+        }
+        default:
+            log_fatal("unknown journal record: %d", head->type);
+            ret = -__LINE__;
+            break;
+        }
+    }
+    j->size = 0;
+    j->order_id = 0;
+
+    return ret;
+}
+
+void journal_free(match_journal_t *j)
+{
+    free(j->buf);
+    memset(j, 0, sizeof(match_journal_t));
+}
+
+static void run_shard(int shard)
+{
+    for (size_t i = 0; i < batch_count; ++i) {
+        match_task_t *task = &batch_tasks[i];
+        market_t *m = task->market;
+        if (m->shard != shard)
+            continue;
+        m->journal = &task->journal;
+        batch_fn(m, task->privdata);
+        m->journal = NULL;
+    }
+}
+
+static void *match_thread_routine(void *arg)
+{
+    int shard = (intptr_t)arg;
+    uint64_t seq = 0;
+
+    pthread_mutex_lock(&lock);
+    while (true) {
+        while (batch_seq == seq && !stop) {
+            pthread_cond_wait(&start_notify, &lock);
+        }
+        if (stop)
+            break;
+        seq = batch_seq;
+        pthread_mutex_unlock(&lock);
+
+        run_shard(shard);
+
+        pthread_mutex_lock(&lock);
+        batch_busy -= 1;
+        if (batch_busy == 0) {
+            pthread_cond_signal(&done_notify);
+        }
+    }
+    pthread_mutex_unlock(&lock);
+
+    return NULL;
+}
+
+bool match_enabled(void)
+{
+    return settings.match_thread > 1;
+}
+
+void match_run(match_task_t *tasks, size_t count, match_fn fn)
+{
+    task_total += count;
+    batch_total += 1;
+
+    __atomic_store_n(&batch_running, true, __ATOMIC_RELAXED);
+    pthread_mutex_lock(&lock);
+    batch_tasks = tasks;
+    batch_count = count;
+    batch_fn = fn;
+    batch_busy = thread_num;
+    batch_seq += 1;
+    pthread_cond_broadcast(&start_notify);
+    pthread_mutex_unlock(&lock);
+
+    // the first shard is run by the main thread
+    run_shard(0);
+
+    pthread_mutex_lock(&lock);
+    while (batch_busy > 0) {
+        pthread_cond_wait(&done_notify, &lock);
+    }
+    batch_tasks = NULL;
+    batch_count = 0;
+    pthread_mutex_unlock(&lock);
+    __atomic_store_n(&batch_running, false, __ATOMIC_RELAXED);
+}
+
+bool match_running(void)
+{
+    return __atomic_load_n(&batch_running, __ATOMIC_RELAXED);
+}
+
+int init_match(void)
+{
+    for (size_t i = 0; i < settings.market_num; ++i) {
+        market_t *m = get_market_by_id(i);
+        if (m == NULL)
+            return -__LINE__;
+        m->shard = i % settings.match_thread;
+    }
+    if (!match_enabled())
+        return 0;
+
+    pthread_mutex_init(&lock, NULL);
+    pthread_cond_init(&start_notify, NULL);
+    pthread_cond_init(&done_notify, NULL);
+
+    thread_num = settings.match_thread - 1;
+    threads = malloc(sizeof(pthread_t) * thread_num);
+    if (threads == NULL)
+        return -__LINE__;
+    for (int i = 0; i < thread_num; ++i) {
+        if (pthread_create(&threads[i], NULL, match_thread_routine, (void *)(intptr_t)(i + 1)) != 0)
+            return -__LINE__;
+    }
+
+    return 0;
+}
+
+int fini_match(void)
+{
+    if (!match_enabled())
+        return 0;
+
+    pthread_mutex_lock(&lock);
+    stop = true;
+    pthread_cond_broadcast(&start_notify);
+    pthread_mutex_unlock(&lock);
+    for (int i = 0; i < thread_num; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    threads = NULL;
+
+    return 0;
+}
+
+sds match_status(sds reply)
+{
+    reply = sdscatprintf(reply, "match thread: %d\n", settings.match_thread);
+    if (match_enabled()) {
+        reply = sdscatprintf(reply, "match batch: %"PRIu64", task: %"PRIu64"\n", batch_total, task_total);
+    }
+    return reply;
+}
+
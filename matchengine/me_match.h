@@ -0,0 +1,73 @@
+/*
+ * Description: matching threads, the markets are sharded to them
+ */
+
+# ifndef _ME_MATCH_H_
+# define _ME_MATCH_H_
+
+# include "me_config.h"
+# include "me_market.h"
+
+/*
+ * a batch of commands is matched in parallel, the markets on their own
+ * threads. the changes out of the market, balances, history, messages and
+ * deal ids, are kept in the journal of the command and applied on the main
+ * thread in command order, so it is the same as the commands run one by
+ * one, except that a command only sees the balances of the batch start.
+ * so a user has one command in a batch.
+ */
+typedef struct match_journal_t {
+    /* the id of the order put by the command */
+    uint64_t        order_id;
+    size_t          size;
+    size_t          max;
+    char            *buf;
+} match_journal_t;
+
+enum {
+    JOURNAL_BALANCE_ADD = 1,
+    JOURNAL_BALANCE_SUB,
+    JOURNAL_BALANCE_FREEZE,
+    JOURNAL_BALANCE_UNFREEZE,
+};
+
+void journal_balance(match_journal_t *j, int op, uint32_t user_id, uint32_t type, int asset_id, fixed_t amount, int prec);
+/* detail is freed when the journal is applied */
+void journal_balance_history(match_journal_t *j, double t, uint32_t user_id, int asset_id, fixed_t change, int prec, char *detail);
+void journal_order_history(match_journal_t *j, order_t *order);
+void journal_order_message(match_journal_t *j, uint32_t event, order_t *order);
+/* the deal id is taken when it is applied */
+void journal_deal(match_journal_t *j, double t, int side, order_t *ask, int ask_role, order_t *bid, int bid_role,
+        fixed_t price, fixed_t amount, fixed_t deal, fixed_t ask_fee, fixed_t bid_fee);
+void journal_slice_order(match_journal_t *j, order_t *order);
+void journal_monitor(match_journal_t *j, const char *key, int val);
+
+/* apply the journal of a command of market m, the journal is empty after */
+int journal_apply(match_journal_t *j, market_t *m);
+void journal_free(match_journal_t *j);
+
+typedef struct match_task_t {
+    market_t        *market;
+    void            *privdata;
+    match_journal_t journal;
+} match_task_t;
+
+typedef void (*match_fn)(market_t *m, void *privdata);
+
+int init_match(void);
+int fini_match(void);
+
+/* more than one matching thread, the market commands are batched to match_run */
+bool match_enabled(void);
+/* run fn for the tasks on the threads of their markets in task order, return when all are done */
+void match_run(match_task_t *tasks, size_t count, match_fn fn);
+/*
+ * true while match_run runs. the matching threads read dict_balance without
+ * a lock then, so nothing may change the balances until it returns.
+ */
+bool match_running(void);
+
+sds match_status(sds reply);
+
+# endif
+
@@ -5,9 +5,13 @@
 
 # include "me_config.h"
 # include "me_message.h"
+# include "ut_event.h"
 
 # include <librdkafka/rdkafka.h>
 
+# define MESSAGE_KEY_MAX_LEN    32
+# define MESSAGE_BATCH_MAX_LEN  1000
+
 static rd_kafka_t *rk;
 
 static rd_kafka_topic_t *rkt_deals;
@@ -20,6 +24,21 @@ static list_t *list_balances;
 
 static nw_timer timer;
 
+/*
+ * a message is written straight to its json text, or packed as a ut_event
+ * if message_format of its topic is binary. the data is handed to librdkafka
+ * with RD_KAFKA_MSG_F_FREE when it is produced. the key selects the
+ * partition: the market for deals and orders, the user for balances.
+ */
+struct message {
+    bool        binary;
+    char        *data;
+    size_t      len;
+    size_t      cap;
+    char        key[MESSAGE_KEY_MAX_LEN];
+    size_t      key_len;
+};
+
 static void on_delivery(rd_kafka_t *rk, const rd_kafka_message_t *rkmessage, void *opaque)
 {
     if (rkmessage->err) {
@@ -35,22 +54,199 @@ static void on_logger(const rd_kafka_t *rk, int level, const char *fac, const ch
     log_error("RDKAFKA-%i-%s: %s: %s\n", level, fac, rk ? rd_kafka_name(rk) : NULL, buf);
 }
 
+static struct message *message_new(size_t cap)
+{
+    struct message *msg = malloc(sizeof(struct message));
+    msg->data = malloc(cap);
+    msg->len = 0;
+    msg->cap = cap;
+    msg->key_len = 0;
+    msg->binary = false;
+    return msg;
+}
+
+static void message_free(struct message *msg)
+{
+    free(msg->data);
+    free(msg);
+}
+
+/* the text for logs, nothing of a binary message */
+static int msg_text_len(struct message *msg)
+{
+    return msg->binary ? 0 : (int)msg->len;
+}
+
+static void msg_append(struct message *msg, const char *data, size_t len)
+{
+    if (msg->len + len > msg->cap) {
+        while (msg->len + len > msg->cap)
+            msg->cap *= 2;
+        msg->data = realloc(msg->data, msg->cap);
+    }
+    memcpy(msg->data + msg->len, data, len);
+    msg->len += len;
+}
+
+static void msg_begin(struct message *msg)
+{
+    msg_append(msg, "{", 1);
+}
+
+static void msg_end(struct message *msg)
+{
+    msg_append(msg, "}", 1);
+}
+
+static void msg_quote(struct message *msg, const char *str)
+{
+    msg_append(msg, "\"", 1);
+    const char *start = str;
+    for (const char *p = str; *p; ++p) {
+        unsigned char c = *p;
+        if (c >= 0x20 && c != '"' && c != '\\')
+            continue;
+        msg_append(msg, start, p - start);
+        char esc[8];
+        if (c == '"' || c == '\\') {
+            esc[0] = '\\';
+            esc[1] = c;
+            msg_append(msg, esc, 2);
+        } else {
+            msg_append(msg, esc, snprintf(esc, sizeof(esc), "\\u%04x", c));
+        }
+        start = p + 1;
+    }
+    msg_append(msg, start, strlen(start));
+    msg_append(msg, "\"", 1);
+}
+
+static void msg_key(struct message *msg, const char *key)
+{
+    if (msg->data[msg->len - 1] != '{') {
+        msg_append(msg, ",", 1);
+    }
+    msg_quote(msg, key);
+    msg_append(msg, ":", 1);
+}
+
+static void msg_str(struct message *msg, const char *key, const char *val)
+{
+    msg_key(msg, key);
+    msg_quote(msg, val);
+}
+
+static void msg_int(struct message *msg, const char *key, uint64_t val)
+{
+    char buf[32];
+    msg_key(msg, key);
+    msg_append(msg, buf, snprintf(buf, sizeof(buf), "%"PRIu64, val));
+}
+
+/* the same text as json_real */
+static void msg_real(struct message *msg, const char *key, double val)
+{
+    char buf[64];
+    int len = snprintf(buf, sizeof(buf), "%.17g", val);
+    if (strpbrk(buf, ".eE") == NULL) {
+        buf[len++] = '.';
+        buf[len++] = '0';
+    }
+    msg_key(msg, key);
+    msg_append(msg, buf, len);
+}
+
+/* the same text as json_object_set_new_fixed, trailing zeros stripped */
+static void msg_fixed(struct message *msg, const char *key, fixed_t val, int prec)
+{
+    char buf[FIXED_STR_MAX_LEN];
+    msg_str(msg, key, rstripzero(fixed_to_sci(buf, val, prec)));
+}
+
+static void msg_set_key(struct message *msg, const char *key)
+{
+    msg->key_len = strlen(key);
+    if (msg->key_len > MESSAGE_KEY_MAX_LEN)
+        msg->key_len = MESSAGE_KEY_MAX_LEN;
+    memcpy(msg->key, key, msg->key_len);
+}
+
+static void msg_set_user_key(struct message *msg, uint32_t user_id)
+{
+    msg->key_len = snprintf(msg->key, sizeof(msg->key), "%u", user_id);
+}
+
+static void set_rkmessage(rd_kafka_message_t *rkmessage, struct message *msg)
+{
+    memset(rkmessage, 0, sizeof(rd_kafka_message_t));
+    rkmessage->payload = msg->data;
+    rkmessage->len = msg->len;
+    rkmessage->key = msg->key;
+    rkmessage->key_len = msg->key_len;
+}
+
+/*
+ * produce msgs in a batch, librdkafka frees the data of the accepted ones.
+ * the messages rejected for a full queue are left in msgs to be produced
+ * again, the others are set to NULL. return the number left.
+ */
+static size_t produce_batch(rd_kafka_topic_t *topic, struct message **msgs, size_t count)
+{
+    static rd_kafka_message_t rkmessages[MESSAGE_BATCH_MAX_LEN];
+    for (size_t i = 0; i < count; ++i) {
+        set_rkmessage(&rkmessages[i], msgs[i]);
+    }
+
+    int ret = rd_kafka_produce_batch(topic, RD_KAFKA_PARTITION_UA, RD_KAFKA_MSG_F_FREE, rkmessages, count);
+    if (ret < (int)count) {
+        monitor_inc("message_push_fail", count - ret);
+    }
+
+    size_t left = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (rkmessages[i].err == RD_KAFKA_RESP_ERR_NO_ERROR) {
+            free(msgs[i]);
+            msgs[i] = NULL;
+            continue;
+        }
+        log_fatal("Failed to produce: %.*s (%zu bytes) to topic %s: %s\n", msg_text_len(msgs[i]), msgs[i]->data,
+                msgs[i]->len, rd_kafka_topic_name(topic), rd_kafka_err2str(rkmessages[i].err));
+        if (rkmessages[i].err == RD_KAFKA_RESP_ERR__QUEUE_FULL) {
+            left++;
+        } else {
+            message_free(msgs[i]);
+            msgs[i] = NULL;
+        }
+    }
+
+    return left;
+}
+
 static void produce_list(list_t *list, rd_kafka_topic_t *topic)
 {
-    list_node *node;
-    list_iter *iter = list_get_iterator(list, LIST_START_HEAD);
-    while ((node = list_next(iter)) != NULL) {
-        int ret = rd_kafka_produce(topic, 0, RD_KAFKA_MSG_F_COPY, node->value, strlen(node->value), NULL, 0, NULL);
-        if (ret == -1) {
-            log_fatal("Failed to produce: %s to topic %s: %s\n", (char *)node->value,
-                    rd_kafka_topic_name(rkt_deals), rd_kafka_err2str(rd_kafka_last_error()));
-            if (rd_kafka_last_error() == RD_KAFKA_RESP_ERR__QUEUE_FULL) {
-                break;
+    struct message *msgs[MESSAGE_BATCH_MAX_LEN];
+    while (list->len) {
+        size_t count = 0;
+        list_node *node;
+        list_iter *iter = list_get_iterator(list, LIST_START_HEAD);
+        while (count < MESSAGE_BATCH_MAX_LEN && (node = list_next(iter)) != NULL) {
+            msgs[count++] = node->value;
+            node->value = NULL;
+            list_del(list, node);
+        }
+        list_release_iterator(iter);
+
+        if (produce_batch(topic, msgs, count) == 0)
+            continue;
+
+        /* the queue is full, put the messages left back to the head in order */
+        for (size_t i = count; i > 0; --i) {
+            if (msgs[i - 1]) {
+                list_add_node_head(list, msgs[i - 1]);
             }
         }
-        list_del(list, node);
+        break;
     }
-    list_release_iterator(iter);
 }
 
 static void on_timer(nw_timer *t, void *privdata)
@@ -70,7 +266,42 @@ static void on_timer(nw_timer *t, void *privdata)
 
 static void on_list_free(void *value)
 {
-    free(value);
+    if (value) {
+        message_free(value);
+    }
+}
+
+static rd_kafka_topic_t *create_topic(const char *name)
+{
+    rd_kafka_topic_conf_t *conf = rd_kafka_topic_conf_new();
+    rd_kafka_topic_conf_set_partitioner_cb(conf, rd_kafka_msg_partitioner_consistent);
+    return rd_kafka_topic_new(rk, name, conf);
+}
+
+/*
+ * the consumers of ut_kafka read a single partition, a message keyed to
+ * another partition would never be read, so a topic must have one partition.
+ * a topic that is not there yet, or a broker that does not answer, is let
+ * through, the producer queues the messages until it is up.
+ */
+static int check_topic_partition(rd_kafka_topic_t *topic)
+{
+    const struct rd_kafka_metadata *metadata;
+    rd_kafka_resp_err_t err = rd_kafka_metadata(rk, 0, topic, &metadata, 5000);
+    if (err != RD_KAFKA_RESP_ERR_NO_ERROR) {
+        log_error("Get metadata of topic %s fail: %s", rd_kafka_topic_name(topic), rd_kafka_err2str(err));
+        return 0;
+    }
+
+    int ret = 0;
+    for (int i = 0; i < metadata->topic_cnt; ++i) {
+        if (metadata->topics[i].partition_cnt > 1) {
+            log_stderr("Topic %s has %d partitions, only 1 is consumed", metadata->topics[i].topic, metadata->topics[i].partition_cnt);
+            ret = -__LINE__;
+        }
+    }
+    rd_kafka_metadata_destroy(metadata);
+    return ret;
 }
 
 int init_message(void)
@@ -94,22 +325,29 @@ int init_message(void)
         return -__LINE__;
     }
 
-    rkt_balances = rd_kafka_topic_new(rk, "balances", NULL);
+    rkt_balances = create_topic("balances");
     if (rkt_balances == NULL) {
         log_stderr("Failed to create topic object: %s", rd_kafka_err2str(rd_kafka_last_error()));
         return -__LINE__;
     }
-    rkt_orders = rd_kafka_topic_new(rk, "orders", NULL);
+    rkt_orders = create_topic("orders");
     if (rkt_orders == NULL) {
         log_stderr("Failed to create topic object: %s", rd_kafka_err2str(rd_kafka_last_error()));
         return -__LINE__;
     }
-    rkt_deals = rd_kafka_topic_new(rk, "deals", NULL);
+    rkt_deals = create_topic("deals");
     if (rkt_deals == NULL) {
         log_stderr("Failed to create topic object: %s", rd_kafka_err2str(rd_kafka_last_error()));
         return -__LINE__;
     }
 
+    if (check_topic_partition(rkt_balances) < 0)
+        return -__LINE__;
+    if (check_topic_partition(rkt_orders) < 0)
+        return -__LINE__;
+    if (check_topic_partition(rkt_deals) < 0)
+        return -__LINE__;
+
     list_type lt;
     memset(&lt, 0, sizeof(lt));
     lt.free = on_list_free;
@@ -143,100 +381,291 @@ int fini_message(void)
     return 0;
 }
 
-static int push_message(char *message, rd_kafka_topic_t *topic, list_t *list)
+static int push_message(struct message *msg, rd_kafka_topic_t *topic, list_t *list)
 {
-    log_trace("push %s message: %s", rd_kafka_topic_name(topic), message);
+    log_trace("push %s message: %.*s (%zu bytes)", rd_kafka_topic_name(topic), msg_text_len(msg), msg->data, msg->len);
 
     if (list->len) {
-        list_add_node_tail(list, message);
+        list_add_node_tail(list, msg);
         return 0;
     }
 
-    int ret = rd_kafka_produce(topic, 0, RD_KAFKA_MSG_F_COPY, message, strlen(message), NULL, 0, NULL);
+    int ret = rd_kafka_produce(topic, RD_KAFKA_PARTITION_UA, RD_KAFKA_MSG_F_FREE, msg->data, msg->len, msg->key, msg->key_len, NULL);
     if (ret == -1) {
         monitor_inc("message_push_fail", 1);
-        log_fatal("Failed to produce: %s to topic %s: %s\n", message, rd_kafka_topic_name(rkt_deals), rd_kafka_err2str(rd_kafka_last_error()));
+        log_fatal("Failed to produce: %.*s (%zu bytes) to topic %s: %s\n", msg_text_len(msg), msg->data,
+                msg->len, rd_kafka_topic_name(topic), rd_kafka_err2str(rd_kafka_last_error()));
         if (rd_kafka_last_error() == RD_KAFKA_RESP_ERR__QUEUE_FULL) {
-            list_add_node_tail(list_deals, message);
+            list_add_node_tail(list, msg);
             return 0;
         }
-        free(message);
+        message_free(msg);
         return -__LINE__;
     }
-    free(message);
+    free(msg);
 
     return 0;
 }
 
-int push_balance_message(double t, uint32_t user_id, const char *asset, const char *business, mpd_t *change, mpd_t *result)
+static struct message *event_message_new(void)
+{
+    struct message *msg = message_new(EVENT_MAX_SIZE);
+    msg->binary = true;
+    return msg;
+}
+
+static void set_event_fixed(event_fixed *num, fixed_t value, int prec)
 {
-    json_t *message = json_object();
-    json_object_set_new(message, "timestamp", json_real(t));
-    json_object_set_new(message, "user_id", json_integer(user_id));
-    json_object_set_new(message, "asset", json_string(asset));
-    json_object_set_new(message, "business", json_string(business));
-    json_object_set_new_mpd(message, "change", change);
-    json_object_set_new_mpd(message, "result", result);
+    num->value = value;
+    num->prec = prec;
+}
+
+static struct message *get_balance_event(double t, uint32_t user_id, int asset_id, const char *business,
+        fixed_t change, int change_prec, fixed_t result, int result_prec)
+{
+    event_balance event;
+    event.timestamp = t;
+    event.user_id = user_id;
+    sstrncpy(event.asset, settings.assets[asset_id].name, sizeof(event.asset));
+    sstrncpy(event.business, business, sizeof(event.business));
+    set_event_fixed(&event.change, change, change_prec);
+    set_event_fixed(&event.result, result, result_prec);
+
+    struct message *msg = event_message_new();
+    void *p = msg->data;
+    size_t left = msg->cap;
+    if (pack_event_balance(&p, &left, &event) < 0) {
+        message_free(msg);
+        return NULL;
+    }
+    msg->len = msg->cap - left;
+    msg_set_user_key(msg, user_id);
 
-    push_message(json_dumps(message, 0), rkt_balances, list_balances);
-    json_decref(message);
+    return msg;
+}
+
+int push_balance_message(double t, uint32_t user_id, int asset_id, const char *business, fixed_t change, int change_prec, fixed_t result, int result_prec)
+{
+    if (settings.message_format.balances) {
+        struct message *msg = get_balance_event(t, user_id, asset_id, business, change, change_prec, result, result_prec);
+        if (msg == NULL)
+            return -__LINE__;
+        push_message(msg, rkt_balances, list_balances);
+        monitor_inc("message_balance", 1);
+        return 0;
+    }
+
+    struct message *msg = message_new(256);
+    msg_set_user_key(msg, user_id);
+    msg_begin(msg);
+    msg_real(msg, "timestamp", t);
+    msg_int(msg, "user_id", user_id);
+    msg_str(msg, "asset", settings.assets[asset_id].name);
+    msg_str(msg, "business", business);
+    msg_fixed(msg, "change", change, change_prec);
+    msg_fixed(msg, "result", result, result_prec);
+    msg_end(msg);
+
+    push_message(msg, rkt_balances, list_balances);
     monitor_inc("message_balance", 1);
 
     return 0;
 }
 
-int push_order_message(uint32_t event, order_t *order, market_t *market)
+static struct message *get_order_event(uint32_t type, order_t *order, market_t *market)
+{
+    event_order event;
+    event.event = type;
+    event.id = order->id;
+    sstrncpy(event.market, market->name, sizeof(event.market));
+    sstrncpy(event.source, order->source, sizeof(event.source));
+    event.type = order->type;
+    event.side = order->side;
+    event.user_id = order->user_id;
+    event.create_time = order->create_time;
+    event.update_time = order->update_time;
+    set_event_fixed(&event.price, order->price, order_price_prec(market, order));
+    set_event_fixed(&event.amount, order->amount, market->stock_prec);
+    set_event_fixed(&event.taker_fee, order->taker_fee, market->fee_prec);
+    set_event_fixed(&event.maker_fee, order->maker_fee, order_maker_fee_prec(market, order));
+    set_event_fixed(&event.left, order->left, order_left_prec(market, order));
+    set_event_fixed(&event.deal_stock, order->deal_stock, order_deal_stock_prec(market, order));
+    set_event_fixed(&event.deal_money, order->deal_money, order_deal_money_prec(market, order));
+    set_event_fixed(&event.deal_fee, order->deal_fee, order_deal_fee_prec(market, order));
+    sstrncpy(event.stock, market->stock, sizeof(event.stock));
+    sstrncpy(event.money, market->money, sizeof(event.money));
+
+    struct message *msg = event_message_new();
+    void *p = msg->data;
+    size_t left = msg->cap;
+    if (pack_event_order(&p, &left, &event) < 0) {
+        message_free(msg);
+        return NULL;
+    }
+    msg->len = msg->cap - left;
+    msg_set_key(msg, market->name);
+
+    return msg;
+}
+
+/* the same fields as get_order_info */
+static struct message *get_order_message(uint32_t event, order_t *order, market_t *market)
 {
-    json_t *message = json_object();
-    json_object_set_new(message, "event", json_integer(event));
-    json_object_set_new(message, "order", get_order_info(order));
-    json_object_set_new(message, "stock", json_string(market->stock));
-    json_object_set_new(message, "money", json_string(market->money));
+    if (settings.message_format.orders)
+        return get_order_event(event, order, market);
+
+    struct message *msg = message_new(640);
+    msg_set_key(msg, market->name);
+    msg_begin(msg);
+    msg_int(msg, "event", event);
+    msg_key(msg, "order");
+    msg_begin(msg);
+    msg_int(msg, "id", order->id);
+    msg_str(msg, "market", market->name);
+    msg_str(msg, "source", order->source);
+    msg_int(msg, "type", order->type);
+    msg_int(msg, "side", order->side);
+    msg_int(msg, "user", order->user_id);
+    msg_real(msg, "ctime", order->create_time);
+    msg_real(msg, "mtime", order->update_time);
+    msg_fixed(msg, "price", order->price, order_price_prec(market, order));
+    msg_fixed(msg, "amount", order->amount, market->stock_prec);
+    msg_fixed(msg, "taker_fee", order->taker_fee, market->fee_prec);
+    msg_fixed(msg, "maker_fee", order->maker_fee, order_maker_fee_prec(market, order));
+    msg_fixed(msg, "left", order->left, order_left_prec(market, order));
+    msg_fixed(msg, "deal_stock", order->deal_stock, order_deal_stock_prec(market, order));
+    msg_fixed(msg, "deal_money", order->deal_money, order_deal_money_prec(market, order));
+    msg_fixed(msg, "deal_fee", order->deal_fee, order_deal_fee_prec(market, order));
+    msg_end(msg);
+    msg_str(msg, "stock", market->stock);
+    msg_str(msg, "money", market->money);
+    msg_end(msg);
+
+    return msg;
+}
 
-    push_message(json_dumps(message, 0), rkt_orders, list_orders);
-    json_decref(message);
+int push_order_message(uint32_t event, order_t *order, market_t *market)
+{
+    struct message *msg = get_order_message(event, order, market);
+    if (msg == NULL)
+        return -__LINE__;
+    push_message(msg, rkt_orders, list_orders);
     monitor_inc("message_order", 1);
 
     return 0;
 }
 
-int push_deal_message(double t, uint64_t id, market_t *market, int side, order_t *ask, order_t *bid, mpd_t *price, mpd_t *amount, mpd_t *deal, mpd_t *ask_fee, mpd_t *bid_fee)
-{
-    json_t *message = json_object();
-
-    json_object_set_new(message, "timestamp", json_real(t));
-    json_object_set_new(message, "id", json_integer(id));
-    json_object_set_new(message, "market", json_string(market->name));
-    json_object_set_new(message, "stock", json_string(market->stock));
-    json_object_set_new(message, "money", json_string(market->money));
-    json_object_set_new(message, "side", json_integer(side));
-    json_object_set_new(message, "ask_id", json_integer(ask->id));
-    json_object_set_new(message, "bid_id", json_integer(bid->id));
-    json_object_set_new(message, "ask_user_id", json_integer(ask->user_id));
-    json_object_set_new(message, "bid_user_id", json_integer(bid->user_id));
-    json_object_set_new_mpd(message, "price", price);
-    json_object_set_new_mpd(message, "amount", amount);
-    json_object_set_new_mpd(message, "deal", deal);
-    json_object_set_new_mpd(message, "ask_fee", ask_fee);
-    json_object_set_new_mpd(message, "bid_fee", bid_fee);
-
-    push_message(json_dumps(message, 0), rkt_deals, list_deals);
-    json_decref(message);
+int push_order_message_batch(uint32_t event, order_t **orders, size_t count, market_t *market)
+{
+    struct message *msgs[MESSAGE_BATCH_MAX_LEN];
+    while (count > 0) {
+        size_t batch = count < MESSAGE_BATCH_MAX_LEN ? count : MESSAGE_BATCH_MAX_LEN;
+        size_t done = 0;
+        for (size_t i = 0; i < batch; ++i) {
+            struct message *msg = get_order_message(event, orders[i], market);
+            if (msg == NULL)
+                continue;
+            log_trace("push %s message: %.*s (%zu bytes)", rd_kafka_topic_name(rkt_orders), msg_text_len(msg), msg->data, msg->len);
+            msgs[done++] = msg;
+        }
+        monitor_inc("message_order", done);
+
+        if (done && list_orders->len == 0) {
+            produce_batch(rkt_orders, msgs, done);
+        }
+        /* keep the order behind the messages already waiting */
+        for (size_t i = 0; i < done; ++i) {
+            if (msgs[i]) {
+                list_add_node_tail(list_orders, msgs[i]);
+            }
+        }
+        orders += batch;
+        count -= batch;
+    }
+
+    return 0;
+}
+
+static struct message *get_deal_event(double t, uint64_t id, market_t *market, int side, order_t *ask, order_t *bid,
+        fixed_t price, fixed_t amount, fixed_t deal, fixed_t ask_fee, fixed_t bid_fee)
+{
+    event_deal event;
+    event.timestamp = t;
+    event.id = id;
+    sstrncpy(event.market, market->name, sizeof(event.market));
+    sstrncpy(event.stock, market->stock, sizeof(event.stock));
+    sstrncpy(event.money, market->money, sizeof(event.money));
+    event.side = side;
+    event.ask_id = ask->id;
+    event.bid_id = bid->id;
+    event.ask_user_id = ask->user_id;
+    event.bid_user_id = bid->user_id;
+    set_event_fixed(&event.price, price, market->money_prec);
+    set_event_fixed(&event.amount, amount, market->stock_prec);
+    set_event_fixed(&event.deal, deal, market->stock_prec + market->money_prec);
+    set_event_fixed(&event.ask_fee, ask_fee, market->stock_prec + market->money_prec + market->fee_prec);
+    set_event_fixed(&event.bid_fee, bid_fee, market->stock_prec + market->fee_prec);
+
+    struct message *msg = event_message_new();
+    void *p = msg->data;
+    size_t left = msg->cap;
+    if (pack_event_deal(&p, &left, &event) < 0) {
+        message_free(msg);
+        return NULL;
+    }
+    msg->len = msg->cap - left;
+    msg_set_key(msg, market->name);
+
+    return msg;
+}
+
+int push_deal_message(double t, uint64_t id, market_t *market, int side, order_t *ask, order_t *bid,
+        fixed_t price, fixed_t amount, fixed_t deal, fixed_t ask_fee, fixed_t bid_fee)
+{
+    if (settings.message_format.deals) {
+        struct message *msg = get_deal_event(t, id, market, side, ask, bid, price, amount, deal, ask_fee, bid_fee);
+        if (msg == NULL)
+            return -__LINE__;
+        push_message(msg, rkt_deals, list_deals);
+        monitor_inc("message_deal", 1);
+        return 0;
+    }
+
+    struct message *msg = message_new(512);
+    msg_set_key(msg, market->name);
+    msg_begin(msg);
+    msg_real(msg, "timestamp", t);
+    msg_int(msg, "id", id);
+    msg_str(msg, "market", market->name);
+    msg_str(msg, "stock", market->stock);
+    msg_str(msg, "money", market->money);
+    msg_int(msg, "side", side);
+    msg_int(msg, "ask_id", ask->id);
+    msg_int(msg, "bid_id", bid->id);
+    msg_int(msg, "ask_user_id", ask->user_id);
+    msg_int(msg, "bid_user_id", bid->user_id);
+    msg_fixed(msg, "price", price, market->money_prec);
+    msg_fixed(msg, "amount", amount, market->stock_prec);
+    msg_fixed(msg, "deal", deal, market->stock_prec + market->money_prec);
+    msg_fixed(msg, "ask_fee", ask_fee, market->stock_prec + market->money_prec + market->fee_prec);
+    msg_fixed(msg, "bid_fee", bid_fee, market->stock_prec + market->fee_prec);
+    msg_end(msg);
+
+    push_message(msg, rkt_deals, list_deals);
     monitor_inc("message_deal", 1);
 
     return 0;
 }
 
-bool is_message_block(void)
+double message_pressure(void)
 {
-    if (list_deals->len >= MAX_PENDING_MESSAGE)
-        return true;
-    if (list_orders->len >= MAX_PENDING_MESSAGE)
-        return true;
-    if (list_balances->len >= MAX_PENDING_MESSAGE)
-        return true;
+    unsigned long pending = list_deals->len;
+    if (list_orders->len > pending)
+        pending = list_orders->len;
+    if (list_balances->len > pending)
+        pending = list_balances->len;
 
-    return false;
+    return (double)pending / MAX_PENDING_MESSAGE;
 }
 
 sds message_status(sds reply)
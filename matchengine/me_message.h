@@ -18,11 +18,15 @@ enum {
     ORDER_EVENT_FINISH  = 3,
 };
 
-int push_balance_message(double t, uint32_t user_id, const char *asset, const char *business, mpd_t *change, mpd_t *result);
+int push_balance_message(double t, uint32_t user_id, int asset_id, const char *business, fixed_t change, int change_prec, fixed_t result, int result_prec);
 int push_order_message(uint32_t event, order_t *order, market_t *market);
-int push_deal_message(double t, uint64_t id, market_t *market, int side, order_t *ask, order_t *bid, mpd_t *price, mpd_t *amount, mpd_t *deal, mpd_t *ask_fee, mpd_t *bid_fee);
+/* produce the messages of several orders of one market in a single batch */
+int push_order_message_batch(uint32_t event, order_t **orders, size_t count, market_t *market);
+int push_deal_message(double t, uint64_t id, market_t *market, int side, order_t *ask, order_t *bid,
+        fixed_t price, fixed_t amount, fixed_t deal, fixed_t ask_fee, fixed_t bid_fee);
 
-bool is_message_block(void);
+/* pending messages relative to MAX_PENDING_MESSAGE, see me_admission */
+double message_pressure(void);
 sds message_status(sds reply);
 
 # endif
@@ -5,6 +5,8 @@
 
 # include "me_config.h"
 # include "me_operlog.h"
+# include "me_load.h"
+# include "me_wal.h"
 
 uint64_t operlog_id_start;
 
@@ -13,12 +15,47 @@ static nw_job *job;
 static list_t *list;
 static nw_timer timer;
 
+/* the operlog files, they are written by the wal job thread */
+static wal_t wal;
+static nw_job *wal_job;
+static nw_timer commit_timer;
+static sds commit_buf;
+static uint64_t commit_first_id;
+static uint64_t commit_last_id;
+
+/* ids are committed to the operlog files first, then inserted to mysql */
+static uint64_t durable_id;
+static uint64_t durable_segment;
+static uint64_t durable_offset;
+static uint64_t ingest_id;
+/* the last id written by the wal job thread, the replies are not handled after the job is released */
+static uint64_t written_id;
+
 struct operlog {
     uint64_t id;
     double create_time;
     char *detail;
 };
 
+struct operlog_sql {
+    sds sql;
+    uint64_t last_id;
+};
+
+struct operlog_commit {
+    sds buf;
+    uint64_t first_id;
+    uint64_t last_id;
+    uint64_t purge_id;
+    uint64_t segment;
+    uint64_t offset;
+};
+
+static bool is_wal_enabled(void)
+{
+    return strlen(settings.operlog_path) > 0;
+}
+
 static void *on_job_init(void)
 {
     return mysql_connect(&settings.db_log);
@@ -27,7 +64,8 @@ static void *on_job_init(void)
 static void on_job(nw_job_entry *entry, void *privdata)
 {
     MYSQL *conn = privdata;
-    sds sql = entry->request;
+    struct operlog_sql *req = entry->request;
+    sds sql = req->sql;
     log_trace("exec sql: %s", sql);
     while (true) {
         int ret = mysql_real_query(conn, sql, sdslen(sql));
@@ -40,9 +78,19 @@ static void on_job(nw_job_entry *entry, void *privdata)
     }
 }
 
+static void on_job_finish(nw_job_entry *entry)
+{
+    struct operlog_sql *req = entry->request;
+    if (req->last_id > ingest_id) {
+        ingest_id = req->last_id;
+    }
+}
+
 static void on_job_cleanup(nw_job_entry *entry)
 {
-    sdsfree(entry->request);
+    struct operlog_sql *req = entry->request;
+    sdsfree(req->sql);
+    free(req);
 }
 
 static void on_job_release(void *privdata)
@@ -50,6 +98,54 @@ static void on_job_release(void *privdata)
     mysql_close(privdata);
 }
 
+static void *on_wal_job_init(void)
+{
+    return &wal;
+}
+
+static void on_wal_job(nw_job_entry *entry, void *privdata)
+{
+    wal_t *w = privdata;
+    struct operlog_commit *req = entry->request;
+    uint64_t segment = w->segment_id;
+    while (true) {
+        int ret = wal_write(w, req->first_id, req->buf, sdslen(req->buf));
+        if (ret < 0) {
+            log_fatal("write operlog %"PRIu64"-%"PRIu64" fail: %d", req->first_id, req->last_id, ret);
+            usleep(1000 * 1000);
+            continue;
+        }
+        break;
+    }
+    if (w->segment_id != segment) {
+        wal_purge(w, req->purge_id);
+    }
+    req->segment = w->segment_id;
+    req->offset  = w->offset;
+    __atomic_store_n(&written_id, req->last_id, __ATOMIC_RELEASE);
+}
+
+static void on_wal_job_finish(nw_job_entry *entry)
+{
+    struct operlog_commit *req = entry->request;
+    durable_id = req->last_id;
+    durable_segment = req->segment;
+    durable_offset = req->offset;
+    monitor_inc("commit_operlog", req->last_id - req->first_id + 1);
+}
+
+static void on_wal_job_cleanup(nw_job_entry *entry)
+{
+    struct operlog_commit *req = entry->request;
+    sdsfree(req->buf);
+    free(req);
+}
+
+static void on_wal_job_release(void *privdata)
+{
+    wal_close(privdata);
+}
+
 static void on_list_free(void *value)
 {
     struct operlog *log = value;
@@ -57,6 +153,29 @@ static void on_list_free(void *value)
     free(log);
 }
 
+static int init_list(void)
+{
+    if (list)
+        return 0;
+
+    list_type lt;
+    memset(&lt, 0, sizeof(lt));
+    lt.free = on_list_free;
+    list = list_create(&lt);
+    if (list == NULL)
+        return -__LINE__;
+
+    return 0;
+}
+
+static void add_sql_job(sds sql, uint64_t last_id)
+{
+    struct operlog_sql *req = malloc(sizeof(struct operlog_sql));
+    req->sql = sql;
+    req->last_id = last_id;
+    nw_job_add(job, 0, req);
+}
+
 static void flush_log(void)
 {
     static sds table_last;
@@ -72,7 +191,7 @@ static void flush_log(void)
     if (sdscmp(table_last, table) != 0) {
         sds create_table_sql = sdsempty();
         create_table_sql = sdscatprintf(create_table_sql, "CREATE TABLE IF NOT EXISTS `%s` like `operlog_example`", table);
-        nw_job_add(job, 0, create_table_sql);
+        add_sql_job(create_table_sql, 0);
         table_last = sdscpy(table_last, table);
     }
 
@@ -80,23 +199,33 @@ static void flush_log(void)
     sql = sdscatprintf(sql, "INSERT INTO `%s` (`id`, `time`, `detail`) VALUES ", table);
     sdsfree(table);
 
-    size_t count;
-    char buf[10240];
+    /* only the logs already in the operlog files */
+    size_t count = 0;
+    uint64_t last_id = 0;
+    static char *buf;
+    static size_t buf_size;
     list_node *node;
     list_iter *iter = list_get_iterator(list, LIST_START_HEAD);
     while ((node = list_next(iter)) != NULL) {
         struct operlog *log = node->value;
+        if (log->id > durable_id)
+            break;
         size_t detail_len = strlen(log->detail);
+        if (buf_size < detail_len * 2 + 1) {
+            buf_size = detail_len * 2 + 1;
+            buf = realloc(buf, buf_size);
+        }
         mysql_real_escape_string(mysql_conn, buf, log->detail, detail_len);
-        sql = sdscatprintf(sql, "(%"PRIu64", %f, '%s')", log->id, log->create_time, buf);
-        if (list_len(list) > 1) {
+        if (count > 0) {
             sql = sdscatprintf(sql, ", ");
         }
+        sql = sdscatprintf(sql, "(%"PRIu64", %f, '%s')", log->id, log->create_time, buf);
+        last_id = log->id;
         list_del(list, node);
         count++;
     }
     list_release_iterator(iter);
-    nw_job_add(job, 0, sql);
+    add_sql_job(sql, last_id);
     log_debug("flush oper log count: %zu", count);
     monitor_inc("flush_operlog", count);
 }
@@ -104,8 +233,79 @@ static void flush_log(void)
 static void on_timer(nw_timer *t, void *privdata)
 {
     if (list->len > 0) {
-        flush_log();
+        struct operlog *log = list->head->value;
+        if (log->id <= durable_id) {
+            flush_log();
+        }
+    }
+}
+
+static void commit_log(void)
+{
+    struct operlog_commit *req = malloc(sizeof(struct operlog_commit));
+    memset(req, 0, sizeof(struct operlog_commit));
+    req->buf = commit_buf;
+    req->first_id = commit_first_id;
+    req->last_id = commit_last_id;
+    req->purge_id = ingest_id;
+    nw_job_add(wal_job, 0, req);
+
+    commit_buf = sdsempty();
+    commit_first_id = 0;
+    commit_last_id = 0;
+}
+
+static void on_commit_timer(nw_timer *t, void *privdata)
+{
+    if (sdslen(commit_buf) > 0) {
+        commit_log();
+    }
+}
+
+static int load_wal_record(uint64_t id, double time, const char *detail, size_t size, void *privdata)
+{
+    int ret = load_operlog_detail(detail, size);
+    if (ret < 0)
+        return ret;
+
+    /* it may not be in mysql yet */
+    struct operlog *log = malloc(sizeof(struct operlog));
+    if (log == NULL)
+        return -__LINE__;
+    log->id = id;
+    log->create_time = time;
+    log->detail = strndup(detail, size);
+    if (log->detail == NULL) {
+        free(log);
+        return -__LINE__;
+    }
+    list_add_node_tail(list, log);
+
+    return 0;
+}
+
+int load_operlog_from_wal(uint64_t *start_id)
+{
+    int ret = init_list();
+    if (ret < 0)
+        return ret;
+
+    uint64_t last_id = *start_id;
+    log_stderr("load oper log from: %s, start id: %"PRIu64, settings.operlog_path, last_id);
+    ret = wal_read(settings.operlog_path, last_id, load_wal_record, NULL);
+    if (ret < 0) {
+        log_error("load oper log from: %s fail: %d", settings.operlog_path, ret);
+        return ret;
+    }
+
+    if (list->len > 0) {
+        struct operlog *log = list->tail->value;
+        last_id = log->id;
     }
+    log_stderr("load oper log from: %s, last id: %"PRIu64, settings.operlog_path, last_id);
+    *start_id = last_id;
+
+    return 0;
 }
 
 int init_operlog(void)
@@ -120,6 +320,7 @@ int init_operlog(void)
     memset(&type, 0, sizeof(type));
     type.on_init    = on_job_init;
     type.on_job     = on_job;
+    type.on_finish  = on_job_finish;
     type.on_cleanup = on_job_cleanup;
     type.on_release = on_job_release;
 
@@ -127,13 +328,32 @@ int init_operlog(void)
     if (job == NULL)
         return -__LINE__;
 
-    list_type lt;
-    memset(&lt, 0, sizeof(lt));
-    lt.free = on_list_free;
-    list = list_create(&lt);
-    if (list == NULL)
+    if (init_list() < 0)
         return -__LINE__;
 
+    /* everything loaded at startup is in mysql or in the operlog files */
+    durable_id = operlog_id_start;
+
+    if (is_wal_enabled()) {
+        if (wal_init(&wal, settings.operlog_path, settings.operlog_segment_size) < 0)
+            return -__LINE__;
+
+        memset(&type, 0, sizeof(type));
+        type.on_init    = on_wal_job_init;
+        type.on_job     = on_wal_job;
+        type.on_finish  = on_wal_job_finish;
+        type.on_cleanup = on_wal_job_cleanup;
+        type.on_release = on_wal_job_release;
+
+        wal_job = nw_job_create(&type, 1);
+        if (wal_job == NULL)
+            return -__LINE__;
+
+        commit_buf = sdsempty();
+        nw_timer_set(&commit_timer, settings.operlog_commit_interval, true, on_commit_timer, NULL);
+        nw_timer_start(&commit_timer);
+    }
+
     nw_timer_set(&timer, 0.1, true, on_timer, NULL);
     nw_timer_start(&timer);
 
@@ -142,6 +362,21 @@ int init_operlog(void)
 
 int fini_operlog(void)
 {
+    if (is_wal_enabled()) {
+        if (sdslen(commit_buf) > 0) {
+            commit_log();
+        }
+        while (wal_job->request_count > 0) {
+            usleep(1000);
+        }
+        // the release waits for the job being written, and closes the wal
+        nw_job_release(wal_job);
+        uint64_t last_id = __atomic_load_n(&written_id, __ATOMIC_ACQUIRE);
+        if (last_id > durable_id) {
+            durable_id = last_id;
+        }
+    }
+
     on_timer(NULL, NULL);
 
     usleep(100 * 1000);
@@ -150,11 +385,8 @@ int fini_operlog(void)
     return 0;
 }
 
-int append_operlog(const char *method, json_t *params)
+static int append_operlog_detail(json_t *detail)
 {
-    json_t *detail = json_object();
-    json_object_set_new(detail, "method", json_string(method));
-    json_object_set(detail, "params", params);
     struct operlog *log = malloc(sizeof(struct operlog));
     log->id = ++operlog_id_start;
     log->create_time = current_timestamp();
@@ -163,19 +395,63 @@ int append_operlog(const char *method, json_t *params)
     list_add_node_tail(list, log);
     log_debug("add log: %s", log->detail);
 
+    if (!is_wal_enabled()) {
+        durable_id = log->id;
+        return 0;
+    }
+
+    commit_buf = wal_pack(commit_buf, log->id, log->create_time, log->detail, strlen(log->detail));
+    if (commit_first_id == 0) {
+        commit_first_id = log->id;
+    }
+    commit_last_id = log->id;
+    if (sdslen(commit_buf) >= settings.operlog_commit_size) {
+        commit_log();
+    }
+
     return 0;
 }
 
-bool is_operlog_block(void)
+int append_operlog(const char *method, json_t *params)
 {
-    if (job->request_count >= MAX_PENDING_OPERLOG)
-        return true;
-    return false;
+    json_t *detail = json_object();
+    json_object_set_new(detail, "method", json_string(method));
+    json_object_set(detail, "params", params);
+    return append_operlog_detail(detail);
+}
+
+int append_operlog_order(const char *method, json_t *params, uint64_t order_id)
+{
+    json_t *detail = json_object();
+    json_object_set_new(detail, "method", json_string(method));
+    json_object_set(detail, "params", params);
+    json_object_set_new(detail, "order_id", json_integer(order_id));
+    return append_operlog_detail(detail);
+}
+
+uint64_t operlog_durable_id(void)
+{
+    return durable_id;
+}
+
+double operlog_pressure(void)
+{
+    int pending = job->request_count;
+    if (wal_job && wal_job->request_count > pending) {
+        pending = wal_job->request_count;
+    }
+    return (double)pending / MAX_PENDING_OPERLOG;
 }
 
 sds operlog_status(sds reply)
 {
     reply = sdscatprintf(reply, "operlog last ID: %"PRIu64"\n", operlog_id_start);
+    reply = sdscatprintf(reply, "operlog durable ID: %"PRIu64"\n", durable_id);
+    reply = sdscatprintf(reply, "operlog ingest ID: %"PRIu64"\n", ingest_id);
+    if (is_wal_enabled()) {
+        reply = sdscatprintf(reply, "operlog segment: %"PRIu64", offset: %"PRIu64"\n", durable_segment, durable_offset);
+        reply = sdscatprintf(reply, "operlog commit pending: %d\n", wal_job->request_count);
+    }
     reply = sdscatprintf(reply, "operlog pending: %d\n", job->request_count);
     return reply;
 }
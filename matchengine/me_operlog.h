@@ -14,8 +14,16 @@ int init_operlog(void);
 int fini_operlog(void);
 
 int append_operlog(const char *method, json_t *params);
+/* the order id of a batched command, replay takes the same id, see me_match */
+int append_operlog_order(const char *method, json_t *params, uint64_t order_id);
+/* replay the operlog files after start_id, and queue them to mysql again */
+int load_operlog_from_wal(uint64_t *start_id);
 
-bool is_operlog_block(void);
+/* the last id fsynced to the operlog files, or queued to mysql if they are not used */
+uint64_t operlog_durable_id(void);
+
+/* pending requests relative to MAX_PENDING_OPERLOG, see me_admission */
+double operlog_pressure(void);
 sds operlog_status(sds reply);
 
 # endif
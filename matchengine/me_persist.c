@@ -7,12 +7,66 @@
 # include "me_persist.h"
 # include "me_operlog.h"
 # include "me_market.h"
+# include "me_trade.h"
 # include "me_load.h"
 # include "me_dump.h"
+# include "me_snapshot.h"
+
+# define SLICE_SCAN_SLOTS   10000
+# define SLICE_BATCH_SIZE   1000
+
+enum {
+    SLICE_JOB_BEGIN,
+    SLICE_JOB_ORDER,
+    SLICE_JOB_BALANCE,
+    SLICE_JOB_END,
+};
+
+enum {
+    SLICE_STATE_IDLE,
+    SLICE_STATE_SCAN,
+    SLICE_STATE_WRITE,
+};
+
+struct slice_job {
+    int                 type;
+    time_t              timestamp;
+    size_t              count;
+    order_t             *orders;
+    struct balance_key  *keys;
+    fixed_t             *balances;
+    /* ids at the start of the slice, for the END job */
+    uint64_t            last_oper_id;
+    uint64_t            last_order_id;
+    uint64_t            last_deals_id;
+    int                 ret;
+};
+
+struct slice_worker {
+    MYSQL               *conn;
+    bool                fail;
+    /* the slice file is optional, a failure of it does not fail the slice */
+    bool                snap_open;
+    snapshot_t          snap;
+};
+
+uint32_t slice_epoch;
 
 static time_t last_slice_time;
 static nw_timer timer;
 
+static nw_job *slice_job;
+static nw_timer slice_timer;
+static int slice_state;
+static time_t slice_time;
+static struct slice_job *slice_orders;
+static struct slice_job *slice_balances;
+static size_t slice_market_index;
+static uint32_t slice_cursor;
+static uint64_t slice_oper_id;
+static uint64_t slice_order_id;
+static uint64_t slice_deals_id;
+
 static time_t get_today_start(void)
 {
     time_t now = time(NULL);
@@ -142,9 +196,20 @@ int init_from_db(void)
         if (ret < 0)
             goto cleanup;
     } else {
-        ret = load_slice_from_db(conn, last_slice_time);
-        if (ret < 0) {
-            goto cleanup;
+        ret = 1;
+        if (strlen(settings.slice_path) > 0) {
+            ret = snapshot_load(settings.slice_path, last_slice_time, last_oper_id, last_order_id, last_deals_id);
+            if (ret < 0) {
+                log_error("snapshot_load fail: %d", ret);
+                log_stderr("snapshot_load fail: %d", ret);
+                goto cleanup;
+            }
+        }
+        if (ret > 0) {
+            ret = load_slice_from_db(conn, last_slice_time);
+            if (ret < 0) {
+                goto cleanup;
+            }
         }
 
         time_t begin = last_slice_time;
@@ -158,6 +223,13 @@ int init_from_db(void)
         }
     }
 
+    if (strlen(settings.operlog_path) > 0) {
+        ret = load_operlog_from_wal(&last_oper_id);
+        if (ret < 0) {
+            goto cleanup;
+        }
+    }
+
     operlog_id_start = last_oper_id;
 
     mysql_close(conn);
@@ -202,11 +274,11 @@ static int dump_balance_to_db(MYSQL *conn, time_t end)
     return 0;
 }
 
-int update_slice_history(MYSQL *conn, time_t end)
+static int update_slice_history(MYSQL *conn, time_t end, uint64_t last_oper_id, uint64_t last_order_id, uint64_t last_deals_id)
 {
     sds sql = sdsempty();
     sql = sdscatprintf(sql, "INSERT INTO `slice_history` (`id`, `time`, `end_oper_id`, `end_order_id`, `end_deals_id`) VALUES (NULL, %ld, %"PRIu64", %"PRIu64", %"PRIu64")",
-            end, operlog_id_start, order_id_start, deals_id_start);
+            end, last_oper_id, last_order_id, last_deals_id);
     log_info("update slice history to: %ld", end);
     log_trace("exec sql: %s", sql);
     int ret = mysql_real_query(conn, sql, sdslen(sql));
@@ -241,7 +313,7 @@ int dump_to_db(time_t timestamp)
         goto cleanup;
     }
 
-    ret = update_slice_history(conn, timestamp);
+    ret = update_slice_history(conn, timestamp, operlog_id_start, order_id_start, deals_id_start);
     if (ret < 0) {
         goto cleanup;
     }
@@ -316,6 +388,10 @@ static int delete_slice(MYSQL *conn, uint64_t id, time_t timestamp)
     }
     sdsfree(sql);
 
+    if (strlen(settings.slice_path) > 0) {
+        snapshot_remove(settings.slice_path, timestamp);
+    }
+
     log_info("delete slice id: %"PRIu64", time: %ld success", id, timestamp);
 
     return 0;
@@ -372,29 +448,357 @@ cleanup:
     return ret;
 }
 
-int make_slice(time_t timestamp)
+static struct slice_job *slice_job_create(int type)
 {
-    int pid = fork();
-    if (pid < 0) {
-        log_fatal("fork fail: %d", pid);
-        return -__LINE__;
-    } else if (pid > 0) {
-        return 0;
+    struct slice_job *job = malloc(sizeof(struct slice_job));
+    if (job == NULL)
+        return NULL;
+    memset(job, 0, sizeof(struct slice_job));
+    job->type = type;
+    job->timestamp = slice_time;
+
+    if (type == SLICE_JOB_ORDER) {
+        job->orders = malloc(sizeof(order_t) * SLICE_BATCH_SIZE);
+        if (job->orders == NULL) {
+            free(job);
+            return NULL;
+        }
+    } else if (type == SLICE_JOB_BALANCE) {
+        // the balances of a user are added together
+        size_t max = SLICE_BATCH_SIZE + settings.asset_num * 2;
+        job->keys = malloc(sizeof(struct balance_key) * max);
+        job->balances = malloc(sizeof(fixed_t) * max);
+        if (job->keys == NULL || job->balances == NULL) {
+            free(job->keys);
+            free(job->balances);
+            free(job);
+            return NULL;
+        }
     }
 
-    int ret;
-    ret = dump_to_db(timestamp);
+    return job;
+}
+
+static void slice_job_free(struct slice_job *job)
+{
+    free(job->orders);
+    free(job->keys);
+    free(job->balances);
+    free(job);
+}
+
+static void slice_job_flush(struct slice_job **job)
+{
+    if (*job == NULL)
+        return;
+    if ((*job)->count == 0) {
+        slice_job_free(*job);
+    } else {
+        nw_job_add(slice_job, 0, *job);
+    }
+    *job = NULL;
+}
+
+static struct slice_job *slice_job_get(struct slice_job **job, int type)
+{
+    if (*job && (*job)->count >= SLICE_BATCH_SIZE) {
+        slice_job_flush(job);
+    }
+    if (*job == NULL) {
+        *job = slice_job_create(type);
+    }
+    return *job;
+}
+
+bool slice_mark_order(order_t *order)
+{
+    if (slice_state != SLICE_STATE_SCAN || order->slice_epoch == slice_epoch)
+        return false;
+    order->slice_epoch = slice_epoch;
+    return true;
+}
+
+void slice_add_order(const order_t *order)
+{
+    struct slice_job *job = slice_job_get(&slice_orders, SLICE_JOB_ORDER);
+    if (job == NULL) {
+        log_fatal("slice save order: %"PRIu64" fail", order->id);
+        return;
+    }
+    memcpy(&job->orders[job->count++], order, sizeof(order_t));
+}
+
+void slice_save_order(order_t *order)
+{
+    if (slice_mark_order(order)) {
+        slice_add_order(order);
+    }
+}
+
+void slice_save_balance(struct balance_user *user)
+{
+    if (slice_state != SLICE_STATE_SCAN || user->slice_epoch == slice_epoch)
+        return;
+    user->slice_epoch = slice_epoch;
+
+    struct slice_job *job = slice_job_get(&slice_balances, SLICE_JOB_BALANCE);
+    if (job == NULL) {
+        log_fatal("slice save balance: %u fail", user->user_id);
+        return;
+    }
+    job->count += balance_user_rows(user, &job->keys[job->count], &job->balances[job->count]);
+}
+
+static void on_scan_order(dict_entry *entry, void *privdata)
+{
+    slice_save_order(entry->val);
+}
+
+static void on_scan_balance(dict_entry *entry, void *privdata)
+{
+    slice_save_balance(entry->val);
+}
+
+static void on_slice_timer(nw_timer *t, void *privdata)
+{
+    uint32_t count = SLICE_SCAN_SLOTS;
+    while (count > 0 && slice_market_index < settings.market_num) {
+        market_t *m = get_market_by_id(slice_market_index);
+        uint32_t cursor = dict_scan(m->orders, slice_cursor, count, on_scan_order, NULL);
+        count -= cursor - slice_cursor;
+        slice_cursor = cursor;
+        if (slice_cursor >= dict_slot(m->orders)) {
+            slice_market_index += 1;
+            slice_cursor = 0;
+        }
+    }
+    if (count == 0)
+        return;
+    slice_cursor = dict_scan(dict_balance, slice_cursor, count, on_scan_balance, NULL);
+    if (slice_cursor < dict_slot(dict_balance))
+        return;
+
+    slice_job_flush(&slice_orders);
+    slice_job_flush(&slice_balances);
+
+    struct slice_job *job = slice_job_create(SLICE_JOB_END);
+    if (job == NULL) {
+        log_fatal("slice %ld create end job fail", slice_time);
+        slice_state = SLICE_STATE_IDLE;
+        nw_timer_stop(&slice_timer);
+        return;
+    }
+    job->last_oper_id  = slice_oper_id;
+    job->last_order_id = slice_order_id;
+    job->last_deals_id = slice_deals_id;
+    nw_job_add(slice_job, 0, job);
+
+    slice_state = SLICE_STATE_WRITE;
+    nw_timer_stop(&slice_timer);
+    log_info("slice %ld scan finished", slice_time);
+}
+
+static void *on_slice_job_init(void)
+{
+    struct slice_worker *worker = malloc(sizeof(struct slice_worker));
+    if (worker == NULL)
+        return NULL;
+    memset(worker, 0, sizeof(struct slice_worker));
+    return worker;
+}
+
+static int slice_job_begin(struct slice_worker *worker, struct slice_job *job)
+{
+    if (worker->conn == NULL || mysql_ping(worker->conn) != 0) {
+        if (worker->conn) {
+            mysql_close(worker->conn);
+        }
+        worker->conn = mysql_connect(&settings.db_log);
+        if (worker->conn == NULL) {
+            log_error("connect mysql fail");
+            return -__LINE__;
+        }
+    }
+
+    sds table = sdsempty();
+    table = sdscatprintf(table, "slice_order_%ld", job->timestamp);
+    int ret = dump_create_table(worker->conn, table, "slice_order_example");
     if (ret < 0) {
-        log_fatal("dump_to_db fail: %d", ret);
+        sdsfree(table);
+        return ret;
     }
 
-    ret = clear_slice(timestamp);
+    sdsclear(table);
+    table = sdscatprintf(table, "slice_balance_%ld", job->timestamp);
+    ret = dump_create_table(worker->conn, table, "slice_balance_example");
+    sdsfree(table);
+    if (ret < 0)
+        return ret;
+
+    if (strlen(settings.slice_path) > 0) {
+        worker->snap_open = snapshot_open(&worker->snap, settings.slice_path, job->timestamp) == 0;
+    }
+
+    return 0;
+}
+
+static void slice_snapshot_abort(struct slice_worker *worker)
+{
+    if (worker->snap_open) {
+        snapshot_abort(&worker->snap);
+        worker->snap_open = false;
+    }
+}
+
+static int slice_job_order(struct slice_worker *worker, struct slice_job *job)
+{
+    sds table = sdsempty();
+    table = sdscatprintf(table, "slice_order_%ld", job->timestamp);
+    int ret = dump_order_rows(worker->conn, table, job->orders, job->count);
+    sdsfree(table);
+    if (ret < 0)
+        return ret;
+
+    if (worker->snap_open && snapshot_write_orders(&worker->snap, job->orders, job->count) < 0) {
+        log_error("slice %ld write orders to file fail", job->timestamp);
+        slice_snapshot_abort(worker);
+    }
+
+    return 0;
+}
+
+static int slice_job_balance(struct slice_worker *worker, struct slice_job *job)
+{
+    sds table = sdsempty();
+    table = sdscatprintf(table, "slice_balance_%ld", job->timestamp);
+    int ret = dump_balance_rows(worker->conn, table, job->keys, job->balances, job->count);
+    sdsfree(table);
+    if (ret < 0)
+        return ret;
+
+    if (worker->snap_open && snapshot_write_balances(&worker->snap, job->keys, job->balances, job->count) < 0) {
+        log_error("slice %ld write balances to file fail", job->timestamp);
+        slice_snapshot_abort(worker);
+    }
+
+    return 0;
+}
+
+static int slice_job_end(struct slice_worker *worker, struct slice_job *job)
+{
+    /* the file is complete before slice_history points to it */
+    if (worker->snap_open) {
+        worker->snap_open = false;
+        if (snapshot_close(&worker->snap, job->timestamp, job->last_oper_id, job->last_order_id, job->last_deals_id) < 0) {
+            log_error("slice %ld close file fail", job->timestamp);
+        }
+    }
+
+    int ret = update_slice_history(worker->conn, job->timestamp, job->last_oper_id, job->last_order_id, job->last_deals_id);
+    if (ret < 0)
+        return ret;
+
+    ret = clear_slice(job->timestamp);
     if (ret < 0) {
-        log_fatal("clear_slice fail: %d", ret);
+        log_error("clear_slice fail: %d", ret);
     }
 
-    monitor_inc("slice_success", 1);
-    exit(0);
+    return 0;
+}
+
+/* market and asset dicts are not changed after init, the worker may look them up */
+static void on_slice_job(nw_job_entry *entry, void *privdata)
+{
+    struct slice_worker *worker = privdata;
+    struct slice_job *job = entry->request;
+
+    if (job->type == SLICE_JOB_BEGIN) {
+        job->ret = slice_job_begin(worker, job);
+        worker->fail = job->ret < 0;
+        return;
+    }
+    if (worker->fail) {
+        if (job->type == SLICE_JOB_END) {
+            slice_snapshot_abort(worker);
+        }
+        job->ret = -__LINE__;
+        return;
+    }
+
+    switch (job->type) {
+    case SLICE_JOB_ORDER:
+        job->ret = slice_job_order(worker, job);
+        break;
+    case SLICE_JOB_BALANCE:
+        job->ret = slice_job_balance(worker, job);
+        break;
+    case SLICE_JOB_END:
+        job->ret = slice_job_end(worker, job);
+        break;
+    }
+    if (job->ret < 0) {
+        worker->fail = true;
+        slice_snapshot_abort(worker);
+    }
+}
+
+static void on_slice_job_finish(nw_job_entry *entry)
+{
+    struct slice_job *job = entry->request;
+    if (job->type != SLICE_JOB_END) {
+        if (job->ret < 0 && job->type == SLICE_JOB_BEGIN) {
+            log_error("slice %ld begin fail: %d", job->timestamp, job->ret);
+        }
+        return;
+    }
+
+    if (job->ret < 0) {
+        log_fatal("slice %ld fail: %d", job->timestamp, job->ret);
+        monitor_inc("slice_fail", 1);
+    } else {
+        log_info("slice %ld success", job->timestamp);
+        monitor_inc("slice_success", 1);
+    }
+    slice_state = SLICE_STATE_IDLE;
+}
+
+static void on_slice_job_cleanup(nw_job_entry *entry)
+{
+    slice_job_free(entry->request);
+}
+
+static void on_slice_job_release(void *privdata)
+{
+    struct slice_worker *worker = privdata;
+    slice_snapshot_abort(worker);
+    if (worker->conn) {
+        mysql_close(worker->conn);
+    }
+    free(worker);
+}
+
+int make_slice(time_t timestamp)
+{
+    if (slice_state != SLICE_STATE_IDLE) {
+        log_error("slice %ld is running", slice_time);
+        return -__LINE__;
+    }
+
+    slice_time = timestamp;
+    struct slice_job *job = slice_job_create(SLICE_JOB_BEGIN);
+    if (job == NULL)
+        return -__LINE__;
+    nw_job_add(slice_job, 0, job);
+
+    slice_epoch += 1;
+    slice_oper_id  = operlog_id_start;
+    slice_order_id = order_id_start;
+    slice_deals_id = deals_id_start;
+    slice_market_index = 0;
+    slice_cursor = 0;
+    slice_state = SLICE_STATE_SCAN;
+    nw_timer_start(&slice_timer);
+    log_info("start slice: %ld, epoch: %u", timestamp, slice_epoch);
 
     return 0;
 }
@@ -410,6 +814,19 @@ static void on_timer(nw_timer *timer, void *privdata)
 
 int init_persist(void)
 {
+    nw_job_type type;
+    memset(&type, 0, sizeof(type));
+    type.on_init    = on_slice_job_init;
+    type.on_job     = on_slice_job;
+    type.on_finish  = on_slice_job_finish;
+    type.on_cleanup = on_slice_job_cleanup;
+    type.on_release = on_slice_job_release;
+
+    slice_job = nw_job_create(&type, 1);
+    if (slice_job == NULL)
+        return -__LINE__;
+    nw_timer_set(&slice_timer, 0.1, true, on_slice_timer, NULL);
+
     nw_timer_set(&timer, 1.0, true, on_timer, NULL);
     nw_timer_start(&timer);
 
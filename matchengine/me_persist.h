@@ -8,8 +8,24 @@
 
 # include <time.h>
 
+# include "me_market.h"
+# include "me_balance.h"
+
+/*
+ * a slice is made in process: orders and balances carry the epoch of the
+ * last slice they are saved to, and a record of an older epoch is saved
+ * before it is changed or deleted, the rest are saved by a background scan.
+ */
+extern uint32_t slice_epoch;
+
 int init_persist(void);
 
+void slice_save_order(order_t *order);
+/* slice_save_order in two steps, the copy of a marked order is added later by the matching threads */
+bool slice_mark_order(order_t *order);
+void slice_add_order(const order_t *order);
+void slice_save_balance(struct balance_user *user);
+
 int init_from_db(void);
 int dump_to_db(time_t timestamp);
 int make_slice(time_t timestamp);
@@ -12,37 +12,30 @@
 # include "me_operlog.h"
 # include "me_history.h"
 # include "me_message.h"
+# include "me_depth.h"
+# include "me_admission.h"
+# include "me_match.h"
+# include "me_io.h"
 
 static rpc_svr *svr;
-static dict_t *dict_cache;
 static nw_timer cache_timer;
 
-struct cache_val {
-    double      time;
-    json_t      *result;
+/* the id the connection of the request had, a connection is only a handle with io_thread */
+static uint64_t request_ses_id;
+
+/* replies of the book reads of a market, valid while the book version is unchanged, indexed by the market id */
+struct market_cache {
+    uint64_t    version;
+    dict_t      *dict;
 };
 
+static struct market_cache *market_caches;
+
 static int reply_json(nw_ses *ses, rpc_pkg *pkg, const json_t *json)
 {
-    char *message_data;
-    if (settings.debug) {
-        message_data = json_dumps(json, JSON_INDENT(4));
-    } else {
-        message_data = json_dumps(json, 0);
-    }
-    if (message_data == NULL)
-        return -__LINE__;
-    log_trace("connection: %s send: %s", nw_sock_human_addr(&ses->peer_addr), message_data);
-
-    rpc_pkg reply;
-    memcpy(&reply, pkg, sizeof(reply));
-    reply.pkg_type = RPC_PKG_TYPE_REPLY;
-    reply.body = message_data;
-    reply.body_size = strlen(message_data);
-    rpc_send(ses, &reply);
-    free(message_data);
-
-    return 0;
+    if (io_enabled())
+        return io_reply(ses, request_ses_id, pkg, json);
+    return send_json(ses, pkg, json);
 }
 
 static int reply_error(nw_ses *ses, rpc_pkg *pkg, int code, const char *message)
@@ -103,41 +96,75 @@ static int reply_success(nw_ses *ses, rpc_pkg *pkg)
     return ret;
 }
 
-static bool process_cache(nw_ses *ses, rpc_pkg *pkg, sds *cache_key)
+static struct market_cache *get_market_cache(market_t *market)
 {
+    if (market->id >= settings.market_num)
+        return NULL;
+    struct market_cache *cache = &market_caches[market->id];
+    if (cache->version != market->book_version) {
+        dict_clear(cache->dict);
+        cache->version = market->book_version;
+    }
+    return cache;
+}
+
+static bool process_cache(nw_ses *ses, rpc_pkg *pkg, market_t *market, sds *cache_key)
+{
+    struct market_cache *cache = get_market_cache(market);
+    if (cache == NULL) {
+        *cache_key = NULL;
+        return false;
+    }
+
     sds key = sdsempty();
     key = sdscatprintf(key, "%u", pkg->command);
     key = sdscatlen(key, pkg->body, pkg->body_size);
-    dict_entry *entry = dict_find(dict_cache, key);
+    dict_entry *entry = dict_find(cache->dict, key);
     if (entry == NULL) {
         *cache_key = key;
         return false;
     }
 
-    struct cache_val *cache = entry->val;
-    double now = current_timestamp();
-    if ((now - cache->time) > settings.cache_timeout) {
-        dict_delete(dict_cache, key);
-        *cache_key = key;
-        return false;
+    monitor_inc("cache_hit", 1);
+    if (io_enabled()) {
+        // the reply is released by the io thread, it can not share the cached one
+        json_t *result = json_deep_copy(entry->val);
+        reply_result(ses, pkg, result);
+        json_decref(result);
+    } else {
+        reply_result(ses, pkg, entry->val);
     }
-
-    reply_result(ses, pkg, cache->result);
     sdsfree(key);
     return true;
 }
 
-static int add_cache(sds cache_key, json_t *result)
+static int add_cache(market_t *market, sds cache_key, json_t *result)
 {
-    struct cache_val cache;
-    cache.time = current_timestamp();
-    cache.result = result;
-    json_incref(result);
-    dict_replace(dict_cache, cache_key, &cache);
+    if (cache_key == NULL)
+        return 0;
+    struct market_cache *cache = get_market_cache(market);
+    if (cache == NULL)
+        return -__LINE__;
+    if (io_enabled()) {
+        dict_replace(cache->dict, cache_key, json_deep_copy(result));
+    } else {
+        json_incref(result);
+        dict_replace(cache->dict, cache_key, result);
+    }
 
     return 0;
 }
 
+// drop the replies of the markets changed by the last command
+static void flush_cache(void)
+{
+    market_t *market;
+    while ((market = market_pop_changed()) != NULL) {
+        // the replies of an older book version are dropped by get_market_cache
+        get_market_cache(market);
+    }
+}
+
 static int on_cmd_asset_list(nw_ses *ses, rpc_pkg *pkg, json_t *params)
 {
     json_t *result = json_array();
@@ -153,26 +180,22 @@ static int on_cmd_asset_list(nw_ses *ses, rpc_pkg *pkg, json_t *params)
     return ret;
 }
 
-static json_t *get_asset_summary(const char *name)
+static json_t *get_asset_summary(int asset_id)
 {
+    const char *name = settings.assets[asset_id].name;
     size_t available_count;
     size_t frozen_count;
-    mpd_t *total = mpd_new(&mpd_ctx);
-    mpd_t *available = mpd_new(&mpd_ctx);
-    mpd_t *frozen = mpd_new(&mpd_ctx);
-    balance_status(name, total, &available_count, available, &frozen_count, frozen);
+    fixed_t total, available, frozen;
+    balance_status(asset_id, &total, &available_count, &available, &frozen_count, &frozen);
 
+    int prec = settings.assets[asset_id].prec_save;
     json_t *obj = json_object();
     json_object_set_new(obj, "name", json_string(name));
-    json_object_set_new_mpd(obj, "total_balance", total);
+    json_object_set_new_fixed(obj, "total_balance", total, available_count + frozen_count ? prec : 0);
     json_object_set_new(obj, "available_count", json_integer(available_count));
-    json_object_set_new_mpd(obj, "available_balance", available);
+    json_object_set_new_fixed(obj, "available_balance", available, available_count ? prec : 0);
     json_object_set_new(obj, "frozen_count", json_integer(frozen_count));
-    json_object_set_new_mpd(obj, "frozen_balance", frozen);
-
-    mpd_del(total);
-    mpd_del(available);
-    mpd_del(frozen);
+    json_object_set_new_fixed(obj, "frozen_balance", frozen, frozen_count ? prec : 0);
 
     return obj;
 }
@@ -194,32 +217,26 @@ static int on_cmd_asset_query(nw_ses *ses, rpc_pkg *pkg, json_t *params)
         for (size_t i = 0; i < settings.asset_num; ++i) {
             const char *asset = settings.assets[i].name;
             json_t *unit = json_object();
-            int prec_save = asset_prec(asset);
-            int prec_show = asset_prec_show(asset);
+            int prec_save = settings.assets[i].prec_save;
+            int prec_show = settings.assets[i].prec_show;
 
-            mpd_t *available = balance_get(user_id, BALANCE_TYPE_AVAILABLE, asset);
+            fixed_t *available = balance_get(user_id, BALANCE_TYPE_AVAILABLE, i);
             if (available) {
                 if (prec_save != prec_show) {
-                    mpd_t *show = mpd_qncopy(available);
-                    mpd_rescale(show, show, -prec_show, &mpd_ctx);
-                    json_object_set_new_mpd(unit, "available", show);
-                    mpd_del(show);
+                    json_object_set_new_fixed(unit, "available", fixed_rescale(*available, prec_save, prec_show), prec_show);
                 } else {
-                    json_object_set_new_mpd(unit, "available", available);
+                    json_object_set_new_fixed(unit, "available", *available, prec_save);
                 }
             } else {
                 json_object_set_new(unit, "available", json_string("0"));
             }
 
-            mpd_t *frozen = balance_get(user_id, BALANCE_TYPE_FROZEN, asset);
+            fixed_t *frozen = balance_get(user_id, BALANCE_TYPE_FROZEN, i);
             if (frozen) {
                 if (prec_save != prec_show) {
-                    mpd_t *show = mpd_qncopy(frozen);
-                    mpd_rescale(show, show, -prec_show, &mpd_ctx);
-                    json_object_set_new_mpd(unit, "frozen", show);
-                    mpd_del(show);
+                    json_object_set_new_fixed(unit, "frozen", fixed_rescale(*frozen, prec_save, prec_show), prec_show);
                 } else {
-                    json_object_set_new_mpd(unit, "frozen", frozen);
+                    json_object_set_new_fixed(unit, "frozen", *frozen, prec_save);
                 }
             } else {
                 json_object_set_new(unit, "frozen", json_string("0"));
@@ -230,37 +247,32 @@ static int on_cmd_asset_query(nw_ses *ses, rpc_pkg *pkg, json_t *params)
     } else {
         for (size_t i = 1; i < request_size; ++i) {
             const char *asset = json_string_value(json_array_get(params, i));
-            if (!asset || !asset_exist(asset)) {
+            int asset_id = asset ? get_asset_id(asset) : -1;
+            if (asset_id < 0) {
                 json_decref(result);
                 return reply_error_invalid_argument(ses, pkg);
             }
             json_t *unit = json_object();
-            int prec_save = asset_prec(asset);
-            int prec_show = asset_prec_show(asset);
+            int prec_save = settings.assets[asset_id].prec_save;
+            int prec_show = settings.assets[asset_id].prec_show;
 
-            mpd_t *available = balance_get(user_id, BALANCE_TYPE_AVAILABLE, asset);
+            fixed_t *available = balance_get(user_id, BALANCE_TYPE_AVAILABLE, asset_id);
             if (available) {
                 if (prec_save != prec_show) {
-                    mpd_t *show = mpd_qncopy(available);
-                    mpd_rescale(show, show, -prec_show, &mpd_ctx);
-                    json_object_set_new_mpd(unit, "available", show);
-                    mpd_del(show);
+                    json_object_set_new_fixed(unit, "available", fixed_rescale(*available, prec_save, prec_show), prec_show);
                 } else {
-                    json_object_set_new_mpd(unit, "available", available);
+                    json_object_set_new_fixed(unit, "available", *available, prec_save);
                 }
             } else {
                 json_object_set_new(unit, "available", json_string("0"));
             }
 
-            mpd_t *frozen = balance_get(user_id, BALANCE_TYPE_FROZEN, asset);
+            fixed_t *frozen = balance_get(user_id, BALANCE_TYPE_FROZEN, asset_id);
             if (frozen) {
                 if (prec_save != prec_show) {
-                    mpd_t *show = mpd_qncopy(frozen);
-                    mpd_rescale(show, show, -prec_show, &mpd_ctx);
-                    json_object_set_new_mpd(unit, "frozen", show);
-                    mpd_del(show);
+                    json_object_set_new_fixed(unit, "frozen", fixed_rescale(*frozen, prec_save, prec_show), prec_show);
                 } else {
-                    json_object_set_new_mpd(unit, "frozen", frozen);
+                    json_object_set_new_fixed(unit, "frozen", *frozen, prec_save);
                 }
             } else {
                 json_object_set_new(unit, "frozen", json_string("0"));
@@ -288,10 +300,10 @@ static int on_cmd_asset_update(nw_ses *ses, rpc_pkg *pkg, json_t *params)
     // asset
     if (!json_is_string(json_array_get(params, 1)))
         return reply_error_invalid_argument(ses, pkg);
-    const char *asset = json_string_value(json_array_get(params, 1));
-    int prec = asset_prec_show(asset);
-    if (prec < 0)
+    int asset_id = get_asset_id(json_string_value(json_array_get(params, 1)));
+    if (asset_id < 0)
         return reply_error_invalid_argument(ses, pkg);
+    int prec = settings.assets[asset_id].prec_show;
 
     // business
     if (!json_is_string(json_array_get(params, 2)))
@@ -306,19 +318,17 @@ static int on_cmd_asset_update(nw_ses *ses, rpc_pkg *pkg, json_t *params)
     // change
     if (!json_is_string(json_array_get(params, 4)))
         return reply_error_invalid_argument(ses, pkg);
-    mpd_t *change = decimal(json_string_value(json_array_get(params, 4)), prec);
-    if (change == NULL)
+    fixed_t change;
+    if (fixed_parse(json_string_value(json_array_get(params, 4)), prec, &change) < 0)
         return reply_error_invalid_argument(ses, pkg);
 
     // detail
     json_t *detail = json_array_get(params, 5);
     if (!json_is_object(detail)) {
-        mpd_del(change);
         return reply_error_invalid_argument(ses, pkg);
     }
 
-    int ret = update_user_balance(true, user_id, asset, business, business_id, change, detail);
-    mpd_del(change);
+    int ret = update_user_balance(true, user_id, asset_id, business, business_id, change, prec, detail);
     if (ret == -1) {
         return reply_error(ses, pkg, 10, "repeat update");
     } else if (ret == -2) {
@@ -336,16 +346,17 @@ static int on_cmd_asset_summary(nw_ses *ses, rpc_pkg *pkg, json_t *params)
     json_t *result = json_array();
     if (json_array_size(params) == 0) {
         for (int i = 0; i < settings.asset_num; ++i) {
-            json_array_append_new(result, get_asset_summary(settings.assets[i].name));
+            json_array_append_new(result, get_asset_summary(i));
         }
     } else {
         for (int i = 0; i < json_array_size(params); ++i) {
             const char *asset = json_string_value(json_array_get(params, i));
             if (asset == NULL)
                 goto invalid_argument;
-            if (!asset_exist(asset))
+            int asset_id = get_asset_id(asset);
+            if (asset_id < 0)
                 goto invalid_argument;
-            json_array_append_new(result, get_asset_summary(asset));
+            json_array_append_new(result, get_asset_summary(asset_id));
         }
     }
 
@@ -358,189 +369,548 @@ invalid_argument:
     return reply_error_invalid_argument(ses, pkg);
 }
 
-static int on_cmd_order_put_limit(nw_ses *ses, rpc_pkg *pkg, json_t *params)
-{
-    if (json_array_size(params) != 8)
-        return reply_error_invalid_argument(ses, pkg);
+/*
+ * a trade command of one market: it is parsed on the main thread, run on
+ * the matching thread of the market, then logged and replied on the main
+ * thread. the run only changes the market and the journal of the market.
+ */
+struct trade_cmd {
+    uint32_t    command;
+    json_t      *params;
+    uint32_t    user_id;
+    market_t    *market;
+    uint64_t    order_id;
+    json_t      *order_ids;
+    uint32_t    side;
+    fixed_t     amount;
+    fixed_t     price;
+    fixed_t     taker_fee;
+    fixed_t     maker_fee;
+    const char  *source;
+
+    /* the reply error code and message, 1 is invalid argument and 2 is internal error */
+    int         code;
+    const char  *message;
+    json_t      *result;
+    /* the orders canceled by a cancel batch, and its internal errors */
+    json_t      *canceled;
+    int         errors;
+};
 
-    // user_id
-    if (!json_is_integer(json_array_get(params, 0)))
-        return reply_error_invalid_argument(ses, pkg);
-    uint32_t user_id = json_integer_value(json_array_get(params, 0));
+/* a trade command in the batch of the matching threads, see me_match */
+struct trade_task {
+    nw_ses      *ses;
+    uint64_t    ses_id;
+    rpc_pkg     pkg;
+    struct trade_cmd cmd;
+};
 
-    // market
-    if (!json_is_string(json_array_get(params, 1)))
-        return reply_error_invalid_argument(ses, pkg);
-    const char *market_name = json_string_value(json_array_get(params, 1));
-    market_t *market = get_market(market_name);
-    if (market == NULL)
-        return reply_error_invalid_argument(ses, pkg);
+static struct trade_task *trade_batch;
+static match_task_t *trade_match_tasks;
+static size_t trade_batch_len;
+static dict_t *trade_batch_users;
+static ev_prepare trade_batch_watcher;
 
-    // side
-    if (!json_is_integer(json_array_get(params, 2)))
-        return reply_error_invalid_argument(ses, pkg);
-    uint32_t side = json_integer_value(json_array_get(params, 2));
-    if (side != MARKET_ORDER_SIDE_ASK && side != MARKET_ORDER_SIDE_BID)
-        return reply_error_invalid_argument(ses, pkg);
+// side, amount, price, fees and source of a limit order from index
+static int parse_limit_args(json_t *params, size_t index, struct trade_cmd *cmd)
+{
+    market_t *market = cmd->market;
 
-    mpd_t *amount    = NULL;
-    mpd_t *price     = NULL;
-    mpd_t *taker_fee = NULL;
-    mpd_t *maker_fee = NULL;
+    // side
+    if (!json_is_integer(json_array_get(params, index)))
+        return 1;
+    cmd->side = json_integer_value(json_array_get(params, index));
+    if (cmd->side != MARKET_ORDER_SIDE_ASK && cmd->side != MARKET_ORDER_SIDE_BID)
+        return 1;
 
     // amount
-    if (!json_is_string(json_array_get(params, 3)))
-        goto invalid_argument;
-    amount = decimal(json_string_value(json_array_get(params, 3)), market->stock_prec);
-    if (amount == NULL || mpd_cmp(amount, mpd_zero, &mpd_ctx) <= 0)
-        goto invalid_argument;
+    if (!json_is_string(json_array_get(params, index + 1)))
+        return 1;
+    if (fixed_parse(json_string_value(json_array_get(params, index + 1)), market->stock_prec, &cmd->amount) < 0 || cmd->amount <= 0)
+        return 1;
 
     // price 
-    if (!json_is_string(json_array_get(params, 4)))
-        goto invalid_argument;
-    price = decimal(json_string_value(json_array_get(params, 4)), market->money_prec);
-    if (price == NULL || mpd_cmp(price, mpd_zero, &mpd_ctx) <= 0)
-        goto invalid_argument;
+    if (!json_is_string(json_array_get(params, index + 2)))
+        return 1;
+    if (fixed_parse(json_string_value(json_array_get(params, index + 2)), market->money_prec, &cmd->price) < 0 || cmd->price <= 0)
+        return 1;
 
     // taker fee
-    if (!json_is_string(json_array_get(params, 5)))
-        goto invalid_argument;
-    taker_fee = decimal(json_string_value(json_array_get(params, 5)), market->fee_prec);
-    if (taker_fee == NULL || mpd_cmp(taker_fee, mpd_zero, &mpd_ctx) < 0 || mpd_cmp(taker_fee, mpd_one, &mpd_ctx) >= 0)
-        goto invalid_argument;
+    if (!json_is_string(json_array_get(params, index + 3)))
+        return 1;
+    if (fixed_parse(json_string_value(json_array_get(params, index + 3)), market->fee_prec, &cmd->taker_fee) < 0 ||
+            cmd->taker_fee < 0 || cmd->taker_fee >= fixed_pow10[market->fee_prec])
+        return 1;
 
     // maker fee
-    if (!json_is_string(json_array_get(params, 6)))
-        goto invalid_argument;
-    maker_fee = decimal(json_string_value(json_array_get(params, 6)), market->fee_prec);
-    if (maker_fee == NULL || mpd_cmp(maker_fee, mpd_zero, &mpd_ctx) < 0 || mpd_cmp(maker_fee, mpd_one, &mpd_ctx) >= 0)
-        goto invalid_argument;
+    if (!json_is_string(json_array_get(params, index + 4)))
+        return 1;
+    if (fixed_parse(json_string_value(json_array_get(params, index + 4)), market->fee_prec, &cmd->maker_fee) < 0 ||
+            cmd->maker_fee < 0 || cmd->maker_fee >= fixed_pow10[market->fee_prec])
+        return 1;
 
     // source
-    if (!json_is_string(json_array_get(params, 7)))
-        goto invalid_argument;
-    const char *source = json_string_value(json_array_get(params, 7));
-    if (strlen(source) >= SOURCE_MAX_LEN)
-        goto invalid_argument;
+    if (!json_is_string(json_array_get(params, index + 5)))
+        return 1;
+    cmd->source = json_string_value(json_array_get(params, index + 5));
+    if (strlen(cmd->source) >= SOURCE_MAX_LEN)
+        return 1;
 
-    json_t *result = NULL;
-    int ret = market_put_limit_order(true, &result, market, user_id, side, amount, price, taker_fee, maker_fee, source);
+    return 0;
+}
 
-    mpd_del(amount);
-    mpd_del(price);
-    mpd_del(taker_fee);
-    mpd_del(maker_fee);
+static int parse_market_args(json_t *params, struct trade_cmd *cmd)
+{
+    market_t *market = cmd->market;
 
-    if (ret == -1) {
-        return reply_error(ses, pkg, 10, "balance not enough");
-    } else if (ret == -2) {
-        return reply_error(ses, pkg, 11, "amount too small");
-    } else if (ret < 0) {
-        log_fatal("market_put_limit_order fail: %d", ret);
-        return reply_error_internal_error(ses, pkg);
-    }
+    // side
+    if (!json_is_integer(json_array_get(params, 2)))
+        return 1;
+    cmd->side = json_integer_value(json_array_get(params, 2));
+    if (cmd->side != MARKET_ORDER_SIDE_ASK && cmd->side != MARKET_ORDER_SIDE_BID)
+        return 1;
 
-    append_operlog("limit_order", params);
-    ret = reply_result(ses, pkg, result);
-    json_decref(result);
-    return ret;
+    // amount
+    if (!json_is_string(json_array_get(params, 3)))
+        return 1;
+    if (fixed_parse(json_string_value(json_array_get(params, 3)), market->stock_prec, &cmd->amount) < 0 || cmd->amount <= 0)
+        return 1;
 
-invalid_argument:
-    if (amount)
-        mpd_del(amount);
-    if (price)
-        mpd_del(price);
-    if (taker_fee)
-        mpd_del(taker_fee);
-    if (maker_fee)
-        mpd_del(maker_fee);
+    // taker fee
+    if (!json_is_string(json_array_get(params, 4)))
+        return 1;
+    if (fixed_parse(json_string_value(json_array_get(params, 4)), market->fee_prec, &cmd->taker_fee) < 0 ||
+            cmd->taker_fee < 0 || cmd->taker_fee >= fixed_pow10[market->fee_prec])
+        return 1;
 
-    return reply_error_invalid_argument(ses, pkg);
+    // source
+    if (!json_is_string(json_array_get(params, 5)))
+        return 1;
+    cmd->source = json_string_value(json_array_get(params, 5));
+    if (strlen(cmd->source) >= SOURCE_MAX_LEN)
+        return 1;
+
+    return 0;
 }
 
-static int on_cmd_order_put_market(nw_ses *ses, rpc_pkg *pkg, json_t *params)
+static int parse_cancel_batch_args(json_t *params, struct trade_cmd *cmd)
 {
-    if (json_array_size(params) != 6)
-        return reply_error_invalid_argument(ses, pkg);
+    // order_ids
+    json_t *order_ids = json_array_get(params, 2);
+    if (!json_is_array(order_ids))
+        return 1;
+    size_t size = json_array_size(order_ids);
+    if (size == 0 || size > ORDER_BATCH_MAX_LEN)
+        return 1;
+    for (size_t i = 0; i < size; ++i) {
+        if (!json_is_integer(json_array_get(order_ids, i)))
+            return 1;
+    }
+    cmd->order_ids = order_ids;
+
+    return 0;
+}
+
+/* return 0, or 1 for invalid argument */
+static int parse_trade_cmd(uint32_t command, json_t *params, struct trade_cmd *cmd)
+{
+    memset(cmd, 0, sizeof(struct trade_cmd));
+    cmd->command = command;
+    cmd->params = params;
+
+    size_t size = 0;
+    switch (command) {
+    case CMD_ORDER_PUT_LIMIT:
+        size = 8;
+        break;
+    case CMD_ORDER_PUT_MARKET:
+        size = 6;
+        break;
+    case CMD_ORDER_CANCEL:
+    case CMD_ORDER_CANCEL_BATCH:
+        size = 3;
+        break;
+    case CMD_ORDER_CANCEL_REPLACE:
+        size = 9;
+        break;
+    }
+    if (size == 0 || json_array_size(params) != size)
+        return 1;
 
     // user_id
     if (!json_is_integer(json_array_get(params, 0)))
-        return reply_error_invalid_argument(ses, pkg);
-    uint32_t user_id = json_integer_value(json_array_get(params, 0));
+        return 1;
+    cmd->user_id = json_integer_value(json_array_get(params, 0));
 
     // market
     if (!json_is_string(json_array_get(params, 1)))
-        return reply_error_invalid_argument(ses, pkg);
-    const char *market_name = json_string_value(json_array_get(params, 1));
-    market_t *market = get_market(market_name);
-    if (market == NULL)
-        return reply_error_invalid_argument(ses, pkg);
+        return 1;
+    cmd->market = get_market(json_string_value(json_array_get(params, 1)));
+    if (cmd->market == NULL)
+        return 1;
 
-    // side
+    switch (command) {
+    case CMD_ORDER_PUT_LIMIT:
+        return parse_limit_args(params, 2, cmd);
+    case CMD_ORDER_PUT_MARKET:
+        return parse_market_args(params, cmd);
+    case CMD_ORDER_CANCEL_BATCH:
+        return parse_cancel_batch_args(params, cmd);
+    }
+
+    // order_id
     if (!json_is_integer(json_array_get(params, 2)))
-        return reply_error_invalid_argument(ses, pkg);
-    uint32_t side = json_integer_value(json_array_get(params, 2));
-    if (side != MARKET_ORDER_SIDE_ASK && side != MARKET_ORDER_SIDE_BID)
-        return reply_error_invalid_argument(ses, pkg);
+        return 1;
+    cmd->order_id = json_integer_value(json_array_get(params, 2));
+    if (command == CMD_ORDER_CANCEL_REPLACE)
+        return parse_limit_args(params, 3, cmd);
 
-    mpd_t *amount = NULL;
-    mpd_t *taker_fee = NULL;
+    return 0;
+}
 
-    // amount
-    if (!json_is_string(json_array_get(params, 3)))
-        goto invalid_argument;
-    amount = decimal(json_string_value(json_array_get(params, 3)), market->stock_prec);
-    if (amount == NULL || mpd_cmp(amount, mpd_zero, &mpd_ctx) <= 0)
-        goto invalid_argument;
+static void set_trade_error(struct trade_cmd *cmd, int code, const char *message)
+{
+    cmd->code = code;
+    cmd->message = message;
+}
 
-    // taker fee
-    if (!json_is_string(json_array_get(params, 4)))
-        goto invalid_argument;
-    taker_fee = decimal(json_string_value(json_array_get(params, 4)), market->fee_prec);
-    if (taker_fee == NULL || mpd_cmp(taker_fee, mpd_zero, &mpd_ctx) < 0 || mpd_cmp(taker_fee, mpd_one, &mpd_ctx) >= 0)
-        goto invalid_argument;
+// per order result of the batch commands, in the form of a reply
+static json_t *get_order_result(int code, const char *message, json_t *result)
+{
+    json_t *obj = json_object();
+    if (code) {
+        json_t *error = json_object();
+        json_object_set_new(error, "code", json_integer(code));
+        json_object_set_new(error, "message", json_string(message));
+        json_object_set_new(obj, "error", error);
+        json_object_set_new(obj, "result", json_null());
+    } else {
+        json_object_set_new(obj, "error", json_null());
+        json_object_set_new(obj, "result", result);
+    }
+    return obj;
+}
 
-    // source
-    if (!json_is_string(json_array_get(params, 5)))
-        goto invalid_argument;
-    const char *source = json_string_value(json_array_get(params, 5));
-    if (strlen(source) >= SOURCE_MAX_LEN)
-        goto invalid_argument;
+static void exec_cancel_batch(market_t *m, struct trade_cmd *cmd)
+{
+    cmd->result = json_array();
+    cmd->canceled = json_array();
+    for (size_t i = 0; i < json_array_size(cmd->order_ids); ++i) {
+        uint64_t order_id = json_integer_value(json_array_get(cmd->order_ids, i));
+        order_t *order = market_get_order(m, order_id);
+        if (order == NULL) {
+            json_array_append_new(cmd->result, get_order_result(10, "order not found", NULL));
+            continue;
+        }
+        if (order->user_id != cmd->user_id) {
+            json_array_append_new(cmd->result, get_order_result(11, "user not match", NULL));
+            continue;
+        }
 
-    json_t *result = NULL;
-    int ret = market_put_market_order(true, &result, market, user_id, side, amount, taker_fee, source);
+        json_t *info = NULL;
+        int ret = market_cancel_order(true, &info, m, order);
+        if (ret < 0) {
+            log_fatal("cancel order: %"PRIu64" fail: %d", order_id, ret);
+            json_array_append_new(cmd->result, get_order_result(2, "internal error", NULL));
+            cmd->errors += 1;
+            continue;
+        }
+        json_array_append_new(cmd->canceled, json_integer(order_id));
+        json_array_append_new(cmd->result, get_order_result(0, NULL, info));
+    }
+}
 
-    mpd_del(amount);
-    mpd_del(taker_fee);
+// run the command on the market, it may be called from the matching thread of the market
+static void exec_trade_cmd(market_t *m, void *privdata)
+{
+    struct trade_cmd *cmd = privdata;
+    order_t *order = NULL;
+    if (cmd->command == CMD_ORDER_CANCEL || cmd->command == CMD_ORDER_CANCEL_REPLACE) {
+        order = market_get_order(m, cmd->order_id);
+        if (order == NULL) {
+            set_trade_error(cmd, 10, "order not found");
+            return;
+        }
+        if (order->user_id != cmd->user_id) {
+            set_trade_error(cmd, 11, "user not match");
+            return;
+        }
+    }
 
-    if (ret == -1) {
-        return reply_error(ses, pkg, 10, "balance not enough");
-    } else if (ret == -2) {
-        return reply_error(ses, pkg, 11, "amount too small");
-    } else if (ret == -3) {
-        return reply_error(ses, pkg, 12, "no enough trader");
-    } else if (ret < 0) {
-        log_fatal("market_put_limit_order fail: %d", ret);
+    int ret;
+    switch (cmd->command) {
+    case CMD_ORDER_PUT_LIMIT:
+        ret = market_put_limit_order(true, &cmd->result, m, cmd->user_id, cmd->side, cmd->amount, cmd->price,
+                cmd->taker_fee, cmd->maker_fee, cmd->source);
+        if (ret == -1) {
+            set_trade_error(cmd, 10, "balance not enough");
+        } else if (ret == -2) {
+            set_trade_error(cmd, 11, "amount too small");
+        } else if (ret < 0) {
+            log_fatal("market_put_limit_order fail: %d", ret);
+            set_trade_error(cmd, 2, "internal error");
+        }
+        break;
+    case CMD_ORDER_PUT_MARKET:
+        ret = market_put_market_order(true, &cmd->result, m, cmd->user_id, cmd->side, cmd->amount, cmd->taker_fee, cmd->source);
+        if (ret == -1) {
+            set_trade_error(cmd, 10, "balance not enough");
+        } else if (ret == -2) {
+            set_trade_error(cmd, 11, "amount too small");
+        } else if (ret == -3) {
+            set_trade_error(cmd, 12, "no enough trader");
+        } else if (ret < 0) {
+            log_fatal("market_put_limit_order fail: %d", ret);
+            set_trade_error(cmd, 2, "internal error");
+        }
+        break;
+    case CMD_ORDER_CANCEL:
+        ret = market_cancel_order(true, &cmd->result, m, order);
+        if (ret < 0) {
+            log_fatal("cancel order: %"PRIu64" fail: %d", cmd->order_id, ret);
+            set_trade_error(cmd, 2, "internal error");
+        }
+        break;
+    case CMD_ORDER_CANCEL_BATCH:
+        exec_cancel_batch(m, cmd);
+        break;
+    case CMD_ORDER_CANCEL_REPLACE:
+        ret = market_replace_order(true, &cmd->result, m, order, cmd->side, cmd->amount, cmd->price,
+                cmd->taker_fee, cmd->maker_fee, cmd->source);
+        if (ret == -1) {
+            set_trade_error(cmd, 12, "balance not enough");
+        } else if (ret == -2) {
+            set_trade_error(cmd, 13, "amount too small");
+        } else if (ret < 0) {
+            log_fatal("market_replace_order fail: %d", ret);
+            set_trade_error(cmd, 2, "internal error");
+        }
+        break;
+    }
+}
+
+/* log the command if it changed anything, order_id is the id given to a batched command */
+static void append_trade_operlog(struct trade_cmd *cmd, uint64_t order_id)
+{
+    if (cmd->errors > 0) {
+        monitor_inc("error_internal_error", cmd->errors);
+    }
+    if (cmd->code)
+        return;
+
+    const char *method = NULL;
+    switch (cmd->command) {
+    case CMD_ORDER_PUT_LIMIT:
+        method = "limit_order";
+        break;
+    case CMD_ORDER_PUT_MARKET:
+        method = "market_order";
+        break;
+    case CMD_ORDER_CANCEL:
+        method = "cancel_order";
+        break;
+    case CMD_ORDER_CANCEL_REPLACE:
+        method = "cancel_replace_order";
+        break;
+    case CMD_ORDER_CANCEL_BATCH:
+        // only the orders canceled are logged
+        if (json_array_size(cmd->canceled) > 0) {
+            json_t *oper = json_array();
+            json_array_append(oper, json_array_get(cmd->params, 0));
+            json_array_append(oper, json_array_get(cmd->params, 1));
+            json_array_append(oper, cmd->canceled);
+            append_operlog("cancel_order_batch", oper);
+            json_decref(oper);
+        }
+        return;
+    }
+
+    if (order_id) {
+        append_operlog_order(method, cmd->params, order_id);
+    } else {
+        append_operlog(method, cmd->params);
+    }
+}
+
+static int reply_order_error(nw_ses *ses, rpc_pkg *pkg, int code, const char *message)
+{
+    if (code == 1) {
+        return reply_error_invalid_argument(ses, pkg);
+    } else if (code == 2) {
         return reply_error_internal_error(ses, pkg);
     }
+    return reply_error(ses, pkg, code, message);
+}
 
-    append_operlog("market_order", params);
-    ret = reply_result(ses, pkg, result);
-    json_decref(result);
+static int reply_trade_cmd(nw_ses *ses, rpc_pkg *pkg, struct trade_cmd *cmd)
+{
+    if (cmd->code)
+        return reply_order_error(ses, pkg, cmd->code, cmd->message);
+    return reply_result(ses, pkg, cmd->result);
+}
+
+static void free_trade_cmd(struct trade_cmd *cmd)
+{
+    json_decref(cmd->result);
+    json_decref(cmd->canceled);
+}
+
+static bool is_trade_cmd(uint32_t command)
+{
+    switch (command) {
+    case CMD_ORDER_PUT_LIMIT:
+    case CMD_ORDER_PUT_MARKET:
+    case CMD_ORDER_CANCEL:
+    case CMD_ORDER_CANCEL_BATCH:
+    case CMD_ORDER_CANCEL_REPLACE:
+        return true;
+    }
+    return false;
+}
+
+static bool is_order_put(uint32_t command)
+{
+    return command == CMD_ORDER_PUT_LIMIT || command == CMD_ORDER_PUT_MARKET || command == CMD_ORDER_CANCEL_REPLACE;
+}
+
+/*
+ * run the batch on the matching threads, then apply the journals, log and
+ * reply in command order. the order ids are taken here, before the run.
+ */
+static void flush_trade_batch(void)
+{
+    if (trade_batch_len == 0)
+        return;
+
+    for (size_t i = 0; i < trade_batch_len; ++i) {
+        struct trade_cmd *cmd = &trade_batch[i].cmd;
+        match_task_t *task = &trade_match_tasks[i];
+        task->market = cmd->market;
+        task->privdata = cmd;
+        task->journal.order_id = is_order_put(cmd->command) ? ++order_id_start : 0;
+    }
+    match_run(trade_match_tasks, trade_batch_len, exec_trade_cmd);
+
+    for (size_t i = 0; i < trade_batch_len; ++i) {
+        struct trade_task *trade = &trade_batch[i];
+        match_task_t *task = &trade_match_tasks[i];
+        uint64_t order_id = task->journal.order_id;
+        if (journal_apply(&task->journal, task->market) < 0) {
+            log_fatal("apply journal of command: %u, user: %u fail", trade->cmd.command, trade->cmd.user_id);
+        }
+        append_trade_operlog(&trade->cmd, order_id);
+        // the io thread drops the replies to the connections closed
+        if (io_enabled() || trade->ses->id == trade->ses_id) {
+            request_ses_id = trade->ses_id;
+            reply_trade_cmd(trade->ses, &trade->pkg, &trade->cmd);
+        }
+        free_trade_cmd(&trade->cmd);
+        json_decref(trade->cmd.params);
+        free(trade->pkg.ext);
+    }
+    monitor_inc("trade_batch", 1);
+    monitor_inc("trade_batch_cmd", trade_batch_len);
+
+    trade_batch_len = 0;
+    dict_clear(trade_batch_users);
+    depth_flush();
+    flush_cache();
+    if (io_enabled()) {
+        io_flush();
+    }
+}
+
+static void on_trade_batch_prepare(struct ev_loop *loop, ev_prepare *watcher, int events)
+{
+    flush_trade_batch();
+}
+
+static int add_trade_batch(nw_ses *ses, rpc_pkg *pkg, struct trade_cmd *cmd)
+{
+    void *user = (void *)(uintptr_t)cmd->user_id;
+    if (trade_batch_len == MATCH_BATCH_MAX_LEN || dict_find(trade_batch_users, user) != NULL) {
+        flush_trade_batch();
+    }
+    struct trade_task *trade = &trade_batch[trade_batch_len];
+    trade->ses = ses;
+    trade->ses_id = request_ses_id;
+    memcpy(&trade->pkg, pkg, sizeof(rpc_pkg));
+    trade->pkg.body = NULL;
+    trade->pkg.body_size = 0;
+    trade->pkg.ext = NULL;
+    // the ext is sent back with the reply, it is in the read buffer
+    if (pkg->ext_size) {
+        trade->pkg.ext = malloc(pkg->ext_size);
+        if (trade->pkg.ext == NULL)
+            return -__LINE__;
+        memcpy(trade->pkg.ext, pkg->ext, pkg->ext_size);
+    }
+    if (dict_add(trade_batch_users, user, NULL) == NULL) {
+        free(trade->pkg.ext);
+        return -__LINE__;
+    }
+    memcpy(&trade->cmd, cmd, sizeof(struct trade_cmd));
+    json_incref(cmd->params);
+    trade_batch_len += 1;
+
+    return 0;
+}
+
+// the single order commands, they are batched to the matching threads if there are more than one
+static int on_cmd_order_trade(nw_ses *ses, rpc_pkg *pkg, json_t *params)
+{
+    struct trade_cmd cmd;
+    if (parse_trade_cmd(pkg->command, params, &cmd) != 0)
+        return reply_error_invalid_argument(ses, pkg);
+    if (match_enabled())
+        return add_trade_batch(ses, pkg, &cmd);
+
+    exec_trade_cmd(cmd.market, &cmd);
+    append_trade_operlog(&cmd, 0);
+    int ret = reply_trade_cmd(ses, pkg, &cmd);
+    free_trade_cmd(&cmd);
     return ret;
+}
 
-invalid_argument:
-    if (amount)
-        mpd_del(amount);
-    if (taker_fee)
-        mpd_del(taker_fee);
+static int on_cmd_order_put_batch(nw_ses *ses, rpc_pkg *pkg, json_t *params)
+{
+    size_t size = json_array_size(params);
+    if (size == 0 || size > ORDER_BATCH_MAX_LEN)
+        return reply_error_invalid_argument(ses, pkg);
 
-    return reply_error_invalid_argument(ses, pkg);
+    json_t *result = json_array();
+    json_t *oper = json_array();
+    for (size_t i = 0; i < size; ++i) {
+        json_t *order_params = json_array_get(params, i);
+        struct trade_cmd cmd;
+        if (!json_is_array(order_params) || parse_trade_cmd(CMD_ORDER_PUT_LIMIT, order_params, &cmd) != 0) {
+            monitor_inc("error_invalid_argument", 1);
+            json_array_append_new(result, get_order_result(1, "invalid argument", NULL));
+            continue;
+        }
+        exec_trade_cmd(cmd.market, &cmd);
+        if (cmd.code == 0) {
+            json_array_append(oper, order_params);
+        } else if (cmd.code == 2) {
+            monitor_inc("error_internal_error", 1);
+        }
+        json_array_append_new(result, get_order_result(cmd.code, cmd.message, cmd.result));
+    }
+
+    // only the orders put are logged, replay them as single orders
+    if (json_array_size(oper) > 0) {
+        append_operlog("limit_order_batch", oper);
+    }
+    json_decref(oper);
+
+    int ret = reply_result(ses, pkg, result);
+    json_decref(result);
+    return ret;
 }
 
-static int on_cmd_order_cancel(nw_ses *ses, rpc_pkg *pkg, json_t *params)
+static int on_cmd_order_cancel_all(nw_ses *ses, rpc_pkg *pkg, json_t *params)
 {
-    if (json_array_size(params) != 3)
+    if (json_array_size(params) != 1 && json_array_size(params) != 2)
         return reply_error_invalid_argument(ses, pkg);
 
     // user_id
@@ -548,36 +918,43 @@ static int on_cmd_order_cancel(nw_ses *ses, rpc_pkg *pkg, json_t *params)
         return reply_error_invalid_argument(ses, pkg);
     uint32_t user_id = json_integer_value(json_array_get(params, 0));
 
-    // market
-    if (!json_is_string(json_array_get(params, 1)))
-        return reply_error_invalid_argument(ses, pkg);
-    const char *market_name = json_string_value(json_array_get(params, 1));
-    market_t *market = get_market(market_name);
-    if (market == NULL)
-        return reply_error_invalid_argument(ses, pkg);
+    // market, all markets if not given
+    market_t *market = NULL;
+    if (json_array_size(params) == 2) {
+        if (!json_is_string(json_array_get(params, 1)))
+            return reply_error_invalid_argument(ses, pkg);
+        market = get_market(json_string_value(json_array_get(params, 1)));
+        if (market == NULL)
+            return reply_error_invalid_argument(ses, pkg);
+    }
 
-    // order_id
-    if (!json_is_integer(json_array_get(params, 2)))
-        return reply_error_invalid_argument(ses, pkg);
-    uint64_t order_id = json_integer_value(json_array_get(params, 2));
+    int count = 0;
+    json_t *result = json_array();
+    for (size_t i = 0; i < settings.market_num; ++i) {
+        market_t *m = get_market_by_id(i);
+        if (market && m != market)
+            continue;
 
-    order_t *order = market_get_order(market, order_id);
-    if (order == NULL) {
-        return reply_error(ses, pkg, 10, "order not found");
-    }
-    if (order->user_id != user_id) {
-        return reply_error(ses, pkg, 11, "user not match");
+        json_t *order_ids = NULL;
+        int ret = market_cancel_all_order(true, &order_ids, m, user_id);
+        if (ret < 0) {
+            log_fatal("cancel all order, user: %u, market: %s fail: %d", user_id, m->name, ret);
+            json_decref(order_ids);
+            json_decref(result);
+            if (count > 0) {
+                append_operlog("cancel_all_order", params);
+            }
+            return reply_error_internal_error(ses, pkg);
+        }
+        count += ret;
+        json_array_extend(result, order_ids);
+        json_decref(order_ids);
     }
 
-    json_t *result = NULL;
-    int ret = market_cancel_order(true, &result, market, order);
-    if (ret < 0) {
-        log_fatal("cancel order: %"PRIu64" fail: %d", order->id, ret);
-        return reply_error_internal_error(ses, pkg);
+    if (count > 0) {
+        append_operlog("cancel_all_order", params);
     }
-
-    append_operlog("cancel_order", params);
-    ret = reply_result(ses, pkg, result);
+    int ret = reply_result(ses, pkg, result);
     json_decref(result);
     return ret;
 }
@@ -624,25 +1001,25 @@ static int on_cmd_order_pending(nw_ses *ses, rpc_pkg *pkg, json_t *params)
     json_object_set_new(result, "offset", json_integer(offset));
 
     json_t *orders = json_array();
-    skiplist_t *order_list = market_get_order_list(market, user_id);
+    order_list_t *order_list = market_get_order_list(market, user_id);
     if (order_list == NULL) {
         json_object_set_new(result, "total", json_integer(0));
     } else {
+        // offset counts the orders of both sides, the same as without side
+        size_t total = order_list->count;
+        if (side == MARKET_ORDER_SIDE_ASK) {
+            total = order_list->ask_count;
+        } else if (side == MARKET_ORDER_SIDE_BID) {
+            total = order_list->count - order_list->ask_count;
+        }
         size_t count = 0;
-        size_t total = 0;
-        skiplist_node *node;
-        skiplist_iter *iter = skiplist_get_iterator(order_list);
-        for (size_t i = 0; (node = skiplist_next(iter)) != NULL; i++) {
-            order_t *order = node->value;
+        order_t *order = order_list_get(order_list, offset);
+        for (; order && count < limit; order = order->user_next) {
             if (side && order->side != side)
                 continue;
-            total += 1;
-            if (i >= offset && count < limit) {
-                count += 1;
-                json_array_append_new(orders, get_order_info(order));
-            }
+            count += 1;
+            json_array_append_new(orders, get_order_info(market, order));
         }
-        skiplist_release_iterator(iter);
         json_object_set_new(result, "total", json_integer(total));
     }
 
@@ -684,113 +1061,94 @@ static int on_cmd_order_book(nw_ses *ses, rpc_pkg *pkg, json_t *params)
     if (limit > ORDER_BOOK_MAX_LEN)
         return reply_error_invalid_argument(ses, pkg);
 
+    sds cache_key = NULL;
+    if (process_cache(ses, pkg, market, &cache_key)) {
+        return 0;
+    }
+
     json_t *result = json_object();
     json_object_set_new(result, "offset", json_integer(offset));
     json_object_set_new(result, "limit", json_integer(limit));
 
     uint64_t total;
-    skiplist_iter *iter;
+    skiplist_t *list;
     if (side == MARKET_ORDER_SIDE_ASK) {
-        iter = skiplist_get_iterator(market->asks);
-        total = market->asks->len;
+        list = market->asks;
+        total = market->ask_count;
         json_object_set_new(result, "total", json_integer(total));
     } else {
-        iter = skiplist_get_iterator(market->bids);
-        total = market->bids->len;
+        list = market->bids;
+        total = market->bid_count;
         json_object_set_new(result, "total", json_integer(total));
     }
 
+    // the levels are weighted by their count, skip to the level of offset
     json_t *orders = json_array();
-    if (offset < total) {
-        for (size_t i = 0; i < offset; i++) {
-            if (skiplist_next(iter) == NULL)
-                break;
+    unsigned long skip = 0;
+    skiplist_node *node = skiplist_find_by_rank(list, offset, &skip);
+    size_t index = 0;
+    for (; node && index < limit; node = skiplist_node_next(node)) {
+        order_level_t *level = node->value;
+        order_t *order = level->head;
+        for (; skip > 0; skip--) {
+            order = order->next;
         }
-        size_t index = 0;
-        skiplist_node *node;
-        while ((node = skiplist_next(iter)) != NULL && index < limit) {
+        for (; order && index < limit; order = order->next) {
             index++;
-            order_t *order = node->value;
-            json_array_append_new(orders, get_order_info(order));
+            json_array_append_new(orders, get_order_info(market, order));
         }
     }
-    skiplist_release_iterator(iter);
 
     json_object_set_new(result, "orders", orders);
+    add_cache(market, cache_key, result);
+    sdsfree(cache_key);
+
     int ret = reply_result(ses, pkg, result);
     json_decref(result);
     return ret;
 }
 
-static json_t *get_depth(market_t *market, size_t limit)
+static json_t *get_depth_list(market_t *market, skiplist_t *list, size_t limit)
 {
-    mpd_t *price = mpd_new(&mpd_ctx);
-    mpd_t *amount = mpd_new(&mpd_ctx);
-
-    json_t *asks = json_array();
-    skiplist_iter *iter = skiplist_get_iterator(market->asks);
-    skiplist_node *node = skiplist_next(iter);
+    json_t *levels = json_array();
+    skiplist_iter *iter = skiplist_get_iterator(list);
+    skiplist_node *node;
     size_t index = 0;
-    while (node && index < limit) {
-        index++;
-        order_t *order = node->value;
-        mpd_copy(price, order->price, &mpd_ctx);
-        mpd_copy(amount, order->left, &mpd_ctx);
-        while ((node = skiplist_next(iter)) != NULL) {
-            order = node->value;
-            if (mpd_cmp(price, order->price, &mpd_ctx) == 0) {
-                mpd_add(amount, amount, order->left, &mpd_ctx);
-            } else {
-                break;
-            }
-        }
-        json_t *info = json_array();
-        json_array_append_new_mpd(info, price);
-        json_array_append_new_mpd(info, amount);
-        json_array_append_new(asks, info);
-    }
-    skiplist_release_iterator(iter);
-
-    json_t *bids = json_array();
-    iter = skiplist_get_iterator(market->bids);
-    node = skiplist_next(iter);
-    index = 0;
-    while (node && index < limit) {
+    while ((node = skiplist_next(iter)) != NULL && index < limit) {
         index++;
-        order_t *order = node->value;
-        mpd_copy(price, order->price, &mpd_ctx);
-        mpd_copy(amount, order->left, &mpd_ctx);
-        while ((node = skiplist_next(iter)) != NULL) {
-            order = node->value;
-            if (mpd_cmp(price, order->price, &mpd_ctx) == 0) {
-                mpd_add(amount, amount, order->left, &mpd_ctx);
-            } else {
-                break;
-            }
-        }
+        order_level_t *level = node->value;
         json_t *info = json_array();
-        json_array_append_new_mpd(info, price);
-        json_array_append_new_mpd(info, amount);
-        json_array_append_new(bids, info);
+        json_array_append_new_fixed(info, level->price, market->money_prec);
+        json_array_append_new_fixed(info, level->left, market->stock_prec);
+        json_array_append_new(levels, info);
     }
     skiplist_release_iterator(iter);
 
-    mpd_del(price);
-    mpd_del(amount);
+    return levels;
+}
 
+static json_t *get_depth(market_t *market, size_t limit)
+{
     json_t *result = json_object();
-    json_object_set_new(result, "asks", asks);
-    json_object_set_new(result, "bids", bids);
+    json_object_set_new(result, "asks", get_depth_list(market, market->asks, limit));
+    json_object_set_new(result, "bids", get_depth_list(market, market->bids, limit));
 
     return result;
 }
 
-static json_t *get_depth_merge(market_t* market, size_t limit, mpd_t *interval)
+static json_t *get_depth_merge(market_t* market, size_t limit, fixed_t interval)
 {
-    mpd_t *q = mpd_new(&mpd_ctx);
-    mpd_t *r = mpd_new(&mpd_ctx);
-    mpd_t *price = mpd_new(&mpd_ctx);
-    mpd_t *amount = mpd_new(&mpd_ctx);
+    // the configured intervals are kept merged by the market
+    skiplist_t *ask_ladder = market_get_depth_ladder(market, MARKET_ORDER_SIDE_ASK, interval);
+    skiplist_t *bid_ladder = market_get_depth_ladder(market, MARKET_ORDER_SIDE_BID, interval);
+    if (ask_ladder && bid_ladder) {
+        json_t *result = json_object();
+        json_object_set_new(result, "asks", get_depth_list(market, ask_ladder, limit));
+        json_object_set_new(result, "bids", get_depth_list(market, bid_ladder, limit));
+        return result;
+    }
+
+    fixed_t price, amount;
 
     json_t *asks = json_array();
     skiplist_iter *iter = skiplist_get_iterator(market->asks);
@@ -798,24 +1156,23 @@ static json_t *get_depth_merge(market_t* market, size_t limit, mpd_t *interval)
     size_t index = 0;
     while (node && index < limit) {
         index++;
-        order_t *order = node->value;
-        mpd_divmod(q, r, order->price, interval, &mpd_ctx);
-        mpd_mul(price, q, interval, &mpd_ctx);
-        if (mpd_cmp(r, mpd_zero, &mpd_ctx) != 0) {
-            mpd_add(price, price, interval, &mpd_ctx);
+        order_level_t *level = node->value;
+        price = level->price / interval * interval;
+        if (level->price % interval != 0) {
+            price += interval;
         }
-        mpd_copy(amount, order->left, &mpd_ctx);
+        amount = level->left;
         while ((node = skiplist_next(iter)) != NULL) {
-            order = node->value;
-            if (mpd_cmp(price, order->price, &mpd_ctx) >= 0) {
-                mpd_add(amount, amount, order->left, &mpd_ctx);
+            level = node->value;
+            if (price >= level->price) {
+                amount += level->left;
             } else {
                 break;
             }
         }
         json_t *info = json_array();
-        json_array_append_new_mpd(info, price);
-        json_array_append_new_mpd(info, amount);
+        json_array_append_new_fixed(info, price, market->money_prec);
+        json_array_append_new_fixed(info, amount, market->stock_prec);
         json_array_append_new(asks, info);
     }
     skiplist_release_iterator(iter);
@@ -826,31 +1183,25 @@ static json_t *get_depth_merge(market_t* market, size_t limit, mpd_t *interval)
     index = 0;
     while (node && index < limit) {
         index++;
-        order_t *order = node->value;
-        mpd_divmod(q, r, order->price, interval, &mpd_ctx);
-        mpd_mul(price, q, interval, &mpd_ctx);
-        mpd_copy(amount, order->left, &mpd_ctx);
+        order_level_t *level = node->value;
+        price = level->price / interval * interval;
+        amount = level->left;
         while ((node = skiplist_next(iter)) != NULL) {
-            order = node->value;
-            if (mpd_cmp(price, order->price, &mpd_ctx) <= 0) {
-                mpd_add(amount, amount, order->left, &mpd_ctx);
+            level = node->value;
+            if (price <= level->price) {
+                amount += level->left;
             } else {
                 break;
             }
         }
 
         json_t *info = json_array();
-        json_array_append_new_mpd(info, price);
-        json_array_append_new_mpd(info, amount);
+        json_array_append_new_fixed(info, price, market->money_prec);
+        json_array_append_new_fixed(info, amount, market->stock_prec);
         json_array_append_new(bids, info);
     }
     skiplist_release_iterator(iter);
 
-    mpd_del(q);
-    mpd_del(r);
-    mpd_del(price);
-    mpd_del(amount);
-
     json_t *result = json_object();
     json_object_set_new(result, "asks", asks);
     json_object_set_new(result, "bids", bids);
@@ -881,34 +1232,30 @@ static int on_cmd_order_depth(nw_ses *ses, rpc_pkg *pkg, json_t *params)
     // interval
     if (!json_is_string(json_array_get(params, 2)))
         return reply_error_invalid_argument(ses, pkg);
-    mpd_t *interval = decimal(json_string_value(json_array_get(params, 2)), market->money_prec);
-    if (!interval)
+    fixed_t interval;
+    if (fixed_parse(json_string_value(json_array_get(params, 2)), market->money_prec, &interval) < 0)
         return reply_error_invalid_argument(ses, pkg);
-    if (mpd_cmp(interval, mpd_zero, &mpd_ctx) < 0) {
-        mpd_del(interval);
+    if (interval < 0)
         return reply_error_invalid_argument(ses, pkg);
-    }
 
     sds cache_key = NULL;
-    if (process_cache(ses, pkg, &cache_key)) {
-        mpd_del(interval);
+    if (process_cache(ses, pkg, market, &cache_key)) {
         return 0;
     }
 
     json_t *result = NULL;
-    if (mpd_cmp(interval, mpd_zero, &mpd_ctx) == 0) {
+    if (interval == 0) {
         result = get_depth(market, limit);
     } else {
         result = get_depth_merge(market, limit, interval);
     }
-    mpd_del(interval);
 
     if (result == NULL) {
         sdsfree(cache_key);
         return reply_error_internal_error(ses, pkg);
     }
 
-    add_cache(cache_key, result);
+    add_cache(market, cache_key, result);
     sdsfree(cache_key);
 
     int ret = reply_result(ses, pkg, result);
@@ -916,6 +1263,28 @@ static int on_cmd_order_depth(nw_ses *ses, rpc_pkg *pkg, json_t *params)
     return ret;
 }
 
+static int on_cmd_order_depth_subscribe(nw_ses *ses, rpc_pkg *pkg, json_t *params)
+{
+    if (json_array_size(params) != 1)
+        return reply_error_invalid_argument(ses, pkg);
+
+    // market
+    if (!json_is_string(json_array_get(params, 0)))
+        return reply_error_invalid_argument(ses, pkg);
+    const char *market_name = json_string_value(json_array_get(params, 0));
+    market_t *market = get_market(market_name);
+    if (market == NULL)
+        return reply_error_invalid_argument(ses, pkg);
+
+    json_t *result = depth_subscribe(ses, request_ses_id, market);
+    if (result == NULL)
+        return reply_error_internal_error(ses, pkg);
+
+    int ret = reply_result(ses, pkg, result);
+    json_decref(result);
+    return ret;
+}
+
 static int on_cmd_order_detail(nw_ses *ses, rpc_pkg *pkg, json_t *params)
 {
     if (json_array_size(params) != 2)
@@ -939,7 +1308,7 @@ static int on_cmd_order_detail(nw_ses *ses, rpc_pkg *pkg, json_t *params)
     if (order == NULL) {
         result = json_null();
     } else {
-        result = get_order_info(order);
+        result = get_order_info(market, order);
     }
 
     int ret = reply_result(ses, pkg, result);
@@ -971,20 +1340,17 @@ static json_t *get_market_summary(const char *name)
 {
     size_t ask_count;
     size_t bid_count;
-    mpd_t *ask_amount = mpd_new(&mpd_ctx);
-    mpd_t *bid_amount = mpd_new(&mpd_ctx);
+    fixed_t ask_amount;
+    fixed_t bid_amount;
     market_t *market = get_market(name);
-    market_get_status(market, &ask_count, ask_amount, &bid_count, bid_amount);
+    market_get_status(market, &ask_count, &ask_amount, &bid_count, &bid_amount);
     
     json_t *obj = json_object();
     json_object_set_new(obj, "name", json_string(name));
     json_object_set_new(obj, "ask_count", json_integer(ask_count));
-    json_object_set_new_mpd(obj, "ask_amount", ask_amount);
+    json_object_set_new_fixed(obj, "ask_amount", ask_amount, ask_count ? market->stock_prec : 0);
     json_object_set_new(obj, "bid_count", json_integer(bid_count));
-    json_object_set_new_mpd(obj, "bid_amount", bid_amount);
-
-    mpd_del(ask_amount);
-    mpd_del(bid_amount);
+    json_object_set_new_fixed(obj, "bid_amount", bid_amount, bid_count ? market->stock_prec : 0);
 
     return obj;
 }
@@ -1016,18 +1382,85 @@ invalid_argument:
     return reply_error_invalid_argument(ses, pkg);
 }
 
-static void svr_on_recv_pkg(nw_ses *ses, rpc_pkg *pkg)
+static const char *get_param_str(json_t *params, size_t index)
+{
+    json_t *node = json_array_get(params, index);
+    return json_is_string(node) ? json_string_value(node) : NULL;
+}
+
+static uint32_t get_param_user(json_t *params)
+{
+    json_t *user = json_array_get(params, 0);
+    return json_is_integer(user) ? json_integer_value(user) : 0;
+}
+
+// every order of the batch is charged, a batch too long is rejected by the command
+static bool is_batch_admitted(json_t *params)
+{
+    uint32_t user_ids[ORDER_BATCH_MAX_LEN];
+    const char *sources[ORDER_BATCH_MAX_LEN];
+    size_t count = json_array_size(params);
+    if (count > ORDER_BATCH_MAX_LEN)
+        count = ORDER_BATCH_MAX_LEN;
+    for (size_t i = 0; i < count; ++i) {
+        json_t *order_params = json_array_get(params, i);
+        user_ids[i] = get_param_user(order_params);
+        sources[i] = get_param_str(order_params, 7);
+    }
+    return admit_order_batch(count, user_ids, sources);
+}
+
+// the user and source are taken before the params are checked, they may be missing
+static bool is_admitted(uint32_t command, json_t *params)
+{
+    int class = ADMIT_CLASS_ORDER;
+    const char *source = NULL;
+    switch (command) {
+    case CMD_ASSET_UPDATE:
+        class = ADMIT_CLASS_BALANCE;
+        break;
+    case CMD_ORDER_CANCEL:
+    case CMD_ORDER_CANCEL_BATCH:
+    case CMD_ORDER_CANCEL_ALL:
+        class = ADMIT_CLASS_CANCEL;
+        break;
+    case CMD_ORDER_PUT_LIMIT:
+        source = get_param_str(params, 7);
+        break;
+    case CMD_ORDER_PUT_MARKET:
+        source = get_param_str(params, 5);
+        break;
+    case CMD_ORDER_CANCEL_REPLACE:
+        source = get_param_str(params, 8);
+        break;
+    case CMD_ORDER_PUT_BATCH:
+        return is_batch_admitted(params);
+    }
+
+    return admit_request(class, get_param_user(params), source);
+}
+
+// with io_thread the session is the io thread's, only peer_addr is read here
+static void on_request(nw_ses *ses, uint64_t ses_id, nw_addr_t *peer_addr, rpc_pkg *pkg, json_t *params)
 {
-    json_t *params = json_loadb(pkg->body, pkg->body_size, 0, NULL);
-    if (params == NULL || !json_is_array(params)) {
-        goto decode_error;
+    char peer[NW_HUMAN_ADDR_SIZE];
+    sds params_str = NULL;
+    if (pkg->pkg_type & RPC_PKG_FLAG_BINARY) {
+        params_str = sdscatprintf(sdsempty(), "<binary %u bytes>", pkg->body_size);
+    } else {
+        params_str = sdsnewlen(pkg->body, pkg->body_size);
+    }
+    request_ses_id = ses_id;
+
+    // the batch of the matching threads is run before any other command
+    if (!is_trade_cmd(pkg->command)) {
+        flush_trade_batch();
     }
-    sds params_str = sdsnewlen(pkg->body, pkg->body_size);
 
     int ret;
     switch (pkg->command) {
     case CMD_ASSET_LIST:
-        log_trace("from: %s cmd asset list, sequence: %u params: %s", nw_sock_human_addr(&ses->peer_addr), pkg->sequence, params_str);
+        log_trace("from: %s cmd asset list, sequence: %u params: %s", nw_sock_human_addr_s(peer_addr, peer), pkg->sequence, params_str);
         monitor_inc("cmd_asset_list", 1);
         ret = on_cmd_asset_list(ses, pkg, params);
         if (ret < 0) {
@@ -1035,7 +1468,7 @@ static void svr_on_recv_pkg(nw_ses *ses, rpc_pkg *pkg)
         }
         break;
     case CMD_ASSET_SUMMARY:
-        log_trace("from: %s cmd asset summary, sequence: %u params: %s", nw_sock_human_addr(&ses->peer_addr), pkg->sequence, params_str);
+        log_trace("from: %s cmd asset summary, sequence: %u params: %s", nw_sock_human_addr_s(peer_addr, peer), pkg->sequence, params_str);
         monitor_inc("cmd_asset_summary", 1);
         ret = on_cmd_asset_summary(ses, pkg, params);
         if (ret < 0) {
@@ -1043,7 +1476,7 @@ static void svr_on_recv_pkg(nw_ses *ses, rpc_pkg *pkg)
         }
         break;
     case CMD_ASSET_QUERY:
-        log_trace("from: %s cmd balance query, sequence: %u params: %s", nw_sock_human_addr(&ses->peer_addr), pkg->sequence, params_str);
+        log_trace("from: %s cmd balance query, sequence: %u params: %s", nw_sock_human_addr_s(peer_addr, peer), pkg->sequence, params_str);
         monitor_inc("cmd_asset_query", 1);
         ret = on_cmd_asset_query(ses, pkg, params);
         if (ret < 0) {
@@ -1051,13 +1484,11 @@ static void svr_on_recv_pkg(nw_ses *ses, rpc_pkg *pkg)
         }
         break;
     case CMD_ASSET_UPDATE:
-        if (is_operlog_block() || is_history_block() || is_message_block()) {
-            log_fatal("service unavailable, operlog: %d, history: %d, message: %d",
-                    is_operlog_block(), is_history_block(), is_message_block());
+        if (!is_admitted(pkg->command, params)) {
             reply_error_service_unavailable(ses, pkg);
             goto cleanup;
         }
-        log_trace("from: %s cmd balance update, sequence: %u params: %s", nw_sock_human_addr(&ses->peer_addr), pkg->sequence, params_str);
+        log_trace("from: %s cmd balance update, sequence: %u params: %s", nw_sock_human_addr_s(peer_addr, peer), pkg->sequence, params_str);
         monitor_inc("cmd_asset_update", 1);
         ret = on_cmd_asset_update(ses, pkg, params);
         if (ret < 0) {
@@ -1065,49 +1496,99 @@ static void svr_on_recv_pkg(nw_ses *ses, rpc_pkg *pkg)
         }
         break;
     case CMD_ORDER_PUT_LIMIT:
-        if (is_operlog_block() || is_history_block() || is_message_block()) {
-            log_fatal("service unavailable, operlog: %d, history: %d, message: %d",
-                    is_operlog_block(), is_history_block(), is_message_block());
+        if (!is_admitted(pkg->command, params)) {
             reply_error_service_unavailable(ses, pkg);
             goto cleanup;
         }
-        log_trace("from: %s cmd order put limit, sequence: %u params: %s", nw_sock_human_addr(&ses->peer_addr), pkg->sequence, params_str);
+        log_trace("from: %s cmd order put limit, sequence: %u params: %s", nw_sock_human_addr_s(peer_addr, peer), pkg->sequence, params_str);
         monitor_inc("cmd_order_put_limit", 1);
-        ret = on_cmd_order_put_limit(ses, pkg, params);
+        ret = on_cmd_order_trade(ses, pkg, params);
         if (ret < 0) {
             log_error("on_cmd_order_put_limit %s fail: %d", params_str, ret);
         }
         break;
     case CMD_ORDER_PUT_MARKET:
-        if (is_operlog_block() || is_history_block() || is_message_block()) {
-            log_fatal("service unavailable, operlog: %d, history: %d, message: %d",
-                    is_operlog_block(), is_history_block(), is_message_block());
+        if (!is_admitted(pkg->command, params)) {
             reply_error_service_unavailable(ses, pkg);
             goto cleanup;
         }
-        log_trace("from: %s cmd order put market, sequence: %u params: %s", nw_sock_human_addr(&ses->peer_addr), pkg->sequence, params_str);
+        log_trace("from: %s cmd order put market, sequence: %u params: %s", nw_sock_human_addr_s(peer_addr, peer), pkg->sequence, params_str);
         monitor_inc("cmd_order_put_market", 1);
-        ret = on_cmd_order_put_market(ses, pkg, params);
+        ret = on_cmd_order_trade(ses, pkg, params);
         if (ret < 0) {
             log_error("on_cmd_order_put_market %s fail: %d", params_str, ret);
         }
         break;
     case CMD_ORDER_CANCEL:
-        if (is_operlog_block() || is_history_block() || is_message_block()) {
-            log_fatal("service unavailable, operlog: %d, history: %d, message: %d",
-                    is_operlog_block(), is_history_block(), is_message_block());
+        if (!is_admitted(pkg->command, params)) {
             reply_error_service_unavailable(ses, pkg);
             goto cleanup;
         }
-        log_trace("from: %s cmd order cancel, sequence: %u params: %s", nw_sock_human_addr(&ses->peer_addr), pkg->sequence, params_str);
+        log_trace("from: %s cmd order cancel, sequence: %u params: %s", nw_sock_human_addr_s(peer_addr, peer), pkg->sequence, params_str);
         monitor_inc("cmd_order_cancel", 1);
-        ret = on_cmd_order_cancel(ses, pkg, params);
+        ret = on_cmd_order_trade(ses, pkg, params);
         if (ret < 0) {
             log_error("on_cmd_order_cancel %s fail: %d", params_str, ret);
         }
         break;
+    case CMD_ORDER_PUT_BATCH:
+        if (!is_admitted(pkg->command, params)) {
+            reply_error_service_unavailable(ses, pkg);
+            goto cleanup;
+        }
+        log_trace("from: %s cmd order put batch, sequence: %u params: %s", nw_sock_human_addr_s(peer_addr, peer), pkg->sequence, params_str);
+        monitor_inc("cmd_order_put_batch", 1);
+        ret = on_cmd_order_put_batch(ses, pkg, params);
+        if (ret < 0) {
+            log_error("on_cmd_order_put_batch %s fail: %d", params_str, ret);
+        }
+        break;
+    case CMD_ORDER_CANCEL_BATCH:
+        if (!is_admitted(pkg->command, params)) {
+            reply_error_service_unavailable(ses, pkg);
+            goto cleanup;
+        }
+        log_trace("from: %s cmd order cancel batch, sequence: %u params: %s", nw_sock_human_addr_s(peer_addr, peer), pkg->sequence, params_str);
+        monitor_inc("cmd_order_cancel_batch", 1);
+        ret = on_cmd_order_trade(ses, pkg, params);
+        if (ret < 0) {
+            log_error("on_cmd_order_cancel_batch %s fail: %d", params_str, ret);
+        }
+        break;
+    case CMD_ORDER_CANCEL_REPLACE:
+        if (!is_admitted(pkg->command, params)) {
+            reply_error_service_unavailable(ses, pkg);
+            goto cleanup;
+        }
+        log_trace("from: %s cmd order cancel replace, sequence: %u params: %s", nw_sock_human_addr_s(peer_addr, peer), pkg->sequence, params_str);
+        monitor_inc("cmd_order_cancel_replace", 1);
+        ret = on_cmd_order_trade(ses, pkg, params);
+        if (ret < 0) {
+            log_error("on_cmd_order_cancel_replace %s fail: %d", params_str, ret);
+        }
+        break;
+    case CMD_ORDER_CANCEL_ALL:
+        if (!is_admitted(pkg->command, params)) {
+            reply_error_service_unavailable(ses, pkg);
+            goto cleanup;
+        }
+        log_trace("from: %s cmd order cancel all, sequence: %u params: %s", nw_sock_human_addr_s(peer_addr, peer), pkg->sequence, params_str);
+        monitor_inc("cmd_order_cancel_all", 1);
+        ret = on_cmd_order_cancel_all(ses, pkg, params);
+        if (ret < 0) {
+            log_error("on_cmd_order_cancel_all %s fail: %d", params_str, ret);
+        }
+        break;
+    case CMD_ORDER_DEPTH_SUBSCRIBE:
+        log_trace("from: %s cmd order depth subscribe, sequence: %u params: %s", nw_sock_human_addr_s(peer_addr, peer), pkg->sequence, params_str);
+        monitor_inc("cmd_order_depth_subscribe", 1);
+        ret = on_cmd_order_depth_subscribe(ses, pkg, params);
+        if (ret < 0) {
+            log_error("on_cmd_order_depth_subscribe %s fail: %d", params_str, ret);
+        }
+        break;
     case CMD_ORDER_PENDING:
-        log_trace("from: %s cmd order query, sequence: %u params: %s", nw_sock_human_addr(&ses->peer_addr), pkg->sequence, params_str);
+        log_trace("from: %s cmd order query, sequence: %u params: %s", nw_sock_human_addr_s(peer_addr, peer), pkg->sequence, params_str);
         monitor_inc("cmd_order_pending", 1);
         ret = on_cmd_order_pending(ses, pkg, params);
         if (ret < 0) {
@@ -1115,7 +1596,7 @@ static void svr_on_recv_pkg(nw_ses *ses, rpc_pkg *pkg)
         }
         break;
     case CMD_ORDER_BOOK:
-        log_trace("from: %s cmd order book, sequence: %u params: %s", nw_sock_human_addr(&ses->peer_addr), pkg->sequence, params_str);
+        log_trace("from: %s cmd order book, sequence: %u params: %s", nw_sock_human_addr_s(peer_addr, peer), pkg->sequence, params_str);
         monitor_inc("cmd_order_book", 1);
         ret = on_cmd_order_book(ses, pkg, params);
         if (ret < 0) {
@@ -1123,7 +1604,7 @@ static void svr_on_recv_pkg(nw_ses *ses, rpc_pkg *pkg)
         }
         break;
     case CMD_ORDER_DEPTH:
-        log_trace("from: %s cmd order book depth, sequence: %u params: %s", nw_sock_human_addr(&ses->peer_addr), pkg->sequence, params_str);
+        log_trace("from: %s cmd order book depth, sequence: %u params: %s", nw_sock_human_addr_s(peer_addr, peer), pkg->sequence, params_str);
         monitor_inc("cmd_order_depth", 1);
         ret = on_cmd_order_depth(ses, pkg, params);
         if (ret < 0) {
@@ -1131,7 +1612,7 @@ static void svr_on_recv_pkg(nw_ses *ses, rpc_pkg *pkg)
         }
         break;
     case CMD_ORDER_PENDING_DETAIL:
-        log_trace("from: %s cmd order detail, sequence: %u params: %s", nw_sock_human_addr(&ses->peer_addr), pkg->sequence, params_str);
+        log_trace("from: %s cmd order detail, sequence: %u params: %s", nw_sock_human_addr_s(peer_addr, peer), pkg->sequence, params_str);
         monitor_inc("cmd_order_detail", 1);
         ret = on_cmd_order_detail(ses, pkg, params);
         if (ret < 0) {
@@ -1139,7 +1620,7 @@ static void svr_on_recv_pkg(nw_ses *ses, rpc_pkg *pkg)
         }
         break;
     case CMD_MARKET_LIST:
-        log_trace("from: %s cmd market list, sequence: %u params: %s", nw_sock_human_addr(&ses->peer_addr), pkg->sequence, params_str);
+        log_trace("from: %s cmd market list, sequence: %u params: %s", nw_sock_human_addr_s(peer_addr, peer), pkg->sequence, params_str);
         monitor_inc("cmd_market_list", 1);
         ret = on_cmd_market_list(ses, pkg, params);
         if (ret < 0) {
@@ -1147,7 +1628,7 @@ static void svr_on_recv_pkg(nw_ses *ses, rpc_pkg *pkg)
         }
         break;
     case CMD_MARKET_SUMMARY:
-        log_trace("from: %s cmd market summary, sequence: %u params: %s", nw_sock_human_addr(&ses->peer_addr), pkg->sequence, params_str);
+        log_trace("from: %s cmd market summary, sequence: %u params: %s", nw_sock_human_addr_s(peer_addr, peer), pkg->sequence, params_str);
         monitor_inc("cmd_market_summary", 1);
         ret = on_cmd_market_summary(ses, pkg, params);
         if (ret < 0) {
@@ -1155,26 +1636,29 @@ static void svr_on_recv_pkg(nw_ses *ses, rpc_pkg *pkg)
         }
         break;
     default:
-        log_error("from: %s unknown command: %u", nw_sock_human_addr(&ses->peer_addr), pkg->command);
+        log_error("from: %s unknown command: %u", nw_sock_human_addr_s(peer_addr, peer), pkg->command);
         break;
     }
+    depth_flush();
+    flush_cache();
 
 cleanup:
     sdsfree(params_str);
-    json_decref(params);
     return;
+}
 
-decode_error:
-    if (params) {
-        json_decref(params);
-    }
-    sds hex = hexdump(pkg->body, pkg->body_size);
-    log_error("connection: %s, cmd: %u decode params fail, params data: \n%s", \
-            nw_sock_human_addr(&ses->peer_addr), pkg->command, hex);
-    sdsfree(hex);
-    rpc_svr_close_clt(svr, ses);
+static void on_close(nw_ses *ses, uint64_t ses_id)
+{
+    depth_unsubscribe(ses);
+}
 
-    return;
+static void svr_on_recv_pkg(nw_ses *ses, rpc_pkg *pkg)
+{
+    json_t *params = decode_pkg_params(svr, ses, pkg);
+    if (params == NULL)
+        return;
+    on_request(ses, ses->id, &ses->peer_addr, pkg, params);
+    json_decref(params);
 }
 
 static void svr_on_new_connection(nw_ses *ses)
@@ -1185,6 +1669,7 @@ static void svr_on_new_connection(nw_ses *ses)
 static void svr_on_connection_close(nw_ses *ses)
 {
     log_trace("connection: %s close", nw_sock_human_addr(&ses->peer_addr));
+    on_close(ses, ses->id);
 }
 
 static uint32_t cache_dict_hash_function(const void *key)
@@ -1207,27 +1692,62 @@ static void cache_dict_key_free(void *key)
     sdsfree(key);
 }
 
-static void *cache_dict_val_dup(const void *val)
+static void cache_dict_val_free(void *val)
 {
-    struct cache_val *obj = malloc(sizeof(struct cache_val));
-    memcpy(obj, val, sizeof(struct cache_val));
-    return obj;
+    json_decref(val);
 }
 
-static void cache_dict_val_free(void *val)
+static uint32_t batch_user_hash_function(const void *key)
 {
-    struct cache_val *obj = val;
-    json_decref(obj->result);
-    free(val);
+    return (uintptr_t)key;
+}
+
+static int batch_user_key_compare(const void *key1, const void *key2)
+{
+    return key1 == key2 ? 0 : 1;
+}
+
+static int init_trade_batch(void)
+{
+    trade_batch = malloc(sizeof(struct trade_task) * MATCH_BATCH_MAX_LEN);
+    if (trade_batch == NULL)
+        return -__LINE__;
+    trade_match_tasks = calloc(MATCH_BATCH_MAX_LEN, sizeof(match_task_t));
+    if (trade_match_tasks == NULL)
+        return -__LINE__;
+
+    dict_types dt;
+    memset(&dt, 0, sizeof(dt));
+    dt.hash_function  = batch_user_hash_function;
+    dt.key_compare    = batch_user_key_compare;
+    trade_batch_users = dict_create(&dt, MATCH_BATCH_MAX_LEN);
+    if (trade_batch_users == NULL)
+        return -__LINE__;
+
+    // the batch is run when the loop has nothing more to read
+    ev_prepare_init(&trade_batch_watcher, on_trade_batch_prepare);
+    ev_prepare_start(nw_default_loop, &trade_batch_watcher);
+
+    return 0;
 }
 
 static void on_cache_timer(nw_timer *timer, void *privdata)
 {
-    dict_clear(dict_cache);
+    for (size_t i = 0; i < settings.market_num; ++i) {
+        dict_clear(market_caches[i].dict);
+    }
 }
 
-int init_server(void)
+static int init_svr(void)
 {
+    if (io_enabled()) {
+        io_handler handler;
+        memset(&handler, 0, sizeof(handler));
+        handler.on_request = on_request;
+        handler.on_close = on_close;
+        return init_io(&handler);
+    }
+
     rpc_svr_type type;
     memset(&type, 0, sizeof(type));
     type.on_recv_pkg = svr_on_recv_pkg;
@@ -1240,22 +1760,49 @@ int init_server(void)
     if (rpc_svr_start(svr) < 0)
         return -__LINE__;
 
+    return 0;
+}
+
+int init_server(void)
+{
     dict_types dt;
     memset(&dt, 0, sizeof(dt));
     dt.hash_function  = cache_dict_hash_function;
     dt.key_compare    = cache_dict_key_compare;
     dt.key_dup        = cache_dict_key_dup;
     dt.key_destructor = cache_dict_key_free;
-    dt.val_dup        = cache_dict_val_dup;
     dt.val_destructor = cache_dict_val_free;
 
-    dict_cache = dict_create(&dt, 64);
-    if (dict_cache == NULL)
+    market_caches = malloc(sizeof(struct market_cache) * (settings.market_num + 1));
+    if (market_caches == NULL)
+        return -__LINE__;
+    for (size_t i = 0; i < settings.market_num; ++i) {
+        market_t *market = get_market_by_id(i);
+        if (market == NULL)
+            return -__LINE__;
+        market_caches[i].version = market->book_version;
+        market_caches[i].dict = dict_create(&dt, 64);
+        if (market_caches[i].dict == NULL)
+            return -__LINE__;
+    }
+
+    if (match_enabled() && init_trade_batch() < 0)
         return -__LINE__;
 
     nw_timer_set(&cache_timer, 60, true, on_cache_timer, NULL);
     nw_timer_start(&cache_timer);
 
+    // requests may come once the server is started
+    if (init_svr() < 0)
+        return -__LINE__;
+
+    return 0;
+}
+
+int fini_server(void)
+{
+    flush_trade_batch();
+    fini_io();
     return 0;
 }
 
@@ -7,6 +7,8 @@
 # define _ME_SERVER_H_
 
 int init_server(void);
+/* run the trade commands still in the batch of the matching threads */
+int fini_server(void);
 
 # endif
 
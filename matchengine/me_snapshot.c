@@ -0,0 +1,564 @@
+/*
+ * Description: binary slice file, written with the mysql slice and loaded by mmap
+ */
+
+# include "me_snapshot.h"
+# include "me_trade.h"
+# include "ut_crc32.h"
+
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <sys/uio.h>
+
+# define SNAPSHOT_MAGIC         "MESLICE"
+# define SNAPSHOT_VERSION       1
+# define SNAPSHOT_NAME_LEN      31
+
+# define SNAPSHOT_BLOCK_ORDER   1
+# define SNAPSHOT_BLOCK_BALANCE 2
+
+enum {
+    SNAP_PRICE,
+    SNAP_AMOUNT,
+    SNAP_TAKER_FEE,
+    SNAP_MAKER_FEE,
+    SNAP_LEFT,
+    SNAP_FROZEN,
+    SNAP_DEAL_STOCK,
+    SNAP_DEAL_MONEY,
+    SNAP_DEAL_FEE,
+    SNAP_FIELD_NUM,
+};
+
+/* all records are multiples of 16 bytes, so fixed_t is aligned in the mapped file */
+struct snapshot_header {
+    char        magic[8];
+    uint32_t    version;
+    uint32_t    crc;
+    int64_t     timestamp;
+    uint64_t    last_oper_id;
+    uint64_t    last_order_id;
+    uint64_t    last_deals_id;
+    uint64_t    block_count;
+    uint64_t    order_count;
+    uint64_t    balance_count;
+    uint64_t    size;
+};
+
+struct snapshot_block {
+    uint32_t    type;
+    uint32_t    count;
+    uint32_t    crc;
+    uint32_t    reserved;
+};
+
+/* values keep the prec they are written with, they are rescaled to the market config on load */
+struct snapshot_order {
+    fixed_t     value[SNAP_FIELD_NUM];
+    uint64_t    id;
+    double      create_time;
+    double      update_time;
+    uint32_t    type;
+    uint32_t    side;
+    uint32_t    user_id;
+    int8_t      prec[SNAP_FIELD_NUM];
+    char        market[SNAPSHOT_NAME_LEN + 1];
+    char        source[SOURCE_MAX_LEN + 1];
+};
+
+struct snapshot_balance {
+    fixed_t     value;
+    uint32_t    user_id;
+    uint32_t    type;
+    int32_t     prec;
+    char        asset[ASSET_NAME_MAX_LEN + 1];
+};
+
+static sds get_snapshot_path(const char *dir, time_t timestamp)
+{
+    sds path = sdsempty();
+    return sdscatprintf(path, "%s/slice_%ld.dat", dir, timestamp);
+}
+
+int snapshot_open(snapshot_t *snap, const char *dir, time_t timestamp)
+{
+    memset(snap, 0, sizeof(snapshot_t));
+    snap->path = get_snapshot_path(dir, timestamp);
+    snap->tmp_path = sdscatprintf(sdsempty(), "%s.tmp", snap->path);
+    snap->fd = open(snap->tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (snap->fd < 0) {
+        log_error("open %s fail: %s", snap->tmp_path, strerror(errno));
+        sdsfree(snap->path);
+        sdsfree(snap->tmp_path);
+        return -__LINE__;
+    }
+
+    /* the header is written when the file is closed */
+    snap->size = sizeof(struct snapshot_header);
+    if (lseek(snap->fd, snap->size, SEEK_SET) < 0) {
+        snapshot_abort(snap);
+        return -__LINE__;
+    }
+
+    return 0;
+}
+
+static int write_block(snapshot_t *snap, uint32_t type, void *records, size_t size, size_t count)
+{
+    struct snapshot_block block;
+    memset(&block, 0, sizeof(block));
+    block.type  = type;
+    block.count = count;
+    block.crc   = generate_crc32c(records, size * count);
+
+    struct iovec iov[2];
+    iov[0].iov_base = &block;
+    iov[0].iov_len  = sizeof(block);
+    iov[1].iov_base = records;
+    iov[1].iov_len  = size * count;
+
+    size_t total = iov[0].iov_len + iov[1].iov_len;
+    ssize_t ret = writev(snap->fd, iov, 2);
+    if (ret < 0 || (size_t)ret != total) {
+        log_error("write %s fail: %zd %s", snap->tmp_path, ret, strerror(errno));
+        return -__LINE__;
+    }
+
+    snap->size += total;
+    snap->block_count += 1;
+    return 0;
+}
+
+int snapshot_write_orders(snapshot_t *snap, order_t *orders, size_t count)
+{
+    if (count == 0)
+        return 0;
+
+    struct snapshot_order *records = calloc(count, sizeof(struct snapshot_order));
+    if (records == NULL)
+        return -__LINE__;
+
+    for (size_t i = 0; i < count; ++i) {
+        order_t *order = &orders[i];
+        struct snapshot_order *record = &records[i];
+        market_t *m = get_market_by_id(order->market_id);
+        if (m == NULL || strlen(m->name) > SNAPSHOT_NAME_LEN) {
+            free(records);
+            return -__LINE__;
+        }
+
+        record->id          = order->id;
+        record->create_time = order->create_time;
+        record->update_time = order->update_time;
+        record->type        = order->type;
+        record->side        = order->side;
+        record->user_id     = order->user_id;
+        strncpy(record->market, m->name, SNAPSHOT_NAME_LEN);
+        strncpy(record->source, order->source, SOURCE_MAX_LEN);
+
+        record->value[SNAP_PRICE]       = order->price;
+        record->value[SNAP_AMOUNT]      = order->amount;
+        record->value[SNAP_TAKER_FEE]   = order->taker_fee;
+        record->value[SNAP_MAKER_FEE]   = order->maker_fee;
+        record->value[SNAP_LEFT]        = order->left;
+        record->value[SNAP_FROZEN]      = order->frozen;
+        record->value[SNAP_DEAL_STOCK]  = order->deal_stock;
+        record->value[SNAP_DEAL_MONEY]  = order->deal_money;
+        record->value[SNAP_DEAL_FEE]    = order->deal_fee;
+
+        record->prec[SNAP_PRICE]        = order_price_prec(m, order);
+        record->prec[SNAP_AMOUNT]       = m->stock_prec;
+        record->prec[SNAP_TAKER_FEE]    = m->fee_prec;
+        record->prec[SNAP_MAKER_FEE]    = order_maker_fee_prec(m, order);
+        record->prec[SNAP_LEFT]         = order_left_prec(m, order);
+        record->prec[SNAP_FROZEN]       = order_frozen_prec(m, order);
+        record->prec[SNAP_DEAL_STOCK]   = order_deal_stock_prec(m, order);
+        record->prec[SNAP_DEAL_MONEY]   = order_deal_money_prec(m, order);
+        record->prec[SNAP_DEAL_FEE]     = order_deal_fee_prec(m, order);
+    }
+
+    int ret = write_block(snap, SNAPSHOT_BLOCK_ORDER, records, sizeof(struct snapshot_order), count);
+    free(records);
+    if (ret < 0)
+        return ret;
+    snap->order_count += count;
+
+    return 0;
+}
+
+int snapshot_write_balances(snapshot_t *snap, struct balance_key *keys, fixed_t *balances, size_t count)
+{
+    if (count == 0)
+        return 0;
+
+    struct snapshot_balance *records = calloc(count, sizeof(struct snapshot_balance));
+    if (records == NULL)
+        return -__LINE__;
+
+    for (size_t i = 0; i < count; ++i) {
+        struct snapshot_balance *record = &records[i];
+        record->value   = balances[i];
+        record->user_id = keys[i].user_id;
+        record->type    = keys[i].type;
+        record->prec    = settings.assets[keys[i].asset_id].prec_save;
+        strncpy(record->asset, settings.assets[keys[i].asset_id].name, ASSET_NAME_MAX_LEN);
+    }
+
+    int ret = write_block(snap, SNAPSHOT_BLOCK_BALANCE, records, sizeof(struct snapshot_balance), count);
+    free(records);
+    if (ret < 0)
+        return ret;
+    snap->balance_count += count;
+
+    return 0;
+}
+
+static void snapshot_free(snapshot_t *snap)
+{
+    if (snap->fd >= 0) {
+        close(snap->fd);
+        snap->fd = -1;
+    }
+    sdsfree(snap->path);
+    sdsfree(snap->tmp_path);
+    snap->path = NULL;
+    snap->tmp_path = NULL;
+}
+
+void snapshot_abort(snapshot_t *snap)
+{
+    if (snap->tmp_path) {
+        unlink(snap->tmp_path);
+    }
+    snapshot_free(snap);
+}
+
+static int sync_dir(const char *path)
+{
+    sds dir = sdsnew(path);
+    char *pos = strrchr(dir, '/');
+    if (pos) {
+        sdsrange(dir, 0, pos - dir - 1);
+    } else {
+        dir = sdscpy(dir, ".");
+    }
+
+    int fd = open(dir, O_RDONLY);
+    sdsfree(dir);
+    if (fd < 0)
+        return -__LINE__;
+    int ret = fsync(fd);
+    close(fd);
+
+    return ret < 0 ? -__LINE__ : 0;
+}
+
+int snapshot_close(snapshot_t *snap, time_t timestamp, uint64_t last_oper_id, uint64_t last_order_id, uint64_t last_deals_id)
+{
+    struct snapshot_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    header.version          = SNAPSHOT_VERSION;
+    header.timestamp        = timestamp;
+    header.last_oper_id     = last_oper_id;
+    header.last_order_id    = last_order_id;
+    header.last_deals_id    = last_deals_id;
+    header.block_count      = snap->block_count;
+    header.order_count      = snap->order_count;
+    header.balance_count    = snap->balance_count;
+    header.size             = snap->size;
+    header.crc              = generate_crc32c((char *)&header, sizeof(header));
+
+    if (pwrite(snap->fd, &header, sizeof(header), 0) != sizeof(header)) {
+        log_error("write %s header fail: %s", snap->tmp_path, strerror(errno));
+        snapshot_abort(snap);
+        return -__LINE__;
+    }
+    if (fsync(snap->fd) < 0) {
+        log_error("fsync %s fail: %s", snap->tmp_path, strerror(errno));
+        snapshot_abort(snap);
+        return -__LINE__;
+    }
+    if (rename(snap->tmp_path, snap->path) < 0) {
+        log_error("rename %s fail: %s", snap->tmp_path, strerror(errno));
+        snapshot_abort(snap);
+        return -__LINE__;
+    }
+    if (sync_dir(snap->path) < 0) {
+        log_error("fsync dir of %s fail: %s", snap->path, strerror(errno));
+    }
+
+    log_info("write %s success, orders: %"PRIu64", balances: %"PRIu64", size: %"PRIu64,
+            snap->path, snap->order_count, snap->balance_count, snap->size);
+    snapshot_free(snap);
+
+    return 0;
+}
+
+static int check_snapshot(const char *data, size_t size, time_t timestamp, uint64_t last_oper_id, uint64_t last_order_id, uint64_t last_deals_id)
+{
+    if (size < sizeof(struct snapshot_header))
+        return -__LINE__;
+
+    struct snapshot_header header;
+    memcpy(&header, data, sizeof(header));
+    uint32_t crc = header.crc;
+    header.crc = 0;
+    if (generate_crc32c((char *)&header, sizeof(header)) != crc)
+        return -__LINE__;
+    if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0 || header.version != SNAPSHOT_VERSION)
+        return -__LINE__;
+    if (header.size != size || header.timestamp != timestamp)
+        return -__LINE__;
+    if (header.last_oper_id != last_oper_id || header.last_order_id != last_order_id || header.last_deals_id != last_deals_id)
+        return -__LINE__;
+
+    size_t offset = sizeof(header);
+    for (uint64_t i = 0; i < header.block_count; ++i) {
+        if (size - offset < sizeof(struct snapshot_block))
+            return -__LINE__;
+        const struct snapshot_block *block = (const struct snapshot_block *)(data + offset);
+        offset += sizeof(struct snapshot_block);
+
+        size_t record_size;
+        if (block->type == SNAPSHOT_BLOCK_ORDER) {
+            record_size = sizeof(struct snapshot_order);
+        } else if (block->type == SNAPSHOT_BLOCK_BALANCE) {
+            record_size = sizeof(struct snapshot_balance);
+        } else {
+            return -__LINE__;
+        }
+        if ((size - offset) / record_size < block->count)
+            return -__LINE__;
+        if (generate_crc32c(data + offset, record_size * block->count) != block->crc)
+            return -__LINE__;
+        offset += record_size * block->count;
+    }
+    if (offset != size)
+        return -__LINE__;
+
+    return 0;
+}
+
+static int load_snapshot_order(market_t *m, const struct snapshot_order *record)
+{
+    order_t *order = market_alloc_order(m);
+    if (order == NULL)
+        return -__LINE__;
+    order->id           = record->id;
+    order->type         = record->type;
+    order->side         = record->side;
+    order->create_time  = record->create_time;
+    order->update_time  = record->update_time;
+    order->user_id      = record->user_id;
+    memcpy(order->source, record->source, sizeof(order->source));
+    order->source[SOURCE_MAX_LEN] = '\0';
+
+    /* the same precisions load_orders parses the mysql slice with */
+    const fixed_t *value = record->value;
+    const int8_t *prec = record->prec;
+    order->price        = fixed_rescale(value[SNAP_PRICE], prec[SNAP_PRICE], m->money_prec);
+    order->amount       = fixed_rescale(value[SNAP_AMOUNT], prec[SNAP_AMOUNT], m->stock_prec);
+    order->taker_fee    = fixed_rescale(value[SNAP_TAKER_FEE], prec[SNAP_TAKER_FEE], m->fee_prec);
+    order->maker_fee    = fixed_rescale(value[SNAP_MAKER_FEE], prec[SNAP_MAKER_FEE], m->fee_prec);
+    order->left         = fixed_rescale(value[SNAP_LEFT], prec[SNAP_LEFT], m->stock_prec);
+    order->frozen       = fixed_rescale(value[SNAP_FROZEN], prec[SNAP_FROZEN], order_frozen_prec(m, order));
+    order->deal_stock   = fixed_rescale(value[SNAP_DEAL_STOCK], prec[SNAP_DEAL_STOCK], m->stock_prec);
+    order->deal_money   = fixed_rescale(value[SNAP_DEAL_MONEY], prec[SNAP_DEAL_MONEY], order_deal_money_prec(m, order));
+    order->deal_fee     = fixed_rescale(value[SNAP_DEAL_FEE], prec[SNAP_DEAL_FEE], order_deal_fee_prec(m, order));
+    market_put_order(m, order);
+
+    return 0;
+}
+
+static int load_snapshot_balance(const struct snapshot_balance *record)
+{
+    char asset[ASSET_NAME_MAX_LEN + 1];
+    memcpy(asset, record->asset, sizeof(asset));
+    asset[ASSET_NAME_MAX_LEN] = '\0';
+    int asset_id = get_asset_id(asset);
+    if (asset_id < 0)
+        return 0;
+
+    int prec = settings.assets[asset_id].prec_save;
+    fixed_t balance = fixed_rescale(record->value, record->prec, prec);
+    if (balance_set(record->user_id, record->type, asset_id, balance, prec) == NULL)
+        return -__LINE__;
+
+    return 0;
+}
+
+static int snapshot_order_compare(const void *p1, const void *p2)
+{
+    const struct snapshot_order *record1 = *(const struct snapshot_order **)p1;
+    const struct snapshot_order *record2 = *(const struct snapshot_order **)p2;
+    int cmp = memcmp(record1->market, record2->market, sizeof(record1->market));
+    if (cmp != 0)
+        return cmp;
+    if (record1->id == record2->id)
+        return 0;
+    return record1->id < record2->id ? -1 : 1;
+}
+
+/*
+ * the slice writes the orders in hash order, they are put by market and id
+ * so that each one goes to the tail of its level and the head of its user.
+ */
+static int load_snapshot_orders(const char *data)
+{
+    const struct snapshot_header *header = (const struct snapshot_header *)data;
+    size_t count = 0;
+    size_t offset = sizeof(struct snapshot_header);
+    for (uint64_t i = 0; i < header->block_count; ++i) {
+        const struct snapshot_block *block = (const struct snapshot_block *)(data + offset);
+        offset += sizeof(struct snapshot_block);
+        if (block->type == SNAPSHOT_BLOCK_ORDER) {
+            count += block->count;
+            offset += sizeof(struct snapshot_order) * block->count;
+        } else {
+            offset += sizeof(struct snapshot_balance) * block->count;
+        }
+    }
+    if (count == 0)
+        return 0;
+
+    const struct snapshot_order **index = malloc(sizeof(struct snapshot_order *) * count);
+    if (index == NULL)
+        return -__LINE__;
+    size_t n = 0;
+    offset = sizeof(struct snapshot_header);
+    for (uint64_t i = 0; i < header->block_count; ++i) {
+        const struct snapshot_block *block = (const struct snapshot_block *)(data + offset);
+        offset += sizeof(struct snapshot_block);
+        if (block->type == SNAPSHOT_BLOCK_ORDER) {
+            const struct snapshot_order *records = (const struct snapshot_order *)(data + offset);
+            for (uint32_t j = 0; j < block->count; ++j) {
+                index[n++] = &records[j];
+            }
+            offset += sizeof(struct snapshot_order) * block->count;
+        } else {
+            offset += sizeof(struct snapshot_balance) * block->count;
+        }
+    }
+    qsort(index, count, sizeof(struct snapshot_order *), snapshot_order_compare);
+
+    // the market is resolved once for each run of its orders
+    market_t *m = NULL;
+    const struct snapshot_order *last = NULL;
+    for (size_t i = 0; i < count; ++i) {
+        const struct snapshot_order *record = index[i];
+        if (last == NULL || memcmp(last->market, record->market, sizeof(record->market)) != 0) {
+            char market_name[SNAPSHOT_NAME_LEN + 1];
+            memcpy(market_name, record->market, sizeof(market_name));
+            market_name[SNAPSHOT_NAME_LEN] = '\0';
+            m = get_market(market_name);
+            last = record;
+        }
+        if (m == NULL)
+            continue;
+        int ret = load_snapshot_order(m, record);
+        if (ret < 0) {
+            log_error("load order: %"PRIu64" fail: %d", record->id, ret);
+            free(index);
+            return -__LINE__;
+        }
+    }
+    free(index);
+
+    return 0;
+}
+
+static int load_snapshot_balances(const char *data)
+{
+    const struct snapshot_header *header = (const struct snapshot_header *)data;
+    if (header->balance_count > dict_slot(dict_balance)) {
+        dict_expand(dict_balance, header->balance_count);
+    }
+
+    size_t offset = sizeof(struct snapshot_header);
+    for (uint64_t i = 0; i < header->block_count; ++i) {
+        const struct snapshot_block *block = (const struct snapshot_block *)(data + offset);
+        offset += sizeof(struct snapshot_block);
+
+        if (block->type == SNAPSHOT_BLOCK_ORDER) {
+            offset += sizeof(struct snapshot_order) * block->count;
+        } else {
+            const struct snapshot_balance *records = (const struct snapshot_balance *)(data + offset);
+            offset += sizeof(struct snapshot_balance) * block->count;
+            for (uint32_t j = 0; j < block->count; ++j) {
+                int ret = load_snapshot_balance(&records[j]);
+                if (ret < 0) {
+                    log_error("load balance of user: %u fail: %d", records[j].user_id, ret);
+                    return -__LINE__;
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+/* 1 if the file can not be used and the mysql slice should be loaded instead */
+int snapshot_load(const char *dir, time_t timestamp, uint64_t last_oper_id, uint64_t last_order_id, uint64_t last_deals_id)
+{
+    sds path = get_snapshot_path(dir, timestamp);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        log_error("open %s fail: %s", path, strerror(errno));
+        sdsfree(path);
+        return 1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        log_error("stat %s fail", path);
+        close(fd);
+        sdsfree(path);
+        return 1;
+    }
+
+    size_t size = st.st_size;
+    char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        log_error("mmap %s fail: %s", path, strerror(errno));
+        sdsfree(path);
+        return 1;
+    }
+    madvise(data, size, MADV_SEQUENTIAL);
+
+    int ret = check_snapshot(data, size, timestamp, last_oper_id, last_order_id, last_deals_id);
+    if (ret < 0) {
+        log_error("check %s fail: %d", path, ret);
+        munmap(data, size);
+        sdsfree(path);
+        return 1;
+    }
+
+    log_stderr("load slice from: %s", path);
+    // orders are put before balances are set, the same as load_slice_from_db
+    ret = load_snapshot_orders(data);
+    if (ret == 0) {
+        ret = load_snapshot_balances(data);
+    }
+    munmap(data, size);
+    sdsfree(path);
+
+    return ret;
+}
+
+int snapshot_remove(const char *dir, time_t timestamp)
+{
+    sds path = get_snapshot_path(dir, timestamp);
+    int ret = unlink(path);
+    if (ret < 0 && errno != ENOENT) {
+        log_error("unlink %s fail: %s", path, strerror(errno));
+        sdsfree(path);
+        return -__LINE__;
+    }
+    sdsfree(path);
+
+    return 0;
+}
+
@@ -0,0 +1,40 @@
+/*
+ * Description: binary slice file, written with the mysql slice and loaded by mmap
+ */
+
+# ifndef _ME_SNAPSHOT_H_
+# define _ME_SNAPSHOT_H_
+
+# include "me_config.h"
+# include "me_market.h"
+# include "me_balance.h"
+
+/*
+ * file layout: a snapshot_header, then blocks of orders or balances, each
+ * a snapshot_block followed by count fixed size records. the header and
+ * every block are checked by crc32c, the file is written to a temporary
+ * name and renamed when it is complete.
+ */
+typedef struct snapshot_t {
+    int         fd;
+    sds         path;
+    sds         tmp_path;
+    uint64_t    size;
+    uint64_t    block_count;
+    uint64_t    order_count;
+    uint64_t    balance_count;
+} snapshot_t;
+
+int snapshot_open(snapshot_t *snap, const char *dir, time_t timestamp);
+int snapshot_write_orders(snapshot_t *snap, order_t *orders, size_t count);
+int snapshot_write_balances(snapshot_t *snap, struct balance_key *keys, fixed_t *balances, size_t count);
+int snapshot_close(snapshot_t *snap, time_t timestamp, uint64_t last_oper_id, uint64_t last_order_id, uint64_t last_deals_id);
+/* remove the temporary file of a failed slice */
+void snapshot_abort(snapshot_t *snap);
+
+/* load the slice file of timestamp, nothing is loaded if the file is missing or broken */
+int snapshot_load(const char *dir, time_t timestamp, uint64_t last_oper_id, uint64_t last_order_id, uint64_t last_deals_id);
+int snapshot_remove(const char *dir, time_t timestamp);
+
+# endif
+
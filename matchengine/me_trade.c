@@ -7,6 +7,8 @@
 # include "me_trade.h"
 
 static dict_t *dict_market;
+static market_t **market_list;
+static nw_timer pool_timer;
 
 static uint32_t market_dict_hash_function(const void *key)
 {
@@ -28,6 +30,17 @@ static void market_dict_key_free(void *key)
     free(key);
 }
 
+// the timer runs in the main loop, so never while a batch is matched
+static void on_pool_timer(nw_timer *timer, void *privdata)
+{
+    for (size_t i = 0; i < settings.market_num; ++i) {
+        uint32_t trim = market_trim_pool(market_list[i]);
+        if (trim) {
+            log_info("market: %s trim %u order slabs", market_list[i]->name, trim);
+        }
+    }
+}
+
 int init_trade(void)
 {
     dict_types type;
@@ -41,15 +54,23 @@ int init_trade(void)
     if (dict_market == NULL)
         return -__LINE__;
 
+    market_list = malloc(sizeof(market_t *) * settings.market_num);
+    if (market_list == NULL)
+        return -__LINE__;
+
     for (size_t i = 0; i < settings.market_num; ++i) {
-        market_t *m = market_create(&settings.markets[i]);
+        market_t *m = market_create(&settings.markets[i], i);
         if (m == NULL) {
             return -__LINE__;
         }
 
         dict_add(dict_market, settings.markets[i].name, m);
+        market_list[i] = m;
     }
 
+    nw_timer_set(&pool_timer, 60, true, on_pool_timer, NULL);
+    nw_timer_start(&pool_timer);
+
     return 0;
 }
 
@@ -61,3 +82,10 @@ market_t *get_market(const char *name)
     return NULL;
 }
 
+market_t *get_market_by_id(uint32_t id)
+{
+    if (id >= settings.market_num)
+        return NULL;
+    return market_list[id];
+}
+
@@ -10,6 +10,8 @@
 
 int init_trade(void);
 market_t *get_market(const char *name);
+/* the id of a market is its index in settings.markets */
+market_t *get_market_by_id(uint32_t id);
 
 # endif
 
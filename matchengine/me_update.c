@@ -14,7 +14,7 @@ static nw_timer timer;
 
 struct update_key {
     uint32_t    user_id;
-    char        asset[ASSET_NAME_MAX_LEN + 1];
+    uint32_t    asset_id;
     char        business[BUSINESS_NAME_MAX_LEN + 1];
     uint64_t    business_id;
 };
@@ -92,11 +92,12 @@ int init_update(void)
     return 0;
 }
 
-int update_user_balance(bool real, uint32_t user_id, const char *asset, const char *business, uint64_t business_id, mpd_t *change, json_t *detail)
+int update_user_balance(bool real, uint32_t user_id, int asset_id, const char *business, uint64_t business_id, fixed_t change, int prec, json_t *detail)
 {
     struct update_key key;
+    memset(&key, 0, sizeof(key));
     key.user_id = user_id;
-    strncpy(key.asset, asset, sizeof(key.asset));
+    key.asset_id = asset_id;
     strncpy(key.business, business, sizeof(key.business));
     key.business_id = business_id;
 
@@ -105,15 +106,12 @@ int update_user_balance(bool real, uint32_t user_id, const char *asset, const ch
         return -1;
     }
 
-    mpd_t *result;
-    mpd_t *abs_change = mpd_new(&mpd_ctx);
-    mpd_abs(abs_change, change, &mpd_ctx);
-    if (mpd_cmp(change, mpd_zero, &mpd_ctx) >= 0) {
-        result = balance_add(user_id, BALANCE_TYPE_AVAILABLE, asset, abs_change);
+    fixed_t *result;
+    if (change >= 0) {
+        result = balance_add(user_id, BALANCE_TYPE_AVAILABLE, asset_id, change, prec);
     } else {
-        result = balance_sub(user_id, BALANCE_TYPE_AVAILABLE, asset, abs_change);
+        result = balance_sub(user_id, BALANCE_TYPE_AVAILABLE, asset_id, -change, prec);
     }
-    mpd_del(abs_change);
     if (result == NULL)
         return -2;
 
@@ -124,11 +122,10 @@ int update_user_balance(bool real, uint32_t user_id, const char *asset, const ch
         double now = current_timestamp();
         json_object_set_new(detail, "id", json_integer(business_id));
         char *detail_str = json_dumps(detail, 0);
-        append_user_balance_history(now, user_id, asset, business, change, detail_str);
+        append_user_balance_history(now, user_id, asset_id, business, change, prec, detail_str);
         free(detail_str);
-        push_balance_message(now, user_id, asset, business, change, result);
+        push_balance_message(now, user_id, asset_id, business, change, prec, *result, *result ? settings.assets[asset_id].prec_save : 0);
     }
 
     return 0;
 }
-
@@ -0,0 +1,270 @@
+/*
+ * Description: append only operlog segment files
+ */
+
+# include "me_wal.h"
+# include "ut_crc32.h"
+
+# include <fcntl.h>
+# include <dirent.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+
+# define WAL_CRC_OFFSET offsetof(struct wal_record, id)
+
+static sds get_segment_path(const char *dir, uint64_t segment_id)
+{
+    sds path = sdsempty();
+    return sdscatprintf(path, "%s/operlog_%020"PRIu64".wal", dir, segment_id);
+}
+
+static int segment_filter(const struct dirent *entry)
+{
+    uint64_t segment_id;
+    char tail[8];
+    return sscanf(entry->d_name, "operlog_%"SCNu64".%7s", &segment_id, tail) == 2 && strcmp(tail, "wal") == 0;
+}
+
+static uint64_t get_segment_id(const struct dirent *entry)
+{
+    uint64_t segment_id = 0;
+    sscanf(entry->d_name, "operlog_%"SCNu64, &segment_id);
+    return segment_id;
+}
+
+static void free_segment_list(struct dirent **list, int count)
+{
+    for (int i = 0; i < count; ++i) {
+        free(list[i]);
+    }
+    free(list);
+}
+
+static int sync_dir(const char *dir)
+{
+    int fd = open(dir, O_RDONLY);
+    if (fd < 0)
+        return -__LINE__;
+    int ret = fsync(fd);
+    close(fd);
+    return ret < 0 ? -__LINE__ : 0;
+}
+
+int wal_init(wal_t *wal, const char *dir, uint64_t segment_max)
+{
+    memset(wal, 0, sizeof(wal_t));
+    wal->dir = sdsnew(dir);
+    wal->fd = -1;
+    wal->segment_max = segment_max;
+    return 0;
+}
+
+void wal_close(wal_t *wal)
+{
+    if (wal->fd >= 0) {
+        close(wal->fd);
+        wal->fd = -1;
+    }
+    sdsfree(wal->dir);
+    wal->dir = NULL;
+}
+
+sds wal_pack(sds buf, uint64_t id, double time, const char *detail, size_t size)
+{
+    struct wal_record record;
+    record.size = size;
+    record.crc  = 0;
+    record.id   = id;
+    record.time = time;
+
+    size_t start = sdslen(buf);
+    buf = sdscatlen(buf, &record, sizeof(record));
+    buf = sdscatlen(buf, detail, size);
+
+    struct wal_record *head = (struct wal_record *)(buf + start);
+    head->crc = generate_crc32c(buf + start + WAL_CRC_OFFSET, sizeof(record) - WAL_CRC_OFFSET + size);
+
+    return buf;
+}
+
+static int open_segment(wal_t *wal, uint64_t segment_id)
+{
+    if (wal->fd >= 0) {
+        close(wal->fd);
+        wal->fd = -1;
+    }
+
+    /* a segment of the same id only has a record that was not committed */
+    sds path = get_segment_path(wal->dir, segment_id);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (fd < 0) {
+        log_error("open %s fail: %s", path, strerror(errno));
+        sdsfree(path);
+        return -__LINE__;
+    }
+    if (sync_dir(wal->dir) < 0) {
+        log_error("fsync dir %s fail: %s", wal->dir, strerror(errno));
+        close(fd);
+        sdsfree(path);
+        return -__LINE__;
+    }
+
+    log_info("open operlog segment: %s", path);
+    sdsfree(path);
+    wal->fd = fd;
+    wal->segment_id = segment_id;
+    wal->offset = 0;
+
+    return 0;
+}
+
+int wal_write(wal_t *wal, uint64_t first_id, const char *buf, size_t size)
+{
+    if (wal->fd < 0 || wal->offset >= wal->segment_max) {
+        int ret = open_segment(wal, first_id);
+        if (ret < 0)
+            return ret;
+    }
+
+    size_t done = 0;
+    while (done < size) {
+        ssize_t ret = write(wal->fd, buf + done, size - done);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            log_error("write operlog segment: %"PRIu64" fail: %s", wal->segment_id, strerror(errno));
+            /* drop what is written, the records are written again */
+            if (ftruncate(wal->fd, wal->offset) < 0) {
+                close(wal->fd);
+                wal->fd = -1;
+            }
+            return -__LINE__;
+        }
+        done += ret;
+    }
+
+    if (fdatasync(wal->fd) < 0) {
+        log_error("fdatasync operlog segment: %"PRIu64" fail: %s", wal->segment_id, strerror(errno));
+        close(wal->fd);
+        wal->fd = -1;
+        return -__LINE__;
+    }
+    wal->offset += size;
+
+    return 0;
+}
+
+int wal_purge(wal_t *wal, uint64_t id)
+{
+    struct dirent **list;
+    int count = scandir(wal->dir, &list, segment_filter, alphasort);
+    if (count < 0) {
+        log_error("scandir %s fail: %s", wal->dir, strerror(errno));
+        return -__LINE__;
+    }
+
+    /* the last id of a segment is the first id of the next one minus 1 */
+    for (int i = 0; i + 1 < count; ++i) {
+        uint64_t segment_id = get_segment_id(list[i]);
+        if (segment_id == wal->segment_id || get_segment_id(list[i + 1]) - 1 > id)
+            break;
+        sds path = get_segment_path(wal->dir, segment_id);
+        if (unlink(path) < 0) {
+            log_error("unlink %s fail: %s", path, strerror(errno));
+        } else {
+            log_info("purge operlog segment: %s", path);
+        }
+        sdsfree(path);
+    }
+    free_segment_list(list, count);
+
+    return 0;
+}
+
+static int read_segment(const char *path, uint64_t *last_id, wal_read_fn fn, void *privdata)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        log_error("open %s fail: %s", path, strerror(errno));
+        return -__LINE__;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return -__LINE__;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+
+    size_t size = st.st_size;
+    char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        log_error("mmap %s fail: %s", path, strerror(errno));
+        return -__LINE__;
+    }
+    madvise(data, size, MADV_SEQUENTIAL);
+
+    int ret = 0;
+    size_t offset = 0;
+    while (size - offset >= sizeof(struct wal_record)) {
+        struct wal_record record;
+        memcpy(&record, data + offset, sizeof(record));
+        if (size - offset - sizeof(record) < record.size)
+            break;
+        const char *detail = data + offset + sizeof(record);
+        if (generate_crc32c(data + offset + WAL_CRC_OFFSET, sizeof(record) - WAL_CRC_OFFSET + record.size) != record.crc)
+            break;
+        offset += sizeof(record) + record.size;
+
+        if (record.id <= *last_id)
+            continue;
+        if (record.id != *last_id + 1) {
+            log_error("invalid id: %"PRIu64", last id: %"PRIu64" in %s", record.id, *last_id, path);
+            ret = -__LINE__;
+            break;
+        }
+        ret = fn(record.id, record.time, detail, record.size, privdata);
+        if (ret < 0) {
+            log_error("load operlog: %"PRIu64" in %s fail: %d", record.id, path, ret);
+            break;
+        }
+        *last_id = record.id;
+    }
+    if (ret == 0 && offset != size) {
+        log_error("%s has %zu bytes not committed from offset: %zu", path, size - offset, offset);
+    }
+    munmap(data, size);
+
+    return ret;
+}
+
+int wal_read(const char *dir, uint64_t start_id, wal_read_fn fn, void *privdata)
+{
+    struct dirent **list;
+    int count = scandir(dir, &list, segment_filter, alphasort);
+    if (count < 0) {
+        log_error("scandir %s fail: %s", dir, strerror(errno));
+        return -__LINE__;
+    }
+
+    uint64_t last_id = start_id;
+    for (int i = 0; i < count; ++i) {
+        /* skip the segments that end before start_id */
+        if (i + 1 < count && get_segment_id(list[i + 1]) - 1 <= start_id)
+            continue;
+        sds path = get_segment_path(dir, get_segment_id(list[i]));
+        int ret = read_segment(path, &last_id, fn, privdata);
+        sdsfree(path);
+        if (ret < 0) {
+            free_segment_list(list, count);
+            return ret;
+        }
+    }
+    free_segment_list(list, count);
+
+    return 0;
+}
+
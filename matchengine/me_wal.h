@@ -0,0 +1,45 @@
+/*
+ * Description: append only operlog segment files
+ */
+
+# ifndef _ME_WAL_H_
+# define _ME_WAL_H_
+
+# include "me_config.h"
+
+/*
+ * a segment is named by the id of its first record, and holds records of
+ * increasing id: a wal_record header, then size bytes of detail. crc is
+ * the crc32c of the id, time and detail. a record that is cut or does not
+ * match its crc ends the segment, it was not committed.
+ */
+struct wal_record {
+    uint32_t    size;
+    uint32_t    crc;
+    uint64_t    id;
+    double      time;
+};
+
+typedef struct wal_t {
+    sds         dir;
+    int         fd;
+    uint64_t    segment_id;
+    uint64_t    offset;
+    uint64_t    segment_max;
+} wal_t;
+
+int wal_init(wal_t *wal, const char *dir, uint64_t segment_max);
+void wal_close(wal_t *wal);
+
+sds wal_pack(sds buf, uint64_t id, double time, const char *detail, size_t size);
+/* write records first_id... in buf and fdatasync, a new segment is started when the current is full */
+int wal_write(wal_t *wal, uint64_t first_id, const char *buf, size_t size);
+/* remove the segments that only have records not greater than id */
+int wal_purge(wal_t *wal, uint64_t id);
+
+/* call fn for every committed record greater than start_id, in id order */
+typedef int (*wal_read_fn)(uint64_t id, double time, const char *detail, size_t size, void *privdata);
+int wal_read(const char *dir, uint64_t start_id, wal_read_fn fn, void *privdata);
+
+# endif
+
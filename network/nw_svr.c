@@ -113,7 +113,7 @@ static int nw_svr_add_clt(nw_ses *ses, int sockfd, nw_addr_t *peer_addr)
         return -1;
     }
     memset(clt, 0, sizeof(nw_ses));
-    if (nw_ses_init(clt, nw_default_loop, svr->buf_pool, svr->buf_limit, NW_SES_TYPE_COMMON) < 0) {
+    if (nw_ses_init(clt, svr->loop, svr->buf_pool, svr->buf_limit, NW_SES_TYPE_COMMON) < 0) {
         nw_cache_free(svr->clt_cache, clt);
         if (privdata) {
             svr->type.on_privdata_free(svr, privdata);
@@ -225,6 +225,7 @@ nw_svr *nw_svr_create(nw_svr_cfg *cfg, nw_svr_type *type, void *privdata)
     svr->read_mem = cfg->read_mem;
     svr->write_mem = cfg->write_mem;
     svr->privdata = privdata;
+    svr->loop = nw_default_loop;
     memset(svr->svr_list, 0, sizeof(nw_ses) * svr->svr_count);
     for (uint32_t i = 0; i < svr->svr_count; ++i) {
         nw_ses *ses = &svr->svr_list[i];
@@ -239,7 +240,7 @@ nw_svr *nw_svr_create(nw_svr_cfg *cfg, nw_svr_type *type, void *privdata)
             return NULL;
         }
         memcpy(host_addr, &cfg->bind_arr[i].addr, sizeof(nw_addr_t));
-        if (nw_ses_init(ses, nw_default_loop, svr->buf_pool, svr->buf_limit, NW_SES_TYPE_SERVER) < 0) {
+        if (nw_ses_init(ses, svr->loop, svr->buf_pool, svr->buf_limit, NW_SES_TYPE_SERVER) < 0) {
             free(host_addr);
             nw_svr_free(svr);
             return NULL;
@@ -266,6 +267,14 @@ nw_svr *nw_svr_create(nw_svr_cfg *cfg, nw_svr_type *type, void *privdata)
     return svr;
 }
 
+void nw_svr_set_loop(nw_svr *svr, struct ev_loop *loop)
+{
+    svr->loop = loop;
+    for (uint32_t i = 0; i < svr->svr_count; ++i) {
+        svr->svr_list[i].loop = loop;
+    }
+}
+
 int nw_svr_start(nw_svr *svr)
 {
     for (uint32_t i = 0; i < svr->svr_count; ++i) {
@@ -100,11 +100,16 @@ typedef struct nw_svr {
     uint32_t write_mem;
     uint64_t id_start;
     void *privdata;
+    /* the loop of the server and its connections, nw_default_loop by default */
+    struct ev_loop *loop;
 } nw_svr;
 
 /* create a server instance, the privdata will assign to nw_svr privdata */
 nw_svr *nw_svr_create(nw_svr_cfg *cfg, nw_svr_type *type, void *privdata);
 int nw_svr_add_clt_fd(nw_svr *svr, int fd);
+/* run the server on another loop, must be called before nw_svr_start.
+ * the server is only used in the thread of the loop after. */
+void nw_svr_set_loop(nw_svr *svr, struct ev_loop *loop);
 int nw_svr_start(nw_svr *svr);
 int nw_svr_stop(nw_svr *svr);
 void nw_svr_release(nw_svr *svr);
@@ -0,0 +1,202 @@
+/*
+ * Description: me_io with rings of a few slots, built with -DIO_RING_SIZE=4
+ */
+
+# include <assert.h>
+# include <netdb.h>
+# include <pthread.h>
+# include <sys/socket.h>
+# include <netinet/in.h>
+# include <arpa/inet.h>
+
+# include "me_config.h"
+# include "me_io.h"
+
+# define TEST_PORT      17316
+# define TEST_REQUEST   100000
+// every so many requests the main thread is slow, and pushes a burst before the reply
+# define TEST_SLOW      1000
+# define TEST_BURST     100
+# define TEST_PUSH      16
+
+struct settings settings;
+
+static int sockfd;
+static sds requests;
+static uint32_t request_count;
+static bool done;
+static nw_timer done_timer;
+
+static void on_request(nw_ses *ses, uint64_t ses_id, nw_addr_t *peer_addr, rpc_pkg *pkg, json_t *params)
+{
+    assert(pkg->sequence == request_count);
+    assert(peer_addr->family == AF_INET && peer_addr->in.sin_addr.s_addr == htonl(INADDR_LOOPBACK));
+    request_count += 1;
+    if (pkg->sequence % TEST_SLOW == 0) {
+        usleep(2000);
+    }
+    if (pkg->sequence % TEST_BURST == 0) {
+        for (int i = 0; i < TEST_PUSH; ++i) {
+            rpc_pkg push;
+            memcpy(&push, pkg, sizeof(push));
+            push.pkg_type = RPC_PKG_TYPE_PUSH;
+            push.body = "[]";
+            push.body_size = 2;
+            int ret = io_push(ses, ses_id, &push);
+            assert(ret == 0);
+        }
+    }
+
+    json_t *result = json_array();
+    json_array_append_new(result, json_integer(pkg->sequence));
+    int ret = io_reply(ses, ses_id, pkg, result);
+    assert(ret == 0);
+    json_decref(result);
+}
+
+static void on_close(nw_ses *ses, uint64_t ses_id)
+{
+}
+
+// rpc_pack has a buffer of its own, the requests are packed before the io thread runs
+static sds pack_requests(void)
+{
+    sds data = sdsempty();
+    for (uint32_t i = 0; i < TEST_REQUEST; ++i) {
+        rpc_pkg req;
+        memset(&req, 0, sizeof(req));
+        req.command = 1;
+        req.pkg_type = RPC_PKG_TYPE_REQUEST;
+        req.sequence = i;
+        req.body = "[]";
+        req.body_size = 2;
+
+        void *pkg_data;
+        uint32_t pkg_size;
+        int ret = rpc_pack(&req, &pkg_data, &pkg_size);
+        assert(ret == 0);
+        data = sdscatlen(data, pkg_data, pkg_size);
+    }
+    return data;
+}
+
+static void *writer_routine(void *arg)
+{
+    char *p = requests;
+    size_t left = sdslen(requests);
+    while (left > 0) {
+        ssize_t ret = write(sockfd, p, left);
+        assert(ret > 0);
+        p += ret;
+        left -= ret;
+    }
+    return NULL;
+}
+
+static void read_full(void *buf, size_t size)
+{
+    char *p = buf;
+    while (size > 0) {
+        ssize_t ret = read(sockfd, p, size);
+        assert(ret > 0);
+        p += ret;
+        size -= ret;
+    }
+}
+
+// the replies come in the order of the requests, each after the pushes of its burst
+static void *reader_routine(void *arg)
+{
+    static char body[1024];
+    uint32_t reply_count = 0;
+    uint32_t push_count = 0;
+    while (reply_count < TEST_REQUEST) {
+        rpc_pkg pkg;
+        read_full(&pkg, RPC_PKG_HEAD_SIZE);
+        assert(le32toh(pkg.magic) == RPC_PKG_MAGIC);
+        uint32_t size = le16toh(pkg.ext_size) + le32toh(pkg.body_size);
+        assert(size < sizeof(body));
+        read_full(body, size);
+
+        uint32_t sequence = le32toh(pkg.sequence);
+        assert(sequence == reply_count);
+        if (le16toh(pkg.pkg_type) == RPC_PKG_TYPE_PUSH) {
+            push_count += 1;
+            continue;
+        }
+        assert(le16toh(pkg.pkg_type) == RPC_PKG_TYPE_REPLY);
+        char expect[32];
+        snprintf(expect, sizeof(expect), "[%u]", sequence);
+        assert(le32toh(pkg.body_size) == strlen(expect) && memcmp(body, expect, strlen(expect)) == 0);
+        reply_count += 1;
+    }
+    assert(push_count == (TEST_REQUEST + TEST_BURST - 1) / TEST_BURST * TEST_PUSH);
+
+    __atomic_store_n(&done, true, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static void on_done_timer(nw_timer *timer, void *privdata)
+{
+    if (__atomic_load_n(&done, __ATOMIC_ACQUIRE)) {
+        nw_loop_break();
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    default_dlog_flag = DLOG_FATAL | DLOG_ERROR;
+    nw_loop_init();
+
+    char bind[64];
+    snprintf(bind, sizeof(bind), "tcp@127.0.0.1:%d", TEST_PORT);
+    nw_svr_bind bind_arr;
+    memset(&bind_arr, 0, sizeof(bind_arr));
+    int ret = nw_sock_cfg_parse(bind, &bind_arr.addr, &bind_arr.sock_type);
+    assert(ret == 0);
+    settings.io_thread = true;
+    settings.svr.bind_count = 1;
+    settings.svr.bind_arr = &bind_arr;
+    settings.svr.max_pkg_size = 1024 * 1024;
+    settings.svr.buf_limit = 1000 * 1000;
+
+    requests = pack_requests();
+
+    io_handler handler;
+    handler.on_request = on_request;
+    handler.on_close = on_close;
+    ret = init_io(&handler);
+    assert(ret == 0);
+
+    sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    assert(sockfd >= 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(TEST_PORT);
+    inet_aton("127.0.0.1", &addr.sin_addr);
+    ret = connect(sockfd, (struct sockaddr *)&addr, sizeof(addr));
+    assert(ret == 0);
+
+    pthread_t writer, reader;
+    pthread_create(&writer, NULL, writer_routine, NULL);
+    pthread_create(&reader, NULL, reader_routine, NULL);
+
+    nw_timer_set(&done_timer, 0.01, true, on_done_timer, NULL);
+    nw_timer_start(&done_timer);
+    nw_loop_run();
+
+    pthread_join(writer, NULL);
+    pthread_join(reader, NULL);
+    fini_io();
+    close(sockfd);
+    sdsfree(requests);
+
+    sds status = io_status(sdsempty());
+    printf("%s", status);
+    assert(strstr(status, "request 0,") == NULL && strstr(status, "reply 0\n") == NULL);
+    sdsfree(status);
+    printf("test io ok\n");
+
+    return 0;
+}
@@ -1,15 +1,289 @@
 /*
- * Description: 
+ * Description:
  *     History: yang@haipo.me, 2017/06/05, create
  */
 
 # include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+# include <assert.h>
+
 # include "ut_decimal.h"
 # include "ut_misc.h"
 
-int main(int argc, char *argv[])
+// the reference context keeps all 38 digits, mpd_ctx only has 34
+static mpd_context_t ref_ctx;
+
+static mpd_t *ref_decimal(const char *str)
+{
+    mpd_t *result = mpd_new(&ref_ctx);
+    ref_ctx.status = 0;
+    mpd_set_string(result, str, &ref_ctx);
+    assert(ref_ctx.status == 0);
+    return result;
+}
+
+// mpd_to_sci of str rescaled to -prec, rounded down
+static char *ref_rescale_sci(char *buf, const char *str, int prec)
+{
+    mpd_t *value = ref_decimal(str);
+    mpd_rescale(value, value, -prec, &ref_ctx);
+    char *sci = mpd_to_sci(value, 0);
+    snprintf(buf, FIXED_STR_MAX_LEN, "%s", sci);
+    free(sci);
+    mpd_del(value);
+    return buf;
+}
+
+static const struct {
+    const char *str;
+    int prec;
+} parse_cases[] = {
+    { "0", 0 },
+    { "0", 8 },
+    { "1", 0 },
+    { "-1", 4 },
+    { "+12.5", 2 },
+    { "100.12345678", 8 },
+    { "000123.4500", 4 },
+    { "-000123.4500", 6 },
+    { "0.000001234", 9 },
+    { "0.000001234", 12 },
+    { "00.00", 2 },
+    { ".5", 1 },
+    { "5.", 1 },
+    { "1.5e3", 0 },
+    { "1.5E3", 2 },
+    { "-2.5e+2", 1 },
+    { "12345e-10", 10 },
+    { "12345e-10", 12 },
+    { "0.0001e4", 0 },
+    { "1e-8", 8 },
+    { "1.23456789", 4 },
+    { "-1.99999", 2 },
+    { "9.999999999999999999", 0 },
+    { "0.5", 0 },
+    { "123456789.987654321", 3 },
+    { "99999999999999999999999999999999999999", 0 },
+    { "-9999999999999999999999999999.999999999", 9 },
+    { "0.99999999999999999999999999999999999999", 38 },
+};
+
+static void test_parse(void)
+{
+    char expect[FIXED_STR_MAX_LEN];
+    char buf[FIXED_STR_MAX_LEN];
+    for (size_t i = 0; i < sizeof(parse_cases) / sizeof(parse_cases[0]); ++i) {
+        const char *str = parse_cases[i].str;
+        int prec = parse_cases[i].prec;
+        fixed_t value;
+        assert(fixed_parse(str, prec, &value) == 0);
+        ref_rescale_sci(expect, str, prec);
+        fixed_to_sci(buf, value, prec);
+        if (strcmp(buf, expect) != 0) {
+            fprintf(stderr, "parse %s prec %d: %s != %s\n", str, prec, buf, expect);
+            assert(0);
+        }
+    }
+
+    // more than 38 digits left after the rescale
+    static const struct {
+        const char *str;
+        int prec;
+    } reject_cases[] = {
+        { "100000000000000000000000000000000000000", 0 },
+        { "1234567890123456789012345678901234567890123", 0 },
+        { "1e38", 0 },
+        { "1e37", 1 },
+        { "10000000000000000000000000000000000000", 1 },
+        { "99999999999999999999999999999.9", 10 },
+        { "1", 39 },
+        { "1", -1 },
+        { "", 0 },
+        { "-", 0 },
+        { ".", 0 },
+        { "--1", 0 },
+        { "1.2.3", 0 },
+        { "1e", 0 },
+        { "1e+", 0 },
+        { "1x", 0 },
+        { "NaN", 0 },
+        { "Infinity", 0 },
+    };
+    for (size_t i = 0; i < sizeof(reject_cases) / sizeof(reject_cases[0]); ++i) {
+        fixed_t value;
+        if (fixed_parse(reject_cases[i].str, reject_cases[i].prec, &value) == 0) {
+            fprintf(stderr, "parse %s prec %d: not rejected\n", reject_cases[i].str, reject_cases[i].prec);
+            assert(0);
+        }
+    }
+    fixed_t value;
+    assert(fixed_parse(NULL, 0, &value) != 0);
+
+    // the digits past 38 are dropped when they do not survive the rescale
+    assert(fixed_parse("1.00000000000000000000000000000000000000000009", 8, &value) == 0);
+    assert(value == fixed_pow10[8]);
+    // zero fits whatever the exponent
+    assert(fixed_parse("0e100", 8, &value) == 0 && value == 0);
+}
+
+static const struct {
+    const char *coef;
+    int prec;
+} sci_cases[] = {
+    { "0", 0 },
+    { "0", 8 },
+    { "7", 0 },
+    { "-7", 0 },
+    { "12345", 2 },
+    { "12345", 5 },
+    { "12345", 8 },
+    { "12345", 10 },
+    { "12345", 11 },
+    { "12345", 12 },
+    { "-12345", 12 },
+    { "1", 6 },
+    { "1", 7 },
+    { "1", 8 },
+    { "-1", 20 },
+    { "100", 8 },
+    { "1000000000000000000", 18 },
+    { "999999999999999999", 18 },
+    { "123456789012345678901234567890", 0 },
+    { "123456789012345678901234567890", 15 },
+    { "99999999999999999999999999999999999999", 0 },
+    { "-99999999999999999999999999999999999999", 38 },
+    { "12345678901234567890123456789012345678", 36 },
+};
+
+static void test_to_sci(void)
+{
+    char str[FIXED_STR_MAX_LEN];
+    char buf[FIXED_STR_MAX_LEN];
+    for (size_t i = 0; i < sizeof(sci_cases) / sizeof(sci_cases[0]); ++i) {
+        const char *coef = sci_cases[i].coef;
+        int prec = sci_cases[i].prec;
+        fixed_t value;
+        assert(fixed_parse(coef, 0, &value) == 0);
+
+        snprintf(str, sizeof(str), "%se-%d", coef, prec);
+        mpd_t *ref = ref_decimal(str);
+        char *expect = mpd_to_sci(ref, 0);
+        fixed_to_sci(buf, value, prec);
+        if (strcmp(buf, expect) != 0) {
+            fprintf(stderr, "to_sci %s prec %d: %s != %s\n", coef, prec, buf, expect);
+            assert(0);
+        }
+        free(expect);
+
+        // and back again, through mpd_ctx which keeps 34 digits
+        if (strlen(coef) - (coef[0] == '-') > 34) {
+            mpd_del(ref);
+            continue;
+        }
+        mpd_t *dec = fixed_to_mpd(value, prec);
+        assert(mpd_cmp(dec, ref, &ref_ctx) == 0);
+        fixed_t back;
+        assert(fixed_from_mpd(dec, prec, &back) == 0 && back == value);
+        mpd_del(dec);
+        mpd_del(ref);
+    }
+}
+
+static const struct {
+    const char *a;
+    int prec_a;
+    const char *b;
+    int prec_b;
+} cmp_cases[] = {
+    { "1", 0, "1", 8 },
+    { "1", 0, "1.00000001", 8 },
+    { "1.00000001", 8, "1", 0 },
+    { "-1", 0, "-1.00000001", 8 },
+    { "-1.00000001", 8, "-1", 0 },
+    { "0.5", 1, "0.49999999", 8 },
+    { "-0.5", 1, "-0.50000000", 8 },
+    { "-0.00000001", 8, "0", 0 },
+    { "0", 0, "-0.00000001", 8 },
+    { "123.45", 2, "123.4500", 4 },
+    { "123.45", 2, "123.4499", 4 },
+    { "123.45", 2, "123.4501", 4 },
+    { "-123.45", 2, "-123.4501", 4 },
+    { "99999999999999999999999999999999999999", 0, "9999999999999999999.9999999999999999999", 19 },
+    { "9999999999999999999", 0, "9999999999999999999.0000000000000000001", 19 },
+    { "-9999999999999999999", 0, "-9999999999999999999.0000000000000000001", 19 },
+    { "0.00000000000000000000000000000000000001", 38, "0", 0 },
+    { "1", 0, "0.99999999999999999999999999999999999999", 38 },
+};
+
+static int sign(int x)
+{
+    return x < 0 ? -1 : x > 0;
+}
+
+static void test_cmp(void)
+{
+    for (size_t i = 0; i < sizeof(cmp_cases) / sizeof(cmp_cases[0]); ++i) {
+        fixed_t a, b;
+        assert(fixed_parse(cmp_cases[i].a, cmp_cases[i].prec_a, &a) == 0);
+        assert(fixed_parse(cmp_cases[i].b, cmp_cases[i].prec_b, &b) == 0);
+        mpd_t *ref_a = ref_decimal(cmp_cases[i].a);
+        mpd_t *ref_b = ref_decimal(cmp_cases[i].b);
+        int expect = mpd_cmp(ref_a, ref_b, &ref_ctx);
+        int ret = fixed_cmp(a, cmp_cases[i].prec_a, b, cmp_cases[i].prec_b);
+        if (sign(ret) != expect) {
+            fprintf(stderr, "cmp %s %s: %d != %d\n", cmp_cases[i].a, cmp_cases[i].b, ret, expect);
+            assert(0);
+        }
+        assert(sign(fixed_cmp(b, cmp_cases[i].prec_b, a, cmp_cases[i].prec_a)) == -expect);
+        mpd_del(ref_a);
+        mpd_del(ref_b);
+    }
+}
+
+// fixed_t has no negative zero, the cases that truncate to zero are positive
+static const struct {
+    const char *str;
+    int prec;
+    int new_prec;
+} rescale_cases[] = {
+    { "1", 0, 8 },
+    { "1.5", 1, 0 },
+    { "-1.5", 1, 0 },
+    { "1.999", 3, 1 },
+    { "-1.999", 3, 1 },
+    { "0.00000001", 8, 0 },
+    { "-0.00000011", 8, 7 },
+    { "123.456", 3, 3 },
+    { "123.456", 3, 20 },
+    { "12345678.12345678", 8, 4 },
+    { "99999999999999999999.999999999999999999", 18, 0 },
+    { "-99999999999999999999.999999999999999999", 18, 2 },
+    { "1", 0, 37 },
+    { "0.12345678901234567890123456789012345678", 38, 19 },
+};
+
+static void test_rescale(void)
+{
+    char expect[FIXED_STR_MAX_LEN];
+    char buf[FIXED_STR_MAX_LEN];
+    for (size_t i = 0; i < sizeof(rescale_cases) / sizeof(rescale_cases[0]); ++i) {
+        const char *str = rescale_cases[i].str;
+        int prec = rescale_cases[i].prec;
+        int new_prec = rescale_cases[i].new_prec;
+        fixed_t value;
+        assert(fixed_parse(str, prec, &value) == 0);
+        ref_rescale_sci(expect, str, new_prec);
+        fixed_to_sci(buf, fixed_rescale(value, prec, new_prec), new_prec);
+        if (strcmp(buf, expect) != 0) {
+            fprintf(stderr, "rescale %s %d -> %d: %s != %s\n", str, prec, new_prec, buf, expect);
+            assert(0);
+        }
+    }
+}
+
+static void bench_add(void)
 {
-    init_mpd();
     mpd_t *a = decimal("100.12345678", 0);
     mpd_t *b = decimal("200.12345678", 0);
     mpd_t *c = mpd_new(&mpd_ctx);
@@ -19,7 +293,40 @@ int main(int argc, char *argv[])
         mpd_add(c, a, b, &mpd_ctx);
     }
     double end = current_timestamp();
-    printf("%f\n", end - start);
+    printf("mpd: %f\n", end - start);
+
+    fixed_t x, y, z = 0;
+    fixed_parse("100.12345678", 8, &x);
+    fixed_parse("200.12345678", 8, &y);
+
+    start = current_timestamp();
+    for (int i = 0; i < 1000000; ++i) {
+        z += x + y;
+    }
+    end = current_timestamp();
+    printf("fixed: %f\n", end - start);
+
+    char buf[FIXED_STR_MAX_LEN];
+    printf("%s\n", fixed_to_sci(buf, z, 8));
+
+    mpd_del(a);
+    mpd_del(b);
+    mpd_del(c);
+}
+
+int main(int argc, char *argv[])
+{
+    init_mpd();
+    mpd_maxcontext(&ref_ctx);
+    ref_ctx.round = MPD_ROUND_DOWN;
+
+    test_parse();
+    test_to_sci();
+    test_cmp();
+    test_rescale();
+    printf("test decimal ok\n");
+
+    bench_add();
 
     return 0;
 }
@@ -0,0 +1,134 @@
+/*
+ * Description: dict and oadict micro benchmark
+ */
+
+# include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+
+# include "ut_misc.h"
+# include "ut_dict.h"
+# include "ut_oadict.h"
+
+static uint32_t key_hash(const void *key)
+{
+    return dict_generic_hash_function(key, sizeof(uint64_t));
+}
+
+static int key_compare(const void *key1, const void *key2)
+{
+    return memcmp(key1, key2, sizeof(uint64_t));
+}
+
+static void report(const char *name, const char *op, double start, double end, double max, size_t count)
+{
+    printf("%-8s %-8s total: %.3fs, %.1fns/op, max: %.3fms\n", name, op,
+            end - start, (end - start) * 1e9 / count, max * 1e3);
+}
+
+static void bench_dict(uint64_t *keys, size_t count)
+{
+    dict_types type;
+    memset(&type, 0, sizeof(type));
+    type.hash_function = key_hash;
+    type.key_compare = key_compare;
+    dict_t *dict = dict_create(&type, 64);
+
+    double max = 0;
+    double start = current_timestamp();
+    for (size_t i = 0; i < count; ++i) {
+        double t = current_timestamp();
+        dict_add(dict, &keys[i], &keys[i]);
+        t = current_timestamp() - t;
+        if (t > max)
+            max = t;
+    }
+    report("dict", "add", start, current_timestamp(), max, count);
+
+    start = current_timestamp();
+    for (size_t i = 0; i < count; ++i) {
+        if (dict_find(dict, &keys[(i * 7919) % count]) == NULL) {
+            printf("dict find fail\n");
+            exit(1);
+        }
+    }
+    report("dict", "find", start, current_timestamp(), 0, count);
+
+    // what a resize costs when it is done at once
+    start = current_timestamp();
+    dict_expand(dict, dict_slot(dict) * 4);
+    printf("%-8s %-8s total: %.3fs\n", "dict", "expand", current_timestamp() - start);
+
+    max = 0;
+    start = current_timestamp();
+    for (size_t i = 0; i < count; ++i) {
+        double t = current_timestamp();
+        dict_delete(dict, &keys[i]);
+        t = current_timestamp() - t;
+        if (t > max)
+            max = t;
+    }
+    report("dict", "delete", start, current_timestamp(), max, count);
+
+    dict_release(dict);
+}
+
+static void bench_oadict(uint64_t *keys, size_t count)
+{
+    oadict_t *dict = oadict_create(sizeof(uint64_t), 64, NULL);
+
+    double max = 0;
+    double start = current_timestamp();
+    for (size_t i = 0; i < count; ++i) {
+        double t = current_timestamp();
+        oadict_add(dict, &keys[i], &keys[i]);
+        t = current_timestamp() - t;
+        if (t > max)
+            max = t;
+    }
+    report("oadict", "add", start, current_timestamp(), max, count);
+
+    start = current_timestamp();
+    for (size_t i = 0; i < count; ++i) {
+        if (oadict_find(dict, &keys[(i * 7919) % count]) == NULL) {
+            printf("oadict find fail\n");
+            exit(1);
+        }
+    }
+    report("oadict", "find", start, current_timestamp(), 0, count);
+
+    max = 0;
+    start = current_timestamp();
+    for (size_t i = 0; i < count; ++i) {
+        double t = current_timestamp();
+        oadict_delete(dict, &keys[i]);
+        t = current_timestamp() - t;
+        if (t > max)
+            max = t;
+    }
+    report("oadict", "delete", start, current_timestamp(), max, count);
+
+    oadict_release(dict);
+}
+
+int main(int argc, char *argv[])
+{
+    size_t count = 4 * 1000 * 1000;
+    if (argc > 1) {
+        count = strtoul(argv[1], NULL, 0);
+    }
+
+    // ids as the order ids are
+    uint64_t *keys = malloc(sizeof(uint64_t) * count);
+    for (size_t i = 0; i < count; ++i) {
+        keys[i] = i + 1;
+    }
+
+    printf("keys: %zu\n", count);
+    bench_dict(keys, count);
+    bench_oadict(keys, count);
+    free(keys);
+
+    return 0;
+}
+
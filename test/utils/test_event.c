@@ -0,0 +1,287 @@
+/*
+ * Description: ut_event round trips and malformed input
+ */
+
+# include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+# include <assert.h>
+
+# include "ut_pack.h"
+# include "ut_event.h"
+
+static char name_max[EVENT_NAME_MAX_LEN + 1];
+
+static event_fixed make_fixed(const char *str, int prec)
+{
+    event_fixed num;
+    int ret = fixed_parse(str, prec, &num.value);
+    assert(ret == 0);
+    num.prec = prec;
+    return num;
+}
+
+static bool fixed_equal(const event_fixed *a, const event_fixed *b)
+{
+    return a->value == b->value && a->prec == b->prec;
+}
+
+static void sample_deal(event_deal *deal)
+{
+    memset(deal, 0, sizeof(*deal));
+    deal->timestamp = 1500000000.123456;
+    deal->id = UINT64_MAX;
+    strcpy(deal->market, name_max);
+    strcpy(deal->stock, "BTC");
+    deal->side = 2;
+    deal->ask_id = 1;
+    deal->bid_id = 0xfd;
+    deal->ask_user_id = UINT32_MAX;
+    deal->bid_user_id = 0x10000;
+    deal->price = make_fixed("8000.12345678", 8);
+    deal->amount = make_fixed("0", 0);
+    deal->deal = make_fixed("99999999999999999999999999999999999999", 0);
+    deal->ask_fee = make_fixed("-0.99999999999999999999999999999999999999", 38);
+    deal->bid_fee = make_fixed("-1", 18);
+}
+
+static void sample_order(event_order *order)
+{
+    memset(order, 0, sizeof(*order));
+    order->event = 3;
+    order->id = 123456789012ULL;
+    strcpy(order->market, "BTCUSDT");
+    strcpy(order->source, name_max);
+    order->type = 1;
+    order->side = 1;
+    order->user_id = 77;
+    order->create_time = 1500000000.25;
+    order->update_time = -0.5;
+    order->price = make_fixed("-1234567890.123456789", 12);
+    order->amount = make_fixed("1.5", 4);
+    order->taker_fee = make_fixed("0.002", 4);
+    order->maker_fee = make_fixed("0.001", 4);
+    order->left = make_fixed("0.05", 2);
+    order->deal_stock = make_fixed("1.45", 4);
+    order->deal_money = make_fixed("11600.17901234", 12);
+    order->deal_fee = make_fixed("0.0029", 8);
+    strcpy(order->stock, "BTC");
+    strcpy(order->money, "USDT");
+}
+
+static void sample_balance(event_balance *balance)
+{
+    memset(balance, 0, sizeof(*balance));
+    balance->timestamp = 1500000000;
+    balance->user_id = 9;
+    strcpy(balance->asset, "ETH");
+    strcpy(balance->business, "trade");
+    balance->change = make_fixed("-0.0042", 4);
+    balance->result = make_fixed("100", 8);
+}
+
+static bool deal_equal(const event_deal *a, const event_deal *b)
+{
+    return a->timestamp == b->timestamp && a->id == b->id &&
+        strcmp(a->market, b->market) == 0 && strcmp(a->stock, b->stock) == 0 && strcmp(a->money, b->money) == 0 &&
+        a->side == b->side && a->ask_id == b->ask_id && a->bid_id == b->bid_id &&
+        a->ask_user_id == b->ask_user_id && a->bid_user_id == b->bid_user_id &&
+        fixed_equal(&a->price, &b->price) && fixed_equal(&a->amount, &b->amount) &&
+        fixed_equal(&a->deal, &b->deal) && fixed_equal(&a->ask_fee, &b->ask_fee) &&
+        fixed_equal(&a->bid_fee, &b->bid_fee);
+}
+
+static bool order_equal(const event_order *a, const event_order *b)
+{
+    return a->event == b->event && a->id == b->id &&
+        strcmp(a->market, b->market) == 0 && strcmp(a->source, b->source) == 0 &&
+        a->type == b->type && a->side == b->side && a->user_id == b->user_id &&
+        a->create_time == b->create_time && a->update_time == b->update_time &&
+        fixed_equal(&a->price, &b->price) && fixed_equal(&a->amount, &b->amount) &&
+        fixed_equal(&a->taker_fee, &b->taker_fee) && fixed_equal(&a->maker_fee, &b->maker_fee) &&
+        fixed_equal(&a->left, &b->left) && fixed_equal(&a->deal_stock, &b->deal_stock) &&
+        fixed_equal(&a->deal_money, &b->deal_money) && fixed_equal(&a->deal_fee, &b->deal_fee) &&
+        strcmp(a->stock, b->stock) == 0 && strcmp(a->money, b->money) == 0;
+}
+
+static bool balance_equal(const event_balance *a, const event_balance *b)
+{
+    return a->timestamp == b->timestamp && a->user_id == b->user_id &&
+        strcmp(a->asset, b->asset) == 0 && strcmp(a->business, b->business) == 0 &&
+        fixed_equal(&a->change, &b->change) && fixed_equal(&a->result, &b->result);
+}
+
+typedef int (*unpack_fn)(const void *data, size_t size, void *event);
+
+// every prefix of a valid event is rejected, at a copy so asan sees the end
+static void check_truncated(const char *buf, size_t size, unpack_fn unpack, void *event)
+{
+    for (size_t i = 0; i < size; ++i) {
+        char *copy = malloc(i + 1);
+        memcpy(copy, buf, i);
+        assert(unpack(copy, i, event) < 0);
+        free(copy);
+    }
+}
+
+static void test_deal(void)
+{
+    event_deal deal, result;
+    sample_deal(&deal);
+
+    char buf[EVENT_MAX_SIZE];
+    void *p = buf;
+    size_t left = sizeof(buf);
+    assert(pack_event_deal(&p, &left, &deal) == 0);
+    size_t size = sizeof(buf) - left;
+    assert(size <= EVENT_MAX_SIZE);
+    assert(is_event_message(buf, size));
+    assert(get_event_type(buf, size) == EVENT_TYPE_DEAL);
+
+    memset(&result, 0xff, sizeof(result));
+    assert(unpack_event_deal(buf, size, &result) == 0);
+    assert(deal_equal(&deal, &result));
+
+    // the other types do not accept it
+    event_order order;
+    event_balance balance;
+    assert(unpack_event_order(buf, size, &order) < 0);
+    assert(unpack_event_balance(buf, size, &balance) < 0);
+
+    for (size_t i = 0; i < size; ++i) {
+        char small[EVENT_MAX_SIZE];
+        p = small;
+        left = i;
+        assert(pack_event_deal(&p, &left, &deal) < 0);
+    }
+    check_truncated(buf, size, (unpack_fn)unpack_event_deal, &result);
+}
+
+static void test_order(void)
+{
+    event_order order, result;
+    sample_order(&order);
+
+    char buf[EVENT_MAX_SIZE];
+    void *p = buf;
+    size_t left = sizeof(buf);
+    assert(pack_event_order(&p, &left, &order) == 0);
+    size_t size = sizeof(buf) - left;
+    assert(get_event_type(buf, size) == EVENT_TYPE_ORDER);
+
+    memset(&result, 0xff, sizeof(result));
+    assert(unpack_event_order(buf, size, &result) == 0);
+    assert(order_equal(&order, &result));
+
+    // the fields of a later version are ignored
+    memset(buf + size, 0x01, 8);
+    memset(&result, 0xff, sizeof(result));
+    assert(unpack_event_order(buf, size + 8, &result) == 0);
+    assert(order_equal(&order, &result));
+
+    check_truncated(buf, size, (unpack_fn)unpack_event_order, &result);
+}
+
+static void test_balance(void)
+{
+    event_balance balance, result;
+    sample_balance(&balance);
+
+    char buf[EVENT_MAX_SIZE];
+    void *p = buf;
+    size_t left = sizeof(buf);
+    assert(pack_event_balance(&p, &left, &balance) == 0);
+    size_t size = sizeof(buf) - left;
+    assert(get_event_type(buf, size) == EVENT_TYPE_BALANCE);
+
+    memset(&result, 0xff, sizeof(result));
+    assert(unpack_event_balance(buf, size, &result) == 0);
+    assert(balance_equal(&balance, &result));
+
+    check_truncated(buf, size, (unpack_fn)unpack_event_balance, &result);
+}
+
+static void test_head(void)
+{
+    assert(!is_event_message("{\"method\": \"balances.update\"}", 29));
+    assert(get_event_type("{\"method\": \"balances.update\"}", 29) < 0);
+
+    uint8_t head[] = { EVENT_MAGIC, EVENT_VERSION, EVENT_TYPE_BALANCE };
+    assert(!is_event_message(head, 2));
+    assert(get_event_type(head, sizeof(head)) == EVENT_TYPE_BALANCE);
+    head[1] = 0;
+    assert(get_event_type(head, sizeof(head)) < 0);
+}
+
+// a balance event written field by field, to put values pack_event_balance would not produce
+static size_t pack_raw_balance(char *buf, uint64_t user_id, const char *asset, size_t asset_len, uint8_t prec)
+{
+    void *p = buf;
+    size_t left = EVENT_MAX_SIZE;
+    double timestamp = 1500000000;
+    uint64_t bits;
+    memcpy(&bits, &timestamp, sizeof(bits));
+    assert(pack_char(&p, &left, EVENT_MAGIC) > 0);
+    assert(pack_char(&p, &left, EVENT_VERSION) > 0);
+    assert(pack_char(&p, &left, EVENT_TYPE_BALANCE) > 0);
+    assert(pack_uint64_le(&p, &left, bits) > 0);
+    assert(pack_varint_le(&p, &left, user_id) > 0);
+    assert(pack_varstr(&p, &left, asset, asset_len) > 0);
+    assert(pack_varstr(&p, &left, "trade", 5) > 0);
+    for (int i = 0; i < 2; ++i) {
+        assert(pack_char(&p, &left, prec) > 0);
+        assert(pack_varint_le(&p, &left, 2) > 0);
+        assert(pack_varint_le(&p, &left, 0) > 0);
+    }
+    return EVENT_MAX_SIZE - left;
+}
+
+static void test_malformed(void)
+{
+    char asset[EVENT_NAME_MAX_LEN + 2];
+    memset(asset, 'A', sizeof(asset));
+
+    char buf[EVENT_MAX_SIZE];
+    event_balance result;
+    size_t size = pack_raw_balance(buf, 1, asset, EVENT_NAME_MAX_LEN, FIXED_DIGITS_MAX);
+    assert(unpack_event_balance(buf, size, &result) == 0);
+    assert(strlen(result.asset) == EVENT_NAME_MAX_LEN);
+    assert(result.change.value == 1 && result.change.prec == FIXED_DIGITS_MAX);
+
+    // string fields of 32 bytes or more
+    size = pack_raw_balance(buf, 1, asset, EVENT_NAME_MAX_LEN + 1, 8);
+    assert(unpack_event_balance(buf, size, &result) < 0);
+    size = pack_raw_balance(buf, 1, asset, EVENT_NAME_MAX_LEN + 2, 8);
+    assert(unpack_event_balance(buf, size, &result) < 0);
+
+    // precision over FIXED_DIGITS_MAX
+    size = pack_raw_balance(buf, 1, "BTC", 3, FIXED_DIGITS_MAX + 1);
+    assert(unpack_event_balance(buf, size, &result) < 0);
+    size = pack_raw_balance(buf, 1, "BTC", 3, 0xff);
+    assert(unpack_event_balance(buf, size, &result) < 0);
+
+    // user id over 32 bits
+    size = pack_raw_balance(buf, (uint64_t)UINT32_MAX + 1, "BTC", 3, 8);
+    assert(unpack_event_balance(buf, size, &result) < 0);
+
+    // a string length larger than the event, the asset follows the head, the time and a one byte user id
+    size = pack_raw_balance(buf, 1, "BTC", 3, 8);
+    assert(buf[3 + 8 + 1] == 3);
+    buf[3 + 8 + 1] = 0x7f;
+    assert(unpack_event_balance(buf, size, &result) < 0);
+}
+
+int main(int argc, char *argv[])
+{
+    memset(name_max, 'N', EVENT_NAME_MAX_LEN);
+
+    test_deal();
+    test_order();
+    test_balance();
+    test_head();
+    test_malformed();
+    printf("test event ok\n");
+
+    return 0;
+}
+
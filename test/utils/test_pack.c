@@ -0,0 +1,228 @@
+/*
+ * Description: pack_json and unpack_json round trips and malformed input
+ */
+
+# include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+# include <stdint.h>
+# include <assert.h>
+
+# include "ut_pack.h"
+
+static json_t *sample_json(void)
+{
+    json_t *object = json_object();
+    json_object_set_new(object, "null", json_null());
+    json_object_set_new(object, "true", json_true());
+    json_object_set_new(object, "false", json_false());
+    json_object_set_new(object, "zero", json_integer(0));
+    json_object_set_new(object, "small", json_integer(-1));
+    json_object_set_new(object, "uint16", json_integer(0xfd));
+    json_object_set_new(object, "uint32", json_integer(-0x10000));
+    json_object_set_new(object, "max", json_integer(INT64_MAX));
+    json_object_set_new(object, "min", json_integer(INT64_MIN));
+    json_object_set_new(object, "real", json_real(-1.25e-3));
+    json_object_set_new(object, "", json_string(""));
+    json_object_set_new(object, "nul", json_stringn("a\0b", 3));
+
+    char long_str[300];
+    memset(long_str, 'x', sizeof(long_str));
+    json_object_set_new(object, "long", json_stringn(long_str, sizeof(long_str)));
+
+    json_t *array = json_array();
+    json_array_append_new(array, json_string("BTCUSDT"));
+    json_array_append_new(array, json_integer(1));
+    json_array_append_new(array, json_array());
+    json_array_append_new(array, json_object());
+    json_t *inner = json_object();
+    json_object_set_new(inner, "price", json_string("8000.12345678"));
+    json_array_append_new(array, inner);
+    json_object_set_new(object, "array", array);
+
+    return object;
+}
+
+static size_t pack_sample(char *buf, size_t size, json_t *json)
+{
+    void *p = buf;
+    size_t left = size;
+    int ret = pack_json(&p, &left, json);
+    assert(ret > 0);
+    assert((size_t)ret == size - left && p == buf + ret);
+    return ret;
+}
+
+static void test_round_trip(void)
+{
+    json_t *json = sample_json();
+    char buf[1024];
+    size_t size = pack_sample(buf, sizeof(buf), json);
+
+    void *p = buf;
+    size_t left = size;
+    json_t *result;
+    int ret = unpack_json(&p, &left, &result);
+    assert(ret == (int)size && left == 0);
+    assert(json_equal(json, result));
+    json_decref(result);
+
+    // trailing data is left to the caller
+    p = buf;
+    left = sizeof(buf);
+    assert(unpack_json(&p, &left, &result) == (int)size && left == sizeof(buf) - size);
+    json_decref(result);
+
+    // a buffer one byte short anywhere fails
+    for (size_t i = 0; i < size; ++i) {
+        char small[1024];
+        p = small;
+        left = i;
+        assert(pack_json(&p, &left, json) < 0);
+    }
+
+    json_decref(json);
+}
+
+static void test_truncated(void)
+{
+    json_t *json = sample_json();
+    char buf[1024];
+    size_t size = pack_sample(buf, sizeof(buf), json);
+    json_decref(json);
+
+    // every prefix of a valid value is rejected, at a copy so asan sees the end
+    for (size_t i = 0; i < size; ++i) {
+        char *copy = malloc(i + 1);
+        memcpy(copy, buf, i);
+        void *p = copy;
+        size_t left = i;
+        json_t *result = NULL;
+        assert(unpack_json(&p, &left, &result) < 0);
+        free(copy);
+    }
+}
+
+static int unpack_bytes(const uint8_t *data, size_t size, json_t **result)
+{
+    void *copy = malloc(size);
+    memcpy(copy, data, size);
+    void *p = copy;
+    size_t left = size;
+    int ret = unpack_json(&p, &left, result);
+    free(copy);
+    return ret;
+}
+
+static void test_malformed(void)
+{
+    static const struct {
+        uint8_t data[16];
+        size_t size;
+    } cases[] = {
+        // short varints
+        { { PACK_JSON_INTEGER }, 1 },
+        { { PACK_JSON_INTEGER, 0xfd, 0x01 }, 3 },
+        { { PACK_JSON_INTEGER, 0xfe, 0x01, 0x02, 0x03 }, 5 },
+        { { PACK_JSON_INTEGER, 0xff, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07 }, 9 },
+        { { PACK_JSON_REAL, 0x01, 0x02, 0x03 }, 4 },
+        // len larger than the data
+        { { PACK_JSON_STRING, 0x04, 'a', 'b', 'c' }, 5 },
+        { { PACK_JSON_STRING, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 'a' }, 11 },
+        { { PACK_JSON_ARRAY, 0xfe, 0x00, 0x00, 0x00, 0x01, PACK_JSON_NULL }, 7 },
+        { { PACK_JSON_ARRAY, 0x02, PACK_JSON_NULL }, 3 },
+        { { PACK_JSON_OBJECT, 0x01, 0x05, 'k', PACK_JSON_NULL }, 5 },
+        { { PACK_JSON_OBJECT, 0x01, 0x01, 'k' }, 4 },
+        { { PACK_JSON_OBJECT, 0x02, 0x01, 'k', PACK_JSON_NULL }, 5 },
+        // scale over 18
+        { { PACK_JSON_DECIMAL, 0x02, 19 }, 3 },
+        { { PACK_JSON_DECIMAL, 0x02, 0xff }, 3 },
+        { { PACK_JSON_DECIMAL, 0x02 }, 2 },
+        // unknown type
+        { { PACK_JSON_DECIMAL + 1 }, 1 },
+        { { 0xff }, 1 },
+        { { 0 }, 0 },
+    };
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        json_t *result = NULL;
+        if (unpack_bytes(cases[i].data, cases[i].size, &result) >= 0) {
+            fprintf(stderr, "malformed case %zu not rejected\n", i);
+            assert(0);
+        }
+    }
+}
+
+static void test_depth(void)
+{
+    // depth arrays each holding the next one, the last is empty
+    for (int depth = 1; depth <= PACK_JSON_MAX_DEPTH + 2; ++depth) {
+        uint8_t data[(PACK_JSON_MAX_DEPTH + 2) * 2];
+        size_t size = 0;
+        for (int i = 0; i < depth; ++i) {
+            data[size++] = PACK_JSON_ARRAY;
+            data[size++] = i + 1 < depth ? 1 : 0;
+        }
+        json_t *result = NULL;
+        int ret = unpack_bytes(data, size, &result);
+        if (depth <= PACK_JSON_MAX_DEPTH + 1) {
+            assert(ret == (int)size);
+            json_decref(result);
+        } else {
+            assert(ret < 0);
+        }
+    }
+}
+
+static void test_decimal(void)
+{
+    static const struct {
+        int64_t mantissa;
+        uint8_t scale;
+        const char *expect;
+    } cases[] = {
+        { 0, 0, "0" },
+        { 0, 2, "0.00" },
+        { 12345, 0, "12345" },
+        { 12345, 2, "123.45" },
+        { -12345, 5, "-0.12345" },
+        { 5, 3, "0.005" },
+        { -5, 3, "-0.005" },
+        { 1, 18, "0.000000000000000001" },
+        { INT64_MAX, 18, "9.223372036854775807" },
+        { INT64_MIN, 18, "-9.223372036854775808" },
+        { INT64_MIN, 0, "-9223372036854775808" },
+    };
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        uint8_t data[16];
+        void *p = data;
+        size_t left = sizeof(data);
+        uint64_t zigzag = ((uint64_t)cases[i].mantissa << 1) ^ (uint64_t)(cases[i].mantissa >> 63);
+        assert(pack_char(&p, &left, PACK_JSON_DECIMAL) == 1);
+        assert(pack_varint_le(&p, &left, zigzag) > 0);
+        assert(pack_char(&p, &left, cases[i].scale) == 1);
+
+        json_t *result = NULL;
+        assert(unpack_bytes(data, sizeof(data) - left, &result) == (int)(sizeof(data) - left));
+        assert(json_is_string(result));
+        if (strcmp(json_string_value(result), cases[i].expect) != 0) {
+            fprintf(stderr, "decimal %zu: %s != %s\n", i, json_string_value(result), cases[i].expect);
+            assert(0);
+        }
+        json_decref(result);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    test_round_trip();
+    test_truncated();
+    test_malformed();
+    test_depth();
+    test_decimal();
+    printf("test pack ok\n");
+
+    return 0;
+}
+
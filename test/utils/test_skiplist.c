@@ -6,6 +6,7 @@
 # include <stdio.h>
 # include <stdlib.h>
 # include <string.h>
+# include <assert.h>
 
 # include "ut_sds.h"
 # include "ut_skiplist.h"
@@ -25,8 +26,134 @@ int node_compare(const void *obj, const void *key)
     return strcmp(obj, key);
 }
 
+# define RANK_NUM 512
+
+static long rank_values[RANK_NUM];
+static long rank_weights[RANK_NUM];
+static int rank_in[RANK_NUM];
+
+int rank_compare(const void *value1, const void *value2)
+{
+    long v1 = *(const long *)value1;
+    long v2 = *(const long *)value2;
+    return v1 < v2 ? -1 : v1 > v2;
+}
+
+// the levels a node is linked at
+static int node_level(skiplist_t *list, skiplist_node *x)
+{
+    int level = 0;
+    for (int i = 0; i < list->level; ++i) {
+        for (skiplist_node *node = list->header->forward[i]; node; node = node->forward[i]) {
+            if (node == x) {
+                level += 1;
+                break;
+            }
+        }
+    }
+    return level;
+}
+
+// every position of the weights against the reference arrays
+static void check_rank(skiplist_t *list)
+{
+    unsigned long total = 0;
+    size_t len = 0;
+    for (int i = 0; i < RANK_NUM; ++i) {
+        if (!rank_in[i])
+            continue;
+        len += 1;
+        for (long j = 0; j < rank_weights[i]; ++j) {
+            unsigned long offset = ~0ul;
+            skiplist_node *node = skiplist_find_by_rank(list, total + j, &offset);
+            assert(node != NULL);
+            assert(*(long *)node->value == rank_values[i]);
+            assert(offset == (unsigned long)j);
+        }
+        total += rank_weights[i];
+    }
+    assert(skiplist_len(list) == len);
+    assert(skiplist_weight(list) == total);
+    assert(skiplist_find_by_rank(list, total, NULL) == NULL);
+    assert(skiplist_find_by_rank(list, total + 100, NULL) == NULL);
+}
+
+static void test_rank(void)
+{
+    skiplist_type type;
+    memset(&type, 0, sizeof(type));
+    type.compare = rank_compare;
+    skiplist_t *list = skiplist_create(&type);
+
+    for (int i = 0; i < RANK_NUM; ++i) {
+        rank_values[i] = i * 10;
+    }
+    // inserted out of order, every node weighs 1
+    for (int i = 0; i < RANK_NUM; ++i) {
+        int index = (i * 7) % RANK_NUM;
+        assert(skiplist_insert(list, &rank_values[index]) != NULL);
+        rank_in[index] = 1;
+        rank_weights[index] = 1;
+    }
+    assert(skiplist_insert(list, &rank_values[3]) == NULL);
+    check_rank(list);
+
+    // weighted nodes, including nodes of weight 0 which no position falls in
+    for (int i = 0; i < RANK_NUM; ++i) {
+        long delta = (i * 13) % 5 - 1;
+        skiplist_add_weight(list, &rank_values[i], delta);
+        rank_weights[i] += delta;
+    }
+    check_rank(list);
+
+    // delete nodes of every level the list has
+    for (int level = list->level; level >= 1; --level) {
+        for (int i = 0; i < RANK_NUM; ++i) {
+            if (!rank_in[i])
+                continue;
+            skiplist_node *node = skiplist_find(list, &rank_values[i]);
+            assert(node != NULL);
+            if (node_level(list, node) != level)
+                continue;
+            skiplist_delete(list, node);
+            rank_in[i] = 0;
+            check_rank(list);
+            break;
+        }
+    }
+
+    // then every other one, changing weights on the way
+    for (int i = 0; i < RANK_NUM; i += 2) {
+        if (rank_in[i]) {
+            skiplist_delete(list, skiplist_find(list, &rank_values[i]));
+            rank_in[i] = 0;
+        }
+        if (i + 1 < RANK_NUM && rank_in[i + 1]) {
+            skiplist_add_weight(list, &rank_values[i + 1], 2);
+            rank_weights[i + 1] += 2;
+        }
+        if (i % 64 == 0) {
+            check_rank(list);
+        }
+    }
+    check_rank(list);
+
+    // deleted nodes are reused by the inserts
+    for (int i = 0; i < RANK_NUM; i += 2) {
+        assert(skiplist_insert(list, &rank_values[i]) != NULL);
+        rank_in[i] = 1;
+        rank_weights[i] = 1;
+    }
+    check_rank(list);
+
+    skiplist_release(list);
+    printf("rank test ok\n");
+}
+
 int main(int argc, char *argv[])
 {
+    test_rank();
+
     skiplist_type type;
     type.dup = node_dup;
     type.free = node_free;
@@ -3,6 +3,12 @@
  *     History: yang@haipo.me, 2017/03/17, create
  */
 
+# include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+# include <stdbool.h>
+# include <inttypes.h>
+
 # include "ut_decimal.h"
 
 mpd_context_t mpd_ctx;
@@ -82,3 +88,227 @@ int json_array_append_new_mpd(json_t *obj, mpd_t *value)
     return ret;
 }
 
+
+# define P18 ((fixed_t)1000000000000000000LL)
+
+const fixed_t fixed_pow10[FIXED_DIGITS_MAX + 1] = {
+    1LL, 10LL, 100LL, 1000LL, 10000LL, 100000LL, 1000000LL, 10000000LL,
+    100000000LL, 1000000000LL, 10000000000LL, 100000000000LL, 1000000000000LL,
+    10000000000000LL, 100000000000000LL, 1000000000000000LL, 10000000000000000LL,
+    100000000000000000LL, 1000000000000000000LL,
+    P18 * 10LL, P18 * 100LL, P18 * 1000LL, P18 * 10000LL, P18 * 100000LL,
+    P18 * 1000000LL, P18 * 10000000LL, P18 * 100000000LL, P18 * 1000000000LL,
+    P18 * 10000000000LL, P18 * 100000000000LL, P18 * 1000000000000LL,
+    P18 * 10000000000000LL, P18 * 100000000000000LL, P18 * 1000000000000000LL,
+    P18 * 10000000000000000LL, P18 * 100000000000000000LL, P18 * P18,
+    P18 * P18 * 10LL, P18 * P18 * 100LL,
+};
+
+int fixed_parse(const char *str, int prec, fixed_t *result)
+{
+    if (str == NULL || prec < 0 || prec > FIXED_DIGITS_MAX)
+        return -__LINE__;
+
+    const char *p = str;
+    bool negative = false;
+    if (*p == '-' || *p == '+') {
+        negative = (*p == '-');
+        p++;
+    }
+
+    /* significant digits, without leading zeros */
+    char digits[FIXED_DIGITS_MAX + 1];
+    int ndigits = 0;
+    int nseen = 0;
+    int dropped = 0;
+    int point = 0;
+    bool has_point = false;
+    for (;; ++p) {
+        if (*p == '.') {
+            if (has_point)
+                return -__LINE__;
+            has_point = true;
+            point = ndigits + dropped;
+            continue;
+        }
+        if (*p < '0' || *p > '9')
+            break;
+        nseen++;
+        if (ndigits == 0 && *p == '0') {
+            if (has_point)
+                point--;
+            continue;
+        }
+        if (ndigits < FIXED_DIGITS_MAX + 1) {
+            digits[ndigits++] = *p;
+        } else {
+            dropped++;
+        }
+    }
+    if (nseen == 0)
+        return -__LINE__;
+    if (!has_point)
+        point = ndigits + dropped;
+
+    long exp = 0;
+    if (*p == 'e' || *p == 'E') {
+        p++;
+        bool exp_negative = false;
+        if (*p == '-' || *p == '+') {
+            exp_negative = (*p == '-');
+            p++;
+        }
+        if (*p < '0' || *p > '9')
+            return -__LINE__;
+        for (; *p >= '0' && *p <= '9'; ++p) {
+            if (exp < 1000000)
+                exp = exp * 10 + (*p - '0');
+        }
+        if (exp_negative)
+            exp = -exp;
+    }
+    if (*p != '\0')
+        return -__LINE__;
+
+    /* number of leading significant digits that survive the rescale */
+    long keep = point + exp + prec;
+    if (keep > FIXED_DIGITS_MAX)
+        return ndigits ? -__LINE__ : (*result = 0, 0);
+    if (keep <= 0 || ndigits == 0) {
+        *result = 0;
+        return 0;
+    }
+    fixed_t value = 0;
+    for (long i = 0; i < keep; ++i) {
+        value = value * 10 + (i < ndigits ? digits[i] - '0' : 0);
+    }
+    *result = negative ? -value : value;
+
+    return 0;
+}
+
+int fixed_from_mpd(const mpd_t *value, int prec, fixed_t *result)
+{
+    if (!mpd_isfinite(value))
+        return -__LINE__;
+    char *str = mpd_to_sci(value, 0);
+    if (str == NULL)
+        return -__LINE__;
+    int ret = fixed_parse(str, prec, result);
+    free(str);
+    return ret;
+}
+
+mpd_t *fixed_to_mpd(fixed_t value, int prec)
+{
+    char buf[FIXED_STR_MAX_LEN];
+    mpd_t *result = mpd_new(&mpd_ctx);
+    mpd_set_string(result, fixed_to_sci(buf, value, prec), &mpd_ctx);
+    return result;
+}
+
+fixed_t fixed_rescale(fixed_t value, int prec, int new_prec)
+{
+    if (new_prec >= prec)
+        return value * fixed_pow10[new_prec - prec];
+    return value / fixed_pow10[prec - new_prec];
+}
+
+int fixed_cmp(fixed_t a, int prec_a, fixed_t b, int prec_b)
+{
+    if (prec_a == prec_b)
+        return a < b ? -1 : (a > b ? 1 : 0);
+
+    int sign = 1;
+    if (prec_a > prec_b) {
+        fixed_t tmp = a; a = b; b = tmp;
+        int tmp_prec = prec_a; prec_a = prec_b; prec_b = tmp_prec;
+        sign = -1;
+    }
+
+    /* compare a with b scaled down, the remainder breaks the tie */
+    fixed_t q = b / fixed_pow10[prec_b - prec_a];
+    fixed_t r = b % fixed_pow10[prec_b - prec_a];
+    if (a != q)
+        return a < q ? -sign : sign;
+    if (r > 0)
+        return -sign;
+    if (r < 0)
+        return sign;
+    return 0;
+}
+
+static int fixed_coefficient(char *buf, unsigned __int128 value)
+{
+    /* convert in chunks of 18 digits, the chunks fit in a uint64_t */
+    uint64_t chunks[3];
+    int nchunk = 0;
+    do {
+        chunks[nchunk++] = (uint64_t)(value % (unsigned __int128)P18);
+        value /= (unsigned __int128)P18;
+    } while (value);
+
+    int len = sprintf(buf, "%"PRIu64, chunks[nchunk - 1]);
+    for (int i = nchunk - 2; i >= 0; --i) {
+        len += sprintf(buf + len, "%018"PRIu64, chunks[i]);
+    }
+
+    return len;
+}
+
+char *fixed_to_sci(char *buf, fixed_t value, int prec)
+{
+    char coef[FIXED_DIGITS_MAX + 2];
+    char *p = buf;
+    unsigned __int128 abs_value = value;
+    if (value < 0) {
+        *p++ = '-';
+        abs_value = -(unsigned __int128)value;
+    }
+
+    int len = fixed_coefficient(coef, abs_value);
+    int adjexp = len - 1 - prec;
+    if (adjexp >= -6) {
+        if (prec == 0) {
+            memcpy(p, coef, len);
+            p += len;
+        } else if (len > prec) {
+            memcpy(p, coef, len - prec);
+            p += len - prec;
+            *p++ = '.';
+            memcpy(p, coef + len - prec, prec);
+            p += prec;
+        } else {
+            *p++ = '0';
+            *p++ = '.';
+            memset(p, '0', prec - len);
+            p += prec - len;
+            memcpy(p, coef, len);
+            p += len;
+        }
+        *p = '\0';
+    } else {
+        *p++ = coef[0];
+        if (len > 1) {
+            *p++ = '.';
+            memcpy(p, coef + 1, len - 1);
+            p += len - 1;
+        }
+        sprintf(p, "e%d", adjexp);
+    }
+
+    return buf;
+}
+
+int json_object_set_new_fixed(json_t *obj, const char *key, fixed_t value, int prec)
+{
+    char buf[FIXED_STR_MAX_LEN];
+    return json_object_set_new(obj, key, json_string(rstripzero(fixed_to_sci(buf, value, prec))));
+}
+
+int json_array_append_new_fixed(json_t *obj, fixed_t value, int prec)
+{
+    char buf[FIXED_STR_MAX_LEN];
+    return json_array_append_new(obj, json_string(rstripzero(fixed_to_sci(buf, value, prec))));
+}
+
@@ -6,6 +6,7 @@
 # ifndef _UT_DECIMAL_H_
 # define _UT_DECIMAL_H_
 
+# include <stdint.h>
 # include <mpdecimal.h>
 # include <jansson.h>
 
@@ -22,5 +23,33 @@ char *rstripzero(char *str);
 int json_object_set_new_mpd(json_t *obj, const char *key, mpd_t *value);
 int json_array_append_new_mpd(json_t *obj, mpd_t *value);
 
+/*
+ * fixed_t is a scaled integer decimal: the real value is fixed * 10^-prec.
+ * The scale is not stored, every caller keeps track of the prec of the
+ * values it owns (a market's stock_prec, money_prec, fee_prec and their
+ * sums for products). Arithmetic on values of the same prec is plain
+ * integer arithmetic; rescaling down truncates toward zero, the same as
+ * MPD_ROUND_DOWN.
+ */
+typedef __int128 fixed_t;
+
+# define FIXED_DIGITS_MAX   38
+# define FIXED_STR_MAX_LEN  64
+
+extern const fixed_t fixed_pow10[FIXED_DIGITS_MAX + 1];
+
+/* parse a decimal string and rescale to prec, 0 on success */
+int fixed_parse(const char *str, int prec, fixed_t *result);
+int fixed_from_mpd(const mpd_t *value, int prec, fixed_t *result);
+mpd_t *fixed_to_mpd(fixed_t value, int prec);
+
+fixed_t fixed_rescale(fixed_t value, int prec, int new_prec);
+int fixed_cmp(fixed_t a, int prec_a, fixed_t b, int prec_b);
+
+/* same output as mpd_to_sci(value, 0) for a value with exponent -prec */
+char *fixed_to_sci(char *buf, fixed_t value, int prec);
+int json_object_set_new_fixed(json_t *obj, const char *key, fixed_t value, int prec);
+int json_array_append_new_fixed(json_t *obj, fixed_t value, int prec);
+
 # endif
 
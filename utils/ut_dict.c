@@ -53,6 +53,10 @@ uint32_t dict_generic_hash_function(const void *data, size_t len)
 # define DICT_HASH_KEY(dt, key) (dt)->type.hash_function(key)
 # define DICT_COMPARE_KEY(dt, key1, key2) (dt)->type.key_compare((key1), (key2))
 
+/* slots moved by an add or delete, and empty slots passed at most */
+# define DICT_REHASH_STEP    1
+# define DICT_REHASH_EMPTY   16
+
 static uint32_t dict_next_power(uint32_t size)
 {
     uint32_t realsize = 4;
@@ -86,45 +90,95 @@ dict_t *dict_create(dict_types *type, uint32_t init_size)
     return dt;
 }
 
-int dict_expand(dict_t *dt, uint32_t size)
+static int rehash_start(dict_t *dt, uint32_t size)
 {
-    dict_t new;
-    memcpy(&new, dt, sizeof(dict_t));
-    new.size = dict_next_power(size);
-    new.mask = new.size - 1;
-    new.table = calloc(new.size, sizeof(dict_entry *));
-    if (new.table == NULL)
+    dt->rehash_size = dict_next_power(size);
+    dt->rehash_mask = dt->rehash_size - 1;
+    dt->rehash_index = 0;
+    dt->rehash_table = calloc(dt->rehash_size, sizeof(dict_entry *));
+    if (dt->rehash_table == NULL)
         return -1;
 
-    for (uint32_t i = 0; i < dt->size && dt->used > 0; ++i) {
-        dict_entry *entry = dt->table[i];
-        dict_entry *next_entry = NULL;
-        while (entry) {
-            next_entry = entry->next;
-            uint32_t index = DICT_HASH_KEY(dt, entry->key) & new.mask;
-            entry->next = new.table[index];
-            new.table[index] = entry;
-            entry = next_entry;
-            dt->used--;
-        }
+    return 0;
+}
+
+static void rehash_slot(dict_t *dt, uint32_t index)
+{
+    dict_entry *entry = dt->table[index];
+    dict_entry *next_entry = NULL;
+    while (entry) {
+        next_entry = entry->next;
+        uint32_t new_index = DICT_HASH_KEY(dt, entry->key) & dt->rehash_mask;
+        entry->next = dt->rehash_table[new_index];
+        dt->rehash_table[new_index] = entry;
+        entry = next_entry;
     }
+    dt->table[index] = NULL;
+}
 
+static void rehash_finish(dict_t *dt)
+{
     free(dt->table);
-    memcpy(dt, &new, sizeof(dict_t));
+    dt->table = dt->rehash_table;
+    dt->size = dt->rehash_size;
+    dt->mask = dt->rehash_mask;
+    dt->rehash_table = NULL;
+    dt->rehash_size = 0;
+    dt->rehash_mask = 0;
+    dt->rehash_index = 0;
+}
+
+static void rehash_step(dict_t *dt, uint32_t count)
+{
+    if (dt->rehash_table == NULL || dt->iterators > 0)
+        return;
+
+    uint32_t empty = DICT_REHASH_EMPTY;
+    while (count > 0 && dt->rehash_index < dt->size) {
+        if (dt->table[dt->rehash_index] == NULL) {
+            dt->rehash_index++;
+            if (--empty == 0)
+                break;
+            continue;
+        }
+        rehash_slot(dt, dt->rehash_index++);
+        count--;
+    }
+    if (dt->rehash_index == dt->size) {
+        rehash_finish(dt);
+    }
+}
+
+// resize at once
+int dict_expand(dict_t *dt, uint32_t size)
+{
+    if (dt->rehash_table) {
+        while (dt->rehash_index < dt->size) {
+            rehash_slot(dt, dt->rehash_index++);
+        }
+        rehash_finish(dt);
+    }
+
+    if (rehash_start(dt, size) < 0)
+        return -1;
+    for (uint32_t i = 0; i < dt->size; ++i) {
+        rehash_slot(dt, i);
+    }
+    rehash_finish(dt);
 
     return 0;
 }
 
 static int dict_expand_if_needed(dict_t *dt)
 {
-    if (dt->used >= dt->size * 4)
-        return dict_expand(dt, dt->size * 4);
+    if (dt->rehash_table == NULL && dt->used >= dt->size * 4)
+        return rehash_start(dt, dt->size * 4);
     return 0;
 }
 
-static void check_clear(dict_t *dt, uint32_t index)
+static void check_clear(dict_t *dt, dict_entry **slot)
 {
-    dict_entry *entry = dt->table[index];
+    dict_entry *entry = *slot;
     dict_entry *prev = NULL;
     dict_entry *next = NULL;
     
@@ -134,7 +188,7 @@ static void check_clear(dict_t *dt, uint32_t index)
             if (prev) {
                 prev->next = next;
             } else {
-                dt->table[index] = next;
+                *slot = next;
             }
             DICT_FREE_HASH_KEY(dt, entry);
             DICT_FREE_HASH_VAL(dt, entry);
@@ -148,13 +202,12 @@ static void check_clear(dict_t *dt, uint32_t index)
     }
 }
 
-dict_entry *dict_find(dict_t *dt, const void *key)
+static dict_entry *find_entry(dict_t *dt, dict_entry **slot, const void *key)
 {
-    uint32_t index = DICT_HASH_KEY(dt, key) & dt->mask;
     if (dt->id_clear > 0) {
-        check_clear(dt, index);
+        check_clear(dt, slot);
     }
-    dict_entry *entry = dt->table[index];
+    dict_entry *entry = *slot;
     while (entry) {
         if (DICT_COMPARE_KEY(dt, key, entry->key) == 0)
             return entry;
@@ -163,20 +216,38 @@ dict_entry *dict_find(dict_t *dt, const void *key)
     return NULL;
 }
 
+dict_entry *dict_find(dict_t *dt, const void *key)
+{
+    uint32_t hash = DICT_HASH_KEY(dt, key);
+    dict_entry *entry = find_entry(dt, &dt->table[hash & dt->mask], key);
+    if (entry == NULL && dt->rehash_table) {
+        entry = find_entry(dt, &dt->rehash_table[hash & dt->rehash_mask], key);
+    }
+    return entry;
+}
+
 dict_entry *dict_add(dict_t *dt, void *key, void *val)
 {
     if (dict_find(dt, key) != NULL)
         return NULL;
     if (dict_expand_if_needed(dt) != 0)
         return NULL;
+    rehash_step(dt, DICT_REHASH_STEP);
     dict_entry *entry = malloc(sizeof(dict_entry));
     if (entry == NULL)
         return NULL;
 
-    uint32_t index = DICT_HASH_KEY(dt, key) & dt->mask;
+    // new entries go to the new table
+    uint32_t hash = DICT_HASH_KEY(dt, key);
+    dict_entry **slot;
+    if (dt->rehash_table) {
+        slot = &dt->rehash_table[hash & dt->rehash_mask];
+    } else {
+        slot = &dt->table[hash & dt->mask];
+    }
     entry->id = dt->id_start++;
-    entry->next = dt->table[index];
-    dt->table[index] = entry;
+    entry->next = *slot;
+    *slot = entry;
     DICT_SET_HASH_KEY(dt, entry, key);
     DICT_SET_HASH_VAL(dt, entry, val);
     dt->used++;
@@ -200,10 +271,9 @@ int dict_replace(dict_t *dt, void *key, void *val)
     return 0;
 }
 
-int dict_delete(dict_t *dt, const void *key)
+static int delete_entry(dict_t *dt, dict_entry **slot, const void *key)
 {
-    uint32_t index = DICT_HASH_KEY(dt, key) & dt->mask;
-    dict_entry *entry = dt->table[index];
+    dict_entry *entry = *slot;
     dict_entry *prev = NULL;
     
     while (entry) {
@@ -211,7 +281,7 @@ int dict_delete(dict_t *dt, const void *key)
             if (prev) {
                 prev->next = entry->next;
             } else {
-                dt->table[index] = entry->next;
+                *slot = entry->next;
             }
             DICT_FREE_HASH_KEY(dt, entry);
             DICT_FREE_HASH_VAL(dt, entry);
@@ -226,6 +296,18 @@ int dict_delete(dict_t *dt, const void *key)
     return 0;
 }
 
+int dict_delete(dict_t *dt, const void *key)
+{
+    rehash_step(dt, DICT_REHASH_STEP);
+    uint32_t hash = DICT_HASH_KEY(dt, key);
+    if (delete_entry(dt, &dt->table[hash & dt->mask], key))
+        return 1;
+    if (dt->rehash_table && delete_entry(dt, &dt->rehash_table[hash & dt->rehash_mask], key))
+        return 1;
+
+    return 0;
+}
+
 void dict_clear(dict_t *dt)
 {
     dict_iterator *iter = dict_get_iterator(dt);
@@ -243,23 +325,66 @@ void dict_mark_clear(dict_t *dt)
     dt->id_clear = dt->id_start++;
 }
 
-void dict_release(dict_t *dt)
+static void release_table(dict_t *dt, dict_entry **table, uint32_t size)
 {
-    for (uint32_t i = 0; i < dt->size && dt->used > 0; ++i) {
-        dict_entry *entry = dt->table[i];
+    for (uint32_t i = 0; i < size && dt->used > 0; ++i) {
+        dict_entry *entry = table[i];
         dict_entry *next_entry = NULL;
         while (entry) {
             next_entry = entry->next;
             DICT_FREE_HASH_KEY(dt, entry);
             DICT_FREE_HASH_VAL(dt, entry);
             free(entry);
+            dt->used--;
             entry = next_entry;
         }
     }
-    free(dt->table);
+    free(table);
+}
+
+void dict_release(dict_t *dt)
+{
+    release_table(dt, dt->table, dt->size);
+    if (dt->rehash_table) {
+        release_table(dt, dt->rehash_table, dt->rehash_size);
+    }
     free(dt);
 }
 
+uint32_t dict_scan(dict_t *dt, uint32_t cursor, uint32_t count, dict_scan_fn fn, void *privdata)
+{
+    for (; cursor < dict_slot(dt) && count > 0; ++cursor, --count) {
+        if (dt->rehash_table) {
+            // the entries of the old slot that are moved to this one
+            dict_entry **slot = &dt->table[cursor & dt->mask];
+            if (dt->id_clear > 0) {
+                check_clear(dt, slot);
+            }
+            dict_entry *entry = *slot;
+            while (entry) {
+                dict_entry *next = entry->next;
+                if ((DICT_HASH_KEY(dt, entry->key) & dt->rehash_mask) == cursor) {
+                    fn(entry, privdata);
+                }
+                entry = next;
+            }
+        }
+
+        dict_entry **slot = dt->rehash_table ? &dt->rehash_table[cursor] : &dt->table[cursor];
+        if (dt->id_clear > 0) {
+            check_clear(dt, slot);
+        }
+        dict_entry *entry = *slot;
+        while (entry) {
+            dict_entry *next = entry->next;
+            fn(entry, privdata);
+            entry = next;
+        }
+    }
+
+    return cursor;
+}
+
 dict_iterator *dict_get_iterator(dict_t *dt)
 {
     dict_iterator *iter = malloc(sizeof(dict_iterator));
@@ -270,18 +395,25 @@ dict_iterator *dict_get_iterator(dict_t *dt)
     iter->index = -1;
     iter->entry = NULL;
     iter->next_entry = NULL;
+    dt->iterators++;
 
     return iter;
 }
 
+// the old table and then the new one, the entries are not moved while iterating
 dict_entry *dict_next(dict_iterator *iter)
 {
+    dict_t *dt = iter->dt;
     while (1) {
         if (iter->entry == NULL) {
             iter->index++;
-            if (iter->index >= iter->dt->size)
+            if (iter->index < dt->size) {
+                iter->entry = dt->table[iter->index];
+            } else if (dt->rehash_table && iter->index < (int64_t)dt->size + dt->rehash_size) {
+                iter->entry = dt->rehash_table[iter->index - dt->size];
+            } else {
                 break;
-            iter->entry = iter->dt->table[iter->index];
+            }
         } else {
             iter->entry = iter->next_entry;
         }
@@ -295,6 +427,7 @@ dict_entry *dict_next(dict_iterator *iter)
 
 void dict_release_iterator(dict_iterator *iter)
 {
+    iter->dt->iterators--;
     free(iter);
 }
 
@@ -25,6 +25,13 @@ typedef struct dict_types {
     void (*val_destructor)(void *val);
 } dict_types;
 
+/*
+ * the table grows incrementally: when it is full a table four times the
+ * size is created, and the entries are moved to it a slot at a time by
+ * each add and delete, so a resize does not stall the caller. lookups
+ * check both tables and never change them, a move is paused while there
+ * is an iterator.
+ */
 typedef struct dict_t {
     dict_entry **table;
     dict_types type;
@@ -33,6 +40,11 @@ typedef struct dict_t {
     uint32_t used;
     uint64_t id_start;
     uint64_t id_clear;
+    dict_entry **rehash_table;
+    uint32_t rehash_size;
+    uint32_t rehash_mask;
+    uint32_t rehash_index;
+    uint32_t iterators;
 } dict_t;
 
 typedef struct dict_iterator {
@@ -43,7 +55,7 @@ typedef struct dict_iterator {
 } dict_iterator;
 
 # define dict_size(dt) (dt)->used
-# define dict_slot(dt) (dt)->size
+# define dict_slot(dt) ((dt)->rehash_table ? (dt)->rehash_size : (dt)->size)
 
 uint32_t dict_generic_hash_function(const void *data, size_t len);
 
@@ -58,6 +70,17 @@ void dict_release(dict_t *dt);
 void dict_clear(dict_t *dt);
 void dict_mark_clear(dict_t *dt);
 
+/*
+ * call fn for the entries of up to count slots from cursor and return the
+ * next cursor, the scan is done when it reaches dict_slot(dt). the dict may
+ * be changed between calls: an entry that is in the dict for the whole scan
+ * is visited at least once, as the table only grows by powers of two. while
+ * the table grows the cursor is a slot of the new table, and the entries
+ * not moved yet are visited with the slot they are moved to.
+ */
+typedef void (*dict_scan_fn)(dict_entry *entry, void *privdata);
+uint32_t dict_scan(dict_t *dt, uint32_t cursor, uint32_t count, dict_scan_fn fn, void *privdata);
+
 dict_iterator *dict_get_iterator(dict_t *dt);
 dict_entry *dict_next(dict_iterator *iter);
 void dict_release_iterator(dict_iterator *iter);
@@ -0,0 +1,246 @@
+/*
+ * Description: binary encoding of the deals, orders and balances events
+ */
+
+# include <string.h>
+
+# include "ut_pack.h"
+# include "ut_event.h"
+
+# define EVENT_HEAD_SIZE 3
+
+# define ERR_RET_PACK(x) do { \
+    if ((x) < 0) \
+        return -__LINE__; \
+} while (0)
+
+static int pack_double_le(void **dest, size_t *left, double num)
+{
+    uint64_t bits;
+    memcpy(&bits, &num, sizeof(bits));
+    return pack_uint64_le(dest, left, bits);
+}
+
+static int unpack_double_le(void **src, size_t *left, double *num)
+{
+    uint64_t bits;
+    if (unpack_uint64_le(src, left, &bits) < 0)
+        return -1;
+    memcpy(num, &bits, sizeof(bits));
+    return sizeof(bits);
+}
+
+static int pack_str(void **dest, size_t *left, const char *str)
+{
+    return pack_varstr(dest, left, str, strlen(str));
+}
+
+static int unpack_str(void **src, size_t *left, char *str, size_t size)
+{
+    uint64_t len;
+    if (unpack_varint_le(src, left, &len) < 0)
+        return -1;
+    if (*left < len || len >= size)
+        return -1;
+    memcpy(str, *src, len);
+    str[len] = 0;
+    *src  += len;
+    *left -= len;
+    return len;
+}
+
+static int pack_uint(void **dest, size_t *left, uint64_t num)
+{
+    return pack_varint_le(dest, left, num);
+}
+
+static int unpack_uint32(void **src, size_t *left, uint32_t *num)
+{
+    uint64_t val;
+    if (unpack_varint_le(src, left, &val) < 0 || val > UINT32_MAX)
+        return -1;
+    *num = val;
+    return 0;
+}
+
+static int pack_fixed(void **dest, size_t *left, const event_fixed *num)
+{
+    unsigned __int128 zigzag = ((unsigned __int128)num->value << 1) ^ (unsigned __int128)(num->value >> 127);
+    if (pack_char(dest, left, num->prec) < 0)
+        return -1;
+    if (pack_varint_le(dest, left, (uint64_t)zigzag) < 0)
+        return -1;
+    return pack_varint_le(dest, left, (uint64_t)(zigzag >> 64));
+}
+
+static int unpack_fixed(void **src, size_t *left, event_fixed *num)
+{
+    uint8_t prec;
+    uint64_t low, high;
+    if (unpack_char(src, left, &prec) < 0 || prec > FIXED_DIGITS_MAX)
+        return -1;
+    if (unpack_varint_le(src, left, &low) < 0)
+        return -1;
+    if (unpack_varint_le(src, left, &high) < 0)
+        return -1;
+    unsigned __int128 zigzag = ((unsigned __int128)high << 64) | low;
+    num->value = (fixed_t)(zigzag >> 1) ^ -(fixed_t)(zigzag & 1);
+    num->prec = prec;
+    return 0;
+}
+
+static int pack_head(void **dest, size_t *left, uint8_t type)
+{
+    if (pack_char(dest, left, EVENT_MAGIC) < 0)
+        return -1;
+    if (pack_char(dest, left, EVENT_VERSION) < 0)
+        return -1;
+    return pack_char(dest, left, type);
+}
+
+bool is_event_message(const void *data, size_t size)
+{
+    return size >= EVENT_HEAD_SIZE && ((const uint8_t *)data)[0] == EVENT_MAGIC;
+}
+
+int get_event_type(const void *data, size_t size)
+{
+    if (!is_event_message(data, size))
+        return -__LINE__;
+    const uint8_t *head = data;
+    if (head[1] == 0)
+        return -__LINE__;
+    return head[2];
+}
+
+static int unpack_head(const void *data, size_t size, uint8_t type, void **src, size_t *left)
+{
+    if (get_event_type(data, size) != type)
+        return -1;
+    *src = (void *)data + EVENT_HEAD_SIZE;
+    *left = size - EVENT_HEAD_SIZE;
+    return 0;
+}
+
+int pack_event_deal(void **dest, size_t *left, const event_deal *deal)
+{
+    ERR_RET_PACK(pack_head(dest, left, EVENT_TYPE_DEAL));
+    ERR_RET_PACK(pack_double_le(dest, left, deal->timestamp));
+    ERR_RET_PACK(pack_uint(dest, left, deal->id));
+    ERR_RET_PACK(pack_str(dest, left, deal->market));
+    ERR_RET_PACK(pack_str(dest, left, deal->stock));
+    ERR_RET_PACK(pack_str(dest, left, deal->money));
+    ERR_RET_PACK(pack_uint(dest, left, deal->side));
+    ERR_RET_PACK(pack_uint(dest, left, deal->ask_id));
+    ERR_RET_PACK(pack_uint(dest, left, deal->bid_id));
+    ERR_RET_PACK(pack_uint(dest, left, deal->ask_user_id));
+    ERR_RET_PACK(pack_uint(dest, left, deal->bid_user_id));
+    ERR_RET_PACK(pack_fixed(dest, left, &deal->price));
+    ERR_RET_PACK(pack_fixed(dest, left, &deal->amount));
+    ERR_RET_PACK(pack_fixed(dest, left, &deal->deal));
+    ERR_RET_PACK(pack_fixed(dest, left, &deal->ask_fee));
+    ERR_RET_PACK(pack_fixed(dest, left, &deal->bid_fee));
+    return 0;
+}
+
+int unpack_event_deal(const void *data, size_t size, event_deal *deal)
+{
+    void *src;
+    size_t left;
+    ERR_RET_PACK(unpack_head(data, size, EVENT_TYPE_DEAL, &src, &left));
+    ERR_RET_PACK(unpack_double_le(&src, &left, &deal->timestamp));
+    ERR_RET_PACK(unpack_varint_le(&src, &left, &deal->id));
+    ERR_RET_PACK(unpack_str(&src, &left, deal->market, sizeof(deal->market)));
+    ERR_RET_PACK(unpack_str(&src, &left, deal->stock, sizeof(deal->stock)));
+    ERR_RET_PACK(unpack_str(&src, &left, deal->money, sizeof(deal->money)));
+    ERR_RET_PACK(unpack_uint32(&src, &left, &deal->side));
+    ERR_RET_PACK(unpack_varint_le(&src, &left, &deal->ask_id));
+    ERR_RET_PACK(unpack_varint_le(&src, &left, &deal->bid_id));
+    ERR_RET_PACK(unpack_uint32(&src, &left, &deal->ask_user_id));
+    ERR_RET_PACK(unpack_uint32(&src, &left, &deal->bid_user_id));
+    ERR_RET_PACK(unpack_fixed(&src, &left, &deal->price));
+    ERR_RET_PACK(unpack_fixed(&src, &left, &deal->amount));
+    ERR_RET_PACK(unpack_fixed(&src, &left, &deal->deal));
+    ERR_RET_PACK(unpack_fixed(&src, &left, &deal->ask_fee));
+    ERR_RET_PACK(unpack_fixed(&src, &left, &deal->bid_fee));
+    return 0;
+}
+
+int pack_event_order(void **dest, size_t *left, const event_order *order)
+{
+    ERR_RET_PACK(pack_head(dest, left, EVENT_TYPE_ORDER));
+    ERR_RET_PACK(pack_uint(dest, left, order->event));
+    ERR_RET_PACK(pack_uint(dest, left, order->id));
+    ERR_RET_PACK(pack_str(dest, left, order->market));
+    ERR_RET_PACK(pack_str(dest, left, order->source));
+    ERR_RET_PACK(pack_uint(dest, left, order->type));
+    ERR_RET_PACK(pack_uint(dest, left, order->side));
+    ERR_RET_PACK(pack_uint(dest, left, order->user_id));
+    ERR_RET_PACK(pack_double_le(dest, left, order->create_time));
+    ERR_RET_PACK(pack_double_le(dest, left, order->update_time));
+    ERR_RET_PACK(pack_fixed(dest, left, &order->price));
+    ERR_RET_PACK(pack_fixed(dest, left, &order->amount));
+    ERR_RET_PACK(pack_fixed(dest, left, &order->taker_fee));
+    ERR_RET_PACK(pack_fixed(dest, left, &order->maker_fee));
+    ERR_RET_PACK(pack_fixed(dest, left, &order->left));
+    ERR_RET_PACK(pack_fixed(dest, left, &order->deal_stock));
+    ERR_RET_PACK(pack_fixed(dest, left, &order->deal_money));
+    ERR_RET_PACK(pack_fixed(dest, left, &order->deal_fee));
+    ERR_RET_PACK(pack_str(dest, left, order->stock));
+    ERR_RET_PACK(pack_str(dest, left, order->money));
+    return 0;
+}
+
+int unpack_event_order(const void *data, size_t size, event_order *order)
+{
+    void *src;
+    size_t left;
+    ERR_RET_PACK(unpack_head(data, size, EVENT_TYPE_ORDER, &src, &left));
+    ERR_RET_PACK(unpack_uint32(&src, &left, &order->event));
+    ERR_RET_PACK(unpack_varint_le(&src, &left, &order->id));
+    ERR_RET_PACK(unpack_str(&src, &left, order->market, sizeof(order->market)));
+    ERR_RET_PACK(unpack_str(&src, &left, order->source, sizeof(order->source)));
+    ERR_RET_PACK(unpack_uint32(&src, &left, &order->type));
+    ERR_RET_PACK(unpack_uint32(&src, &left, &order->side));
+    ERR_RET_PACK(unpack_uint32(&src, &left, &order->user_id));
+    ERR_RET_PACK(unpack_double_le(&src, &left, &order->create_time));
+    ERR_RET_PACK(unpack_double_le(&src, &left, &order->update_time));
+    ERR_RET_PACK(unpack_fixed(&src, &left, &order->price));
+    ERR_RET_PACK(unpack_fixed(&src, &left, &order->amount));
+    ERR_RET_PACK(unpack_fixed(&src, &left, &order->taker_fee));
+    ERR_RET_PACK(unpack_fixed(&src, &left, &order->maker_fee));
+    ERR_RET_PACK(unpack_fixed(&src, &left, &order->left));
+    ERR_RET_PACK(unpack_fixed(&src, &left, &order->deal_stock));
+    ERR_RET_PACK(unpack_fixed(&src, &left, &order->deal_money));
+    ERR_RET_PACK(unpack_fixed(&src, &left, &order->deal_fee));
+    ERR_RET_PACK(unpack_str(&src, &left, order->stock, sizeof(order->stock)));
+    ERR_RET_PACK(unpack_str(&src, &left, order->money, sizeof(order->money)));
+    return 0;
+}
+
+int pack_event_balance(void **dest, size_t *left, const event_balance *balance)
+{
+    ERR_RET_PACK(pack_head(dest, left, EVENT_TYPE_BALANCE));
+    ERR_RET_PACK(pack_double_le(dest, left, balance->timestamp));
+    ERR_RET_PACK(pack_uint(dest, left, balance->user_id));
+    ERR_RET_PACK(pack_str(dest, left, balance->asset));
+    ERR_RET_PACK(pack_str(dest, left, balance->business));
+    ERR_RET_PACK(pack_fixed(dest, left, &balance->change));
+    ERR_RET_PACK(pack_fixed(dest, left, &balance->result));
+    return 0;
+}
+
+int unpack_event_balance(const void *data, size_t size, event_balance *balance)
+{
+    void *src;
+    size_t left;
+    ERR_RET_PACK(unpack_head(data, size, EVENT_TYPE_BALANCE, &src, &left));
+    ERR_RET_PACK(unpack_double_le(&src, &left, &balance->timestamp));
+    ERR_RET_PACK(unpack_uint32(&src, &left, &balance->user_id));
+    ERR_RET_PACK(unpack_str(&src, &left, balance->asset, sizeof(balance->asset)));
+    ERR_RET_PACK(unpack_str(&src, &left, balance->business, sizeof(balance->business)));
+    ERR_RET_PACK(unpack_fixed(&src, &left, &balance->change));
+    ERR_RET_PACK(unpack_fixed(&src, &left, &balance->result));
+    return 0;
+}
+
@@ -0,0 +1,102 @@
+/*
+ * Description: binary encoding of the deals, orders and balances events
+ */
+
+# ifndef _UT_EVENT_H_
+# define _UT_EVENT_H_
+
+# include <stdint.h>
+# include <stdbool.h>
+# include <stddef.h>
+
+# include "ut_decimal.h"
+
+/*
+ * an event starts with EVENT_MAGIC, the version and the type, a json
+ * message always starts with '{'. the fields follow in the order of the
+ * structs below: integers are varints, times are 8 bytes little endian
+ * doubles, strings are varstr and decimals are a scale byte followed by
+ * the low and high 64 bits of the zigzag mantissa as varints.
+ *
+ * a new version only appends fields, a reader ignores the fields after
+ * the ones it knows, so the consumers are upgraded before the producer.
+ */
+# define EVENT_MAGIC            0xeb
+# define EVENT_VERSION          1
+# define EVENT_NAME_MAX_LEN     31
+# define EVENT_MAX_SIZE         1024
+
+enum {
+    EVENT_TYPE_DEAL     = 1,
+    EVENT_TYPE_ORDER    = 2,
+    EVENT_TYPE_BALANCE  = 3,
+};
+
+typedef struct event_fixed {
+    fixed_t     value;
+    int         prec;
+} event_fixed;
+
+typedef struct event_deal {
+    double      timestamp;
+    uint64_t    id;
+    char        market[EVENT_NAME_MAX_LEN + 1];
+    char        stock[EVENT_NAME_MAX_LEN + 1];
+    char        money[EVENT_NAME_MAX_LEN + 1];
+    uint32_t    side;
+    uint64_t    ask_id;
+    uint64_t    bid_id;
+    uint32_t    ask_user_id;
+    uint32_t    bid_user_id;
+    event_fixed price;
+    event_fixed amount;
+    event_fixed deal;
+    event_fixed ask_fee;
+    event_fixed bid_fee;
+} event_deal;
+
+typedef struct event_order {
+    uint32_t    event;
+    uint64_t    id;
+    char        market[EVENT_NAME_MAX_LEN + 1];
+    char        source[EVENT_NAME_MAX_LEN + 1];
+    uint32_t    type;
+    uint32_t    side;
+    uint32_t    user_id;
+    double      create_time;
+    double      update_time;
+    event_fixed price;
+    event_fixed amount;
+    event_fixed taker_fee;
+    event_fixed maker_fee;
+    event_fixed left;
+    event_fixed deal_stock;
+    event_fixed deal_money;
+    event_fixed deal_fee;
+    char        stock[EVENT_NAME_MAX_LEN + 1];
+    char        money[EVENT_NAME_MAX_LEN + 1];
+} event_order;
+
+typedef struct event_balance {
+    double      timestamp;
+    uint32_t    user_id;
+    char        asset[EVENT_NAME_MAX_LEN + 1];
+    char        business[EVENT_NAME_MAX_LEN + 1];
+    event_fixed change;
+    event_fixed result;
+} event_balance;
+
+bool is_event_message(const void *data, size_t size);
+/* return the type of the event, or < 0 if it is not a valid event */
+int get_event_type(const void *data, size_t size);
+
+int pack_event_deal(void **dest, size_t *left, const event_deal *deal);
+int pack_event_order(void **dest, size_t *left, const event_order *order);
+int pack_event_balance(void **dest, size_t *left, const event_balance *balance);
+
+int unpack_event_deal(const void *data, size_t size, event_deal *deal);
+int unpack_event_order(const void *data, size_t size, event_order *order);
+int unpack_event_balance(const void *data, size_t size, event_balance *balance);
+
+# endif
+
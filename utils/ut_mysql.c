@@ -7,11 +7,24 @@
 # include "ut_mysql.h"
 
 MYSQL *mysql_connect(mysql_cfg *db)
+{
+    return mysql_connect_opt(db, false);
+}
+
+MYSQL *mysql_connect_opt(mysql_cfg *db, bool local_infile)
 {
     MYSQL *conn = mysql_init(NULL);
     if (conn == NULL)
         return NULL;
 
+    if (local_infile) {
+        unsigned int enable = 1;
+        if (mysql_options(conn, MYSQL_OPT_LOCAL_INFILE, &enable) != 0) {
+            mysql_close(conn);
+            return NULL;
+        }
+    }
+
     my_bool reconnect = 1;
     if (mysql_options(conn, MYSQL_OPT_RECONNECT, &reconnect) != 0) {
         mysql_close(conn);
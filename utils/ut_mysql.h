@@ -11,6 +11,8 @@
 # include <mysql/errmsg.h>
 
 MYSQL *mysql_connect(mysql_cfg *cfg);
+/* local_infile allows LOAD DATA LOCAL, the data is given by mysql_set_local_infile_handler */
+MYSQL *mysql_connect_opt(mysql_cfg *cfg, bool local_infile);
 bool is_table_exists(MYSQL *conn, const char *table);
 
 # endif
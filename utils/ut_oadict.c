@@ -0,0 +1,253 @@
+/*
+ * Description: open addressing hash table for fixed size keys
+ */
+
+# include <stdlib.h>
+# include <string.h>
+# include <stdbool.h>
+# include "ut_dict.h"
+# include "ut_oadict.h"
+
+/* slots passed by an add or delete while the table grows */
+# define OADICT_REHASH_STEP  8
+
+/* the hash of a slot, 0 and 1 are kept for the empty and moved slots */
+# define SLOT_EMPTY     0
+# define SLOT_MOVED     1
+# define SLOT_HASH(h)   ((h) < 2 ? (h) + 2 : (h))
+
+struct oadict_slot {
+    uint32_t    hash;
+    void        *val;
+    char        key[];
+};
+
+# define GET_SLOT(dt, t, index) ((struct oadict_slot *)((t)->slots + (size_t)(index) * (dt)->slot_size))
+
+static uint32_t oadict_next_power(uint32_t size)
+{
+    uint32_t realsize = 8;
+    while (realsize < size) {
+        realsize *= 2;
+    }
+    return realsize;
+}
+
+static int table_init(oadict_t *dt, oadict_table *t, uint32_t size)
+{
+    t->size = oadict_next_power(size);
+    t->mask = t->size - 1;
+    t->slots = calloc(t->size, dt->slot_size);
+    if (t->slots == NULL)
+        return -1;
+    return 0;
+}
+
+static uint32_t get_hash(oadict_t *dt, const void *key)
+{
+    uint32_t hash;
+    if (dt->hash_function) {
+        hash = dt->hash_function(key);
+    } else {
+        hash = dict_generic_hash_function(key, dt->key_size);
+    }
+    return SLOT_HASH(hash);
+}
+
+oadict_t *oadict_create(uint32_t key_size, uint32_t init_size, oadict_hash_fn hash_function)
+{
+    if (key_size == 0)
+        return NULL;
+    oadict_t *dt = malloc(sizeof(oadict_t));
+    if (dt == NULL)
+        return NULL;
+    memset(dt, 0, sizeof(oadict_t));
+    dt->hash_function = hash_function;
+    dt->key_size = key_size;
+    dt->slot_size = (sizeof(struct oadict_slot) + key_size + 7) & ~7u;
+    // keep the load under 3/4
+    if (table_init(dt, &dt->table, init_size + init_size / 3 + 1) < 0) {
+        free(dt);
+        return NULL;
+    }
+
+    return dt;
+}
+
+void oadict_release(oadict_t *dt)
+{
+    free(dt->table.slots);
+    free(dt->rehash_table.slots);
+    free(dt);
+}
+
+static struct oadict_slot *table_find(oadict_t *dt, oadict_table *t, uint32_t hash, const void *key)
+{
+    uint32_t index = hash & t->mask;
+    while (true) {
+        struct oadict_slot *slot = GET_SLOT(dt, t, index);
+        if (slot->hash == SLOT_EMPTY)
+            return NULL;
+        if (slot->hash == hash && memcmp(slot->key, key, dt->key_size) == 0)
+            return slot;
+        index = (index + 1) & t->mask;
+    }
+}
+
+// the new table has no moved slots, take the first empty one
+static void table_insert(oadict_t *dt, oadict_table *t, uint32_t hash, const void *key, void *val)
+{
+    uint32_t index = hash & t->mask;
+    struct oadict_slot *slot = GET_SLOT(dt, t, index);
+    while (slot->hash != SLOT_EMPTY) {
+        index = (index + 1) & t->mask;
+        slot = GET_SLOT(dt, t, index);
+    }
+    slot->hash = hash;
+    slot->val = val;
+    memcpy(slot->key, key, dt->key_size);
+}
+
+// shift the following slots of the probe back to the hole
+static void table_remove(oadict_t *dt, oadict_table *t, struct oadict_slot *slot)
+{
+    uint32_t hole = ((char *)slot - t->slots) / dt->slot_size;
+    uint32_t index = hole;
+    while (true) {
+        index = (index + 1) & t->mask;
+        struct oadict_slot *next = GET_SLOT(dt, t, index);
+        if (next->hash == SLOT_EMPTY)
+            break;
+        uint32_t home = next->hash & t->mask;
+        // the slot stays if its home is in (hole, index]
+        if (((index - home) & t->mask) < ((index - hole) & t->mask))
+            continue;
+        memcpy(GET_SLOT(dt, t, hole), next, dt->slot_size);
+        hole = index;
+    }
+    GET_SLOT(dt, t, hole)->hash = SLOT_EMPTY;
+}
+
+static void rehash_finish(oadict_t *dt)
+{
+    free(dt->rehash_table.slots);
+    memset(&dt->rehash_table, 0, sizeof(oadict_table));
+    dt->rehash_index = 0;
+    dt->rehash_used = 0;
+}
+
+static void rehash_step(oadict_t *dt, uint32_t count)
+{
+    if (dt->rehash_table.slots == NULL)
+        return;
+
+    oadict_table *old = &dt->rehash_table;
+    while (count > 0 && dt->rehash_index < old->size && dt->rehash_used > 0) {
+        struct oadict_slot *slot = GET_SLOT(dt, old, dt->rehash_index++);
+        count--;
+        if (slot->hash == SLOT_EMPTY || slot->hash == SLOT_MOVED)
+            continue;
+        table_insert(dt, &dt->table, slot->hash, slot->key, slot->val);
+        slot->hash = SLOT_MOVED;
+        dt->rehash_used--;
+    }
+    if (dt->rehash_used == 0) {
+        rehash_finish(dt);
+    }
+}
+
+static int expand_if_needed(oadict_t *dt)
+{
+    if ((uint64_t)(dt->used + 1) * 4 <= (uint64_t)dt->table.size * 3)
+        return 0;
+
+    // the last one is not done yet, which only happens by a lot of adds without deletes
+    if (dt->rehash_table.slots) {
+        rehash_step(dt, UINT32_MAX);
+    }
+
+    oadict_table table;
+    if (table_init(dt, &table, dt->table.size * 2) < 0)
+        return -1;
+    dt->rehash_table = dt->table;
+    dt->rehash_index = 0;
+    dt->rehash_used = dt->used;
+    dt->table = table;
+    if (dt->rehash_used == 0) {
+        rehash_finish(dt);
+    }
+
+    return 0;
+}
+
+void *oadict_find(oadict_t *dt, const void *key)
+{
+    uint32_t hash = get_hash(dt, key);
+    struct oadict_slot *slot = table_find(dt, &dt->table, hash, key);
+    if (slot == NULL && dt->rehash_table.slots) {
+        slot = table_find(dt, &dt->rehash_table, hash, key);
+    }
+    return slot ? slot->val : NULL;
+}
+
+int oadict_add(oadict_t *dt, const void *key, void *val)
+{
+    if (oadict_find(dt, key) != NULL)
+        return -1;
+    if (expand_if_needed(dt) < 0)
+        return -1;
+    rehash_step(dt, OADICT_REHASH_STEP);
+
+    table_insert(dt, &dt->table, get_hash(dt, key), key, val);
+    dt->used++;
+
+    return 0;
+}
+
+int oadict_delete(oadict_t *dt, const void *key)
+{
+    rehash_step(dt, OADICT_REHASH_STEP);
+
+    uint32_t hash = get_hash(dt, key);
+    struct oadict_slot *slot = table_find(dt, &dt->table, hash, key);
+    if (slot) {
+        table_remove(dt, &dt->table, slot);
+        dt->used--;
+        return 1;
+    }
+
+    if (dt->rehash_table.slots) {
+        slot = table_find(dt, &dt->rehash_table, hash, key);
+        if (slot) {
+            // a probe of the old table goes on over moved slots
+            slot->hash = SLOT_MOVED;
+            dt->used--;
+            dt->rehash_used--;
+            if (dt->rehash_used == 0) {
+                rehash_finish(dt);
+            }
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static void table_foreach(oadict_t *dt, oadict_table *t, oadict_fn fn, void *privdata)
+{
+    for (uint32_t i = 0; i < t->size; ++i) {
+        struct oadict_slot *slot = GET_SLOT(dt, t, i);
+        if (slot->hash == SLOT_EMPTY || slot->hash == SLOT_MOVED)
+            continue;
+        fn(slot->key, slot->val, privdata);
+    }
+}
+
+void oadict_foreach(oadict_t *dt, oadict_fn fn, void *privdata)
+{
+    if (dt->rehash_table.slots) {
+        table_foreach(dt, &dt->rehash_table, fn, privdata);
+    }
+    table_foreach(dt, &dt->table, fn, privdata);
+}
+
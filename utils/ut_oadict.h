@@ -0,0 +1,61 @@
+/*
+ * Description: open addressing hash table for fixed size keys
+ */
+
+# ifndef _UT_OADICT_H_
+# define _UT_OADICT_H_
+
+# include <stdint.h>
+# include <stddef.h>
+
+/*
+ * the keys are copied to the slots next to their hash and value, so a
+ * lookup mostly reads one cache line and there is no allocation for an
+ * entry. linear probing, a delete shifts the following entries back
+ * instead of leaving a tombstone.
+ *
+ * the table grows the same as dict_t: a table twice the size is created
+ * and the slots are moved to it a few at a time by each add and delete.
+ * lookups check both tables and never change them.
+ *
+ * values are not owned by the table and must not be NULL.
+ */
+
+typedef uint32_t (*oadict_hash_fn)(const void *key);
+
+typedef struct oadict_table {
+    char        *slots;
+    uint32_t    size;
+    uint32_t    mask;
+} oadict_table;
+
+typedef struct oadict_t {
+    oadict_hash_fn  hash_function;
+    uint32_t        key_size;
+    uint32_t        slot_size;
+    uint32_t        used;
+    oadict_table    table;
+    /* the old table while it grows, the moved slots are left as tombstones */
+    oadict_table    rehash_table;
+    uint32_t        rehash_index;
+    uint32_t        rehash_used;
+} oadict_t;
+
+# define oadict_size(dt) (dt)->used
+
+/* hash_function is optional, dict_generic_hash_function of the key by default */
+oadict_t *oadict_create(uint32_t key_size, uint32_t init_size, oadict_hash_fn hash_function);
+void oadict_release(oadict_t *dt);
+
+void *oadict_find(oadict_t *dt, const void *key);
+/* return -1 if the key exists */
+int oadict_add(oadict_t *dt, const void *key, void *val);
+/* return 1 if the key is deleted */
+int oadict_delete(oadict_t *dt, const void *key);
+
+/* fn must not change the table */
+typedef void (*oadict_fn)(const void *key, void *val, void *privdata);
+void oadict_foreach(oadict_t *dt, oadict_fn fn, void *privdata);
+
+# endif
+
@@ -3,9 +3,11 @@
  *     History: yang@haipo.me, 2016/04/09, create
  */
 
+# include <stdio.h>
 # include <string.h>
 # include <stdlib.h>
 # include <stdbool.h>
+# include <inttypes.h>
 
 # include "ut_misc.h"
 # include "ut_pack.h"
@@ -337,3 +339,233 @@ int unpack_oppushint_le(void **src, size_t *left, int64_t *num)
     return space;
 }
 
+
+static uint64_t zigzag_encode(int64_t num)
+{
+    return ((uint64_t)num << 1) ^ (uint64_t)(num >> 63);
+}
+
+static int64_t zigzag_decode(uint64_t num)
+{
+    return (int64_t)(num >> 1) ^ -(int64_t)(num & 1);
+}
+
+int pack_json(void **dest, size_t *left, const json_t *value)
+{
+    size_t pos = *left;
+    switch (json_typeof(value)) {
+    case JSON_NULL:
+        if (pack_char(dest, left, PACK_JSON_NULL) < 0)
+            return -1;
+        break;
+    case JSON_TRUE:
+        if (pack_char(dest, left, PACK_JSON_TRUE) < 0)
+            return -1;
+        break;
+    case JSON_FALSE:
+        if (pack_char(dest, left, PACK_JSON_FALSE) < 0)
+            return -1;
+        break;
+    case JSON_INTEGER:
+        if (pack_char(dest, left, PACK_JSON_INTEGER) < 0)
+            return -1;
+        if (pack_varint_le(dest, left, zigzag_encode(json_integer_value(value))) < 0)
+            return -1;
+        break;
+    case JSON_REAL:
+    {
+        double real = json_real_value(value);
+        uint64_t bits;
+        memcpy(&bits, &real, sizeof(bits));
+        if (pack_char(dest, left, PACK_JSON_REAL) < 0)
+            return -1;
+        if (pack_uint64_le(dest, left, bits) < 0)
+            return -1;
+        break;
+    }
+    case JSON_STRING:
+        if (pack_char(dest, left, PACK_JSON_STRING) < 0)
+            return -1;
+        if (pack_varstr(dest, left, json_string_value(value), json_string_length(value)) < 0)
+            return -1;
+        break;
+    case JSON_ARRAY:
+        if (pack_char(dest, left, PACK_JSON_ARRAY) < 0)
+            return -1;
+        if (pack_varint_le(dest, left, json_array_size(value)) < 0)
+            return -1;
+        for (size_t i = 0; i < json_array_size(value); ++i) {
+            if (pack_json(dest, left, json_array_get(value, i)) < 0)
+                return -1;
+        }
+        break;
+    case JSON_OBJECT:
+    {
+        if (pack_char(dest, left, PACK_JSON_OBJECT) < 0)
+            return -1;
+        if (pack_varint_le(dest, left, json_object_size(value)) < 0)
+            return -1;
+        const char *key;
+        json_t *val;
+        json_object_foreach((json_t *)value, key, val) {
+            if (pack_varstr(dest, left, key, strlen(key)) < 0)
+                return -1;
+            if (pack_json(dest, left, val) < 0)
+                return -1;
+        }
+        break;
+    }
+    default:
+        return -1;
+    }
+
+    return pos - *left;
+}
+
+static json_t *unpack_json_decimal(int64_t mantissa, uint8_t scale)
+{
+    char buf[64];
+    bool neg = mantissa < 0;
+    uint64_t abs = neg ? -(uint64_t)mantissa : (uint64_t)mantissa;
+    char digits[32];
+    int len = snprintf(digits, sizeof(digits), "%"PRIu64, abs);
+
+    char *p = buf;
+    if (neg)
+        *p++ = '-';
+    if (scale == 0) {
+        memcpy(p, digits, len + 1);
+    } else if (len > scale) {
+        memcpy(p, digits, len - scale);
+        p += len - scale;
+        *p++ = '.';
+        memcpy(p, digits + len - scale, scale + 1);
+    } else {
+        *p++ = '0';
+        *p++ = '.';
+        memset(p, '0', scale - len);
+        p += scale - len;
+        memcpy(p, digits, len + 1);
+    }
+
+    return json_string(buf);
+}
+
+static int unpack_json_value(void **src, size_t *left, json_t **value, int depth)
+{
+    if (depth > PACK_JSON_MAX_DEPTH)
+        return -1;
+
+    size_t pos = *left;
+    uint8_t type;
+    if (unpack_char(src, left, &type) < 0)
+        return -1;
+
+    *value = NULL;
+    switch (type) {
+    case PACK_JSON_NULL:
+        *value = json_null();
+        break;
+    case PACK_JSON_TRUE:
+        *value = json_true();
+        break;
+    case PACK_JSON_FALSE:
+        *value = json_false();
+        break;
+    case PACK_JSON_INTEGER:
+    {
+        uint64_t num;
+        if (unpack_varint_le(src, left, &num) < 0)
+            return -1;
+        *value = json_integer(zigzag_decode(num));
+        break;
+    }
+    case PACK_JSON_REAL:
+    {
+        uint64_t bits;
+        double real;
+        if (unpack_uint64_le(src, left, &bits) < 0)
+            return -1;
+        memcpy(&real, &bits, sizeof(real));
+        *value = json_real(real);
+        break;
+    }
+    case PACK_JSON_STRING:
+    {
+        uint64_t len;
+        if (unpack_varint_le(src, left, &len) < 0 || *left < len)
+            return -1;
+        *value = json_stringn(*src, len);
+        *src  += len;
+        *left -= len;
+        break;
+    }
+    case PACK_JSON_DECIMAL:
+    {
+        uint64_t num;
+        uint8_t scale;
+        if (unpack_varint_le(src, left, &num) < 0)
+            return -1;
+        if (unpack_char(src, left, &scale) < 0 || scale > 18)
+            return -1;
+        *value = unpack_json_decimal(zigzag_decode(num), scale);
+        break;
+    }
+    case PACK_JSON_ARRAY:
+    {
+        uint64_t size;
+        if (unpack_varint_le(src, left, &size) < 0 || *left < size)
+            return -1;
+        json_t *array = json_array();
+        if (array == NULL)
+            return -1;
+        for (uint64_t i = 0; i < size; ++i) {
+            json_t *item;
+            if (unpack_json_value(src, left, &item, depth + 1) < 0) {
+                json_decref(array);
+                return -1;
+            }
+            json_array_append_new(array, item);
+        }
+        *value = array;
+        break;
+    }
+    case PACK_JSON_OBJECT:
+    {
+        uint64_t size;
+        if (unpack_varint_le(src, left, &size) < 0 || *left < size)
+            return -1;
+        json_t *object = json_object();
+        if (object == NULL)
+            return -1;
+        for (uint64_t i = 0; i < size; ++i) {
+            sds key;
+            json_t *item;
+            if (unpack_varstr(src, left, &key) < 0) {
+                json_decref(object);
+                return -1;
+            }
+            if (unpack_json_value(src, left, &item, depth + 1) < 0) {
+                sdsfree(key);
+                json_decref(object);
+                return -1;
+            }
+            json_object_set_new(object, key, item);
+            sdsfree(key);
+        }
+        *value = object;
+        break;
+    }
+    default:
+        return -1;
+    }
+
+    if (*value == NULL)
+        return -1;
+    return pos - *left;
+}
+
+int unpack_json(void **src, size_t *left, json_t **value)
+{
+    return unpack_json_value(src, left, value, 0);
+}
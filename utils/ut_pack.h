@@ -9,6 +9,8 @@
 # include <stdint.h>
 # include <stddef.h>
 
+# include <jansson.h>
+
 # include "ut_sds.h"
 
 int pack_varint_le(void **dest, size_t *left, uint64_t num);
@@ -38,5 +40,26 @@ int unpack_oppush(void **src, size_t *left, char *dest, size_t *size);
 int pack_oppushint_le(void **dest, size_t *left, int64_t num);
 int unpack_oppushint_le(void **src, size_t *left, int64_t *num);
 
+/*
+ * compact binary form of a json value: a type byte followed by the value.
+ * integers are zigzag varints, strings and object keys are varstr, arrays
+ * and objects are prefixed with a varint count. PACK_JSON_DECIMAL is a
+ * zigzag varint mantissa and a scale byte, it is unpacked as a decimal string.
+ */
+# define PACK_JSON_NULL         0
+# define PACK_JSON_TRUE         1
+# define PACK_JSON_FALSE        2
+# define PACK_JSON_INTEGER      3
+# define PACK_JSON_REAL         4
+# define PACK_JSON_STRING       5
+# define PACK_JSON_ARRAY        6
+# define PACK_JSON_OBJECT       7
+# define PACK_JSON_DECIMAL      8
+
+# define PACK_JSON_MAX_DEPTH    32
+
+int pack_json(void **dest, size_t *left, const json_t *value);
+int unpack_json(void **src, size_t *left, json_t **value);
+
 # endif
 
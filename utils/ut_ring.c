@@ -0,0 +1,65 @@
+/*
+ * Description: lock free single producer single consumer ring
+ */
+
+# include <stdlib.h>
+# include <string.h>
+
+# include "ut_ring.h"
+
+ring_t *ring_create(uint32_t size)
+{
+    uint64_t real_size = 2;
+    while (real_size < size) {
+        real_size *= 2;
+    }
+
+    ring_t *ring;
+    if (posix_memalign((void **)&ring, 64, sizeof(ring_t)) != 0)
+        return NULL;
+    memset(ring, 0, sizeof(ring_t));
+    ring->mask = real_size - 1;
+    ring->slots = calloc(real_size, sizeof(void *));
+    if (ring->slots == NULL) {
+        free(ring);
+        return NULL;
+    }
+
+    return ring;
+}
+
+void ring_release(ring_t *ring)
+{
+    free(ring->slots);
+    free(ring);
+}
+
+bool ring_push(ring_t *ring, void *item)
+{
+    uint64_t tail = ring->tail;
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    if (tail - head > ring->mask)
+        return false;
+    ring->slots[tail & ring->mask] = item;
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+void *ring_pop(ring_t *ring)
+{
+    uint64_t head = ring->head;
+    uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    if (head == tail)
+        return NULL;
+    void *item = ring->slots[head & ring->mask];
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    return item;
+}
+
+uint32_t ring_size(ring_t *ring)
+{
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    return tail - head;
+}
+
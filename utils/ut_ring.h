@@ -0,0 +1,36 @@
+/*
+ * Description: lock free single producer single consumer ring
+ */
+
+# ifndef _UT_RING_H_
+# define _UT_RING_H_
+
+# include <stdint.h>
+# include <stdbool.h>
+
+/*
+ * one thread pushes and one thread pops. head is only written by the
+ * consumer and tail by the producer, each on its own cache line. a slot is
+ * published by the release store of tail and freed by the release store
+ * of head, so the item is seen whole by the other side.
+ */
+typedef struct ring_t {
+    uint64_t    head __attribute__((aligned(64)));
+    uint64_t    tail __attribute__((aligned(64)));
+    uint64_t    mask __attribute__((aligned(64)));
+    void        **slots;
+} ring_t;
+
+/* size is rounded up to a power of 2 */
+ring_t *ring_create(uint32_t size);
+void ring_release(ring_t *ring);
+
+/* producer side, false when full */
+bool ring_push(ring_t *ring, void *item);
+/* consumer side, NULL when empty */
+void *ring_pop(ring_t *ring);
+
+uint32_t ring_size(ring_t *ring);
+
+# endif
+
@@ -15,6 +15,9 @@
 # define RPC_PKG_TYPE_REPLY   1
 # define RPC_PKG_TYPE_PUSH    2
 
+/* set in pkg_type when the body is packed with pack_json instead of json text */
+# define RPC_PKG_FLAG_BINARY  0x100
+
 # pragma pack(1)
 typedef struct rpc_pkg {
     uint32_t magic;
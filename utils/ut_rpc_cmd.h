@@ -33,6 +33,12 @@
 # define CMD_ORDER_DEALS            208
 # define CMD_ORDER_FINISHED         209
 # define CMD_ORDER_FINISHED_DETAIL  210
+# define CMD_ORDER_PUT_BATCH        211
+# define CMD_ORDER_CANCEL_BATCH     212
+# define CMD_ORDER_CANCEL_REPLACE   213
+# define CMD_ORDER_CANCEL_ALL       214
+# define CMD_ORDER_DEPTH_SUBSCRIBE  215
+# define CMD_ORDER_DEPTH_UPDATE     216
 
 // market
 # define CMD_MARKET_LIST            301
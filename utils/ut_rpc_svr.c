@@ -177,6 +177,12 @@ rpc_svr *rpc_svr_create(rpc_svr_cfg *cfg, rpc_svr_type *type)
     return svr;
 }
 
+void rpc_svr_set_loop(rpc_svr *svr, struct ev_loop *loop)
+{
+    nw_svr_set_loop(svr->raw_svr, loop);
+    svr->timer.loop = loop;
+}
+
 int rpc_svr_start(rpc_svr *svr)
 {
     int ret = nw_svr_start(svr->raw_svr);
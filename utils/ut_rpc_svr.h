@@ -38,6 +38,8 @@ typedef struct rpc_svr {
 } rpc_svr;
 
 rpc_svr *rpc_svr_create(rpc_svr_cfg *cfg, rpc_svr_type *type);
+/* run the server on another loop, see nw_svr_set_loop */
+void rpc_svr_set_loop(rpc_svr *svr, struct ev_loop *loop);
 int rpc_svr_start(rpc_svr *svr);
 int rpc_svr_stop(rpc_svr *svr);
 void rpc_svr_release(rpc_svr *svr);
@@ -8,17 +8,69 @@
 
 # include "ut_skiplist.h"
 
-# define SKIPLIST_MAX_LEVEL 16
-# define SKIPLIST_P         0.25
+/* a node goes up a level with 1/4 chance */
+# define SKIPLIST_P_MASK    0x3
+# define SKIPLIST_SEED      0x9e3779b9
+
+# define SKIPLIST_SLAB_MIN  128
+# define SKIPLIST_SLAB_MAX  65536
+
+struct skiplist_slab {
+    struct skiplist_slab *next;
+    size_t size;
+    size_t used;
+    char data[];
+};
+
+/* span of the forward link at level i, the spans are laid out backward before the node */
+# define NODE_SPAN(node, i) (((uint32_t *)(node))[-1 - (i)])
+
+static size_t skiplist_node_head(int level)
+{
+    return (level * sizeof(uint32_t) + 7) & ~(size_t)7;
+}
+
+static size_t skiplist_node_size(int level)
+{
+    return skiplist_node_head(level) + sizeof(skiplist_node) + level * sizeof(skiplist_node *);
+}
+
+static void *skiplist_carve(skiplist_t *list, size_t size)
+{
+    struct skiplist_slab *slab = list->slab;
+    if (slab == NULL || slab->used + size > slab->size) {
+        size_t slab_size = slab ? slab->size * 2 : SKIPLIST_SLAB_MIN;
+        if (slab_size > SKIPLIST_SLAB_MAX)
+            slab_size = SKIPLIST_SLAB_MAX;
+        if (slab_size < size)
+            slab_size = size;
+        slab = malloc(sizeof(struct skiplist_slab) + slab_size);
+        if (slab == NULL)
+            return NULL;
+        slab->next = list->slab;
+        slab->size = slab_size;
+        slab->used = 0;
+        list->slab = slab;
+    }
+
+    void *p = slab->data + slab->used;
+    slab->used += size;
+    return p;
+}
 
 static skiplist_node *skiplist_create_node(skiplist_t *list, int level, void *value)
 {
-    size_t size = sizeof(skiplist_node) + level * sizeof(skiplist_node *);
-    skiplist_node *node = malloc(size);
-    if (node == NULL) {
-        return NULL;
+    skiplist_node *node = list->free_nodes[level - 1];
+    if (node) {
+        list->free_nodes[level - 1] = node->forward[0];
+    } else {
+        char *p = skiplist_carve(list, skiplist_node_size(level));
+        if (p == NULL) {
+            return NULL;
+        }
+        node = (skiplist_node *)(p + skiplist_node_head(level));
     }
-    memset(node, 0, size);
+    memset((char *)node - skiplist_node_head(level), 0, skiplist_node_size(level));
     if (value && list->type.dup) {
         node->value = list->type.dup(value);
     } else {
@@ -27,6 +79,12 @@ static skiplist_node *skiplist_create_node(skiplist_t *list, int level, void *va
     return node;
 }
 
+static void skiplist_free_node(skiplist_t *list, int level, skiplist_node *node)
+{
+    node->forward[0] = list->free_nodes[level - 1];
+    list->free_nodes[level - 1] = node;
+}
+
 skiplist_t *skiplist_create(skiplist_type *type)
 {
     if (type == NULL || type->compare == NULL) {
@@ -38,31 +96,47 @@ skiplist_t *skiplist_create(skiplist_type *type)
     }
     memset(list, 0, sizeof(skiplist_t));
     list->level = 1;
+    list->seed = SKIPLIST_SEED;
     memcpy(&list->type, type, sizeof(skiplist_type));
-    list->header = skiplist_create_node(list, SKIPLIST_MAX_LEVEL, NULL);
-    if (list->header == NULL) {
+
+    size_t size = skiplist_node_size(SKIPLIST_MAX_LEVEL);
+    char *p = malloc(size);
+    if (p == NULL) {
         free(list);
         return NULL;
     }
+    memset(p, 0, size);
+    list->header = (skiplist_node *)(p + skiplist_node_head(SKIPLIST_MAX_LEVEL));
     return list;
 }
 
-static int skiplist_random_level(void)
+// xorshift, the same list always gets the same levels
+static int skiplist_random_level(skiplist_t *list)
 {
     int level = 1;
-    while ((random() & 0xFFFF) < (SKIPLIST_P * 0xFFFF)) {
+    while (level < SKIPLIST_MAX_LEVEL) {
+        uint32_t x = list->seed;
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        list->seed = x;
+        if ((x & SKIPLIST_P_MASK) != 0)
+            break;
         level += 1;
     }
-    return level < SKIPLIST_MAX_LEVEL ? level : SKIPLIST_MAX_LEVEL;
+    return level;
 }
 
 skiplist_t *skiplist_insert(skiplist_t *list, void *value)
 {
     skiplist_node *update[SKIPLIST_MAX_LEVEL];
+    unsigned long rank[SKIPLIST_MAX_LEVEL];
     skiplist_node *node = list->header;
 
     for (int i = list->level - 1; i >= 0; i--) {
+        rank[i] = i == list->level - 1 ? 0 : rank[i + 1];
         while (node->forward[i] && list->type.compare(node->forward[i]->value, value) <= 0) {
+            rank[i] += NODE_SPAN(node, i);
             node = node->forward[i];
         }
         update[i] = node;
@@ -71,10 +145,12 @@ skiplist_t *skiplist_insert(skiplist_t *list, void *value)
         return NULL;
     }
 
-    int level = skiplist_random_level();
+    int level = skiplist_random_level(list);
     if (level > list->level) {
         for (int i = list->level; i < level; ++i) {
+            rank[i] = 0;
             update[i] = list->header;
+            NODE_SPAN(list->header, i) = list->weight;
         }
         list->level = level;
     }
@@ -86,8 +162,14 @@ skiplist_t *skiplist_insert(skiplist_t *list, void *value)
     for (int i = 0; i < level; ++i) {
         node->forward[i] = update[i]->forward[i];
         update[i]->forward[i] = node;
+        NODE_SPAN(node, i) = NODE_SPAN(update[i], i) - (rank[0] - rank[i]);
+        NODE_SPAN(update[i], i) = rank[0] - rank[i] + 1;
+    }
+    for (int i = level; i < list->level; ++i) {
+        NODE_SPAN(update[i], i) += 1;
     }
     list->len += 1;
+    list->weight += 1;
     return list;
 }
 
@@ -117,9 +199,16 @@ void skiplist_delete(skiplist_t *list, skiplist_node *x)
         update[i] = node;
     }
 
+    // the link to x at level 0 passes over x only
+    uint32_t weight = NODE_SPAN(update[0], 0);
+    int level = 0;
     for (int i = 0; i < list->level; ++i) {
         if (update[i]->forward[i] == x) {
             update[i]->forward[i] = x->forward[i];
+            NODE_SPAN(update[i], i) += NODE_SPAN(x, i) - weight;
+            level += 1;
+        } else {
+            NODE_SPAN(update[i], i) -= weight;
         }
     }
     while (list->level > 1 && list->header->forward[list->level - 1] == NULL) {
@@ -129,23 +218,62 @@ void skiplist_delete(skiplist_t *list, skiplist_node *x)
     if (list->type.free) {
         list->type.free(x->value);
     }
-    free(x);
+    skiplist_free_node(list, level, x);
     list->len -= 1;
+    list->weight -= weight;
+}
+
+void skiplist_add_weight(skiplist_t *list, void *value, long delta)
+{
+    skiplist_node *node = list->header;
+    for (int i = list->level - 1; i >= 0; i--) {
+        while (node->forward[i] && list->type.compare(node->forward[i]->value, value) < 0) {
+            node = node->forward[i];
+        }
+        // the link passes over the node whether it ends there or after it
+        NODE_SPAN(node, i) += delta;
+    }
+    list->weight += delta;
+}
+
+skiplist_node *skiplist_find_by_rank(skiplist_t *list, unsigned long rank, unsigned long *offset)
+{
+    if (rank >= list->weight) {
+        return NULL;
+    }
+
+    unsigned long traversed = 0;
+    skiplist_node *node = list->header;
+    for (int i = list->level - 1; i >= 0; i--) {
+        while (node->forward[i] && traversed + NODE_SPAN(node, i) <= rank) {
+            traversed += NODE_SPAN(node, i);
+            node = node->forward[i];
+        }
+    }
+    if (offset) {
+        *offset = rank - traversed;
+    }
+    return node->forward[0];
 }
 
 void skiplist_release(skiplist_t *list)
 {
-    unsigned long len = list->len;
     skiplist_node *curr = list->header->forward[0];
-    skiplist_node *next;
-    while (len--) {
-        next = curr->forward[0];
+    while (curr) {
         if (list->type.free) {
             list->type.free(curr->value);
         }
-        free(curr);
-        curr = next;
+        curr = curr->forward[0];
+    }
+
+    struct skiplist_slab *slab = list->slab;
+    while (slab) {
+        struct skiplist_slab *next = slab->next;
+        free(slab);
+        slab = next;
     }
+    free((char *)list->header - skiplist_node_head(SKIPLIST_MAX_LEVEL));
+    free(list);
 }
 
 skiplist_iter *skiplist_get_iterator(skiplist_t *list)
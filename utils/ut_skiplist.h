@@ -6,6 +6,16 @@
 # ifndef _UT_SKIPLIST_H_
 # define _UT_SKIPLIST_H_
 
+# include <stdint.h>
+
+# define SKIPLIST_MAX_LEVEL 16
+
+/*
+ * every node has a weight, 1 when inserted, and each forward link keeps
+ * the sum of the weights it passes over, so a position in the weights is
+ * found in O(log n). the spans are 32 bits and are stored in front of the
+ * node, the weights of a list must add up below 2^32.
+ */
 typedef struct skiplist_node {
     void *value;
     struct skiplist_node *forward[];
@@ -21,15 +31,26 @@ typedef struct skiplist_type {
     int (*compare)(const void *value1, const void *value2);
 } skiplist_type;
 
+struct skiplist_slab;
+
 typedef struct skiplist_t {
     int level;
     skiplist_type type;
     skiplist_node *header;
     unsigned long len;
+    unsigned long weight;
+    /* the levels of the nodes only depend on the inserts done to the list */
+    uint32_t seed;
+    /* nodes are carved from slabs of the list, freed nodes are kept by level */
+    skiplist_node *free_nodes[SKIPLIST_MAX_LEVEL];
+    struct skiplist_slab *slab;
 } skiplist_t;
 
 # define skiplist_len(l)        ((l)->len)
+# define skiplist_weight(l)     ((l)->weight)
 # define skiplist_node_value(n) ((n)->value)
+# define skiplist_first(l)      ((l)->header->forward[0])
+# define skiplist_node_next(n)  ((n)->forward[0])
 
 skiplist_t *skiplist_create(skiplist_type *type);
 skiplist_t *skiplist_insert(skiplist_t *list, void *value);
@@ -37,6 +58,14 @@ skiplist_node *skiplist_find(skiplist_t *list, void *value);
 void skiplist_delete(skiplist_t *list, skiplist_node *node);
 void skiplist_release(skiplist_t *list);
 
+/* change the weight of the node of value by delta, value must be in the list */
+void skiplist_add_weight(skiplist_t *list, void *value, long delta);
+/*
+ * the node at position rank of the weights, counted from 0, offset is set
+ * to the position inside the node. NULL if rank is not less than the weight.
+ */
+skiplist_node *skiplist_find_by_rank(skiplist_t *list, unsigned long rank, unsigned long *offset);
+
 skiplist_iter *skiplist_get_iterator(skiplist_t *list);
 skiplist_node *skiplist_next(skiplist_iter *iter);
 void skiplist_release_iterator(skiplist_iter *iter);